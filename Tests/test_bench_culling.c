@@ -0,0 +1,157 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Headless benchmark of TEAPOT_ENABLE_FRUSTUM_CULLING.
+// 1) (only when TEAPOT_ENABLE_FRUSTUM_CULLING is defined) cull cost per object: Teapot_CullMulti(...) (4 objects at a time)
+//    against a loop of Teapot_Helper_IsVisible(...) calls, and the number of objects where the two tests disagree.
+// 2) frame time of Teapot_DrawMulti(...) (glFinish() included) on a random scene where about half the objects are off-screen.
+// Build it twice (with and without -DTEAPOT_ENABLE_FRUSTUM_CULLING) to compare the frame times.
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_bench_culling.c -o test_bench_culling_off -I"../" -lEGL -lGL -lm
+gcc -O2 -std=gnu89 -DTEAPOT_ENABLE_FRUSTUM_CULLING test_bench_culling.c -o test_bench_culling_on -I"../" -lEGL -lGL -lm
+(add -msse -DTEAPOT_USE_SIMD to measure the SSE path of Teapot_CullMulti(...))
+
+// USAGE:
+./test_bench_culling_on [width=320] [height=240]
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+#include "test_headless.h"  // (again: for the Teapot_MeshData helpers)
+
+#define NUM_REPETITIONS (20)
+#define MAX_NUM_MESHES (4000)
+
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+typedef struct {
+    TestHeadless_MeshArray meshes;
+    const tpoat (*frustumPlanes)[4];
+    int numVisible;
+} CullArgs;
+// The measured calls: Teapot_CullMulti(...) and a loop of Teapot_Helper_IsVisible(...)
+static void CullMulti(void* userData) {
+    CullArgs* a = (CullArgs*) userData;
+    a->numVisible = Teapot_CullMulti(a->meshes.pMeshes,a->meshes.numMeshes,a->frustumPlanes,NULL);
+}
+static void CullSingle(void* userData) {
+    CullArgs* a = (CullArgs*) userData;
+    int i,numVisible = 0;
+    for (i=0;i<a->meshes.numMeshes;i++) {
+        const Teapot_MeshData* md = a->meshes.pMeshes[i];
+        const TeapotMeshEnum meshId = md->meshId;
+        float aabbMin[3],aabbMax[3];int j;
+        for (j=0;j<3;j++) {aabbMin[j]=TIS.aabbMin[meshId][j]*md->scaling[j];aabbMax[j]=TIS.aabbMax[meshId][j]*md->scaling[j];}
+        numVisible+=Teapot_Helper_IsVisible(a->frustumPlanes,md->mvMatrix,aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2]);
+    }
+    a->numVisible = numVisible;
+}
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+
+int main(int argc, char** argv)
+{
+    static const int numMeshesArray[] = {1000,2000,MAX_NUM_MESHES};
+    const int numNumMeshes = (int) (sizeof(numMeshesArray)/sizeof(numMeshesArray[0]));
+    const int width = argc>1 ? atoi(argv[1]) : 320;
+    const int height = argc>2 ? atoi(argv[2]) : 240;
+    static Teapot_MeshData meshes[MAX_NUM_MESHES];
+    static Teapot_MeshData* pMeshes[MAX_NUM_MESHES];
+    tpoat pMatrix[16],vMatrix[16];
+    float lightDirection[3] = {1.2f,-2.f,-1.f};
+    const float posMin[3] = {-100.f,0.f,-150.f},posMax[3] = {100.f,5.f,50.f};
+    int i,j;
+    if (width<=0 || height<=0) return 1;
+
+    if (!TestHeadless_Init(width,height)) return 1;
+    Teapot_Init();
+    Teapot_Helper_Perspective(pMatrix,45.f,(tpoat)width/(tpoat)height,0.5f,200.f);
+    Teapot_SetProjectionMatrix(pMatrix);
+    Teapot_Helper_LookAt(vMatrix,0,10,20,0,0,-40,0,1,0);
+    Teapot_SetViewMatrixAndLightDirection(vMatrix,lightDirection);
+    Teapot_Enable_ColorMaterial();
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glClearColor(0.2f,0.4f,0.8f,1.f);
+
+    // Objects spread all around the camera (the ones behind it and on the sides are off-screen)
+    TestHeadless_InitRandomMeshes(meshes,pMeshes,MAX_NUM_MESHES,TEAPOT_MESH_CAPSULE,posMin,posMax,0.5f,2.f);
+
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    {
+        int mismatches = 0;
+        double msM,msS;
+        CullArgs m,c;
+        m.meshes.pMeshes = c.meshes.pMeshes = pMeshes;m.meshes.numMeshes = c.meshes.numMeshes = MAX_NUM_MESHES;
+        m.frustumPlanes = c.frustumPlanes = (const tpoat (*)[4]) TIS.pMatrixFrustum;m.numVisible = c.numVisible = 0;
+        Teapot_MeshData_CalculateMvMatrixFromArray(pMeshes,MAX_NUM_MESHES);
+        msS = TestHeadless_Benchmark(NUM_REPETITIONS,&CullSingle,NULL,&c);
+        msM = TestHeadless_Benchmark(NUM_REPETITIONS,&CullMulti,NULL,&m);
+        for (i=0;i<MAX_NUM_MESHES;i++) {
+            const Teapot_MeshData* md = pMeshes[i];
+            const TeapotMeshEnum meshId = md->meshId;
+            float aabbMin[3],aabbMax[3];
+            for (j=0;j<3;j++) {aabbMin[j]=TIS.aabbMin[meshId][j]*md->scaling[j];aabbMax[j]=TIS.aabbMax[meshId][j]*md->scaling[j];}
+            mismatches+=(md->visible!=Teapot_Helper_IsVisible(TIS.pMatrixFrustum,md->mvMatrix,aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2]));
+        }
+        printf("\nCull cost (%d objects, best of %d runs)",MAX_NUM_MESHES,NUM_REPETITIONS);
+#       if (defined(TEAPOT_USE_SIMD) && (defined(__SSE__) || defined(__AVX__)))
+        printf(" (TEAPOT_USE_SIMD)\n");
+#       else
+        printf(" (scalar: compile with -msse -DTEAPOT_USE_SIMD to measure the SSE path)\n");
+#       endif
+        printf("%28s %10s %10s %10s\n","","ms","ns/object","visible");
+        printf("%28s %10.3f %10.2f %10d\n","Teapot_Helper_IsVisible(...)",msS,msS*1000000.0/MAX_NUM_MESHES,c.numVisible);
+        printf("%28s %10.3f %10.2f %10d\n","Teapot_CullMulti(...)",msM,msM*1000000.0/MAX_NUM_MESHES,m.numVisible);
+        printf("mismatches: %d\n",mismatches);
+    }
+#   endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+
+    printf("\nTeapot_DrawMulti(...) frame time at %dx%d (best of %d frames, glFinish() included)",width,height,NUM_REPETITIONS);
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    printf(": TEAPOT_ENABLE_FRUSTUM_CULLING defined\n");
+#   else
+    printf(": TEAPOT_ENABLE_FRUSTUM_CULLING NOT defined\n");
+#   endif
+    printf("%10s %10s %10s\n","objects","ms","drawn");
+    for (j=0;j<numNumMeshes;j++) {
+        const int numMeshes = numMeshesArray[j];
+        TestHeadless_MeshArray a;
+        double ms;
+        int drawn = 0;
+        a.pMeshes = pMeshes;a.numMeshes = numMeshes;
+        ms = TestHeadless_Benchmark(NUM_REPETITIONS,&TestHeadless_DrawMultiFrame,NULL,&a);
+        for (i=0;i<numMeshes;i++) drawn+=meshes[i].visible;
+        printf("%10d %10.3f %10d\n",numMeshes,ms,drawn);
+    }
+    printf("\nglGetError()=%d\n",(int)glGetError());
+
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return 0;
+}
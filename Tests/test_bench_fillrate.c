@@ -0,0 +1,131 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Headless fill-rate benchmark of Teapot_DrawMulti(...) (fog + specular shading): many overlapping opaque meshes submitted back to front,
+// drawn in array order, with Teapot_Enable_FrontToBackSorting(), with the depth prepass (TEAPOT_ENABLE_DEPTH_PREPASS) and with both.
+// It also counts the pixels that differ from the array order image (only a few where two surfaces tie in depth are expected).
+// Results depend a lot on the GPU: with a software rasterizer (Mesa llvmpipe, see test_headless.h) vertex work is expensive too.
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_bench_fillrate.c -o test_bench_fillrate -I"../" -lEGL -lGL -lm
+
+// USAGE:
+./test_bench_fillrate [width=640] [height=480] [numMeshes=400]
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_SHADER_SPECULAR
+#define TEAPOT_SHADER_FOG
+#define TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
+#define TEAPOT_ENABLE_DEPTH_PREPASS     // Mandatory here
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+#include "test_headless.h"  // (again: for the Teapot_MeshData helpers)
+
+#define NUM_REPETITIONS (10)
+#define NUM_MODES (4)
+
+// mode: bit 0 => front to back sorting, bit 1 => depth prepass
+static void SetMode(int mode) {
+    if (mode&1) Teapot_Enable_FrontToBackSorting();
+    else Teapot_Disable_FrontToBackSorting();
+    if (mode&2) Teapot_Enable_DepthPrepass();
+    else Teapot_Disable_DepthPrepass();
+}
+
+// Sorts by mMatrix[14] (far objects first)
+static int BackToFrontSorter(const void* a,const void* b) {
+    const tpoat za = (*((const Teapot_MeshData* const*)a))->mMatrix[14];
+    const tpoat zb = (*((const Teapot_MeshData* const*)b))->mMatrix[14];
+    return za<zb ? -1 : (za>zb ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    static const char* modeNames[NUM_MODES] = {"array order","front to back","depth prepass","front to back + prepass"};
+    const int width = argc>1 ? atoi(argv[1]) : 640;
+    const int height = argc>2 ? atoi(argv[2]) : 480;
+    const int numMeshes = argc>3 ? atoi(argv[3]) : 400;
+    Teapot_MeshData* meshes = NULL;
+    Teapot_MeshData** pMeshes = NULL;
+    unsigned char *reference = NULL,*pixels = NULL;
+    tpoat pMatrix[16],vMatrix[16];
+    float lightDirection[3] = {1.2f,-2.f,-1.f};
+    const float posMin[3] = {-6.f,0.f,-40.f},posMax[3] = {6.f,4.f,0.f};
+    TestHeadless_MeshArray a;
+    int i,mode;
+    if (width<=0 || height<=0 || numMeshes<=0) return 1;
+
+    meshes = (Teapot_MeshData*) malloc(numMeshes*sizeof(Teapot_MeshData));
+    pMeshes = (Teapot_MeshData**) malloc(numMeshes*sizeof(Teapot_MeshData*));
+    reference = (unsigned char*) malloc(width*height*4);
+    pixels = (unsigned char*) malloc(width*height*4);
+    if (!meshes || !pMeshes || !reference || !pixels) {fprintf(stderr,"Error: out of memory.\n");return 1;}
+
+    if (!TestHeadless_Init(width,height)) return 1;
+    Teapot_Init();
+    Teapot_Helper_Perspective(pMatrix,45.f,(tpoat)width/(tpoat)height,0.5f,100.f);
+    Teapot_SetProjectionMatrix(pMatrix);
+    Teapot_Helper_LookAt(vMatrix,0,2,10,0,2,0,0,1,0);
+    Teapot_SetViewMatrixAndLightDirection(vMatrix,lightDirection);
+    Teapot_SetFogColor(0.2f,0.4f,0.8f);
+    Teapot_SetFogDistances(20.f,100.f);
+    glClearColor(0.2f,0.4f,0.8f,1.f);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    if (!Teapot_Get_DepthPrepass_Enabled()) fprintf(stderr,"Warning: the depth prepass program is not available.\n");
+
+    // Big overlapping meshes in front of the camera (a lot of overdraw), submitted back to front (the worst case for the array order)
+    TestHeadless_InitRandomMeshes(meshes,pMeshes,numMeshes,TEAPOT_MESH_CAPSULE,posMin,posMax,1.5f,3.f);
+    qsort((void*)pMeshes,numMeshes,sizeof(Teapot_MeshData*),BackToFrontSorter);
+    a.pMeshes = pMeshes;a.numMeshes = numMeshes;
+
+    printf("\nTeapot_DrawMulti(...) of %d overlapping meshes at %dx%d (best of %d frames, glFinish() included)\n",numMeshes,width,height,NUM_REPETITIONS);
+    printf("%24s %10s %10s %16s\n","","ms","speedup","different px");
+    {
+        double arrayOrder = 0;
+        for (mode=0;mode<NUM_MODES;mode++) {
+            double ms;
+            int numDifferent = 0;
+            SetMode(mode);
+            ms = TestHeadless_Benchmark(NUM_REPETITIONS,&TestHeadless_DrawMultiFrame,NULL,&a);
+            if (mode==0) {arrayOrder = ms;glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,reference);}
+            else {
+                glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,pixels);
+                for (i=0;i<width*height;i++) numDifferent+=(memcmp(&pixels[4*i],&reference[4*i],3)!=0);
+            }
+            printf("%24s %10.3f %9.2fx %16d\n",modeNames[mode],ms,ms>0 ? arrayOrder/ms : 0.0,numDifferent);
+        }
+    }
+    printf("\nglGetError()=%d\n",(int)glGetError());
+
+    free(pixels);free(reference);free(pMeshes);free(meshes);
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return 0;
+}
@@ -0,0 +1,127 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Benchmark of Teapot_MeshData_RaycastBatch(...) against one Teapot_MeshData_GetMeshUnderMouseFromRay(...) call per ray
+// (rays per second), for 500 and 2000 meshes and 4096 random rays shot from a camera into the scene.
+// It also checks that both return the same hit mesh and distance for every ray.
+// A headless GL context is needed only because Teapot_Init() builds the mesh aabbs.
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+-> OpenMP (optional)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_bench_raycast.c -o test_bench_raycast -I"../" -lEGL -lGL -lm
+(add -msse -DTEAPOT_USE_SIMD to measure the SSE path, -mavx -DTEAPOT_USE_SIMD -DTEAPOT_MATRIX_USE_DOUBLE_PRECISION the AVX one, and -fopenmp -DTEAPOT_USE_OPENMP the multi-threaded one)
+
+// USAGE:
+./test_bench_raycast [numRays=4096]
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+#include "test_headless.h"  // (again: for the Teapot_MeshData helpers)
+
+#define NUM_REPETITIONS (5)
+#define MAX_NUM_MESHES (2000)
+
+typedef struct {
+    TestHeadless_MeshArray meshes;
+    const tpoat *rayOrigins,*rayDirs;
+    int numRays;
+    Teapot_MeshData** hitsOut;
+    tpoat* distancesOut;
+} RaycastArgs;
+// The measured calls: Teapot_MeshData_RaycastBatch(...) and one Teapot_MeshData_GetMeshUnderMouseFromRay(...) per ray
+static void RaycastBatch(void* userData) {
+    const RaycastArgs* a = (const RaycastArgs*) userData;
+    Teapot_MeshData_RaycastBatch(a->meshes.pMeshes,a->meshes.numMeshes,a->rayOrigins,a->rayDirs,a->numRays,a->hitsOut,a->distancesOut);
+}
+static void RaycastSingle(void* userData) {
+    const RaycastArgs* a = (const RaycastArgs*) userData;
+    int i;
+    for (i=0;i<a->numRays;i++) a->hitsOut[i] = Teapot_MeshData_GetMeshUnderMouseFromRay(a->meshes.pMeshes,a->meshes.numMeshes,&a->rayOrigins[3*i],&a->rayDirs[3*i],&a->distancesOut[i]);
+}
+
+int main(int argc, char** argv)
+{
+    static const int numMeshesArray[] = {500,MAX_NUM_MESHES};
+    const int numNumMeshes = (int) (sizeof(numMeshesArray)/sizeof(numMeshesArray[0]));
+    const int numRays = argc>1 ? atoi(argv[1]) : 4096;
+    static Teapot_MeshData meshes[MAX_NUM_MESHES];
+    static Teapot_MeshData* pMeshes[MAX_NUM_MESHES];
+    tpoat *rayOrigins,*rayDirs,*distancesS,*distancesB;
+    Teapot_MeshData **hitsS,**hitsB;
+    const float posMin[3] = {-50.f,0.f,-100.f},posMax[3] = {50.f,5.f,-5.f};
+    int i,j;
+    if (numRays<=0) return 1;
+
+    rayOrigins = (tpoat*) malloc(3*numRays*sizeof(tpoat));rayDirs = (tpoat*) malloc(3*numRays*sizeof(tpoat));
+    distancesS = (tpoat*) malloc(numRays*sizeof(tpoat));distancesB = (tpoat*) malloc(numRays*sizeof(tpoat));
+    hitsS = (Teapot_MeshData**) malloc(numRays*sizeof(Teapot_MeshData*));hitsB = (Teapot_MeshData**) malloc(numRays*sizeof(Teapot_MeshData*));
+    if (!rayOrigins || !rayDirs || !distancesS || !distancesB || !hitsS || !hitsB) {fprintf(stderr,"Error: out of memory (%d rays).\n",numRays);return 1;}
+
+    if (!TestHeadless_Init(64,64)) return 1;
+    Teapot_Init();
+
+    TestHeadless_InitRandomMeshes(meshes,pMeshes,MAX_NUM_MESHES,TEAPOT_MESH_TEXT_X,posMin,posMax,0.5f,2.f);
+    // Rays from a camera at (0,5,10), inside a cone around -Z (as if picking random pixels)
+    for (i=0;i<numRays;i++) {
+        tpoat* o = &rayOrigins[3*i];tpoat* d = &rayDirs[3*i];tpoat len;
+        o[0]=0;o[1]=5;o[2]=10;
+        d[0]=TestHeadless_RandomFloat(-0.5f,0.5f);d[1]=TestHeadless_RandomFloat(-0.3f,0.1f);d[2]=-1;
+        len = sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);d[0]/=len;d[1]/=len;d[2]/=len;
+    }
+
+    printf("\nRaycast of %d rays against the mesh OBBs: best of %d runs",numRays,NUM_REPETITIONS);
+#   if (defined(TEAPOT_USE_SIMD) && ((!defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__SSE__)) || (defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__AVX__))))
+    printf(" (TEAPOT_USE_SIMD)");
+#   endif
+#   ifdef TEAPOT_USE_OPENMP
+    printf(" (TEAPOT_USE_OPENMP: %d threads)",omp_get_max_threads());
+#   endif //TEAPOT_USE_OPENMP
+    printf("\n%10s %16s %16s %10s %8s %12s\n","meshes","per-ray Mrays/s","batch Mrays/s","speedup","hits","mismatches");
+    for (j=0;j<numNumMeshes;j++) {
+        RaycastArgs s,b;
+        double msS,msB;
+        int numHits=0,mismatches=0;
+        s.meshes.pMeshes = b.meshes.pMeshes = pMeshes;s.meshes.numMeshes = b.meshes.numMeshes = numMeshesArray[j];
+        s.rayOrigins = b.rayOrigins = rayOrigins;s.rayDirs = b.rayDirs = rayDirs;s.numRays = b.numRays = numRays;
+        s.hitsOut = hitsS;s.distancesOut = distancesS;b.hitsOut = hitsB;b.distancesOut = distancesB;
+        msS = TestHeadless_Benchmark(NUM_REPETITIONS,&RaycastSingle,NULL,&s);
+        msB = TestHeadless_Benchmark(NUM_REPETITIONS,&RaycastBatch,NULL,&b);
+        for (i=0;i<numRays;i++) {
+            numHits+=(hitsB[i]!=NULL);
+            mismatches+=(hitsS[i]!=hitsB[i] || distancesS[i]!=distancesB[i]);
+        }
+        printf("%10d %16.4f %16.4f %9.2fx %8d %12d\n",numMeshesArray[j],msS>0 ? numRays/(msS*1000.0) : 0.0,msB>0 ? numRays/(msB*1000.0) : 0.0,msB>0 ? msS/msB : 0.0,numHits,mismatches);
+    }
+
+    free(hitsB);free(hitsS);free(distancesB);free(distancesS);free(rayDirs);free(rayOrigins);
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return 0;
+}
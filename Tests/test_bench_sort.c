@@ -0,0 +1,105 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Benchmark of the draw ordering used by Teapot_DrawMulti(...) when mustSortObjectsForTransparency==1:
+// Teapot_MeshData_RadixSort(...) against the legacy qsort(...) with Teapot_MeshData_Depth_Sorter(...), for 1k, 10k and 100k objects.
+// It also checks that both produce the same sequence of (transparent, depth) pairs.
+// No OpenGL context is needed (test_headless.h is included only for the GL headers, the timer and the random scene).
+
+// DEPENDENCIES:
+/*
+-> EGL and GL headers (see test_headless.h)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_bench_sort.c -o test_bench_sort -I"../" -lEGL -lGL -lm
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+#include "test_headless.h"  // (again: for the Teapot_MeshData helpers)
+
+#define NUM_REPETITIONS (10)
+
+// 'source' is copied to 'dst' (untimed) before every sort of 'dst'
+typedef struct {
+    Teapot_MeshData** dst;
+    Teapot_MeshData* const* source;
+    int numMeshes;
+} SortArgs;
+static void CopySource(void* userData) {const SortArgs* a = (const SortArgs*) userData;memcpy(a->dst,a->source,a->numMeshes*sizeof(Teapot_MeshData*));}
+// The measured calls
+static void RadixSort(void* userData) {const SortArgs* a = (const SortArgs*) userData;Teapot_MeshData_RadixSort(a->dst,a->numMeshes);}
+static void QSort(void* userData) {const SortArgs* a = (const SortArgs*) userData;qsort((void*)a->dst,a->numMeshes,sizeof(Teapot_MeshData*),Teapot_MeshData_Depth_Sorter);}
+
+// Number of positions where the two orders differ in transparency or in (quantized) depth
+static int CountMismatches(Teapot_MeshData* const* a,Teapot_MeshData* const* b,int numMeshes,tpoat depthTolerance) {
+    int i,mismatches=0;
+    for (i=0;i<numMeshes;i++) {
+        const tpoat dz = a[i]->mvMatrix[14]-b[i]->mvMatrix[14];
+        if ((a[i]->color[3]<1.f)!=(b[i]->color[3]<1.f) || dz>depthTolerance || dz<-depthTolerance) ++mismatches;
+    }
+    return mismatches;
+}
+
+int main(void)
+{
+    static const int numMeshesArray[] = {1000,10000,100000};
+    const int numNumMeshes = (int) (sizeof(numMeshesArray)/sizeof(numMeshesArray[0]));
+    const int maxNumMeshes = numMeshesArray[numNumMeshes-1];
+    const float zRange = 1000.f;
+    const float posMin[3] = {-100.f,-5.f,-zRange},posMax[3] = {100.f,5.f,-1.f};
+    Teapot_MeshData* meshes = (Teapot_MeshData*) malloc(maxNumMeshes*sizeof(Teapot_MeshData));
+    Teapot_MeshData** source = (Teapot_MeshData**) malloc(maxNumMeshes*sizeof(Teapot_MeshData*));
+    Teapot_MeshData** sortedQ = (Teapot_MeshData**) malloc(maxNumMeshes*sizeof(Teapot_MeshData*));
+    Teapot_MeshData** sortedR = (Teapot_MeshData**) malloc(maxNumMeshes*sizeof(Teapot_MeshData*));
+    int i,j;
+    if (!meshes || !source || !sortedQ || !sortedR) {fprintf(stderr,"Error: out of memory.\n");return 1;}
+
+    TestHeadless_InitRandomMeshes(meshes,source,maxNumMeshes,TEAPOT_MESH_TEXT_X,posMin,posMax,0.5f,2.f);
+    for (i=0;i<maxNumMeshes;i++) {
+        Teapot_MeshData* md = &meshes[i];
+        Teapot_MeshData_SetMvMatrix(md,md->mMatrix);  // (the sort reads only the mvMatrix)
+        md->color[3]=(rand()%4==0) ? 0.5f : 1.f;    // 25% transparent objects
+    }
+
+    printf("Draw ordering of Teapot_DrawMulti(...) (25%% transparent objects): best of %d runs\n",NUM_REPETITIONS);
+    printf("%10s %12s %12s %10s %12s\n","objects","qsort ms","radix ms","speedup","mismatches");
+    for (j=0;j<numNumMeshes;j++) {
+        const int numMeshes = numMeshesArray[j];
+        SortArgs q,r;
+        double msQ,msR;
+        int mismatches;
+        q.dst = sortedQ;r.dst = sortedR;q.source = r.source = source;q.numMeshes = r.numMeshes = numMeshes;
+        msQ = TestHeadless_Benchmark(NUM_REPETITIONS,&QSort,&CopySource,&q);
+        msR = TestHeadless_Benchmark(NUM_REPETITIONS,&RadixSort,&CopySource,&r);
+        // The radix sort quantizes depth to TEAPOT_SORTKEY_DEPTH_BITS (24) bits over the batch range
+        mismatches = CountMismatches(sortedQ,sortedR,numMeshes,zRange/(tpoat)(1<<20));
+        printf("%10d %12.3f %12.3f %9.2fx %12d\n",numMeshes,msQ,msR,msR>0 ? msQ/msR : 0.0,mismatches);
+    }
+
+    free(sortedR);free(sortedQ);free(source);free(meshes);
+    Teapot_Destroy();   // frees the radix sort buffers
+    return 0;
+}
@@ -0,0 +1,123 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Headless benchmark of the transform stage of Teapot_DrawMulti(...): Teapot_MeshData_CalculateMvMatrixFromArray(...)
+// (mvMatrix + frustum culling + accurate normal coefficients), from 1 to N threads (TEAPOT_USE_OPENMP), for 10k to 1M Teapot_MeshData.
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+-> OpenMP (optional)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 -fopenmp test_bench_transform.c -o test_bench_transform -I"../" -lEGL -lGL -lm
+(without -fopenmp only the single-threaded stage is measured)
+
+// USAGE:
+./test_bench_transform [maxNumMeshes=1000000] [maxNumThreads=omp_get_max_threads()]
+*/
+
+#include "test_headless.h"
+
+#ifdef _OPENMP
+#   define TEAPOT_USE_OPENMP             // Teapot_MeshData_CalculateMvMatrixFromArray(...) becomes multi-threaded
+#endif //_OPENMP
+#define TEAPOT_ENABLE_FRUSTUM_CULLING       // The stage calculates Teapot_MeshData::visible
+#define TEAPOT_SHADER_USE_ACCURATE_NORMALS  // The stage calculates Teapot_MeshData::nCoefficients
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+#include "test_headless.h"  // (again: for the Teapot_MeshData helpers)
+
+#define NUM_REPETITIONS (5)
+
+// The measured call
+static void CalculateMvMatrices(void* userData) {
+    const TestHeadless_MeshArray* a = (const TestHeadless_MeshArray*) userData;
+    Teapot_MeshData_CalculateMvMatrixFromArray(a->pMeshes,a->numMeshes);
+}
+
+int main(int argc, char** argv)
+{
+    static const int numMeshesArray[] = {10000,100000,1000000};
+    const int numNumMeshes = (int) (sizeof(numMeshesArray)/sizeof(numMeshesArray[0]));
+    const int maxNumMeshes = argc>1 ? atoi(argv[1]) : numMeshesArray[numNumMeshes-1];
+    int maxNumThreads = 1;
+    Teapot_MeshData* meshes = NULL;
+    Teapot_MeshData** pMeshes = NULL;
+    tpoat pMatrix[16],vMatrix[16];
+    float lightDirection[3] = {1.2f,-2.f,-1.f};
+    const float posMin[3] = {-100.f,-5.f,-150.f},posMax[3] = {100.f,5.f,50.f};
+    int i,j,numThreads,visible=0;
+#   ifdef _OPENMP
+    maxNumThreads = argc>2 ? atoi(argv[2]) : omp_get_max_threads();
+    if (maxNumThreads<1) maxNumThreads=1;
+#   endif //_OPENMP
+    if (maxNumMeshes<=0) return 1;
+
+    if (!TestHeadless_Init(64,64)) return 1;
+    Teapot_Init();
+    Teapot_Helper_Perspective(pMatrix,45.f,1.f,0.5f,200.f);
+    Teapot_SetProjectionMatrix(pMatrix);
+    Teapot_Helper_IdentityMatrix(vMatrix);
+    Teapot_SetViewMatrixAndLightDirection(vMatrix,lightDirection);
+
+    meshes = (Teapot_MeshData*) malloc(maxNumMeshes*sizeof(Teapot_MeshData));
+    pMeshes = (Teapot_MeshData**) malloc(maxNumMeshes*sizeof(Teapot_MeshData*));
+    if (!meshes || !pMeshes) {fprintf(stderr,"Error: out of memory (%d meshes).\n",maxNumMeshes);return 1;}
+    TestHeadless_InitRandomMeshes(meshes,pMeshes,maxNumMeshes,TEAPOT_MESH_TEXT_X,posMin,posMax,0.5f,2.f);
+
+    printf("\nTeapot_MeshData_CalculateMvMatrixFromArray(...): best of %d runs",NUM_REPETITIONS);
+#   ifdef TEAPOT_USE_OPENMP
+    printf(" (TEAPOT_OPENMP_CHUNK_SIZE=%d, TEAPOT_OPENMP_MIN_NUM_MESHES=%d)\n",TEAPOT_OPENMP_CHUNK_SIZE,TEAPOT_OPENMP_MIN_NUM_MESHES);
+#   else //TEAPOT_USE_OPENMP
+    printf(" (single-threaded build: compile with -fopenmp to measure the scaling)\n");
+#   endif //TEAPOT_USE_OPENMP
+    printf("%10s %8s %12s %12s %10s\n","meshes","threads","ms","ns/mesh","speedup");
+    for (j=0;j<numNumMeshes;j++) {
+        const int numMeshes = numMeshesArray[j]<maxNumMeshes ? numMeshesArray[j] : maxNumMeshes;
+        TestHeadless_MeshArray a;
+        double singleThreaded = 0;
+        a.pMeshes = pMeshes;a.numMeshes = numMeshes;
+        for (numThreads=1;;numThreads*=2) {
+            double ms;
+            if (numThreads>maxNumThreads) numThreads=maxNumThreads;
+#           ifdef _OPENMP
+            omp_set_num_threads(numThreads);
+#           endif //_OPENMP
+            ms = TestHeadless_Benchmark(NUM_REPETITIONS,&CalculateMvMatrices,NULL,&a);
+            if (numThreads==1) singleThreaded = ms;
+            printf("%10d %8d %12.3f %12.2f %9.2fx\n",numMeshes,numThreads,ms,ms*1000000.0/numMeshes,ms>0 ? singleThreaded/ms : 0.0);
+            if (numThreads==maxNumThreads) break;
+        }
+        if (numMeshes==maxNumMeshes) break;
+    }
+
+    // Prevents the compiler from optimizing the stage away (and it's a sanity check)
+    for (i=0;i<maxNumMeshes;i++) visible+=meshes[i].visible;
+    printf("\nvisible meshes: %d/%d\n",visible,maxNumMeshes);
+
+    free(pMeshes);free(meshes);
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return 0;
+}
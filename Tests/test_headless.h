@@ -0,0 +1,153 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Tiny helper shared by the headless programs in this folder (test_bench_*.c, test_mesh_lods.c, test_lowlevel.c).
+// It creates an OpenGL 3.3 compatibility context without any window (EGL + EGL_MESA_platform_surfaceless)
+// and renders into a framebuffer object. So it works on CPU-only machines too (Mesa llvmpipe: force it with LIBGL_ALWAYS_SOFTWARE=1).
+// Must be included before teapot.h. Include it again after teapot.h to get the Teapot_MeshData helpers used by the benchmarks.
+
+// DEPENDENCIES:
+/*
+-> EGL (Linux, Mesa)
+*/
+
+#ifndef TEST_HEADLESS_H_
+#define TEST_HEADLESS_H_
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+static EGLDisplay TestHeadless_Display = EGL_NO_DISPLAY;
+static EGLContext TestHeadless_Context = EGL_NO_CONTEXT;
+static GLuint TestHeadless_Fbo = 0, TestHeadless_Rbos[2] = {0,0};
+
+// Returns 0 on failure. The viewport is set to (0,0,width,height)
+static __inline int TestHeadless_Init(int width,int height) {
+    static const EGLint configAttribs[] = {EGL_SURFACE_TYPE,EGL_PBUFFER_BIT,EGL_RENDERABLE_TYPE,EGL_OPENGL_BIT,EGL_NONE};
+    static const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION,3,EGL_CONTEXT_MINOR_VERSION,3,EGL_CONTEXT_OPENGL_PROFILE_MASK,EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,EGL_NONE};
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLint major,minor,numConfigs=0;EGLConfig config;
+    if (!getPlatformDisplay) {fprintf(stderr,"Error: eglGetPlatformDisplayEXT(...) not available.\n");return 0;}
+    TestHeadless_Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL);
+    if (TestHeadless_Display==EGL_NO_DISPLAY || !eglInitialize(TestHeadless_Display,&major,&minor)) {fprintf(stderr,"Error: eglInitialize(...) failed.\n");return 0;}
+    if (!eglChooseConfig(TestHeadless_Display,configAttribs,&config,1,&numConfigs) || numConfigs<1) {fprintf(stderr,"Error: eglChooseConfig(...) failed.\n");return 0;}
+    eglBindAPI(EGL_OPENGL_API);
+    TestHeadless_Context = eglCreateContext(TestHeadless_Display,config,EGL_NO_CONTEXT,contextAttribs);
+    if (TestHeadless_Context==EGL_NO_CONTEXT || !eglMakeCurrent(TestHeadless_Display,EGL_NO_SURFACE,EGL_NO_SURFACE,TestHeadless_Context)) {fprintf(stderr,"Error: eglCreateContext(...) failed.\n");return 0;}
+
+    glGenFramebuffers(1,&TestHeadless_Fbo);glBindFramebuffer(GL_FRAMEBUFFER,TestHeadless_Fbo);
+    glGenRenderbuffers(2,TestHeadless_Rbos);
+    glBindRenderbuffer(GL_RENDERBUFFER,TestHeadless_Rbos[0]);glRenderbufferStorage(GL_RENDERBUFFER,GL_RGBA8,width,height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,TestHeadless_Rbos[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER,TestHeadless_Rbos[1]);glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT24,width,height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,TestHeadless_Rbos[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE) {fprintf(stderr,"Error: incomplete framebuffer.\n");return 0;}
+    glViewport(0,0,width,height);
+
+    printf("GL Renderer : %s\n", glGetString( GL_RENDERER ));
+    printf("GL Version (string) : %s\n",  glGetString( GL_VERSION ));
+    return 1;
+}
+
+static __inline void TestHeadless_Destroy(void) {
+    if (TestHeadless_Fbo) {glDeleteFramebuffers(1,&TestHeadless_Fbo);TestHeadless_Fbo=0;}
+    if (TestHeadless_Rbos[0]) {glDeleteRenderbuffers(2,TestHeadless_Rbos);TestHeadless_Rbos[0]=TestHeadless_Rbos[1]=0;}
+    if (TestHeadless_Display!=EGL_NO_DISPLAY) {
+        eglMakeCurrent(TestHeadless_Display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+        if (TestHeadless_Context!=EGL_NO_CONTEXT) {eglDestroyContext(TestHeadless_Display,TestHeadless_Context);TestHeadless_Context=EGL_NO_CONTEXT;}
+        eglTerminate(TestHeadless_Display);TestHeadless_Display=EGL_NO_DISPLAY;
+    }
+}
+
+// Monotonic time in milliseconds
+static __inline double TestHeadless_GetTimeMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec*1000.0+(double)ts.tv_nsec/1000000.0;
+}
+
+typedef void (*TestHeadless_BenchmarkFn)(void* userData);
+// Best time (in ms) of numRepetitions calls to measuredFn(userData). prepareFn (optional) is called before every measured call, and it's not timed
+static __inline double TestHeadless_Benchmark(int numRepetitions,TestHeadless_BenchmarkFn measuredFn,TestHeadless_BenchmarkFn prepareFn,void* userData) {
+    double best = 1.0e20;int r;
+    for (r=0;r<numRepetitions;r++) {
+        double start,elapsed;
+        if (prepareFn) prepareFn(userData);
+        start = TestHeadless_GetTimeMs();
+        measuredFn(userData);
+        elapsed = TestHeadless_GetTimeMs()-start;
+        if (best>elapsed) best=elapsed;
+    }
+    return best;
+}
+
+// Uniform random float in [mn,mx] (call srand(...) first for repeatable runs)
+static __inline float TestHeadless_RandomFloat(float mn,float mx) {return mn+(mx-mn)*(float)rand()/(float)RAND_MAX;}
+
+#endif //TEST_HEADLESS_H_
+
+
+#if (defined(TEAPOT_H_) && !defined(TEST_HEADLESS_TEAPOT_H_))
+#define TEST_HEADLESS_TEAPOT_H_
+
+// The argument of the TestHeadless_BenchmarkFn functions below
+typedef struct {
+    Teapot_MeshData** pMeshes;
+    int numMeshes;
+} TestHeadless_MeshArray;
+
+// Fills meshes[numMeshes] (and pMeshes[numMeshes]) with a random scene: meshId<numMeshIds, random rotation around the Y axis,
+// position in [posMin,posMax], uniform scaling in [minScaling,maxScaling] and random color. It calls srand(1) first, so the scene is always the same.
+static __inline void TestHeadless_InitRandomMeshes(Teapot_MeshData* meshes,Teapot_MeshData** pMeshes,int numMeshes,int numMeshIds,const float posMin[3],const float posMax[3],float minScaling,float maxScaling) {
+    int i,j;
+    srand(1);
+    for (i=0;i<numMeshes;i++) {
+        Teapot_MeshData* md = &meshes[i];
+        Teapot_MeshData_Clear(md);
+        md->meshId = (TeapotMeshEnum) (rand()%numMeshIds);
+        Teapot_Helper_IdentityMatrix(md->mMatrix);
+        Teapot_Helper_RotateMatrix(md->mMatrix,TestHeadless_RandomFloat(0.f,360.f),0,1,0);
+        for (j=0;j<3;j++) md->mMatrix[12+j]=TestHeadless_RandomFloat(posMin[j],posMax[j]);
+        md->scaling[0]=md->scaling[1]=md->scaling[2]=TestHeadless_RandomFloat(minScaling,maxScaling);
+        for (j=0;j<3;j++) md->color[j]=TestHeadless_RandomFloat(0.f,1.f);
+        pMeshes[i] = md;
+    }
+}
+
+// TestHeadless_BenchmarkFn that draws a frame of a TestHeadless_MeshArray with Teapot_DrawMulti(...) (glFinish() included)
+static __inline void TestHeadless_DrawMultiFrame(void* userData) {
+    const TestHeadless_MeshArray* a = (const TestHeadless_MeshArray*) userData;
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    Teapot_PreDraw();
+    Teapot_DrawMulti(a->pMeshes,a->numMeshes,0);
+    Teapot_PostDraw();
+    glFinish();
+}
+
+#endif //TEST_HEADLESS_TEAPOT_H_
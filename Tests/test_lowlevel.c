@@ -0,0 +1,149 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Headless check of the Teapot_LowLevel_XXX functions.
+// 1) Every mesh is drawn with Teapot_LowLevel_DrawElements(...) while another shader program is bound
+//    (as the dynamic_resolution.h shadow pass does): no teapot.h uniform must be touched (glGetError() must stay GL_NO_ERROR).
+// 2) Every mesh is drawn with the teapot.h shader program through the Teapot_LowLevel_XXX functions
+//    and the image must match the one of Teapot_Draw_Mv(...).
+// The program fails (exit code 1) when one of these checks fails.
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_lowlevel.c -o test_lowlevel -I"../" -lEGL -lGL -lm
+// (add -DTEAPOT_ENABLE_VERTEX_QUANTIZATION to check the quantized vertex format too)
+
+// USAGE:
+./test_lowlevel
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+
+#define IMAGE_SIZE (128)
+
+static unsigned char pixels[2][IMAGE_SIZE*IMAGE_SIZE*4];
+
+// A program that has nothing in common with the teapot.h one (but a_vertex, which it ignores)
+static GLuint CreateUserProgram(void) {
+    static const char* vs = "#version 120\nattribute vec3 a_vertex;\nvoid main() {gl_Position = vec4(a_vertex*0.0,1.0);}\n";
+    static const char* fs = "#version 120\nuniform vec4 u_userColor;\nvoid main() {gl_FragColor = u_userColor;}\n";
+    GLuint program = glCreateProgram(), vShader = glCreateShader(GL_VERTEX_SHADER), fShader = glCreateShader(GL_FRAGMENT_SHADER);
+    GLint linked = 0;
+    glShaderSource(vShader,1,&vs,NULL);glCompileShader(vShader);glAttachShader(program,vShader);
+    glShaderSource(fShader,1,&fs,NULL);glCompileShader(fShader);glAttachShader(program,fShader);
+    glLinkProgram(program);glGetProgramiv(program,GL_LINK_STATUS,&linked);
+    glDeleteShader(vShader);glDeleteShader(fShader);
+    if (!linked) {glDeleteProgram(program);program=0;}
+    return program;
+}
+
+// Renders meshId (fitted to the viewport) into pixels[lowLevel], with Teapot_Draw_Mv(...) or with the Teapot_LowLevel_XXX functions
+static void Render(TeapotMeshEnum meshId,const tpoat vMatrix[16],int lowLevel) {
+    float center[3];
+    tpoat mMatrix[16],mvMatrix[16];
+    Teapot_GetMeshAabbCenter(meshId,center);
+    Teapot_Helper_IdentityMatrix(mMatrix);
+    mMatrix[12]=-center[0];mMatrix[13]=-center[1];mMatrix[14]=-center[2];
+    Teapot_Helper_MultMatrix(mvMatrix,vMatrix,mMatrix);
+
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    if (!lowLevel) {
+        Teapot_PreDraw();
+        Teapot_SetScaling(1,1,1);
+        Teapot_SetColor(0.8f,0.5f,0.2f,1.f);
+        Teapot_Draw_Mv(mvMatrix,meshId);
+        Teapot_PostDraw();
+    }
+    else {
+        Teapot_LowLevel_BindShaderProgram();
+        Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1);
+        Teapot_SetScaling(1,1,1);
+        Teapot_SetColor(0.8f,0.5f,0.2f,1.f);
+        Teapot_LowLevel_SetMvMatrixUniform(mvMatrix);
+        Teapot_LowLevel_SetMeshUniforms(meshId);
+        Teapot_LowLevel_DrawElements(meshId);
+        Teapot_LowLevel_UnbindVertexBufferObjectAndDisableVertexAttributes(1,1);
+        Teapot_LowLevel_UnbindShaderProgram();
+    }
+    glReadPixels(0,0,IMAGE_SIZE,IMAGE_SIZE,GL_RGBA,GL_UNSIGNED_BYTE,pixels[lowLevel]);
+}
+
+int main(int argc, char** argv)
+{
+    tpoat pMatrix[16],vMatrix[16];
+    tpoat lightDirection[3] = {1.2f,-2.f,-1.f};
+    GLuint userProgram;
+    int meshId,i,numFailures=0,numCompared=0;
+    (void)argc;(void)argv;
+
+    if (!TestHeadless_Init(IMAGE_SIZE,IMAGE_SIZE)) return 1;
+    Teapot_Init();
+    Teapot_Helper_Perspective(pMatrix,45.f,1.f,0.1f,1000.f);
+    Teapot_SetProjectionMatrix(pMatrix);
+    Teapot_Helper_LookAt(vMatrix,1.5f,1.f,2.5f,0,0,0,0,1,0);
+    Teapot_SetViewMatrixAndLightDirection(vMatrix,lightDirection);
+    Teapot_Enable_ColorMaterial();
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glClearColor(0,0,0,1);
+
+    // 1) Teapot_LowLevel_DrawElements(...) with a user program bound
+    userProgram = CreateUserProgram();
+    if (!userProgram) {fprintf(stderr,"Error: can't link the user program.\n");return 1;}
+    while (glGetError()!=GL_NO_ERROR) {}
+    glUseProgram(userProgram);
+    glUniform4f(glGetUniformLocation(userProgram,"u_userColor"),1.f,1.f,1.f,1.f);
+    Teapot_LowLevel_BindVertexBufferObject();
+    for (meshId=0;meshId<TEAPOT_MESH_COUNT;meshId++) {
+        GLenum error;
+        if (meshId==TEAPOT_MESH_CAPSULE) continue;  // drawn as 3 meshes by Teapot_Draw_Mv(...)
+        Teapot_LowLevel_DrawElements((TeapotMeshEnum)meshId);
+        error = glGetError();
+        if (error!=GL_NO_ERROR) {printf("meshId %d drawn with a user program: glGetError()=0x%x FAILED\n",meshId,(unsigned)error);++numFailures;}
+    }
+    Teapot_LowLevel_UnbindVertexBufferObject();
+    glUseProgram(0);
+    glDeleteProgram(userProgram);
+
+    // 2) Teapot_LowLevel_XXX with the teapot.h program against Teapot_Draw_Mv(...)
+    for (meshId=0;meshId<TEAPOT_MESH_COUNT;meshId++) {
+        int numDifferent=0;
+        if (meshId==TEAPOT_MESH_CAPSULE || meshId==TEAPOT_MESH_PIVOT3D || meshId>=TEAPOT_FIRST_MESHLINES_INDEX) continue;    // Teapot_Draw_Mv(...) adds extra draws/uniforms for them
+        ++numCompared;
+        Render((TeapotMeshEnum)meshId,vMatrix,0);
+        Render((TeapotMeshEnum)meshId,vMatrix,1);
+        for (i=0;i<IMAGE_SIZE*IMAGE_SIZE*4;i++) numDifferent+=(pixels[0][i]!=pixels[1][i]);
+        if (numDifferent>0) {printf("meshId %d drawn with the Teapot_LowLevel_XXX functions: %d values differ from Teapot_Draw_Mv(...) FAILED\n",meshId,numDifferent);++numFailures;}
+    }
+    printf("\n%d meshes drawn with a user program, %d compared with Teapot_Draw_Mv(...), %d checks failed. glGetError()=%d\n",(int)TEAPOT_MESH_COUNT-1,numCompared,numFailures,(int)glGetError());
+
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return numFailures>0 ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+// https://github.com/Flix01/Header-Only-GL-Helpers
+//
+/** License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Headless check of the mesh LODs generated by TEAPOT_ENABLE_MESH_LODS.
+// Every mesh is rendered at every LOD (forced with Teapot_Set_MeshLod_Thresholds(...)) from several directions, with back face culling,
+// and its silhouette (the covered pixels) is compared with the one of LOD 0.
+// The program fails (exit code 1) when a LOD differs from LOD 0 in more than MAX_SILHOUETTE_ERROR of the LOD 0 pixels in some view
+// (missing parts, spurious triangles, flipped triangles).
+
+// DEPENDENCIES:
+/*
+-> EGL (see test_headless.h)
+*/
+
+// HOW TO COMPILE:
+/*
+// LINUX:
+gcc -O2 -std=gnu89 test_mesh_lods.c -o test_mesh_lods -I"../" -lEGL -lGL -lm
+
+// USAGE:
+./test_mesh_lods [-ppm]     (-ppm saves every rendered image as lod_<meshId>_<view>_<lod>.ppm)
+*/
+
+#include "test_headless.h"
+
+#define TEAPOT_ENABLE_MESH_LODS     // Mandatory here
+#define TEAPOT_IMPLEMENTATION       // Mandatory in only one c/c++ file
+#include "teapot.h"
+
+#define IMAGE_SIZE (200)
+#define NUM_VIEWS (6)
+#define MAX_SILHOUETTE_ERROR (0.1f)     // max fraction of (LOD 0 covered) pixels that can differ
+
+static unsigned char pixels[IMAGE_SIZE*IMAGE_SIZE*4];
+static unsigned char masks[TEAPOT_NUM_MESH_LODS][IMAGE_SIZE*IMAGE_SIZE];
+
+static void SavePpm(const char* path) {
+    FILE* f = fopen(path,"wb");int y,x;
+    if (!f) return;
+    fprintf(f,"P6 %d %d 255\n",IMAGE_SIZE,IMAGE_SIZE);
+    for (y=IMAGE_SIZE-1;y>=0;y--) {for (x=0;x<IMAGE_SIZE;x++) fwrite(&pixels[(y*IMAGE_SIZE+x)*4],1,3,f);}
+    fclose(f);
+}
+
+// Renders meshId (fitted to the viewport) at the given LOD and view, and stores its coverage mask. Returns the number of covered pixels.
+static int RenderMask(TeapotMeshEnum meshId,int lod,int view,unsigned char* mask,int savePpm) {
+    static const float azimuths[NUM_VIEWS] = {0.f,90.f,180.f,270.f,45.f,225.f};
+    static const float elevations[NUM_VIEWS] = {15.f,15.f,15.f,15.f,75.f,-45.f};
+    float thresholds[TEAPOT_NUM_MESH_LODS-1];
+    float center[3],halfExtents[3];
+    tpoat lightDirection[3] = {1.2f,-2.f,-1.f};
+    tpoat mMatrix[16],vMatrix[16];
+    tpoat radius,distance,azimuth,elevation;
+    int i,numCovered=0;
+
+    // LOD 'lod' is used when the projected size is smaller than the first 'lod' thresholds
+    for (i=0;i<TEAPOT_NUM_MESH_LODS-1;i++) thresholds[i] = i<lod ? 1000.f : 0.f;
+    Teapot_Set_MeshLod_Thresholds(thresholds);
+
+    Teapot_GetMeshAabbCenter(meshId,center);
+    Teapot_GetMeshAabbHalfExtents(meshId,halfExtents);
+    radius = sqrt(halfExtents[0]*halfExtents[0]+halfExtents[1]*halfExtents[1]+halfExtents[2]*halfExtents[2]);
+    distance = radius/sin(M_PI*22.5/180.0)*1.05;
+    azimuth = azimuths[view]*M_PI/180.0;elevation = elevations[view]*M_PI/180.0;
+    Teapot_Helper_LookAt(vMatrix,distance*cos(elevation)*sin(azimuth),distance*sin(elevation),distance*cos(elevation)*cos(azimuth),0,0,0,0,1,0);
+    Teapot_SetViewMatrixAndLightDirection(vMatrix,lightDirection);
+    Teapot_Helper_IdentityMatrix(mMatrix);
+    mMatrix[12]=-center[0];mMatrix[13]=-center[1];mMatrix[14]=-center[2];
+
+    glClearColor(0,0,0,1);
+    glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    Teapot_PreDraw();
+    Teapot_SetScaling(1,1,1);
+    Teapot_SetColor(0.8f,0.5f,0.2f,1.f);
+    Teapot_Draw(mMatrix,meshId);
+    Teapot_PostDraw();
+
+    glReadPixels(0,0,IMAGE_SIZE,IMAGE_SIZE,GL_RGBA,GL_UNSIGNED_BYTE,pixels);
+    for (i=0;i<IMAGE_SIZE*IMAGE_SIZE;i++) {
+        const unsigned char* p = &pixels[4*i];
+        mask[i] = (p[0]|p[1]|p[2]) ? 1 : 0;
+        numCovered+=mask[i];
+    }
+    if (savePpm) {char path[64];sprintf(path,"lod_%d_%d_%d.ppm",(int)meshId,view,lod);SavePpm(path);}
+    return numCovered;
+}
+
+int main(int argc, char** argv)
+{
+    const int savePpm = (argc>1 && strcmp(argv[1],"-ppm")==0);
+    tpoat pMatrix[16];
+    int meshId,lod,view,i,numFailures=0,numTested=0;
+
+    if (!TestHeadless_Init(IMAGE_SIZE,IMAGE_SIZE)) return 1;
+    Teapot_Init();
+    Teapot_Helper_Perspective(pMatrix,45.f,1.f,0.1f,1000.f);
+    Teapot_SetProjectionMatrix(pMatrix);
+    Teapot_Enable_ColorMaterial();
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    printf("\nSilhouette error of every LOD against LOD 0 (worst of %d views, max allowed: %1.1f%%)\n",NUM_VIEWS,MAX_SILHOUETTE_ERROR*100.f);
+    printf("%8s %10s %s\n","meshId","triangles","error per LOD");
+    for (meshId=0;meshId<TEAPOT_MESH_COUNT;meshId++) {
+        const int numLevels = Teapot_Get_MeshLod_NumLevels((TeapotMeshEnum)meshId);
+        float worstError[TEAPOT_NUM_MESH_LODS];
+        if (numLevels<2) continue;
+        for (lod=0;lod<numLevels;lod++) worstError[lod]=0.f;
+        for (view=0;view<NUM_VIEWS;view++) {
+            const int numCovered = RenderMask((TeapotMeshEnum)meshId,0,view,masks[0],savePpm);
+            for (lod=1;lod<numLevels;lod++) {
+                int numDifferent=0;float error;
+                RenderMask((TeapotMeshEnum)meshId,lod,view,masks[lod],savePpm);
+                for (i=0;i<IMAGE_SIZE*IMAGE_SIZE;i++) numDifferent+=(masks[0][i]!=masks[lod][i]);
+                error = numCovered>0 ? (float)numDifferent/(float)numCovered : 0.f;
+                if (worstError[lod]<error) worstError[lod]=error;
+            }
+        }
+        printf("%8d %10d",meshId,Teapot_Get_MeshLod_NumTriangles((TeapotMeshEnum)meshId,0));
+        for (lod=1;lod<numLevels;lod++) {
+            const int failed = worstError[lod]>MAX_SILHOUETTE_ERROR;
+            printf("   LOD%d (%d tris): %5.2f%%%s",lod,Teapot_Get_MeshLod_NumTriangles((TeapotMeshEnum)meshId,lod),worstError[lod]*100.f,failed ? " FAILED" : "");
+            numFailures+=failed;++numTested;
+        }
+        printf("\n");
+    }
+    printf("\n%d LODs tested, %d failed. glGetError()=%d\n",numTested,numFailures,(int)glGetError());
+
+    Teapot_Destroy();
+    TestHeadless_Destroy();
+    return numFailures>0 ? 1 : 0;
+}
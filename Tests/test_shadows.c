@@ -506,9 +506,11 @@ void DrawGL(void)
 
         pAnimatedMeshData0->mMatrix[12] = 1.5f + 0.3f*s;
         pAnimatedMeshData0->mMatrix[14] = 0.5f + 1.25f*c;
+        Teapot_MeshData_MarkTransformDirty(pAnimatedMeshData0); // (needed only with TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE)
 
         pAnimatedMeshData1->mMatrix[12] = -1.5f + 0.5f*c;
         pAnimatedMeshData1->mMatrix[14] = 1.f + 0.25f*s;
+        Teapot_MeshData_MarkTransformDirty(pAnimatedMeshData1);
     }
 
     Teapot_MeshData_CalculateMvMatrixFromArray(pMeshData,numMeshData);  // This sets every Teapot_MeshData::mvMatrix
@@ -38,16 +38,45 @@
 //#define TEAPOT_SHADER_SHADOW_MAP_PCF 4    // (optional, but needs a value>0, otherwise will be set to zero). Basically when TEAPOT_SHADER_USE_SHADOW_MAP is defined, PCF filter used (dynamic_resolution.h can automatically set this value when DYNAMIC_RESOLUTION_SHADOW_USE_PCF is used).
 //                                          // Warning: when TEAPOT_SHADER_SHADOW_MAP_PCF is used with emscripten, it needs: -s USE_WEBGL2=1
 //
-//#define TEAPOT_MAX_NUM_USER_MESH_VERTICES (3000)  // (experimental) default is 1000. Needed when, using Teapot_Set_Init_UserMeshCallback(...), you overflow the number of vertices. Warning: the max number of vertices for ALL meshes (= embedded + user) can't be bigger than 65535, because the indices are unsigned short.
-//#define TEAPOT_MAX_NUM_USER_MESH_INDICES (15000)  // (experimental) default is 5000. Needed when, using Teapot_Set_Init_UserMeshCallback(...), you overflow the number of indices.
+//#define TEAPOT_ENABLE_FRUSTUM_CULLING     // (experimental) it does not cull 100% objects. Teapot_DrawMulti(...) and Teapot_DrawScene(...) test 4 objects at once (SSE/AVX when TEAPOT_USE_SIMD is defined) and draw only the visible ones. See Teapot_CullMulti(...).
 //
-//#define TEAPOT_ENABLE_FRUSTUM_CULLING     // (experimental) it does not cull 100% objects, and performance might be slower rather than faster...
+//#define TEAPOT_ENABLE_INSTANCING          // Teapot_DrawMulti(...) groups opaque meshes by meshId and draws each group with a single glDrawElementsInstanced(...). Requires OpenGL 3.3 (or OpenGL ES 3.0/WebGL2). See Teapot_Enable_Instancing().
+//                                          // With dynamic_resolution.h, Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...) draws its shadow casters the same way (with a position-only depth program).
 //
-//#define TEAPOT_USE_OPENMP                 // (experimental) ATM is only used in Teapot_MeshData_CalculateMvMatrixFromArray(...) and never tested => one more dependency and no gain: DO NOT USE!
+//#define TEAPOT_ENABLE_DEPTH_PREPASS       // Teapot_DrawMulti(...) and Teapot_DrawMulti_Mv(...) first write the depth of their opaque meshes with a position-only program, and then shade them with glDepthFunc(GL_EQUAL) (so that every pixel is shaded once). It pays off only when fragment shading is the bottleneck: it doubles the vertex work. See Teapot_Enable_DepthPrepass() and Teapot_Enable_FrontToBackSorting().
+//
+//#define TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT // Teapot_PreDraw(), Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1) and the instanced/depth/shadow passes bind a vertex array object that captured their vertex layout the first time, instead of re-issuing glBindBuffer(...), glEnableVertexAttribArray(...) and glVertexAttribPointer(...). Requires OpenGL 3.0 (or OpenGL ES 3.0/WebGL2; with OpenGL ES 2.0 + OES_vertex_array_object please #define glGenVertexArrays, glBindVertexArray and glDeleteVertexArrays as their OES versions). See Teapot_Enable_VertexArrayObjects().
+//
+//#define TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE // Teapot_MeshData_CalculateMvMatrixFromArray(...) (and so Teapot_DrawMulti(...)) recalculates mvMatrix, nCoefficients and visible only for the meshes whose Teapot_MeshData::transformVersion or view/projection matrix changed. See Teapot_Get_MvMatrixUpdate_Counters(...). Writing md->mMatrix/scaling/meshId directly (or the matrix pointed by md->mMatrix with TEAPOT_MESHDATA_HAS_MMATRIX_PTR) is not detected: call Teapot_MeshData_MarkTransformDirty(md) afterwards, or the mesh is drawn with its old transform.
+//
+//#define TEAPOT_ENABLE_VERTEX_QUANTIZATION // The VBO stores 12 bytes per vertex (int16 positions normalized to the mesh aabb, int16 octahedral normals, int16 material) instead of 28. With the teapot.h shader program, Teapot_LowLevel_SetMeshUniforms(meshId) must be called before every Teapot_LowLevel_DrawElements(meshId). Other shader programs can't dequantize the vertices (but the dynamic_resolution.h shadow pass is supported).
+//
+//#define TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION // Teapot_Init() and Teapot_Set_UserMesh(...) reorder the triangles of every mesh for the post-transform vertex cache and for less overdraw (Tipsify), and then its vertices for fetch locality. See Teapot_Get_VertexCache_ACMR(...).
+//                                          // Warning: the triangle order inside a mesh changes, so transparent meshes (blended without depth writes) can look slightly different where their triangles overlap. Don't use it if that matters.
+//#define TEAPOT_VERTEX_CACHE_SIZE (16)     // (used only when TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION is defined) size of the vertex cache we optimize for (default 16)
+//
+//#define TEAPOT_ENABLE_MESH_LODS           // Teapot_Init() and Teapot_Set_UserMesh(...) generate simplified LODs of every mesh (quadric edge collapse), and the color and shadow passes pick one based on the projected size of the mesh. See Teapot_Set_MeshLod_Thresholds(...).
+//#define TEAPOT_NUM_MESH_LODS (4)          // (used only when TEAPOT_ENABLE_MESH_LODS is defined) max number of LODs, including the full mesh (default 4: each simplified LOD has at most half the triangles of the previous one)
+//#define TEAPOT_MESH_LOD_MAX_ERROR (0.02f) // (used only when TEAPOT_ENABLE_MESH_LODS is defined) max geometric error of LOD 1, relative to the mesh radius (default 0.02). It's multiplied by 2.5 at every further LOD. Meshes get fewer LODs (or none) when simplifying them further would exceed it.
+
+//#define TEAPOT_ENABLE_STATIC_SHADOW_CACHE // With dynamic_resolution.h, Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...) keeps the depth of the Teapot_MeshData::staticShadowCaster meshes in a cache, and every frame it copies it into the shadow map and draws only the other casters. Requires OpenGL 3.0 (or OpenGL ES 3.0/WebGL2). See Teapot_Enable_StaticShadowCache().
+//
+//#define TEAPOT_ENABLE_PERSISTENT_RING_BUFFER // (used only when TEAPOT_ENABLE_INSTANCING is defined) The instanced passes write their per-instance stream directly into a persistently mapped ring buffer (glBufferStorage with GL_MAP_PERSISTENT_BIT, 3 sections guarded by fences), instead of filling a CPU array and orphaning the instance buffer (glBufferData + glBufferSubData). Requires OpenGL 4.4 (or ARB_buffer_storage) at runtime: otherwise (and with emscripten) orphaning is used. See Teapot_Enable_PersistentRingBuffer().
+//#define TEAPOT_RING_BUFFER_MIN_SECTION_SIZE (262144)  // (used only when TEAPOT_ENABLE_PERSISTENT_RING_BUFFER is defined) initial size in bytes of each section of the ring buffer (it grows when a pass needs more)
+//
+//#define TEAPOT_ENABLE_PROGRAM_BINARY_CACHE // Teapot_Init() (and Teapot_SetShaderFeatures(...)) save every linked shader program to a file (glGetProgramBinary) and load it back at the next runs (glProgramBinary), compiling from source when the file is missing or does not match (GL vendor/renderer/version, sources and defines). Requires OpenGL 4.1 (or ARB_get_program_binary, or OpenGL ES 3.0): ignored with emscripten. See Teapot_Set_ProgramBinaryCache_Path(...) and Teapot_Get_ProgramLoad_Counters(...).
+//
+//#define TEAPOT_ENABLE_EXACT_PICKING       // Teapot_Init() and Teapot_Set_UserMesh(...) build a bounding volume hierarchy over the triangles of every mesh (kept in CPU memory), so that Teapot_MeshData_RaycastExact(...) can return the hit triangle (and not just the first OBB hit).
+//
+//#define TEAPOT_ENABLE_STATE_CACHE         // Skips the GL calls (program and buffer bindings, enable bits, per-object uniforms) that would not change the GL state. See Teapot_Get_StateCache_Counters(...) and Teapot_Invalidate_StateCache().
+//
+//#define TEAPOT_USE_OPENMP                 // (experimental) Teapot_MeshData_CalculateMvMatrixFromArray(...) (and so Teapot_DrawMulti(...)) splits the per-object transform stage (mvMatrix, frustum culling, accurate normal coefficients) across threads. Requires -fopenmp. Worth it only with many thousands of objects.
+//#define TEAPOT_OPENMP_CHUNK_SIZE (64)     // (used only when TEAPOT_USE_OPENMP is defined) number of consecutive objects processed by a thread (default 64)
+//#define TEAPOT_OPENMP_MIN_NUM_MESHES (2048)   // (used only when TEAPOT_USE_OPENMP is defined) below this number of objects the transform stage is single-threaded (default 2048)
 //
 //#define TEAPOT_USE_SIMD					// (experimental) speeds up Teapot_Helper_MultMatrix(...) using SIMD (about 1.5x-2x when compiled with -O3 -DNDEBUG -march=native), Requires -msse (OR -mavx when using double precision).
 //
-//#define TEAPOT_MESHDATA_HAS_MMATRIX_PTR   // (untested) handy when using Teapot_MeshData + some kind of physic engine that already stores a mMatrix16 somewhere.
+//#define TEAPOT_MESHDATA_HAS_MMATRIX_PTR   // (untested) handy when using Teapot_MeshData + some kind of physic engine that already stores a mMatrix16 somewhere. With TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE, call Teapot_MeshData_MarkTransformDirty(md) every time that matrix changes.
 
 #ifndef TEAPOT_H_
 #define TEAPOT_H_
@@ -61,6 +90,13 @@ extern "C" {
 #   define TEAPOT_VERSION 1.23
 #endif //TEAPOT_VERSION
 
+#if (defined(TEAPOT_ENABLE_PROGRAM_BINARY_CACHE) && defined(__EMSCRIPTEN__))
+#   undef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE    // WebGL has no program binaries
+#endif
+#if (defined(TEAPOT_ENABLE_PERSISTENT_RING_BUFFER) && (defined(__EMSCRIPTEN__) || !defined(TEAPOT_ENABLE_INSTANCING)))
+#   undef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER  // WebGL has no buffer mapping (and the ring buffer streams only instance data)
+#endif
+
 
 /* The __restrict and __restrict__ keywords are recognized in both C, at all language levels, and C++, at LANGLVL(EXTENDED).*/
 #ifdef TEAPOT_NO_RESTRICT  // please define it globally if the keyword __restrict is not present
@@ -138,7 +174,7 @@ typedef enum {
     TEAPOT_MESH_SLEDGE,
     TEAPOT_MESH_TABLE,
     TEAPOT_MESH_TORUS,
-    TEAPOT_MESH_USER_00,                // TEAPOT_MESH_USER_XX meshes must be entered through Teapot_Set_Init_UserMeshCallback(...) before calling Teapot_Init(...)
+    TEAPOT_MESH_USER_00,                // TEAPOT_MESH_USER_XX meshes can be entered through Teapot_Set_Init_UserMeshCallback(...) before calling Teapot_Init(...), or through Teapot_Set_UserMesh(...) after it
     TEAPOT_MESH_USER_01,
     TEAPOT_MESH_USER_02,
     TEAPOT_MESH_USER_03,
@@ -204,9 +240,23 @@ void Teapot_Set_Init_UserMeshCallback(TeapotInitUserMeshCallback callback); // (
 typedef void (*TeapotInitCallback)(TeapotMeshEnum meshId,const float* pverts,int numVerts,const unsigned short* pinds,int numInds); // numVerts is the number of vertices (each vertex is 3 floats)
 void Teapot_Set_Init_Callback(TeapotInitCallback callback); // (Optional/Advanced Users) to be called before Teapot_Init(void)
 
+// (Optional/Advanced Users) These can be called after Teapot_Init(void) (but outside Teapot_PreDraw()/Teapot_PostDraw()) to add, replace or remove TEAPOT_MESH_USER_XX meshes at runtime.
+// There's no limit to the number of vertices: meshes that need it use 32-bit indices (on OpenGL ES 2.0/WebGL 1 this requires the OES_element_index_uint extension).
+int Teapot_Set_UserMesh(TeapotMeshEnum meshId,const float* verts,int numVerts,const unsigned int* inds,int numInds);    // numVerts is the number of vertices (each vertex is 3 floats). Returns 1 on success (on failure the old mesh, if any, is kept). Every index must be < numVerts [Warning: it binds GL buffers => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
+void Teapot_Remove_UserMesh(TeapotMeshEnum meshId);
+
 void Teapot_Init(void);     // In your InitGL() method
 void Teapot_Destroy(void);  // In your DestroyGL() method (cleanup)
 
+#ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+// These can be called before Teapot_Init(void)
+void Teapot_Set_ProgramBinaryCache_Path(const char* pathPrefix);   // Every program is cached in the file <pathPrefix><64-bit key in hex>.bin (the directory must exist). Default (NULL or ""): TEAPOT_PROGRAM_BINARY_CACHE_PATH ("teapot_program_")
+void Teapot_Enable_ProgramBinaryCache(void);    // (default)
+void Teapot_Disable_ProgramBinaryCache(void);
+int Teapot_Get_ProgramBinaryCache_Enabled(void);
+void Teapot_Get_ProgramLoad_Counters(int* numLoadedFromCacheOut,int* numCompiledOut,float* loadMillisecondsOut);  // Shader programs loaded since Teapot_Init(), and the processor time they took (startup timing report)
+#endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+
 // In your InitGL() and ResizeGL() methods:
 void Teapot_SetProjectionMatrix(const tpoat pMatrix[16]);   // Sets the projection matrix [Warning: it calls glUseProgram(0); at the end => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
 void Teapot_SetProjectionMatrixf(const float pMatrix[16]);   // Sets a float projection matrix [Warning: it calls glUseProgram(0); at the end => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
@@ -215,6 +265,18 @@ void Teapot_SetFogColor(float R, float G, float B);  // it should be the same as
 void Teapot_SetFogDistances(float startDistance,float endDistance); // endDistance should be equal to the far clipping plane [Warning: it calls glUseProgram(0); at the end => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
 #endif //TEAPOT_SHADER_FOG
 
+// (Optional) Runtime shader features (e.g. for a low-quality mode). The TEAPOT_SHADER_XXX definitions set the features compiled in: at runtime they can only be turned off (and on again).
+// Every combination is a shader program variant, generated from the same source and compiled the first time it's used (then it's cached until Teapot_Destroy()).
+#define TEAPOT_SHADER_FEATURE_SPECULAR          (1)     // TEAPOT_SHADER_SPECULAR
+#define TEAPOT_SHADER_FEATURE_FOG               (2)     // TEAPOT_SHADER_FOG
+#define TEAPOT_SHADER_FEATURE_ACCURATE_NORMALS  (4)     // TEAPOT_SHADER_USE_ACCURATE_NORMALS
+#define TEAPOT_SHADER_FEATURE_SHADOW_MAP        (8)     // TEAPOT_SHADER_USE_SHADOW_MAP (when off, nothing is shadowed)
+#define TEAPOT_SHADER_FEATURE_SHADOW_MAP_PCF    (16)    // TEAPOT_SHADER_SHADOW_MAP_PCF>1 (when off, a single shadow map tap is used)
+#define TEAPOT_SHADER_FEATURE_ALL               (31)
+int Teapot_SetShaderFeatures(int features);     // 'features' is a combination of TEAPOT_SHADER_FEATURE_XXX (the ones not compiled in are ignored). Returns 1 on success. [Warning: it calls glUseProgram(0); at the end => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
+int Teapot_GetShaderFeatures(void);
+int Teapot_GetAvailableShaderFeatures(void);    // the features compiled in (the default ones)
+
 // In your DrawGL() method:
 void Teapot_SetViewMatrixAndLightDirection(const tpoat vMatrix[16],tpoat lightDirectionWorldSpace[3]);    // vMatrix CAN'T HAVE any scaling! Sets the camera view matrix (= gluLookAt matrix) and the directional light in world space [Warning: it calls glUseProgram(0); at the end => call it outside Teapot_PreDraw()/Teapot_PostDraw()]
 
@@ -276,6 +338,18 @@ typedef struct _Teapot_MeshData {
     float colorSpecular[4]; // Skipped when Teapot_Color_Material is enabled. Used only when TEAPOT_SHADER_SPECULAR is defined
     int outlineEnabled;     // 0 or 1
     int active;             // 0 or 1
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    int staticShadowCaster; // 0 or 1. The depth of static shadow casters is cached by Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...) (it's redrawn only when one of them changes)
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    unsigned transformVersion;  // Increment it when mMatrix, scaling or meshId change (Teapot_MeshData_SetMMatrix(...), Teapot_MeshData_SetScaling(...), Teapot_MeshData_SetMeshId(...) and Teapot_MeshData_MarkTransformDirty(...) do it)
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    // Output of Teapot_MeshData_CalculateMvMatrixFromArray(...) (together with mvMatrix), used by Teapot_DrawMulti(...):
+    int visible;            // 0 if frustum culled (always 1 if TEAPOT_ENABLE_FRUSTUM_CULLING is not defined)
+    float nCoefficients[3]; // u_nCoefficients (used only when TEAPOT_SHADER_USE_ACCURATE_NORMALS is defined)
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    unsigned calculatedVersions[2]; // (private) transformVersion and view version of mvMatrix, visible and nCoefficients
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 #   ifdef TEAPOT_MESHDATA_STRUCT_EXTRA_FIELDS
     TEAPOT_MESHDATA_STRUCT_EXTRA_FIELDS
 #   else
@@ -291,7 +365,11 @@ void Teapot_MeshData_Clear(Teapot_MeshData* md);
 void Teapot_MeshData_SetMMatrix(Teapot_MeshData* md,const tpoat* mMatrix16);
 #endif //TEAPOT_MESHDATA_HAS_MMATRIX_PTR
 void Teapot_MeshData_SetMvMatrix(Teapot_MeshData* md,const tpoat* mvMatrix16);
+#ifndef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 static __inline void Teapot_MeshData_SetScaling(Teapot_MeshData* md,float scalingX,float scalingY,float scalingZ) {md->scaling[0]=scalingX;md->scaling[1]=scalingY;md->scaling[2]=scalingZ;}
+#else //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+static __inline void Teapot_MeshData_SetScaling(Teapot_MeshData* md,float scalingX,float scalingY,float scalingZ) {md->scaling[0]=scalingX;md->scaling[1]=scalingY;md->scaling[2]=scalingZ;++md->transformVersion;}
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 static __inline void Teapot_MeshData_SetColor(Teapot_MeshData* md,float R,float G,float B,float A) {md->color[0]=R;md->color[1]=G;md->color[2]=B;md->color[3]=A;}
 static __inline void Teapot_MeshData_SetColorAmbient(Teapot_MeshData* md,float R,float G,float B) {md->colorAmbient[0]=R;md->colorAmbient[1]=G;md->colorAmbient[2]=B;}
 #ifdef TEAPOT_SHADER_SPECULAR
@@ -301,24 +379,142 @@ void Teapot_MeshData_GetAabbHalfExtents(const Teapot_MeshData* md,float* halfAab
 void Teapot_MeshData_GetAabbExtents(const Teapot_MeshData* md,float* aabb);
 void Teapot_MeshData_GetAabbCenter(const Teapot_MeshData* md,float* center);
 static __inline void Teapot_MeshData_SetOutlineEnabled(Teapot_MeshData* md,int meshOutlineEnabled) {md->outlineEnabled=meshOutlineEnabled;}
+#ifndef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 static __inline void Teapot_MeshData_SetMeshId(Teapot_MeshData* md,TeapotMeshEnum meshId) {md->meshId = meshId;}
-void Teapot_MeshData_CalculateMvMatrix(Teapot_MeshData* md);    // From mMatrix (called internally when Teapot_DrawMulti(...) is used)
-void Teapot_MeshData_CalculateMvMatrixFromArray(Teapot_MeshData** meshes,int numMeshes);  // From mMatrix (called internally when Teapot_DrawMulti(...) is used)
+#else //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+static __inline void Teapot_MeshData_SetMeshId(Teapot_MeshData* md,TeapotMeshEnum meshId) {md->meshId = meshId;++md->transformVersion;}
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+// Call it after writing md->mMatrix, md->scaling or md->meshId directly (or the matrix pointed by md->mMatrix with TEAPOT_MESHDATA_HAS_MMATRIX_PTR). It does nothing without TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+#ifndef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+static __inline void Teapot_MeshData_MarkTransformDirty(Teapot_MeshData* md) {(void)md;}
+#else //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+static __inline void Teapot_MeshData_MarkTransformDirty(Teapot_MeshData* md) {++md->transformVersion;}
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_MeshData_CalculateMvMatrix(Teapot_MeshData* md);    // From mMatrix (called internally when Teapot_DrawMulti(...) is used). It calculates visible and nCoefficients too.
+void Teapot_MeshData_CalculateMvMatrixFromArray(Teapot_MeshData** meshes,int numMeshes);  // From mMatrix (called internally when Teapot_DrawMulti(...) is used). It calculates visible and nCoefficients too (in parallel when TEAPOT_USE_OPENMP is defined).
+#ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_Get_MvMatrixUpdate_Counters(unsigned* numCalculatedOut,unsigned* numSkippedOut);    // Number of meshes recalculated and skipped by Teapot_MeshData_CalculateMvMatrixFromArray(...) since Teapot_Init() or Teapot_Reset_MvMatrixUpdate_Counters()
+void Teapot_Reset_MvMatrixUpdate_Counters(void);
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 Teapot_MeshData* Teapot_MeshData_GetMeshUnderMouse(Teapot_MeshData* const* meshes,int numMeshes,int mouseX,int mouseY,const int* viewport4,tpoat* pOptionalDistanceOut);
 Teapot_MeshData* Teapot_MeshData_GetMeshUnderMouseFromRay(Teapot_MeshData* const* meshes, int numMeshes, const tpoat* rayOrigin3, const tpoat* rayDir3, tpoat* pOptionalDistanceOut);   /* ray in world space */
+int Teapot_MeshData_RaycastBatch(Teapot_MeshData* const* meshes,int numMeshes,const tpoat* rayOrigins3,const tpoat* rayDirs3,int numRays,Teapot_MeshData** hitMeshesOut,tpoat* distancesOut/*=NULL*/);  /* Same as Teapot_MeshData_GetMeshUnderMouseFromRay(...) on numRays world space rays (3 tpoats each) at once, but every OBB is set up once and tested against 4 rays at a time (in parallel when TEAPOT_USE_OPENMP is defined). Returns the number of rays that hit something */
+#ifdef TEAPOT_ENABLE_EXACT_PICKING
+typedef struct {
+    Teapot_MeshData* mesh;      // NULL when nothing is hit
+    tpoat distance;             // along rayDir3 (as in Teapot_MeshData_GetMeshUnderMouseFromRay(...))
+    tpoat point[3];             // world space hit point
+    int triangle;               // the hit triangle of mesh->meshId (see Teapot_GetMeshTriangle(...)), or -1 when the mesh is picked by its OBB (TEAPOT_MESH_CAPSULE and the line meshes)
+    float barycentrics[2];      // (u,v) of the hit point: (1-u-v)*v0 + u*v1 + v*v2
+} Teapot_RaycastHit;
+int Teapot_MeshData_RaycastExact(Teapot_MeshData* const* meshes,int numMeshes,const tpoat* rayOrigin3,const tpoat* rayDir3,Teapot_RaycastHit* hitOut);   /* ray in world space. Returns 1 if the nearest triangle hit has been found */
+int Teapot_MeshData_RaycastExactUnderMouse(Teapot_MeshData* const* meshes,int numMeshes,int mouseX,int mouseY,const int* viewport4,Teapot_RaycastHit* hitOut);
+int Teapot_GetMeshTriangle(TeapotMeshEnum meshId,int triangle,float v0[3],float v1[3],float v2[3]);  // Mesh space (unscaled) vertices of a triangle returned by the functions above. Returns 0 if 'triangle' is out of range
+#endif //TEAPOT_ENABLE_EXACT_PICKING
 
 tpoat* Teapot_Helper_ExtractMatrix3x3(tpoat* __restrict m9Out,const tpoat* __restrict m16,tpoat* __restrict optionalTranslation3Out/*=NULL*/);
 void Teapot_Helper_ExtractScalingFromTransformMatrix(const tpoat* __restrict m16,tpoat* __restrict scaOut3,tpoat* __restrict optionalMOut16);
 
 void Teapot_DrawMulti(Teapot_MeshData** meshes,int numMeshes,int mustSortObjectsForTransparency);  // 'mustSortObjectsForTransparency' requires glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); and  glDisable(GL_BLEND); At the end it restores glDisable(GL_BLEND); if used.
 void Teapot_DrawMulti_Mv(Teapot_MeshData* const* meshes,int numMeshes,int mustSortObjectsForTransparency);  // Same as above, but use it only if you set or calculate all the Teapot_MeshData::mvMatrix[16] manually
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+// Frustum culls the Teapot_MeshData::mvMatrix of all the meshes (4 at a time) and sets Teapot_MeshData::visible. 'frustumPlanes' must be in view space (NULL: the planes of the current projection matrix).
+// If not NULL, 'visibleIndicesOut' (numMeshes ints) gets the indices of the active and visible meshes. Returns their number.
+int Teapot_CullMulti(Teapot_MeshData* const* meshes,int numMeshes,const tpoat frustumPlanes[6][4]/*=NULL*/,int* visibleIndicesOut/*=NULL*/);
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
 
 void Teapot_MeshData_DrawAabb(const Teapot_MeshData* mesh);
 
-int Teapot_MeshData_Depth_Sorter(const void* pmd0,const void* pmd1);    // helper function used internally by Teapot_DrawMulti(...) when mustSortObjectsForTransparency==1  (for qsort)
+int Teapot_MeshData_Depth_Sorter(const void* pmd0,const void* pmd1);    // (legacy) qsort helper function: it gives the same order as Teapot_MeshData_RadixSort(...) (apart from ties)
+void Teapot_MeshData_RadixSort(Teapot_MeshData* const* meshes,int numMeshes);  // used internally by Teapot_DrawMulti(...) when mustSortObjectsForTransparency==1. It sorts (in place) opaque objects front to back first, then transparent objects back to front (based on mvMatrix[14])
+void Teapot_Enable_FrontToBackSorting(void);    // Teapot_DrawMulti(...) and Teapot_DrawMulti_Mv(...) draw their visible opaque meshes front to back (same keys as Teapot_MeshData_RadixSort(...)) when mustSortObjectsForTransparency==0 too, and then the other meshes in array order. The array is not reordered. Less overdraw with expensive fragment shaders (fog, specular, PCF shadows).
+void Teapot_Disable_FrontToBackSorting(void);   // (default) meshes are drawn in array order (when mustSortObjectsForTransparency==0)
+int Teapot_Get_FrontToBackSorting_Enabled(void);
+
+// Teapot_Scene: a structure-of-arrays alternative to Teapot_MeshData** (no pointer chasing: per-frame data is stored in contiguous arrays that Teapot_DrawScene(...) reads linearly)
+#define TEAPOT_SCENE_FLAG_ACTIVE    (1)     // Input
+#define TEAPOT_SCENE_FLAG_OUTLINE   (2)     // Input (same as Teapot_MeshData::outlineEnabled)
+#define TEAPOT_SCENE_FLAG_VISIBLE   (4)     // Output of Teapot_Scene_CalculateMvMatrices(...) (0 if frustum culled)
+typedef struct {
+    // Hot data (accessed every frame), object 'i' uses: mMatrices[16*i], mvMatrices[16*i], meshIds[i], scalings[3*i], colors[i], flags[i] and nCoefficients[3*i]:
+    tpoat* mMatrices;           // Input for Teapot_DrawScene(...)
+    tpoat* mvMatrices;          // Output of Teapot_Scene_CalculateMvMatrices(...) [Teapot_Helper_MultMatrix(mvMatrix,vMatrix,mMatrix)]
+    unsigned char* meshIds;     // TeapotMeshEnum
+    float* scalings;
+    unsigned int* colors;       // RGBA8 (see Teapot_Helper_PackColor(...)). Ambient and specular colors are the global ones (or derived from these colors when Teapot_Color_Material is enabled)
+    unsigned char* flags;       // TEAPOT_SCENE_FLAG_*
+    float* nCoefficients;       // Output of Teapot_Scene_CalculateMvMatrices(...) (used only when TEAPOT_SHADER_USE_ACCURATE_NORMALS is defined)
+    // Cold data:
+    void** userPtrs;            // yours
+    int numObjects;
+    int capacity;
+} Teapot_Scene;
+void Teapot_Scene_Init(Teapot_Scene* scene,int initialCapacity);
+void Teapot_Scene_Destroy(Teapot_Scene* scene);                 // frees all the arrays
+int Teapot_Scene_Reserve(Teapot_Scene* scene,int capacity);     // returns 0 when out of memory
+static __inline void Teapot_Scene_Clear(Teapot_Scene* scene) {scene->numObjects=0;}
+int Teapot_Scene_AddObject(Teapot_Scene* scene,TeapotMeshEnum meshId,const tpoat* mMatrix16/*=NULL*/);  // returns the index of the new object (or -1 when out of memory). Defaults are the same as Teapot_MeshData_Clear(...)
+static __inline unsigned int Teapot_Helper_PackColor(float R,float G,float B,float A) {
+    const float c[4] = {R,G,B,A};unsigned int rgba=0;int i;
+    for (i=0;i<4;i++) {const float v = c[i]<0.f ? 0.f : (c[i]>1.f ? 1.f : c[i]);rgba|=((unsigned int)(v*255.f+0.5f))<<(8*i);}
+    return rgba;
+}
+static __inline void Teapot_Helper_UnpackColor(unsigned int rgba,float color4Out[4]) {int i;for (i=0;i<4;i++) color4Out[i]=(float)((rgba>>(8*i))&0xFF)*(1.f/255.f);}
+void Teapot_Scene_SetMMatrix(Teapot_Scene* scene,int index,const tpoat* mMatrix16);
+static __inline void Teapot_Scene_SetMeshId(Teapot_Scene* scene,int index,TeapotMeshEnum meshId) {scene->meshIds[index]=(unsigned char)meshId;}
+static __inline void Teapot_Scene_SetScaling(Teapot_Scene* scene,int index,float scalingX,float scalingY,float scalingZ) {float* s=&scene->scalings[3*index];s[0]=scalingX;s[1]=scalingY;s[2]=scalingZ;}
+static __inline void Teapot_Scene_SetColor(Teapot_Scene* scene,int index,float R,float G,float B,float A) {scene->colors[index]=Teapot_Helper_PackColor(R,G,B,A);}
+static __inline void Teapot_Scene_SetActive(Teapot_Scene* scene,int index,int active) {if (active) scene->flags[index]|=TEAPOT_SCENE_FLAG_ACTIVE;else scene->flags[index]&=~TEAPOT_SCENE_FLAG_ACTIVE;}
+static __inline void Teapot_Scene_SetOutlineEnabled(Teapot_Scene* scene,int index,int outlineEnabled) {if (outlineEnabled) scene->flags[index]|=TEAPOT_SCENE_FLAG_OUTLINE;else scene->flags[index]&=~TEAPOT_SCENE_FLAG_OUTLINE;}
+void Teapot_Scene_CalculateMvMatrices(Teapot_Scene* scene);    // From mMatrices (called internally by Teapot_DrawScene(...)). It calculates TEAPOT_SCENE_FLAG_VISIBLE and nCoefficients too (in parallel when TEAPOT_USE_OPENMP is defined).
+void Teapot_DrawScene(Teapot_Scene* scene,int mustSortObjectsForTransparency);     // Same as Teapot_DrawMulti(...), but for a Teapot_Scene (the scene arrays are not reordered when sorting)
+void Teapot_DrawScene_Mv(const Teapot_Scene* scene,int mustSortObjectsForTransparency); // Same as above, but use it only if you set or calculate all the mvMatrices manually
+
+// Teapot_Bvh: an optional bounding volume hierarchy of the world space aabbs of a Teapot_MeshData** array (built with binned SAH), that speeds up picking and frustum culling of large arrays
+#ifndef TEAPOT_BVH_MAX_LEAF_SIZE
+#define TEAPOT_BVH_MAX_LEAF_SIZE (4)    // max number of objects in a leaf node
+#endif
+#ifndef TEAPOT_BVH_NUM_BINS
+#define TEAPOT_BVH_NUM_BINS (16)        // number of SAH bins per axis
+#endif
+typedef struct {
+    tpoat aabbMin[3],aabbMax[3];    // world space
+    int start;  // leaf: first item in Teapot_Bvh::items; inner node: index of the first child node (the second one is start+1)
+    int count;  // number of items (0 for inner nodes)
+} Teapot_BvhNode;
+typedef struct {
+    Teapot_BvhNode* nodes;      // nodes[0] is the root (a child node always follows its parent)
+    int numNodes;
+    int* items;                 // object indices (in the array used to build the hierarchy), grouped by leaf
+    tpoat* itemAabbs;           // world space aabbMin[3] and aabbMax[3] of items[i] (6 per item)
+    int numItems;
+    int capacity;
+} Teapot_Bvh;
+void Teapot_Bvh_Init(Teapot_Bvh* bvh);
+void Teapot_Bvh_Destroy(Teapot_Bvh* bvh);
+int Teapot_Bvh_Build(Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,int numMeshes);   // From Teapot_MeshData::mMatrix, meshId and scaling (inactive meshes are included too). Returns 0 when out of memory
+void Teapot_Bvh_Refit(Teapot_Bvh* bvh,Teapot_MeshData* const* meshes);  // Updates the bounds after some Teapot_MeshData::mMatrix (or scaling) changed: 'meshes' must be the same array passed to Teapot_Bvh_Build(...). Much cheaper than a rebuild, but the hierarchy degrades when objects move far away from their starting places
+Teapot_MeshData* Teapot_Bvh_GetMeshUnderMouseFromRay(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut);  // Same as Teapot_MeshData_GetMeshUnderMouseFromRay(...) (ray in world space)
+Teapot_MeshData* Teapot_Bvh_GetMeshUnderMouse(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,int mouseX,int mouseY,const int* viewport4,tpoat* pOptionalDistanceOut);
+// Generic versions (see Teapot_Helper_GetMeshUnderMouseFromRayGeneric(...)): Teapot_Bvh_Refit(...) can't be used (just call Teapot_Bvh_BuildGeneric(...) again)
+int Teapot_Bvh_BuildGeneric(Teapot_Bvh* bvh,int numMeshes,void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData),void* userData);
+int Teapot_Bvh_GetMeshUnderMouseFromRayGeneric(const Teapot_Bvh* bvh,void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData),const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut,void* userData);
+#ifdef TEAPOT_ENABLE_EXACT_PICKING
+int Teapot_Bvh_RaycastExact(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat* rayOrigin3,const tpoat* rayDir3,Teapot_RaycastHit* hitOut);    // Same as Teapot_MeshData_RaycastExact(...)
+#endif //TEAPOT_ENABLE_EXACT_PICKING
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+// Same as Teapot_CullMulti(...), but it traverses the hierarchy, and the world space 'frustumPlanes' come from a vpMatrix (NULL: pMatrix*vMatrix). Objects are tested by their world space aabb (so a few objects might get a different result).
+int Teapot_Bvh_CullMulti(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat frustumPlanes[6][4]/*=NULL*/,int* visibleIndicesOut/*=NULL*/);
+void Teapot_Bvh_DrawMulti(const Teapot_Bvh* bvh,Teapot_MeshData** meshes,int mustSortObjectsForTransparency);   // Same as Teapot_DrawMulti(...) with the array used to build 'bvh', but culled objects skip the transform stage too
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
 
 //----------------------------------------------------------------------------------------
 void Teapot_PostDraw(void); // unsets program and buffers for drawing
+#ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+void Teapot_Enable_VertexArrayObjects(void);    // (default) Call it outside Teapot_PreDraw()/Teapot_PostDraw()
+void Teapot_Disable_VertexArrayObjects(void);   // Call it outside Teapot_PreDraw()/Teapot_PostDraw()
+int Teapot_Get_VertexArrayObjects_Enabled(void);
+#endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
 //----------------------------------------------------------------------------------------
 
 void Teapot_GetMeshAabbCenter(TeapotMeshEnum meshId,float center[3]);
@@ -340,12 +536,55 @@ int Teapot_Get_ColorMaterial_Enabled(void);    // returns 0 or 1
     with values derived from R,G,B,A.
 */
 
+#ifdef TEAPOT_ENABLE_INSTANCING
+void Teapot_Enable_Instancing(void);        // (default) Teapot_DrawMulti(...) and Teapot_DrawMulti_Mv(...) draw their opaque, non-outlined meshes (but TEAPOT_MESH_CAPSULE and TEAPOT_MESH_PIVOT3D) with one glDrawElementsInstanced(...) per meshId (before all the other meshes).
+                                            // Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...) draws all its shadow casters with one glDrawElementsInstanced(...) per (simplified) meshId and LOD.
+void Teapot_Disable_Instancing(void);
+int Teapot_Get_Instancing_Enabled(void);    // returns 0 or 1 (0 if the instanced shader program could not be created)
+#endif //TEAPOT_ENABLE_INSTANCING
+
+#ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+void Teapot_Enable_PersistentRingBuffer(void);  // (default) Call it outside Teapot_PreDraw()/Teapot_PostDraw()
+void Teapot_Disable_PersistentRingBuffer(void); // Frees the ring buffer: the instance buffer is orphaned every pass. Call it outside Teapot_PreDraw()/Teapot_PostDraw()
+int Teapot_Get_PersistentRingBuffer_Enabled(void);  // returns 0 or 1 (0 if glBufferStorage(...) is not available)
+void Teapot_Get_PersistentRingBuffer_Counters(unsigned* numSectionSwitchesOut,unsigned* numStallsOut);  // Since Teapot_Init(): the times the ring buffer moved to its next section, and the times it had to wait for the GPU to release it
+#endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+
+#ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+void Teapot_Enable_DepthPrepass(void);      // (default) Teapot_DrawMulti(...) and Teapot_DrawMulti_Mv(...) write the depth of their visible, opaque, non-outlined meshes (but TEAPOT_MESH_CAPSULE, TEAPOT_MESH_PIVOT3D and the instanced meshes) first, and then shade them with glDepthFunc(GL_EQUAL). The other meshes use the current glDepthFunc(...).
+void Teapot_Disable_DepthPrepass(void);
+int Teapot_Get_DepthPrepass_Enabled(void);  // returns 0 or 1 (0 if the depth shader program could not be created)
+#endif //TEAPOT_ENABLE_DEPTH_PREPASS
+
+#ifdef TEAPOT_ENABLE_STATE_CACHE
+void Teapot_Invalidate_StateCache(void);    // Call it if, between Teapot_PreDraw() and Teapot_PostDraw(), you change the GL program, GL_ARRAY_BUFFER, GL_BLEND, GL_POLYGON_OFFSET_FILL, glFrontFace(...), glDepthMask(...) or the teapot.h uniforms yourself
+void Teapot_Get_StateCache_Counters(unsigned* numIssuedGLCallsOut,unsigned* numElidedGLCallsOut);  // Number of GL calls (program, buffer, enable and uniform calls) issued and skipped by the state cache since Teapot_Init() or Teapot_Reset_StateCache_Counters()
+void Teapot_Reset_StateCache_Counters(void);
+#endif //TEAPOT_ENABLE_STATE_CACHE
+
+#ifdef TEAPOT_ENABLE_MESH_LODS
+#ifndef TEAPOT_NUM_MESH_LODS
+#define TEAPOT_NUM_MESH_LODS (4)
+#endif //TEAPOT_NUM_MESH_LODS
+void Teapot_Set_MeshLod_Thresholds(const float thresholds[TEAPOT_NUM_MESH_LODS-1]);  // Must be called after Teapot_Init(). LOD i+1 is used when the projected radius of the mesh (1.0 = half the viewport height) is smaller than thresholds[i] (decreasing values). Defaults are 0.2f,0.08f,0.03f (all zeros disable the LODs)
+void Teapot_Get_MeshLod_Thresholds(float thresholdsOut[TEAPOT_NUM_MESH_LODS-1]);
+int Teapot_Get_MeshLod_NumLevels(TeapotMeshEnum meshId);   // 1 + the number of simplified LODs of meshId (small meshes and GL_LINES meshes have none)
+int Teapot_Get_MeshLod_NumTriangles(TeapotMeshEnum meshId,int lod);
+#endif //TEAPOT_ENABLE_MESH_LODS
+
+#ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+void Teapot_Get_VertexCache_ACMR(TeapotMeshEnum meshId,float* acmrBeforeOut,float* acmrAfterOut);   // Average cache miss ratio (processed vertices per triangle, from 0.5 to 3.0) of meshId, before and after the optimization, simulated with a FIFO cache of TEAPOT_VERTEX_CACHE_SIZE entries. Zero for GL_LINES meshes.
+#endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+
 void Teapot_Enable_MeshOutline(void);       // Needs glEnable(GL_CULL_FACE). Adds an outline around the mesh.
 void Teapot_Disable_MeshOutline(void);
 int Teapot_Get_MeshOutline_Enabled(void);    // returns 0 or 1
 void Teapot_Set_MeshOutline_Color(float R,float G, float B, float A);	// A<1.0 requires glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); and glEnable(GL_BLEND); to make transparency work
 void Teapot_Set_MeshOutline_Scaling(float scalingGreaterOrEqualThanOne);    // default is 1.015f
 void Teapot_Set_MeshOutline_Params(float polygonOffsetSlope, float polygonOffsetConstant);  // defaults are -1.f, -250.f
+void Teapot_Enable_MeshOutlinePass(void);   // (default) Teapot_DrawMulti(...) and Teapot_DrawMulti_Mv(...) draw the outlines of their opaque meshes in a single pass (setting the outline state once, and with instancing when available), instead of before every mesh
+void Teapot_Disable_MeshOutlinePass(void);
+int Teapot_Get_MeshOutlinePass_Enabled(void);
 
 static __inline tpoat* Teapot_Helper_IdentityMatrix(tpoat* __restrict result16) {tpoat* m = result16;m[0]=m[5]=m[10]=m[15]=1;m[1]=m[2]=m[3]=m[4]=m[6]=m[7]=m[8]=m[9]=m[11]=m[12]=m[13]=m[14]=0;return result16;}
 static __inline tpoat* Teapot_Helper_IdentityMatrix3x3(tpoat* __restrict result9) {tpoat* m = result9;m[0]=m[4]=m[8]=1;m[1]=m[2]=m[3]=m[5]=m[6]=m[7]==0;return result9;}
@@ -434,6 +673,10 @@ void Teapot_Helper_InvertTransformMatrixXZAxisInPlace(tpoat* __restrict m16);
 tpoat* Teapot_Helper_InvertTransformMatrixXZAxis(tpoat* __restrict mOut16,const tpoat* __restrict m16);
 void Teapot_Helper_GetFrustumPlaneEquations(tpoat planeEquationsOut[6][4],const tpoat* __restrict vpMatrix16,int normalizePlanes);
 void Teapot_Helper_GetFrustumPoints(tpoat frustumPoints[8][4],const tpoat* __restrict vpMatrixInverse16);   // frustumPoints[i][3]==1
+// Shadow casters that can shadow the camera frustum lie inside the camera frustum extruded towards the light (along -normalizedLightDirection3, the same arg of Teapot_Helper_GetLightViewProjectionMatrix(...)).
+// Fills 'planeEquationsOut' with the (not normalized, inward) planes of this convex volume in world space and returns their number (0 if 'cameraVpMatrix16' can't be inverted).
+#define TEAPOT_MAX_SHADOW_CASTER_CULLING_PLANES (18)    // (6 faces + 12 edges: usually much less are used)
+int Teapot_Helper_GetShadowCasterCullingPlanes(tpoat planeEquationsOut[TEAPOT_MAX_SHADOW_CASTER_CULLING_PLANES][4],const tpoat* __restrict cameraVpMatrix16,const tpoat* __restrict normalizedLightDirection3);
 
 // returns the frustum radius (by value) and the scalar (positive) distance from the the camera eye to the frustum center (by 'pFrustumCenterDistanceOut').
 // 'cameraTargetDistanceForUnstableOrtho3DModeOnly_or_zero': the arg name is correct when the result is passed to 'Teapot_Helper_GetLightViewProjectionMatrix' functions.
@@ -541,6 +784,7 @@ void Teapot_LowLevel_BindShaderProgram(void);
 void Teapot_LowLevel_StartDisablingLighting(void);      // Use Teapot_SetAmbientColor() to set the color then (but ALPHA is still set through last call to Teapot_SetColor(...))
 void Teapot_LowLevel_SetMvMatrixUniform(const tpoat mvMatrix[16]);   // This just sets the uniform matrix
 void Teapot_LowLevel_SetMvMatrixUniformFloat(const float mvMatrix[16]); // Same as above, but enforces single precision
+void Teapot_LowLevel_SetMeshUniforms(TeapotMeshEnum meshId);   // Sets the per-mesh uniforms of the teapot.h shader program (palette params of multi-material meshes, dequantization with TEAPOT_ENABLE_VERTEX_QUANTIZATION). Call it before Teapot_LowLevel_DrawElements(...) only when the teapot.h shader program is bound
 void Teapot_LowLevel_DrawElements(TeapotMeshEnum meshId);   // This just calls glDrawElements(...)
 void Teapot_LowLevel_StopDisablingLighting(void);
 
@@ -561,10 +805,24 @@ int Teapot_Helper_LowLevel_IsAABBVisible(const tpoat frustumPlanes[6][4],const t
 void Teapot_HiLevel_DrawMulti_ShadowMap_Vp(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16, float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData)/*=NULL*/,void* userData/*=NULL*/);
 // Not always faster (overhead + no BVH). Anyway use: Teapot_Helper_GetFrustumPlaneEquations(vpMatrixFrustumPlaneEquations,lvpMatrix16,0);
 void Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithFrustumCulling(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16, const tpoat lvpMatrixFrustumPlaneEquations[6][4], float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData)/*=NULL*/,void* userData/*=NULL*/);
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+// Like Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithFrustumCulling(...), but the casters (4 at once) must also be inside 'casterCullingPlanes' (usually the camera frustum extruded towards the light: see Teapot_Helper_GetShadowCasterCullingPlanes(...)),
+// so that casters that can't shadow anything visible are not drawn. Casters cached by TEAPOT_ENABLE_STATIC_SHADOW_CACHE are never culled (culling them would just invalidate the cache).
+void Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithCasterCulling(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16, const tpoat lvpMatrixFrustumPlaneEquations[6][4], const tpoat casterCullingPlanes[][4], int numCasterCullingPlanes, float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData)/*=NULL*/,void* userData/*=NULL*/);
+// Stats of the last call above: number of tested casters (capsules and text meshes are never tested), and number of them outside the light frustum, outside 'casterCullingPlanes' and outside any of the two (i.e. not drawn). All args can be NULL.
+void Teapot_Get_ShadowCasterCulling_Counters(int* numTestedOut,int* numCulledByLightFrustumOut,int* numCulledByCasterCullingPlanesOut,int* numCulledOut);
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
 static __inline void Teapot_HiLevel_DrawMulti_ShadowMap(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lpMatrix16, const tpoat* lvMatrix16, float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData)/*=NULL*/,void* userData/*=NULL*/) {
     tpoat lpvMatrix16[16];Teapot_Helper_MultMatrix(lpvMatrix16,lpMatrix16,lvMatrix16);
     Teapot_HiLevel_DrawMulti_ShadowMap_Vp(pMeshData,numMeshData,lpvMatrix16,transparent_threshold,optionalAdditionalObjectsCallback,userData);
 }
+#ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+void Teapot_Enable_StaticShadowCache(void);     // (default) the functions above draw the Teapot_MeshData::staticShadowCaster meshes only when the cache is out of date (optionalAdditionalObjectsCallback is always called)
+void Teapot_Disable_StaticShadowCache(void);
+int Teapot_Get_StaticShadowCache_Enabled(void);
+void Teapot_Invalidate_StaticShadowCache(void); // The cache is invalidated automatically when a static caster changes (mMatrix, scaling, meshId, active and color[3]), when the shadow map viewport or 'transparent_threshold' change, and when 'lvpMatrix16' changes beyond the thresholds below.
+void Teapot_Set_StaticShadowCache_LvpMatrixThreshold(float depthThreshold); // 'lvpMatrix16' translations below a quarter of a shadow map texel are ignored (Teapot_Helper_GetLightViewProjectionMatrix(...) snaps them to texels), and so are depth offsets below 'depthThreshold' (in NDC, default 0.0005: static casters may get this additional bias). Rotations are never ignored.
+#endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
 #endif
 #endif
 
@@ -598,8 +856,27 @@ static __inline void Teapot_HiLevel_DrawMulti_ShadowMap(Teapot_MeshData* const*
 #include <math.h>   // sqrt
 #include <stdlib.h> // qsort
 #include <string.h> // memcpy
+#ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+#   define TEAPOT_RING_BUFFER_NUM_SECTIONS (3)  // triple buffering
+#   ifndef TEAPOT_RING_BUFFER_MIN_SECTION_SIZE
+#       define TEAPOT_RING_BUFFER_MIN_SECTION_SIZE (262144)
+#   endif //TEAPOT_RING_BUFFER_MIN_SECTION_SIZE
+#endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+#ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+#   include <stdio.h>  // fopen
+#   include <time.h>   // clock
+#   ifndef TEAPOT_PROGRAM_BINARY_CACHE_PATH
+#       define TEAPOT_PROGRAM_BINARY_CACHE_PATH "teapot_program_"
+#   endif //TEAPOT_PROGRAM_BINARY_CACHE_PATH
+#endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
 #ifdef TEAPOT_USE_OPENMP
 #include <omp.h>
+#   ifndef TEAPOT_OPENMP_CHUNK_SIZE
+#       define TEAPOT_OPENMP_CHUNK_SIZE (64)
+#   endif //TEAPOT_OPENMP_CHUNK_SIZE
+#   ifndef TEAPOT_OPENMP_MIN_NUM_MESHES
+#       define TEAPOT_OPENMP_MIN_NUM_MESHES (2048)
+#   endif //TEAPOT_OPENMP_MIN_NUM_MESHES
 #endif //TEAPOT_USE_OPENMP
 
 #ifndef TEAPOT_SHADER_SHADOW_MAP_PCF
@@ -617,6 +894,47 @@ static __inline void Teapot_HiLevel_DrawMulti_ShadowMap(Teapot_MeshData* const*
 #   define XSTR_MACRO(s) STR_MACRO(s)
 #endif //XSTR_MACRO
 
+#define TEAPOT_VERTEX_NUM_FLOATS (7)            // interleaved VBO: position (3) + normal (3) + material (1)
+#define TEAPOT_NUM_USER_MESHES (TEAPOT_MESH_CUBE-TEAPOT_MESH_USER_00)
+#ifndef TEAPOT_ENABLE_MESH_LODS
+#undef TEAPOT_NUM_MESH_LODS
+#define TEAPOT_NUM_MESH_LODS (1)                // just the full mesh
+#endif //TEAPOT_ENABLE_MESH_LODS
+#ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+#define TEAPOT_QVERTEX_NUM_SHORTS (6)           // quantized VBO: position (3) + octahedral normal (2) + material (1)
+#endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+#define TEAPOT_MATERIAL_PALETTE_SIZE 10         // (a plain number: it's stringified in the shader)
+
+// Colors of the fixed parts of the multi-material meshes (entry 0 is unused: material 0 means Teapot_SetColor(...))
+static const float TeapotMaterialPalette[TEAPOT_MATERIAL_PALETTE_SIZE][4] = {
+    {0.f,0.f,0.f,1.f},
+    {0.074895f,0.62175f,0.64f,1.f},             // 1 car glass
+    {0.f,0.f,0.f,1.f},                          // 2 car black
+    {0.02f,0.02f,0.02f,1.f},                    // 3 black
+    {0.740000f,0.562612f,0.399372f,1.f},        // 4 skin
+    {0.9f,0.9f,0.9f,1.f},                       // 5 white
+    {0.9f,0.9f,0.f,1.f},                        // 6 yellow
+    {0.875f,0.f,0.f,1.f},                       // 7 pivot X (unlit)
+    {0.f,0.875f,0.f,1.f},                       // 8 pivot Y (unlit)
+    {0.f,0.f,0.875f,1.f}                        // 9 pivot Z (unlit)
+};
+// Consecutive index ranges of the multi-material meshes, each with its material
+typedef struct {
+    int meshId;
+    int numParts;
+    int numInds[4];
+    unsigned char materials[4];
+} Teapot_MultiMaterialMesh;
+static const Teapot_MultiMaterialMesh TeapotMultiMaterialMeshes[] = {
+    {TEAPOT_MESH_CAR,           3, {156,24,564,0},  {0,1,2,0}},     // Chassis, Glass, Black+Wheels (wheels are the last 360 inds)
+    {TEAPOT_MESH_CHARACTER,     3, {327,216,183,0}, {0,3,4,0}},     // Outfit, Black, Skin
+    {TEAPOT_MESH_GHOST,         3, {558,48,24,0},   {0,5,3,0}},     // Color, White, Black
+    {TEAPOT_MESH_FLIPPER_RIGHT, 2, {384,180,0,0},   {0,5,0,0}},     // Rubber, White
+    {TEAPOT_MESH_FLIPPER_LEFT,  2, {384,180,0,0},   {0,5,0,0}},     // Rubber, White
+    {TEAPOT_MESH_SLEDGE,        2, {68*3,144*3,0,0},{0,6,0,0}},
+    {TEAPOT_MESH_PIVOT3D,       4, {90,72,72,72},   {0,7,8,9}}      // Center, ArrowX, ArrowY, ArrowZ
+};
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -661,17 +979,46 @@ static const char* TeapotVS[] = {
     "#ifdef GL_ES\n"
     "precision highp float;\n"
     "#endif\n"
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
     "attribute vec4 a_vertex;\n"
     "attribute vec3 a_normal;\n"
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec3 a_qvertex;\n"     // int16: a_vertex = u_dequantization[0] + a_qvertex*u_dequantization[1]
+    "attribute vec2 a_qnormal;\n"     // int16 octahedral encoding
+    "uniform vec4 u_dequantization[2];\n"
+    "vec4 q_vertex;\n"
+    "vec3 q_normal;\n"
+    "#define a_vertex q_vertex\n"
+    "#define a_normal q_normal\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute float a_material;\n"   // 0 = u_colorData, >0 = u_palette[a_material] (used by multi-material meshes, like TEAPOT_MESH_CAR)
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    "#ifdef TEAPOT_INSTANCING\n"     // per-instance attributes (used by the instanced path of Teapot_DrawMulti_Mv(...))
+    "attribute vec4 a_mvMatrix0;\n"
+    "attribute vec4 a_mvMatrix1;\n"
+    "attribute vec4 a_mvMatrix2;\n"
+    "attribute vec4 a_mvMatrix3;\n"
+    "attribute vec4 a_scaling;\n"
+    "attribute vec4 a_colorData0;\n"
+    "attribute vec4 a_colorData1;\n"
+#   ifdef TEAPOT_SHADER_SPECULAR
+    "attribute vec4 a_colorData2;\n"
+    "#define u_colorSpecular a_colorData2\n"
+#   endif //TEAPOT_SHADER_SPECULAR
+    "mat4 i_mvMatrix;\n"
+    "#define u_mvMatrix i_mvMatrix\n"
+    "#define u_scaling a_scaling\n"
+    "#define u_color a_colorData0\n"
+    "#define u_colorAmbient a_colorData1\n"
+    "#else //TEAPOT_INSTANCING\n"
+#   endif //TEAPOT_ENABLE_INSTANCING
     "uniform mat4 u_mvMatrix;\n"
-    "uniform mat4 u_pMatrix;\n"
 #   ifdef TEAPOT_SHADER_USE_ACCURATE_NORMALS
 #       ifndef TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU
     "   uniform vec3 u_nCoefficients;\n"
 #       endif
 #   endif //TEAPOT_SHADER_USE_ACCURATE_NORMALS
     "uniform vec4 u_scaling;\n"
-    "uniform vec3 u_lightVector;\n"
 #   ifndef TEAPOT_SHADER_SPECULAR
     "uniform vec4 u_colorData[2];\n"   // RGBA diffuse + RGBA ambient
 #   else //TEAPOT_SHADER_SPECULAR
@@ -680,6 +1027,13 @@ static const char* TeapotVS[] = {
 #   endif //TEAPOT_SHADER_SPECULAR
     "#define u_color u_colorData[0]\n"
     "#define u_colorAmbient u_colorData[1]\n"
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    "#endif //TEAPOT_INSTANCING\n"
+#   endif //TEAPOT_ENABLE_INSTANCING
+    "uniform mat4 u_pMatrix;\n"
+    "uniform vec3 u_lightVector;\n"
+    "uniform vec4 u_palette[" XSTR_MACRO(TEAPOT_MATERIAL_PALETTE_SIZE) "];\n"
+    "uniform vec4 u_materialParams;\n"   // x: palette enabled, y: palette ambient mix, z: palette ambient scale, w: palette specular mix
 #   ifdef TEAPOT_SHADER_FOG
     "uniform vec4 u_fogDistances;\n"
 #   ifndef TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
@@ -695,6 +1049,18 @@ static const char* TeapotVS[] = {
     "varying vec4 v_color;\n"
     "\n"
     "void main()	{\n"
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   q_vertex = vec4(u_dequantization[0].xyz + a_qvertex*u_dequantization[1].xyz,1.0);\n"
+    "   q_normal = vec3(a_qnormal*(1.0/32767.0),0.0);\n"
+    "   q_normal.z = 1.0-abs(q_normal.x)-abs(q_normal.y);\n"
+    "   if (q_normal.z<0.0) q_normal.xy = (1.0-abs(q_normal.yx))*vec2(q_normal.x>=0.0?1.0:-1.0,q_normal.y>=0.0?1.0:-1.0);\n"
+    "   q_normal = normalize(q_normal);\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    "#ifdef TEAPOT_INSTANCING\n"
+    "   i_mvMatrix = mat4(a_mvMatrix0,a_mvMatrix1,a_mvMatrix2,a_mvMatrix3);\n"
+    "#endif //TEAPOT_INSTANCING\n"
+#   endif //TEAPOT_ENABLE_INSTANCING
 #   ifndef TEAPOT_SHADER_USE_ACCURATE_NORMALS
 #       ifndef TEAPOT_SHADER_NORMALIZE_NORMALS
     "   vec3 normalEyeSpace = vec3(u_mvMatrix * vec4(a_normal, 0.0));\n"
@@ -703,30 +1069,67 @@ static const char* TeapotVS[] = {
 #       endif
 #   else //TEAPOT_SHADER_USE_ACCURATE_NORMALS
     // https://lxjk.github.io/2017/10/01/Stop-Using-Normal-Matrix.html
+    "#ifdef TEAPOT_NO_ACCURATE_NORMALS\n"   // runtime variant (see Teapot_SetShaderFeatures(...))
+#       ifndef TEAPOT_SHADER_NORMALIZE_NORMALS
+    "   vec3 normalEyeSpace = vec3(u_mvMatrix * vec4(a_normal, 0.0));\n"
+#       else
+    "   vec3 normalEyeSpace = normalize(vec3(u_mvMatrix * vec4(a_normal, 0.0)));\n"
+#       endif
+    "#else //TEAPOT_NO_ACCURATE_NORMALS\n"
 #       ifdef TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU
     "   vec3 u_nCoefficients=vec3(1.0/(dot(u_mvMatrix[0].xyz,u_mvMatrix[0].xyz)*u_scaling[0]),1.0/(dot(u_mvMatrix[1].xyz,u_mvMatrix[1].xyz)*u_scaling[1]),1.0/(dot(u_mvMatrix[2].xyz,u_mvMatrix[2].xyz)*u_scaling[2]));\n"
+#       elif defined(TEAPOT_ENABLE_INSTANCING)
+    "#ifdef TEAPOT_INSTANCING\n"  // no per-instance u_nCoefficients: we calculate them here
+    "   vec3 u_nCoefficients=vec3(1.0/(dot(u_mvMatrix[0].xyz,u_mvMatrix[0].xyz)*u_scaling[0]),1.0/(dot(u_mvMatrix[1].xyz,u_mvMatrix[1].xyz)*u_scaling[1]),1.0/(dot(u_mvMatrix[2].xyz,u_mvMatrix[2].xyz)*u_scaling[2]));\n"
+    "#endif //TEAPOT_INSTANCING\n"
 #       endif
     "   //vec3 normalEyeSpace = normalize(mat3(u_mvMatrix)*(a_normal*u_nCoefficients));\n"
     "   vec3 normalEyeSpace = normalize(vec3(u_mvMatrix * vec4(a_normal*u_nCoefficients, 0.0)));\n"
+    "#endif //TEAPOT_NO_ACCURATE_NORMALS\n"
 #   endif //TEAPOT_SHADER_USE_ACCURATE_NORMALS
     "   float fDot = max(0.0, dot(normalEyeSpace,u_lightVector));\n"
     "   vec4 vertexScaledWorldSpace = a_vertex * u_scaling;\n"
     "   vec4 vertexScaledEyeSpace = u_mvMatrix*vertexScaledWorldSpace;\n"
     "   //vertexScaledEyeSpace.xyz/vertexScaledEyeSpace.w;\n"                 // is this necessary ?
 #   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+#       ifdef TEAPOT_ENABLE_INSTANCING
+    "#ifdef TEAPOT_INSTANCING\n"  // here u_biasedShadowMvpMatrix is just TIS.biasedShadowVpMatrix (it already contains vMatrixInverse)
+    "   v_shadowCoord = u_biasedShadowMvpMatrix*vertexScaledEyeSpace;\n"
+    "#else //TEAPOT_INSTANCING\n"
+    "   v_shadowCoord = u_biasedShadowMvpMatrix*vertexScaledWorldSpace;\n"
+    "#endif //TEAPOT_INSTANCING\n"
+#       else //TEAPOT_ENABLE_INSTANCING
     "   v_shadowCoord = u_biasedShadowMvpMatrix*vertexScaledWorldSpace;\n"
+#       endif //TEAPOT_ENABLE_INSTANCING
     //"   v_shadowCoord = u_biasedShadowMvpMatrix*(u_mvMatrix*vertexScaledWorldSpace);\n"
 #   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+    "   vec3 diffuseColor = u_color.rgb;\n"
+    "   vec3 ambientColor = u_colorAmbient.rgb;\n"
+#   ifdef TEAPOT_SHADER_SPECULAR
+    "   vec3 specularColor = u_colorSpecular.rgb;\n"
+#   endif // TEAPOT_SHADER_SPECULAR
+    "   if (a_material>0.5 && u_materialParams.x>0.5) {\n"
+    "       diffuseColor = u_palette[int(a_material+0.5)].rgb;\n"
+    "       ambientColor = mix(ambientColor,diffuseColor*u_materialParams.z,u_materialParams.y);\n"
+#   ifdef TEAPOT_SHADER_SPECULAR
+    "       specularColor = mix(specularColor,diffuseColor*(0.8*u_color.a),u_materialParams.w);\n"
+#   endif // TEAPOT_SHADER_SPECULAR
+    "   }\n"
 #   ifndef TEAPOT_SHADER_SPECULAR
-    "   v_color = vec4(u_colorAmbient.rgb + u_color.rgb*(fDot*u_colorAmbient.a),u_color.a);\n"
+    "   v_color = vec4(ambientColor + diffuseColor*(fDot*u_colorAmbient.a),u_color.a);\n"
 #   else  // TEAPOT_SHADER_SPECULAR
+    "#ifdef TEAPOT_NO_SPECULAR\n"
+    "   v_color = vec4(ambientColor + diffuseColor*(fDot*u_colorAmbient.a),u_color.a);\n"
+    "#else //TEAPOT_NO_SPECULAR\n"
     "   vec3 E = normalize(-vertexScaledEyeSpace.xyz);\n"
     "   vec3 halfVector = normalize(u_lightVector + E);\n"
     "   float nxHalf = max(0.005,dot(normalEyeSpace, halfVector));\n"
-    "   vec3 specularColor = u_colorSpecular.rgb * pow(nxHalf,u_colorSpecular.a);\n"
-    "   v_color = vec4(u_colorAmbient.rgb + (u_color.rgb*fDot+specularColor.rgb)*u_colorAmbient.a,u_color.a);\n"
+    "   specularColor*=pow(nxHalf,u_colorSpecular.a);\n"
+    "   v_color = vec4(ambientColor + (diffuseColor*fDot+specularColor)*u_colorAmbient.a,u_color.a);\n"
+    "#endif //TEAPOT_NO_SPECULAR\n"
 #   endif // TEAPOT_SHADER_SPECULAR
 #   ifdef TEAPOT_SHADER_FOG
+    "#ifndef TEAPOT_NO_FOG\n"
 #   ifdef TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
     "  v_fog = \n"
 #   else //TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
@@ -737,6 +1140,7 @@ static const char* TeapotVS[] = {
 #   ifndef TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
     "  v_color.rgb = mix(v_color.rgb,u_fogColor.rgb,v_fog);\n"
 #   endif //TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
+    "#endif //TEAPOT_NO_FOG\n"
 #   endif //TEAPOT_SHADER_FOG
     "   gl_Position = u_pMatrix * vertexScaledEyeSpace;\n"
     "}\n"
@@ -785,6 +1189,7 @@ static const char* TeapotFS[] = {
     "void main() {\n"
     "float shadowFactor = 1.0;\n"
 #   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    "#ifndef TEAPOT_NO_SHADOW_MAP\n"
     "vec4 shadowCoordinateWdivide = v_shadowCoord/v_shadowCoord.w;\n"
     "\n"
 #       if (TEAPOT_SHADER_SHADOW_MAP_PCF<1)
@@ -793,6 +1198,9 @@ static const char* TeapotFS[] = {
     "       shadowFactor = shadow2D(u_shadowMap,vec3(shadowCoordinateWdivide.st,shadowCoordinateWdivide.z-u_shadowDarkening.x));\n"
     "       shadowFactor = u_shadowDarkening.y + (1.0-u_shadowDarkening.y)*shadowFactor;\n"
 #       else //TEAPOT_SHADER_SHADOW_MAP_PCF
+    "#ifdef TEAPOT_NO_SHADOW_MAP_PCF\n"   // single tap
+    "       shadowFactor = shadow2D(u_shadowMap,vec3(shadowCoordinateWdivide.st,shadowCoordinateWdivide.z-u_shadowDarkening.x));\n"
+    "#else //TEAPOT_NO_SHADOW_MAP_PCF\n"
     "       shadowFactor=0.0;\n"
     "       float biasedShadowCoordinateZ = shadowCoordinateWdivide.z-u_shadowDarkening.x;\n;"
 #           if (TEAPOT_SHADER_SHADOW_MAP_PCF== (TEAPOT_SHADER_SHADOW_MAP_PCF/2)*2)  // even
@@ -811,14 +1219,18 @@ static const char* TeapotFS[] = {
     "           }\n"
     "       }\n"
     "       shadowFactor/=float(TABSSQRT*TABSSQRT);\n"
+    "#endif //TEAPOT_NO_SHADOW_MAP_PCF\n"
     "       shadowFactor = u_shadowDarkening.y + (1.0-u_shadowDarkening.y)*shadowFactor;\n"
 #       endif //TEAPOT_SHADER_SHADOW_MAP_PCF
+    "#endif //TEAPOT_NO_SHADOW_MAP\n"
 #   endif //TEAPOT_SHADER_USE_SHADOW_MAP
 #   ifdef TEAPOT_SHADER_FOG
 #   ifdef TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
+    "#ifndef TEAPOT_NO_FOG\n"
     "   //float v_fog = 1.0 - (u_fogDistances.y-gl_FragCoord.z/gl_FragCoord.w)*u_fogDistances.w;\n" // Best quality but expensive...
     "   gl_FragColor = vec4(mix(v_color.rgb*shadowFactor,u_fogColor.rgb,v_fog).rgb,v_color.a);\n"
     "   return;\n"
+    "#endif //TEAPOT_NO_FOG\n"
 #   endif //TEAPOT_SHADER_FOG_HINT_FRAGMENT_SHADER
 #   endif //TEAPOT_SHADER_FOG
     "    gl_FragColor = vec4(v_color.rgb*shadowFactor,v_color.a);\n"
@@ -826,6 +1238,177 @@ static const char* TeapotFS[] = {
 };
 
 
+#ifdef TEAPOT_ENABLE_INSTANCING
+#   ifndef TEAPOT_SHADER_SPECULAR
+#       define TEAPOT_INSTANCE_NUM_VEC4 (7)   // mvMatrix (4 vec4) + scaling + color + colorAmbient
+#   else //TEAPOT_SHADER_SPECULAR
+#       define TEAPOT_INSTANCE_NUM_VEC4 (8)   // mvMatrix (4 vec4) + scaling + color + colorAmbient + colorSpecular
+#   endif //TEAPOT_SHADER_SPECULAR
+#   define TEAPOT_INSTANCE_NUM_FLOATS (TEAPOT_INSTANCE_NUM_VEC4*4)
+#endif //TEAPOT_ENABLE_INSTANCING
+#if (defined(DYNAMIC_RESOLUTION_H) && defined(TEAPOT_SHADER_USE_SHADOW_MAP) && !defined(DYNAMIC_RESOLUTION_SHADOW_MAP_DISABLED))
+#if ((defined(DYNAMIC_RESOLUTION_USE_DOUBLE_PRECISION) && defined(TEAPOT_USE_DOUBLE_PRECISION)) || (!defined(DYNAMIC_RESOLUTION_USE_DOUBLE_PRECISION) && !defined(TEAPOT_USE_DOUBLE_PRECISION)))
+#   ifdef TEAPOT_ENABLE_INSTANCING
+#       define TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS   // used by Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...)
+#       define TEAPOT_SHADOW_INSTANCE_NUM_FLOATS (16)   // mMatrix, with the scaling folded into its first 3 columns
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+#       define TEAPOT_PRIVATE_STATIC_SHADOW_CACHE     // used by Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...)
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+#endif
+#endif
+
+#ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+// Depth-only program used by the instanced path of Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...) (it replaces the dynamic_resolution.h shadow program)
+static const char* TeapotShadowInstancedVS[] = {
+#   if (defined(__EMSCRIPTEN__) && (TEAPOT_SHADER_SHADOW_MAP_PCF>0))
+    "#version 300 es\n"
+    "#define attribute in\n"
+#   endif //__EMSCRIPTEN__ && TEAPOT_SHADER_SHADOW_MAP_PCF
+    "#ifdef GL_ES\n"
+    "precision highp float;\n"
+    "#endif\n"
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec3 a_vertex;\n"
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec3 a_qvertex;\n"
+    "uniform vec4 u_dequantization[2];\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec4 a_mMatrix0;\n"    // per-instance
+    "attribute vec4 a_mMatrix1;\n"
+    "attribute vec4 a_mMatrix2;\n"
+    "attribute vec4 a_mMatrix3;\n"
+    "uniform mat4 u_lvpMatrix;\n"
+    "\n"
+    "void main()	{\n"
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   vec3 position = a_vertex;\n"
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   vec3 position = u_dequantization[0].xyz + a_qvertex*u_dequantization[1].xyz;\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   gl_Position = u_lvpMatrix*(mat4(a_mMatrix0,a_mMatrix1,a_mMatrix2,a_mMatrix3)*vec4(position,1.0));\n"
+    "}\n"
+};
+static const char* TeapotShadowInstancedFS[] = {
+#   if (defined(__EMSCRIPTEN__) && (TEAPOT_SHADER_SHADOW_MAP_PCF>0))
+    "#version 300 es\n"
+#   endif //__EMSCRIPTEN__ && TEAPOT_SHADER_SHADOW_MAP_PCF
+    "void main() {}\n"
+};
+#endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+#ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+// Position-only program of the depth prepass of Teapot_DrawMulti_Mv(...). gl_Position must be calculated exactly like in TeapotVS (the shaded pass uses glDepthFunc(GL_EQUAL))
+static const char* TeapotDepthVS[] = {
+    "#ifdef GL_ES\n"
+    "precision highp float;\n"
+    "#endif\n"
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec4 a_vertex;\n"
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "attribute vec3 a_qvertex;\n"
+    "uniform vec4 u_dequantization[2];\n"
+    "vec4 q_vertex;\n"
+    "#define a_vertex q_vertex\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "uniform mat4 u_mvMatrix;\n"
+    "uniform vec4 u_scaling;\n"
+    "uniform mat4 u_pMatrix;\n"
+    "\n"
+    "void main()	{\n"
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   q_vertex = vec4(u_dequantization[0].xyz + a_qvertex*u_dequantization[1].xyz,1.0);\n"
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    "   vec4 vertexScaledWorldSpace = a_vertex * u_scaling;\n"
+    "   vec4 vertexScaledEyeSpace = u_mvMatrix*vertexScaledWorldSpace;\n"
+    "   gl_Position = u_pMatrix * vertexScaledEyeSpace;\n"
+    "}\n"
+};
+static const char* TeapotDepthFS[] = {
+    "void main() {}\n"
+};
+#endif //TEAPOT_ENABLE_DEPTH_PREPASS
+// Per-object uniforms of TIS.programId (cached when TEAPOT_ENABLE_STATE_CACHE is defined)
+enum {
+    TEAPOT_UNIFORM_SLOT_MVMATRIX=0,
+    TEAPOT_UNIFORM_SLOT_SCALING,
+    TEAPOT_UNIFORM_SLOT_COLOR_DATA,             // 3 vec4: color, colorAmbient, colorSpecular
+    TEAPOT_UNIFORM_SLOT_NCOEFFICIENTS,
+    TEAPOT_UNIFORM_SLOT_BIASED_SHADOW_MVP_MATRIX,
+    TEAPOT_UNIFORM_SLOT_MATERIAL_PARAMS,
+    TEAPOT_UNIFORM_SLOT_DEQUANTIZATION,         // 2 vec4: offset, scale
+    TEAPOT_UNIFORM_SLOT_COUNT
+};
+// Vertex array objects (see Teapot_Private_BindVertexArray(...))
+enum {
+    TEAPOT_VAO_DRAW=0,                  // Teapot_PreDraw() layout
+    TEAPOT_VAO_INSTANCED,               // TIS.instancedProgramId (the instance attributes are pointed per bucket)
+    TEAPOT_VAO_DEPTH,                   // TIS.depthProgramId
+    TEAPOT_VAO_SHADOW_INSTANCED,        // TIS.shadowInstancedProgramId (the instance attributes are pointed per bucket)
+    TEAPOT_VAO_COUNT
+};
+#ifdef TEAPOT_ENABLE_STATE_CACHE
+typedef struct {
+    float value[16];
+    unsigned validMask;                         // one bit per vec4 of 'value'
+} Teapot_UniformSlot;
+typedef struct {
+    Teapot_UniformSlot uniforms[TEAPOT_UNIFORM_SLOT_COUNT];
+    // The bindings below are tracked only between Teapot_PreDraw() and Teapot_PostDraw() (-1 = unknown)
+    int bindingsValid;
+    GLint program,arrayBuffer;
+    GLint blendEnabled,polygonOffsetFillEnabled;
+    GLint frontFace,depthMask;
+    float polygonOffset[2];int polygonOffsetValid;
+    int instancedProgramUniformsDirty;
+    unsigned numIssuedGLCalls,numElidedGLCalls;
+} Teapot_StateCache;
+#endif //TEAPOT_ENABLE_STATE_CACHE
+
+// CPU copy of TIS.vertexBuffer and TIS.elementBuffer (needed to grow them when user meshes are added after Teapot_Init(...))
+typedef struct {
+    float* verts;                       // TEAPOT_VERTEX_NUM_FLOATS floats per vertex
+    unsigned char* inds;                // 16-bit or 32-bit indices, depending on the mesh (see TIS.indsType)
+    size_t maxVerts,maxIndsBytes;       // capacity of both the CPU copy and the GL buffers
+    size_t numFixedVerts,numFixedIndsBytes; // embedded meshes: user meshes are sub-allocated after them
+    size_t userStartVerts[TEAPOT_NUM_USER_MESHES],userNumVerts[TEAPOT_NUM_USER_MESHES];
+    size_t userStartIndsBytes[TEAPOT_NUM_USER_MESHES],userNumIndsBytes[TEAPOT_NUM_USER_MESHES];
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    short* qverts;                      // what's actually uploaded: TEAPOT_QVERTEX_NUM_SHORTS shorts per vertex
+    size_t maxQVerts;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+} Teapot_MeshBuffer;
+
+// Teapot_Private_RayObbIntersection(...) setup of a mesh, done once per Teapot_MeshData_RaycastBatch(...) call
+typedef struct {
+    tpoat axis[3][3];           // normalized
+    tpoat aabbMin[3],aabbMax[3];// (scaled by the length of the axes)
+    tpoat center[3];
+    Teapot_MeshData* md;
+} Teapot_Private_PickingObb;
+
+#ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+// Depth of the static shadow casters, copied into the shadow map by Teapot_HiLevel_DrawMulti_ShadowMap_Vp(...)
+typedef struct {
+    int enabled,valid;
+    GLuint frameBuffer,depthBuffer;
+    int bufferWidth,bufferHeight;   // of depthBuffer (the size of the shadow map texture)
+    int width,height;               // of the shadow map viewport (it changes with dynamic resolution)
+    tpoat lvpMatrix[16];
+    unsigned long long hash;        // of the static casters (see Teapot_Private_HashStaticShadowCasters(...))
+    float transparentThreshold;
+    int frustumCulling;
+    float depthThreshold;
+} Teapot_Private_StaticShadowCache;
+#endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+
+#ifdef TEAPOT_ENABLE_EXACT_PICKING
+// Hierarchy over the triangles of a mesh (in mesh space): built at Teapot_Init() from TIS.meshBuffer
+typedef struct {
+    Teapot_Bvh bvh;     // items are triangle indices (-1 for padding): every leaf starts at a multiple of 4 (itemAabbs is freed after the build)
+    float* tris;        // 36 floats every 4 items: v0[3], edge1[3] and edge2[3] of the 4 triangles (SoA, as needed by Teapot_Private_RayTriangles4(...))
+} Teapot_MeshTriBvh;
+#endif //TEAPOT_ENABLE_EXACT_PICKING
+
 typedef struct {
     float color[4];
     float colorAmbient[4];
@@ -835,13 +1418,31 @@ typedef struct {
     GLuint vertexBuffer,elementBuffer;
     int startInds[TEAPOT_MESH_COUNT];
     int numInds[TEAPOT_MESH_COUNT];
+    GLenum indsType[TEAPOT_MESH_COUNT];     // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    size_t indsOffset[TEAPOT_MESH_COUNT];   // in bytes
+    Teapot_MeshBuffer meshBuffer;
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    int lodNumInds[TEAPOT_MESH_COUNT][TEAPOT_NUM_MESH_LODS];        // [meshId][0] is unused (it's numInds[meshId]). Zero when the LOD is not available.
+    size_t lodIndsOffset[TEAPOT_MESH_COUNT][TEAPOT_NUM_MESH_LODS];  // in bytes (the index type is indsType[meshId])
+    float lodThresholds[TEAPOT_NUM_MESH_LODS-1];
+#   endif //TEAPOT_ENABLE_MESH_LODS
+#   ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+    float acmr[TEAPOT_MESH_COUNT][2];   // before and after the optimization
+#   endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+#   ifdef TEAPOT_ENABLE_EXACT_PICKING
+    Teapot_MeshTriBvh triBvhs[TEAPOT_MESH_COUNT];
+#   endif //TEAPOT_ENABLE_EXACT_PICKING
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    float dequantization[TEAPOT_MESH_COUNT][2][4];  // u_dequantization: offset and scale of the int16 positions
+    GLint uLoc_dequantization;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
     float halfExtents[TEAPOT_MESH_COUNT][3];
     float centerPoint[TEAPOT_MESH_COUNT][3];
     float aabbMin[TEAPOT_MESH_COUNT][3];
     float aabbMax[TEAPOT_MESH_COUNT][3];
-    GLint aLoc_vertex,aLoc_normal;
+    GLint aLoc_vertex,aLoc_normal,aLoc_material;
     GLint uLoc_mvMatrix,uLoc_pMatrix,uLoc_nCoefficients,uLoc_scaling,
-    uLoc_lightVector;
+    uLoc_lightVector,uLoc_palette,uLoc_materialParams;
     GLint uLoc_color,uLoc_colorAmbient,uLoc_colorSpecular;
     GLint uLoc_fogColor,uLoc_fogDistances,
     uLoc_biasedShadowMvpMatrix,uLoc_shadowMap,uLoc_shadowDarkening,uLoc_shadowMapFactor,uLoc_shadowMapTexelIncrement;
@@ -859,15 +1460,238 @@ typedef struct {
 
     int colorMaterialEnabled;
     int meshOutlineEnabled;
+    int meshOutlinePassEnabled;
     float colorMeshOutline[4];
     float scalingMeshOutline;
     float polygonOffsetSlope;
     float polygonOffsetConstant;
+
+    float fogColor[3],fogDistances[4];
+    float shadowMapFactor,shadowMapTexelIncrement[2];
+
+    int shaderFeatures;                                     // see Teapot_SetShaderFeatures(...)
+    GLuint shaderVariants[TEAPOT_SHADER_FEATURE_ALL+1];     // programId of every shader feature combination (0 = not compiled yet)
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    GLuint instancedShaderVariants[TEAPOT_SHADER_FEATURE_ALL+1];
+#   endif //TEAPOT_ENABLE_INSTANCING
+
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    GLuint instancedProgramId;
+    GLuint instanceBuffer;
+    int instanceBufferCapacity;         // in number of instances
+    float* instanceData;                // CPU-side per-instance stream (TEAPOT_INSTANCE_NUM_FLOATS per instance)
+    int instanceDataCapacity;           // in number of instances
+    int instancingEnabled;
+    GLint aLoc_instVertex,aLoc_instNormal,aLoc_instMaterial;
+    GLint aLoc_instData[TEAPOT_INSTANCE_NUM_VEC4];    // 4 x mvMatrix columns, scaling, color, colorAmbient [, colorSpecular]
+    GLint instLoc_pMatrix,instLoc_lightVector,instLoc_materialParams,instLoc_fogColor,instLoc_fogDistances,
+    instLoc_biasedShadowVpMatrix,instLoc_shadowMap,instLoc_shadowDarkening,instLoc_shadowMapFactor,instLoc_shadowMapTexelIncrement;
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    GLint instLoc_dequantization;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+#   ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    GLuint shadowInstancedProgramId;    // shares TIS.instanceBuffer and the instance stream
+    GLint aLoc_shadowInstVertex,aLoc_shadowInstMMatrix[4];
+    GLint shadowInstLoc_lvpMatrix,shadowInstLoc_dequantization;
+#   endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+#   ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    // When ringBufferMapped!=NULL, TIS.instanceBuffer is a persistently mapped ring of TEAPOT_RING_BUFFER_NUM_SECTIONS sections (see Teapot_Private_BeginInstanceStream(...))
+    unsigned char* ringBufferMapped;
+    size_t ringBufferSectionSize;       // in bytes
+    size_t ringBufferOffset;            // write head (in bytes)
+    size_t ringBufferStreamOffset;      // start of the stream being written (valid when ringBufferStreamMapped==1)
+    int ringBufferStreamMapped;         // 1 if the stream being written is in ringBufferMapped, 0 if it's in TIS.instanceData
+    int ringBufferSection;
+    GLsync ringBufferFences[TEAPOT_RING_BUFFER_NUM_SECTIONS];  // signaled when the GPU is done with a section
+    int ringBufferAvailable;            // glBufferStorage(...) is supported (checked by Teapot_Init())
+    int ringBufferDisabled;
+    unsigned ringBufferCounters[2];     // see Teapot_Get_PersistentRingBuffer_Counters(...)
+#   endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+    GLuint depthProgramId;              // position-only program of the depth prepass
+    int depthPrepassEnabled;
+    GLint aLoc_depthVertex,depthLoc_mvMatrix,depthLoc_scaling,depthLoc_pMatrix,depthLoc_dequantization;
+#   endif //TEAPOT_ENABLE_DEPTH_PREPASS
+    int frontToBackSortingEnabled;
+
+    // Temporary buffers used by Teapot_MeshData_RadixSort(...) (and by the front to back sorting of Teapot_DrawMulti_Mv(...))
+    unsigned long long* sortKeys;       // 2*sortCapacity
+    unsigned int* sortIndices;          // 2*sortCapacity
+    Teapot_MeshData** sortMeshes;       // sortCapacity
+    int sortCapacity;
+    // Temporary buffer used by Teapot_MeshData_RaycastBatch(...)
+    Teapot_Private_PickingObb* pickingObbs;
+    int pickingObbsCapacity;
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    Teapot_Private_StaticShadowCache staticShadowCache;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    int* visibleIndices;                // visibleIndicesCapacity (draw list of Teapot_DrawMulti(...))
+    int visibleIndicesCapacity;
+    Teapot_MeshData** shadowCasters;    // shadowCastersCapacity (casters left by Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithCasterCulling(...))
+    int shadowCastersCapacity;
+    int shadowCasterCullingCounters[4]; // see Teapot_Get_ShadowCasterCulling_Counters(...)
+#   endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    tpoat* shadowMvpMatrices;           // 16*shadowMvpMatricesCapacity (biasedShadowVpMatrix*mvMatrix of the meshes drawn by Teapot_DrawMulti(...) and Teapot_DrawScene(...))
+    int shadowMvpMatricesCapacity;
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    unsigned viewVersion;               // incremented when vMatrix or pMatrix change (never 0)
+    Teapot_MeshData** dirtyMeshes;      // dirtyMeshesCapacity (meshes recalculated by Teapot_MeshData_CalculateMvMatrixFromArray(...))
+    int dirtyMeshesCapacity;
+    unsigned mvMatrixUpdateCounters[2]; // see Teapot_Get_MvMatrixUpdate_Counters(...)
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_StateCache stateCache;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+
+#   ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    GLuint vertexArrays[TEAPOT_VAO_COUNT];  // created the first time they are bound
+    unsigned vertexArraysValidMask;     // one bit per vertexArrays[] (0 = its layout must be captured again)
+    int vertexArrayBound;               // 1 when one of vertexArrays[] has been bound by us (and must be unbound by Teapot_PostDraw())
+    int vertexArrayObjectsDisabled;
+#   endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+
+#   ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+    char programBinaryCachePath[512];   // see Teapot_Set_ProgramBinaryCache_Path(...) ("" = TEAPOT_PROGRAM_BINARY_CACHE_PATH)
+    int programBinaryCacheDisabled;     // (so that it's enabled before Teapot_Init())
+    int programBinaryFormatsAvailable;  // GL_NUM_PROGRAM_BINARY_FORMATS>0
+    int programLoadCounters[2];         // see Teapot_Get_ProgramLoad_Counters(...)
+    clock_t programLoadTicks;
+#   endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
 } Teapot_Inner_Struct;
 static Teapot_Inner_Struct TIS;
 static TeapotInitCallback gTeapotInitCallback=NULL;
 static TeapotInitUserMeshCallback gTeapotInitUserMeshCallback=NULL;
 
+// GL call wrappers used by teapot.h. When TEAPOT_ENABLE_STATE_CACHE is defined they skip the calls that would not change the GL state.
+#ifdef TEAPOT_ENABLE_STATE_CACHE
+static void Teapot_Private_InvalidateBindings(int bindingsValid) {
+    Teapot_StateCache* sc = &TIS.stateCache;
+    sc->bindingsValid = bindingsValid;
+    sc->program = sc->arrayBuffer = -1;
+    sc->blendEnabled = sc->polygonOffsetFillEnabled = -1;
+    sc->frontFace = sc->depthMask = -1;
+    sc->polygonOffsetValid = 0;
+}
+static void Teapot_Private_InvalidateUniforms(void) {
+    int i;for (i=0;i<TEAPOT_UNIFORM_SLOT_COUNT;i++) TIS.stateCache.uniforms[i].validMask = 0;
+    TIS.stateCache.instancedProgramUniformsDirty = 1;
+}
+// Returns 1 if the GL state tracked in 'cached' already equals 'value' (and so the call can be skipped). Otherwise updates 'cached'.
+static __inline int Teapot_Private_StateCacheHit(GLint* cached,GLint value) {
+    if (TIS.stateCache.bindingsValid && *cached==value) {++TIS.stateCache.numElidedGLCalls;return 1;}
+    *cached = TIS.stateCache.bindingsValid ? value : -1;
+    ++TIS.stateCache.numIssuedGLCalls;
+    return 0;
+}
+// Same as above for 'numVec4' vec4 of a uniform slot of TIS.programId (values are cached only if TIS.programId is bound).
+static __inline int Teapot_Private_UniformCacheHit(int slot,int firstVec4,int numVec4,const float* value) {
+    Teapot_StateCache* sc = &TIS.stateCache;
+    Teapot_UniformSlot* u = &sc->uniforms[slot];
+    const unsigned mask = ((1U<<numVec4)-1U)<<firstVec4;
+    float* cached = &u->value[firstVec4*4];
+    const int numFloats = numVec4*4;
+    int i;
+    if (!sc->bindingsValid || sc->program!=(GLint)TIS.programId) {u->validMask&=~mask;++sc->numIssuedGLCalls;return 0;}
+    if ((u->validMask&mask)==mask)  {
+        for (i=0;i<numFloats;i++) {if (cached[i]!=value[i]) break;}
+        if (i==numFloats) {++sc->numElidedGLCalls;return 1;}
+    }
+    for (i=0;i<numFloats;i++) cached[i]=value[i];
+    u->validMask|=mask;
+    ++sc->numIssuedGLCalls;
+    return 0;
+}
+#endif //TEAPOT_ENABLE_STATE_CACHE
+// Marks the uniforms of the instanced program as out of date (they are synced lazily by Teapot_Private_SyncInstancedProgramUniforms())
+static __inline void Teapot_Private_SetGlobalUniformsDirty(void) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    TIS.stateCache.instancedProgramUniformsDirty = 1;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+}
+static __inline void Teapot_Private_UseProgram(GLuint program) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_StateCacheHit(&TIS.stateCache.program,(GLint)program)) return;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glUseProgram(program);
+}
+static __inline void Teapot_Private_BindArrayBuffer(GLuint buffer) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_StateCacheHit(&TIS.stateCache.arrayBuffer,(GLint)buffer)) return;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glBindBuffer(GL_ARRAY_BUFFER,buffer);
+}
+// 'cap' can be GL_BLEND or GL_POLYGON_OFFSET_FILL
+static __inline void Teapot_Private_SetCapability(GLenum cap,int enabled) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_StateCacheHit(cap==GL_BLEND ? &TIS.stateCache.blendEnabled : &TIS.stateCache.polygonOffsetFillEnabled,enabled ? 1 : 0)) return;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    if (enabled) glEnable(cap);
+    else glDisable(cap);
+}
+static __inline void Teapot_Private_FrontFace(GLenum mode) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_StateCacheHit(&TIS.stateCache.frontFace,(GLint)mode)) return;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glFrontFace(mode);
+}
+static __inline void Teapot_Private_DepthMask(GLboolean flag) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_StateCacheHit(&TIS.stateCache.depthMask,flag ? 1 : 0)) return;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glDepthMask(flag);
+}
+static __inline void Teapot_Private_PolygonOffset(float factor,float units) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_StateCache* sc = &TIS.stateCache;
+    if (sc->bindingsValid && sc->polygonOffsetValid && sc->polygonOffset[0]==factor && sc->polygonOffset[1]==units) {++sc->numElidedGLCalls;return;}
+    sc->polygonOffset[0]=factor;sc->polygonOffset[1]=units;sc->polygonOffsetValid=sc->bindingsValid;
+    ++sc->numIssuedGLCalls;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glPolygonOffset(factor,units);
+}
+// Sets 'count' vec4 of a per-object uniform array of TIS.programId, starting at vec4 'firstVec4' of 'slot' ('location' must match it)
+static __inline void Teapot_Private_Uniform4fv(int slot,int firstVec4,GLint location,int count,const float* value) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (Teapot_Private_UniformCacheHit(slot,firstVec4,count,value)) return;
+#   else //TEAPOT_ENABLE_STATE_CACHE
+    (void)slot;(void)firstVec4;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glUniform4fv(location,count,value);
+}
+static __inline void Teapot_Private_Uniform4f(int slot,int firstVec4,GLint location,float x,float y,float z,float w) {
+    const float v[4] = {x,y,z,w};
+    Teapot_Private_Uniform4fv(slot,firstVec4,location,1,v);
+}
+static __inline void Teapot_Private_Uniform3fv(int slot,GLint location,const float* value) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    const float v[4] = {value[0],value[1],value[2],0.f};
+    if (Teapot_Private_UniformCacheHit(slot,0,1,v)) return;
+#   else //TEAPOT_ENABLE_STATE_CACHE
+    (void)slot;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glUniform3fv(location,1,value);
+}
+static __inline void Teapot_Private_UniformMatrix4v(int slot,GLint location,const tpoat* value) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    const float* fvalue = NULL;
+#   ifndef TEAPOT_MATRIX_USE_DOUBLE_PRECISION
+    fvalue = value;
+#   else
+    float val[16];Teapot_Helper_ConvertMatrixd2f16(val,value);fvalue=val;
+#   endif
+    if (Teapot_Private_UniformCacheHit(slot,0,4,fvalue)) return;
+    glUniformMatrix4fv(location,1,GL_FALSE,fvalue);
+#   else //TEAPOT_ENABLE_STATE_CACHE
+    (void)slot;
+    Teapot_Helper_GlUniformMatrix4v(location,1,GL_FALSE,value);
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+}
+
 static __inline GLuint Teapot_LoadShaderProgramFromSource(const char* vs,const char* fs);
 void Teapot_Helper_LookAt(tpoat* __restrict mOut16,tpoat eyeX,tpoat eyeY,tpoat eyeZ,tpoat centerX,tpoat centerY,tpoat centerZ,tpoat upX,tpoat upY,tpoat upZ)    {
     tpoat* m = mOut16;
@@ -1244,6 +2068,37 @@ void Teapot_Helper_GetFrustumPoints(tpoat frustumPoints[8][4],const tpoat* __res
         frustumPoints[i][3]=1;
     }
 }
+int Teapot_Helper_GetShadowCasterCullingPlanes(tpoat planeEquationsOut[TEAPOT_MAX_SHADOW_CASTER_CULLING_PLANES][4],const tpoat* __restrict cameraVpMatrix16,const tpoat* __restrict normalizedLightDirection3) {
+    // Edges of Teapot_Helper_GetFrustumPoints(...) and their two faces [xl,xr,yb,yt,zn,zf] (see Teapot_Helper_GetFrustumPlaneEquations(...))
+    static const int edges[12][4] = {{0,1,0,4},{1,2,3,4},{2,3,1,4},{3,0,2,4},{4,5,0,5},{5,6,3,5},{6,7,1,5},{7,4,2,5},{0,4,0,2},{1,5,0,3},{2,6,1,3},{3,7,1,2}};
+    tpoat vpMatrixInverse[16],points[8][4],planes[6][4],center[3]={0,0,0};
+    const tpoat e[3] = {-normalizedLightDirection3[0],-normalizedLightDirection3[1],-normalizedLightDirection3[2]};  // extrusion direction
+    int i,j,kept[6],numPlanes=0;
+    if (!Teapot_Helper_InvertMatrix(vpMatrixInverse,cameraVpMatrix16)) return 0;
+    Teapot_Helper_GetFrustumPoints(points,vpMatrixInverse);
+    Teapot_Helper_GetFrustumPlaneEquations(planes,cameraVpMatrix16,0);
+    for (i=0;i<8;i++) {for (j=0;j<3;j++) center[j]+=points[i][j]*(tpoat)0.125;}
+    // the faces that don't face the extrusion direction bound the volume
+    for (i=0;i<6;i++) {
+        kept[i] = Teapot_Helper_Vector3Dot(planes[i],e)>=0;
+        if (kept[i]) {for (j=0;j<4;j++) planeEquationsOut[numPlanes][j]=planes[i][j];++numPlanes;}
+    }
+    // the silhouette edges (between a kept and a dropped face), extruded along e, close it
+    for (i=0;i<12;i++) {
+        const tpoat* a = points[edges[i][0]];const tpoat* b = points[edges[i][1]];
+        tpoat ab[3],n[3],len2,d;
+        if (kept[edges[i][2]]==kept[edges[i][3]]) continue;
+        for (j=0;j<3;j++) ab[j]=b[j]-a[j];
+        Teapot_Helper_Vector3Cross(n,ab,e);
+        len2 = Teapot_Helper_Vector3Dot(n,n);
+        if (len2<=(tpoat)1e-12*Teapot_Helper_Vector3Dot(ab,ab)) continue;   // edge parallel to e (skipping it just makes the volume bigger)
+        d = -Teapot_Helper_Vector3Dot(n,a);
+        if (Teapot_Helper_Vector3Dot(n,center)+d<0) {for (j=0;j<3;j++) n[j]=-n[j];d=-d;}
+        for (j=0;j<3;j++) planeEquationsOut[numPlanes][j]=n[j];
+        planeEquationsOut[numPlanes++][3]=d;
+    }
+    return numPlanes;
+}
 static __inline void Teapot_Helper_GetFrustumAabbCenterAndHalfExtents(tpoat* __restrict frustumCenterOut3,tpoat* __restrict frustumHalfExtentsOut3,const tpoat frustumPoints[8][4])    {
     tpoat vmin[3] = {frustumPoints[0][0],frustumPoints[0][1],frustumPoints[0][2]};
     tpoat vmax[3] = {vmin[0],vmin[1],vmin[2]};
@@ -1660,86 +2515,87 @@ void Teapot_Helper_UnProjectMouseCoords(tpoat* rayOriginOut3,tpoat* rayDirOut3,i
         if (rayOriginOut3) rayOriginOut3[i] = rayOrigin[i];
     }
 }
+// Ray vs OBB slab test (ray in world space). 'aabbMin' and 'aabbMax' are modified. Returns 1 and the distance of the nearest intersection (0 when rayOrigin3 is inside the OBB) in 'tMinOut' on collision
+// Code based on: http://www.opengl-tutorial.org/miscellaneous/clicking-on-objects/picking-with-custom-ray-obb-function/ (WTFPL Public Licence)
+static int Teapot_Private_RayObbIntersection(const tpoat* __restrict obbMatrix,tpoat* __restrict aabbMin,tpoat* __restrict aabbMax,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* tMinOut) {
+    tpoat tMin = 0;tpoat tMax = (tpoat)1000000000000;
+    const tpoat obbPosDelta[3] = {obbMatrix[12]-rayOrigin3[0],obbMatrix[13]-rayOrigin3[1],obbMatrix[14]-rayOrigin3[2]};
+    int j;
+    for (j=0;j<3;j++)   {
+        const int j4 = 4*j;
+        // Test intersection with the 2 planes perpendicular to the OBB's j axis
+#       ifdef OLD_CODE
+        const tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]};
+        const tpoat e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
+        const tpoat f = Teapot_Helper_Vector3Dot(rayDir3, axis);
+#       else /* this works for scaling inside 'obbMatrix' too (but I'm not sure about TEAPOT_MESH_CAPSULE) */
+        tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]},e,f;
+        tpoat sca = Teapot_Helper_Vector3Dot(axis,axis);
+        if (sca<(tpoat)0.00009 || sca>(tpoat)1.00001) {
+            sca = sqrt(sca);
+            aabbMin[j]*=sca;aabbMax[j]*=sca;
+            sca=(tpoat)1/sca;axis[0]*=sca;axis[1]*=sca;axis[2]*=sca;
+        }
+        e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
+        f = Teapot_Helper_Vector3Dot(rayDir3, axis);
+#       endif
+        //if ( abs(f) > 0.001)  // @Flix: the reference code used this (but it does not work for me; so maybe my selection does not work with a projection ortho matrix...)... (or maybe it's just fabs instead of abs...)
+        {
+            // Standard case
+            // t1 and t2 now contain distances betwen ray origin and ray-plane intersections:
+            tpoat t1 = (e+aabbMin[j])/f; // Intersection with the "left" plane
+            tpoat t2 = (e+aabbMax[j])/f; // Intersection with the "right" plane
+            // We want t1 to represent the nearest intersection, so if it's not the case, invert t1 and t2
+            if (t1>t2)  {tpoat w=t1;t1=t2;t2=w;}
+            if (t2 < tMax)    tMax = t2;
+            if (t1 > tMin)    tMin = t1;
+            // And here's the trick :
+            // If "far" is closer than "near", then there is NO intersection.
+            // See the images in the tutorials for the visual explanation.
+            if (tMin > tMax) return 0;
+        }
+        /*else    {
+            // Rare case : the ray is almost parallel to the planes, so they don't have any "intersection"
+            if(-e+aabbMin[j] > 0.0 || -e+aabbMax[j] < 0.0) return 0;
+        }*/
+    }
+    *tMinOut = tMin;
+    return 1;
+}
+// The (scaled) aabb used to pick md (its obbMatrix is md->mMatrix)
+static void Teapot_Private_MeshData_GetPickingAabb(const Teapot_MeshData* md,tpoat aabbMin[3],tpoat aabbMax[3]) {
+    const TeapotMeshEnum meshId = md->meshId;
+    //const float scaling[3] = {meshId==TEAPOT_MESH_CAPSULE ? ((md->scaling[0]+md->scaling[2])*0.5) : md->scaling[0],md->scaling[1],meshId==TEAPOT_MESH_CAPSULE ? ((md->scaling[0]+md->scaling[2])*0.5) : md->scaling[2]};
+    const float* scaling = md->scaling;
+    int j;
+    for (j=0;j<3;j++) {aabbMin[j] = TIS.aabbMin[meshId][j]*scaling[j];aabbMax[j] = TIS.aabbMax[meshId][j]*scaling[j];}
+    if (meshId==TEAPOT_MESH_CAPSULE) {
+        // Sorry, but capsules are special
+        const float sphereScaling = (md->scaling[0]+md->scaling[2])*0.5;
+#       ifndef TEAPOT_CENTER_MESHES_ON_FLOOR
+        aabbMin[1]+=0.5*(md->scaling[1]-2.0*sphereScaling);
+        aabbMax[1]-=0.5*(md->scaling[1]-2.0*sphereScaling);
+#       else //TEAPOT_CENTER_MESHES_ON_FLOOR
+        aabbMax[1]-=0.5*(md->scaling[1]-2.0*sphereScaling);
+#       endif //TEAPOT_CENTER_MESHES_ON_FLOOR
+        //printf("TEAPOT_MESH_CAPSULE: aabbMin(%1.3f,%1.3f,%1.3f) aabbMax(%1.3f,%1.3f,%1.3f) md->scaling[1]=%1.3f sphereScaling=%1.3f TIS.halfExtents[TEAPOT_MESH_HALF_SPHERE_DOWN][1]=%1.3f\n",aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2],md->scaling[1],sphereScaling,TIS.halfExtents[TEAPOT_MESH_HALF_SPHERE_DOWN][1]);
+    }
+}
 Teapot_MeshData* Teapot_MeshData_GetMeshUnderMouseFromRay(Teapot_MeshData* const* meshes,int numMeshes,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut) {
     // rayOrigin3 and rayDirection3 are in world space
     Teapot_MeshData* rv = 0;
     tpoat intersection_distance = 0;
-    int i,j;
+    int i;
     if (pOptionalDistanceOut) *pOptionalDistanceOut=intersection_distance;
     if (!meshes || numMeshes<=0) return rv;
 
     // Loop all meshes and find OBB vs ray intersection
-    // Code based on: http://www.opengl-tutorial.org/miscellaneous/clicking-on-objects/picking-with-custom-ray-obb-function/ (WTFPL Public Licence)
     for (i=0;i<numMeshes;i++)   {
         const Teapot_MeshData* md = meshes[i];
         if (md->active) {
-            const tpoat* obbMatrix = md->mMatrix;
-            const TeapotMeshEnum meshId = md->meshId;
-            tpoat tMin = 0;tpoat tMax = (tpoat)1000000000000;
-            int noCollisionDetected = 0;
-            tpoat obbPosDelta[3] =  {obbMatrix[12]-rayOrigin3[0],obbMatrix[13]-rayOrigin3[1],obbMatrix[14]-rayOrigin3[2]};
-            //const float scaling[3] = {meshId==TEAPOT_MESH_CAPSULE ? ((md->scaling[0]+md->scaling[2])*0.5) : md->scaling[0],md->scaling[1],meshId==TEAPOT_MESH_CAPSULE ? ((md->scaling[0]+md->scaling[2])*0.5) : md->scaling[2]};
-            const float* scaling = md->scaling;
-            tpoat aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
-            tpoat aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
-            //Teapot_Helper_Vector3Normalize(obbPosDelta);
-            //for (j=0;j<3;j++) obbPosDelta[i]=-obbPosDelta[i];
-
-            if (md->meshId==TEAPOT_MESH_CAPSULE) {
-                // Sorry, but capsules are special
-                const float sphereScaling = (md->scaling[0]+md->scaling[2])*0.5;
-#           ifndef TEAPOT_CENTER_MESHES_ON_FLOOR
-                aabbMin[1]+=0.5*(md->scaling[1]-2.0*sphereScaling);
-                aabbMax[1]-=0.5*(md->scaling[1]-2.0*sphereScaling);
-#           else //TEAPOT_CENTER_MESHES_ON_FLOOR
-                aabbMax[1]-=0.5*(md->scaling[1]-2.0*sphereScaling);
-#           endif //TEAPOT_CENTER_MESHES_ON_FLOOR
-                //printf("TEAPOT_MESH_CAPSULE: aabbMin(%1.3f,%1.3f,%1.3f) aabbMax(%1.3f,%1.3f,%1.3f) md->scaling[1]=%1.3f sphereScaling=%1.3f TIS.halfExtents[TEAPOT_MESH_HALF_SPHERE_DOWN][1]=%1.3f\n",aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2],md->scaling[1],sphereScaling,TIS.halfExtents[TEAPOT_MESH_HALF_SPHERE_DOWN][1]);
-            }
-
-            for (j=0;j<3;j++)   {
-                if (!noCollisionDetected)   {
-                    int j4 = 4*j;
-                    // Test intersection with the 2 planes perpendicular to the OBB's j axis
-#               ifdef OLD_CODE
-                    const tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]};
-                    const tpoat e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
-                    const tpoat f = Teapot_Helper_Vector3Dot(rayDir3, axis);
-#               else /* this works for scaling inside 'obbMatrix == md->mMatrix' too (but I'm not sure about TEAPOT_MESH_CAPSULE) */
-                    tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]},e,f;
-                    tpoat sca = Teapot_Helper_Vector3Dot(axis,axis);
-                    if (sca<(tpoat)0.00009 || sca>(tpoat)1.00001) {
-                        sca = sqrt(sca);
-                        aabbMin[j]*=sca;aabbMax[j]*=sca;
-                        sca=(tpoat)1/sca;axis[0]*=sca;axis[1]*=sca;axis[2]*=sca;
-                    }
-                    e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
-                    f = Teapot_Helper_Vector3Dot(rayDir3, axis);
-#               endif
-                    //if ( abs(f) > 0.001)  // @Flix: the reference code used this (but it does not work for me; so maybe my selection does not work with a projection ortho matrix...)
-                    {
-                        // Standard case
-                        // t1 and t2 now contain distances betwen ray origin and ray-plane intersections:
-                        tpoat t1 = (e+aabbMin[j])/f; // Intersection with the "left" plane
-                        tpoat t2 = (e+aabbMax[j])/f; // Intersection with the "right" plane
-                        // We want t1 to represent the nearest intersection, so if it's not the case, invert t1 and t2
-                        if (t1>t2)  {tpoat w=t1;t1=t2;t2=w;}
-                        if (t2 < tMax)    tMax = t2;
-                        if (t1 > tMin)    tMin = t1;
-                        // And here's the trick :
-                        // If "far" is closer than "near", then there is NO intersection.
-                        // See the images in the tutorials for the visual explanation.
-                        if (tMin > tMax) noCollisionDetected=1;
-
-                    }
-                    /*else    {
-                    // Rare case : the ray is almost parallel to the planes, so they don't have any "intersection"
-                    if(-e+aabbMin[j] > 0.0 || -e+aabbMax[j] < 0.0) noCollisionDetected=1;
-                }*/
-                }
-            }
-
-            if (!noCollisionDetected && (intersection_distance<=0 || intersection_distance>tMin))   {
+            tpoat aabbMin[3],aabbMax[3],tMin;
+            Teapot_Private_MeshData_GetPickingAabb(md,aabbMin,aabbMax);
+            if (Teapot_Private_RayObbIntersection(md->mMatrix,aabbMin,aabbMax,rayOrigin3,rayDir3,&tMin) && (intersection_distance<=0 || intersection_distance>tMin))   {
                 intersection_distance = tMin;
                 rv = (Teapot_MeshData*) md;
             }
@@ -1749,68 +2605,164 @@ Teapot_MeshData* Teapot_MeshData_GetMeshUnderMouseFromRay(Teapot_MeshData* const
     if (pOptionalDistanceOut) *pOptionalDistanceOut=intersection_distance;
     return rv;
 }
+static void Teapot_Private_SetPickingObb(Teapot_Private_PickingObb* obb,Teapot_MeshData* md) {
+    int j;
+    Teapot_Private_MeshData_GetPickingAabb(md,obb->aabbMin,obb->aabbMax);
+    for (j=0;j<3;j++) {
+        tpoat* axis = obb->axis[j];tpoat sca;
+        axis[0]=md->mMatrix[4*j];axis[1]=md->mMatrix[4*j+1];axis[2]=md->mMatrix[4*j+2];
+        sca = Teapot_Helper_Vector3Dot(axis,axis);
+        if (sca<(tpoat)0.00009 || sca>(tpoat)1.00001) {
+            sca = sqrt(sca);
+            obb->aabbMin[j]*=sca;obb->aabbMax[j]*=sca;
+            sca=(tpoat)1/sca;axis[0]*=sca;axis[1]*=sca;axis[2]*=sca;
+        }
+        obb->center[j] = md->mMatrix[12+j];
+    }
+    obb->md = md;
+}
+// Same test as Teapot_Private_RayObbIntersection(...) on 4 rays at once (rays12: SoA origins (x[4],y[4],z[4]), then SoA directions). Returns a 4-bit mask (bit k set if ray k hits the OBB) and the 4 entry distances
+static int Teapot_Private_RayObbBatch4(const Teapot_Private_PickingObb* __restrict obb,const tpoat* __restrict rays24,tpoat* __restrict tMinOut4) {
+    int j;
+#   if (defined(TEAPOT_USE_SIMD) && !defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__SSE__))
+    const __m128 dx = _mm_loadu_ps(&rays24[12]),dy = _mm_loadu_ps(&rays24[16]),dz = _mm_loadu_ps(&rays24[20]);
+    const __m128 deltaX = _mm_sub_ps(_mm_set1_ps(obb->center[0]),_mm_loadu_ps(&rays24[0]));
+    const __m128 deltaY = _mm_sub_ps(_mm_set1_ps(obb->center[1]),_mm_loadu_ps(&rays24[4]));
+    const __m128 deltaZ = _mm_sub_ps(_mm_set1_ps(obb->center[2]),_mm_loadu_ps(&rays24[8]));
+    __m128 tMin = _mm_setzero_ps(),tMax = _mm_set1_ps((tpoat)1000000000000),miss = _mm_setzero_ps();
+    for (j=0;j<3;j++) {
+        const __m128 ax = _mm_set1_ps(obb->axis[j][0]),ay = _mm_set1_ps(obb->axis[j][1]),az = _mm_set1_ps(obb->axis[j][2]);
+        const __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax,deltaX),_mm_mul_ps(ay,deltaY)),_mm_mul_ps(az,deltaZ));
+        const __m128 f = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,ax),_mm_mul_ps(dy,ay)),_mm_mul_ps(dz,az));
+        const __m128 t1 = _mm_div_ps(_mm_add_ps(e,_mm_set1_ps(obb->aabbMin[j])),f);
+        const __m128 t2 = _mm_div_ps(_mm_add_ps(e,_mm_set1_ps(obb->aabbMax[j])),f);
+        // Selects are made with compare masks (not with min/max), so that NaNs (f==0) behave as in the scalar code
+        const __m128 swap = _mm_cmpgt_ps(t1,t2);
+        const __m128 tNear = _mm_or_ps(_mm_and_ps(swap,t2),_mm_andnot_ps(swap,t1)),tFar = _mm_or_ps(_mm_and_ps(swap,t1),_mm_andnot_ps(swap,t2));
+        __m128 m = _mm_cmplt_ps(tFar,tMax);
+        tMax = _mm_or_ps(_mm_and_ps(m,tFar),_mm_andnot_ps(m,tMax));
+        m = _mm_cmpgt_ps(tNear,tMin);
+        tMin = _mm_or_ps(_mm_and_ps(m,tNear),_mm_andnot_ps(m,tMin));
+        miss = _mm_or_ps(miss,_mm_cmpgt_ps(tMin,tMax));
+    }
+    _mm_storeu_ps(tMinOut4,tMin);
+    return (~_mm_movemask_ps(miss))&15;
+#   elif (defined(TEAPOT_USE_SIMD) && defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__AVX__))
+    const __m256d dx = _mm256_loadu_pd(&rays24[12]),dy = _mm256_loadu_pd(&rays24[16]),dz = _mm256_loadu_pd(&rays24[20]);
+    const __m256d deltaX = _mm256_sub_pd(_mm256_set1_pd(obb->center[0]),_mm256_loadu_pd(&rays24[0]));
+    const __m256d deltaY = _mm256_sub_pd(_mm256_set1_pd(obb->center[1]),_mm256_loadu_pd(&rays24[4]));
+    const __m256d deltaZ = _mm256_sub_pd(_mm256_set1_pd(obb->center[2]),_mm256_loadu_pd(&rays24[8]));
+    __m256d tMin = _mm256_setzero_pd(),tMax = _mm256_set1_pd((tpoat)1000000000000),miss = _mm256_setzero_pd();
+    for (j=0;j<3;j++) {
+        const __m256d ax = _mm256_set1_pd(obb->axis[j][0]),ay = _mm256_set1_pd(obb->axis[j][1]),az = _mm256_set1_pd(obb->axis[j][2]);
+        const __m256d e = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax,deltaX),_mm256_mul_pd(ay,deltaY)),_mm256_mul_pd(az,deltaZ));
+        const __m256d f = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,ax),_mm256_mul_pd(dy,ay)),_mm256_mul_pd(dz,az));
+        const __m256d t1 = _mm256_div_pd(_mm256_add_pd(e,_mm256_set1_pd(obb->aabbMin[j])),f);
+        const __m256d t2 = _mm256_div_pd(_mm256_add_pd(e,_mm256_set1_pd(obb->aabbMax[j])),f);
+        // (no _mm256_blendv_pd(...): without AVX2 gcc splits it into scalar code)
+        const __m256d swap = _mm256_cmp_pd(t1,t2,_CMP_GT_OQ);
+        const __m256d tNear = _mm256_or_pd(_mm256_and_pd(swap,t2),_mm256_andnot_pd(swap,t1)),tFar = _mm256_or_pd(_mm256_and_pd(swap,t1),_mm256_andnot_pd(swap,t2));
+        __m256d m = _mm256_cmp_pd(tFar,tMax,_CMP_LT_OQ);
+        tMax = _mm256_or_pd(_mm256_and_pd(m,tFar),_mm256_andnot_pd(m,tMax));
+        m = _mm256_cmp_pd(tNear,tMin,_CMP_GT_OQ);
+        tMin = _mm256_or_pd(_mm256_and_pd(m,tNear),_mm256_andnot_pd(m,tMin));
+        miss = _mm256_or_pd(miss,_mm256_cmp_pd(tMin,tMax,_CMP_GT_OQ));
+    }
+    _mm256_storeu_pd(tMinOut4,tMin);
+    return (~_mm256_movemask_pd(miss))&15;
+#   else
+    int k,mask=0;
+    for (k=0;k<4;k++) {
+        const tpoat delta[3] = {obb->center[0]-rays24[k],obb->center[1]-rays24[4+k],obb->center[2]-rays24[8+k]};
+        const tpoat dir[3] = {rays24[12+k],rays24[16+k],rays24[20+k]};
+        tpoat tMin = 0,tMax = (tpoat)1000000000000;
+        for (j=0;j<3;j++) {
+            const tpoat e = Teapot_Helper_Vector3Dot(obb->axis[j],delta),f = Teapot_Helper_Vector3Dot(dir,obb->axis[j]);
+            tpoat t1 = (e+obb->aabbMin[j])/f,t2 = (e+obb->aabbMax[j])/f;
+            if (t1>t2) {tpoat w=t1;t1=t2;t2=w;}
+            if (t2<tMax) tMax = t2;
+            if (t1>tMin) tMin = t1;
+            if (tMin>tMax) break;
+        }
+        if (j==3) mask|=(1<<k);
+        tMinOut4[k] = tMin;
+    }
+    return mask;
+#   endif
+}
+#ifndef TEAPOT_RAYCAST_BATCH_CHUNK_SIZE
+#   define TEAPOT_RAYCAST_BATCH_CHUNK_SIZE (64)     // rays per chunk (the OBBs are tested against a chunk of rays before moving to the next TEAPOT_RAYCAST_BATCH_BLOCK_SIZE OBBs)
+#endif //TEAPOT_RAYCAST_BATCH_CHUNK_SIZE
+#ifndef TEAPOT_RAYCAST_BATCH_BLOCK_SIZE
+#   define TEAPOT_RAYCAST_BATCH_BLOCK_SIZE (256)
+#endif //TEAPOT_RAYCAST_BATCH_BLOCK_SIZE
+int Teapot_MeshData_RaycastBatch(Teapot_MeshData* const* meshes,int numMeshes,const tpoat* rayOrigins3,const tpoat* rayDirs3,int numRays,Teapot_MeshData** hitMeshesOut,tpoat* distancesOut) {
+    int i,numObbs=0,numChunks,numHits=0;
+    if (!rayOrigins3 || !rayDirs3 || numRays<=0) return 0;
+    for (i=0;i<numRays;i++) {if (hitMeshesOut) hitMeshesOut[i]=NULL;if (distancesOut) distancesOut[i]=0;}
+    if (!meshes || numMeshes<=0 || !hitMeshesOut) return 0;
+
+    // The OBB setup is done once per mesh (and inactive meshes are dropped here)
+    if (TIS.pickingObbsCapacity<numMeshes) {
+        const int capacity = numMeshes + numMeshes/2;
+        void* p = realloc(TIS.pickingObbs,capacity*sizeof(Teapot_Private_PickingObb));
+        if (!p) {fprintf(stderr,"Error in teapot.h: Teapot_MeshData_RaycastBatch(...) out of memory (numMeshes=%d).\n",numMeshes);return 0;}    // (TIS.pickingObbs is still valid)
+        TIS.pickingObbs = (Teapot_Private_PickingObb*) p;TIS.pickingObbsCapacity = capacity;
+    }
+    for (i=0;i<numMeshes;i++) {if (meshes[i]->active) Teapot_Private_SetPickingObb(&TIS.pickingObbs[numObbs++],meshes[i]);}
+
+    numChunks = (numRays+TEAPOT_RAYCAST_BATCH_CHUNK_SIZE-1)/TEAPOT_RAYCAST_BATCH_CHUNK_SIZE;
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(dynamic,1) if(numChunks>1 && numObbs*(numRays/4)>=TEAPOT_OPENMP_MIN_NUM_MESHES*TEAPOT_RAYCAST_BATCH_CHUNK_SIZE)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numChunks;i++) {
+        // Packets of 4 rays (SoA), with their nearest hit so far
+        tpoat packets[TEAPOT_RAYCAST_BATCH_CHUNK_SIZE/4][24],dist[TEAPOT_RAYCAST_BATCH_CHUNK_SIZE];
+        int hits[TEAPOT_RAYCAST_BATCH_CHUNK_SIZE];
+        const int start = i*TEAPOT_RAYCAST_BATCH_CHUNK_SIZE,count = start+TEAPOT_RAYCAST_BATCH_CHUNK_SIZE<=numRays ? TEAPOT_RAYCAST_BATCH_CHUNK_SIZE : numRays-start;
+        const int numPackets = (count+3)/4;
+        int b,p,k,o;
+        for (k=0;k<4*numPackets;k++) {
+            const int r = start+(k<count ? k : count-1);   // (unused lanes repeat the last ray)
+            tpoat* packet = packets[k/4];
+            for (o=0;o<3;o++) {packet[4*o+(k&3)] = rayOrigins3[3*r+o];packet[12+4*o+(k&3)] = rayDirs3[3*r+o];}
+            dist[k] = 0;hits[k] = -1;
+        }
+        for (b=0;b<numObbs;b+=TEAPOT_RAYCAST_BATCH_BLOCK_SIZE) {
+            const int end = b+TEAPOT_RAYCAST_BATCH_BLOCK_SIZE<numObbs ? b+TEAPOT_RAYCAST_BATCH_BLOCK_SIZE : numObbs;
+            for (p=0;p<numPackets;p++) {
+                tpoat* d = &dist[4*p];int* h = &hits[4*p];
+                for (o=b;o<end;o++) {
+                    tpoat tMin[4];
+                    const int mask = Teapot_Private_RayObbBatch4(&TIS.pickingObbs[o],packets[p],tMin);
+                    if (mask) {
+                        // Same acceptance rule of Teapot_MeshData_GetMeshUnderMouseFromRay(...)
+                        for (k=0;k<4;k++) {if ((mask&(1<<k)) && (d[k]<=0 || d[k]>tMin[k])) {d[k]=tMin[k];h[k]=o;}}
+                    }
+                }
+            }
+        }
+        for (k=0;k<count;k++) {
+            if (hits[k]>=0) hitMeshesOut[start+k] = TIS.pickingObbs[hits[k]].md;
+            if (distancesOut) distancesOut[start+k] = dist[k];
+        }
+    }
+    for (i=0;i<numRays;i++) {if (hitMeshesOut[i]) ++numHits;}
+    return numHits;
+}
 
 
 int Teapot_Helper_GetMeshUnderMouseFromRayGeneric(int numMeshes,void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData),const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut,void* userData)   {
     // ray is in world space
-    // code based on http://www.opengl-tutorial.org/miscellaneous/clicking-on-objects/picking-with-custom-ray-obb-function/
-    int i,j,rv = -1;
+    int i,rv = -1;
     tpoat intersection_distance = 0;
     tpoat obbMatrix[16]={1,0,0,0,   0,1,0,0,    0,0,1,0,    0,0,0,1};
     if (pOptionalDistanceOut) *pOptionalDistanceOut=0.f;
     if (!getMeshDataCallback || numMeshes==0) return -1;
     for (i=0;i<numMeshes;i++)   {
-        tpoat tMin = 0;tpoat tMax = (tpoat)1000000000000;
-        int noCollisionDetected = 0;
-        tpoat obbPosDelta[3],aabbMin[3],aabbMax[3];       
-
+        tpoat aabbMin[3],aabbMax[3],tMin;
         getMeshDataCallback(i,obbMatrix,aabbMin,aabbMax,userData);
-
-        for (j=0;j<3;j++)  {obbPosDelta[j] = obbMatrix[12+j]-rayOrigin3[j];}
-        for (j=0;j<3;j++)   {
-            if (!noCollisionDetected)   {
-                int j4 = 4*j;
-                // Test intersection with the 2 planes perpendicular to the OBB's j axis
-#               ifdef OLD_CODE
-                const tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]};
-                const tpoat e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
-                const tpoat f = Teapot_Helper_Vector3Dot(rayDir3, axis);
-#               else /* this works for scaling inside matrix too */
-                tpoat axis[3] = {obbMatrix[j4],obbMatrix[j4+1],obbMatrix[j4+2]},e,f;
-                tpoat sca = Teapot_Helper_Vector3Dot(axis,axis);
-                if (sca<(tpoat)0.00009 || sca>(tpoat)1.00001) {
-                    sca = sqrt(sca);
-                    aabbMin[j]*=sca;aabbMax[j]*=sca;
-                    sca=(tpoat)1/sca;axis[0]*=sca;axis[1]*=sca;axis[2]*=sca;
-                }
-                e = Teapot_Helper_Vector3Dot(axis, obbPosDelta);
-                f = Teapot_Helper_Vector3Dot(rayDir3, axis);
-#               endif
-
-                //if ( abs(f) > 0.001)  // @Flix: the reference code used this (but it does not work for me; so maybe my selection does not work with a projection ortho matrix...)... (or maybe it's just fabs instead of abs...)
-                {
-                    // Standard case
-                    // t1 and t2 now contain distances betwen ray origin and ray-plane intersections:
-                    tpoat t1 = (e+aabbMin[j])/f; // Intersection with the "left" plane
-                    tpoat t2 = (e+aabbMax[j])/f; // Intersection with the "right" plane
-                    // We want t1 to represent the nearest intersection, so if it's not the case, invert t1 and t2
-                    if (t1>t2)  {tpoat w=t1;t1=t2;t2=w;}
-                    if (t2 < tMax)    tMax = t2;
-                    if (t1 > tMin)    tMin = t1;
-                    // And here's the trick :
-                    // If "far" is closer than "near", then there is NO intersection.
-                    // See the images in the tutorials for the visual explanation.
-                    if (tMin > tMax) noCollisionDetected=1;
-
-                }
-                /*else    {
-                    // Rare case : the ray is almost parallel to the planes, so they don't have any "intersection"
-                    if(-e+aabbMin[j] > 0.0 || -e+aabbMax[j] < 0.0) noCollisionDetected=1;
-                }*/
-            }
-        }
-
-        if (!noCollisionDetected && (intersection_distance<=0 || intersection_distance>tMin))   {
+        if (Teapot_Private_RayObbIntersection(obbMatrix,aabbMin,aabbMax,rayOrigin3,rayDir3,&tMin) && (intersection_distance<=0 || intersection_distance>tMin))   {
             intersection_distance = tMin;
             rv = i;
         }
@@ -1846,6 +2798,10 @@ tpoat* Teapot_Helper_GetPickMatrix(tpoat* __restrict mOut16,tpoat x,tpoat y,tpoa
     return m;
 }
 
+#ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+// Invalidates mvMatrix, visible and nCoefficients of all the Teapot_MeshData
+static __inline void Teapot_Private_IncrementViewVersion(void) {if (++TIS.viewVersion==0) TIS.viewVersion=1;}
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
 
 void Teapot_SetViewMatrixAndLightDirection(const tpoat vMatrix[16],tpoat lightDirectionWorldSpace[3])   {
     tpoat len = lightDirectionWorldSpace[0]*lightDirectionWorldSpace[0]+lightDirectionWorldSpace[1]*lightDirectionWorldSpace[1]+lightDirectionWorldSpace[2]*lightDirectionWorldSpace[2];
@@ -1855,6 +2811,9 @@ void Teapot_SetViewMatrixAndLightDirection(const tpoat vMatrix[16],tpoat lightDi
     TIS.lightDirectionWorldSpace[2] = lightDirectionWorldSpace[2];
 
     // lightDirectionViewSpace = v3_norm(m4_mul_dir(vMatrix,light_direction));
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    if (memcmp(TIS.vMatrix,vMatrix,16*sizeof(tpoat))!=0) Teapot_Private_IncrementViewVersion();
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
     Teapot_Helper_CopyMatrix(TIS.vMatrix,vMatrix);
 #   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
     Teapot_Helper_InvertTransformMatrixFast(TIS.vMatrixInverse,TIS.vMatrix);
@@ -1864,31 +2823,40 @@ void Teapot_SetViewMatrixAndLightDirection(const tpoat vMatrix[16],tpoat lightDi
     TIS.lightDirectionViewSpace[1] = lightDirectionWorldSpace[0]*TIS.vMatrix[1] + lightDirectionWorldSpace[1]*TIS.vMatrix[5] + lightDirectionWorldSpace[2]*TIS.vMatrix[9];
     TIS.lightDirectionViewSpace[2] = lightDirectionWorldSpace[0]*TIS.vMatrix[2] + lightDirectionWorldSpace[1]*TIS.vMatrix[6] + lightDirectionWorldSpace[2]*TIS.vMatrix[10];
 
-    glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
     Teapot_Helper_GlUniform3v(TIS.uLoc_lightVector,1,TIS.lightDirectionViewSpace);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 
 void Teapot_SetProjectionMatrix(const tpoat pMatrix[16])    {
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    if (memcmp(TIS.pMatrix,pMatrix,16*sizeof(tpoat))!=0) Teapot_Private_IncrementViewVersion();   // (visible depends on it)
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
     Teapot_Helper_CopyMatrix(TIS.pMatrix,pMatrix);
 #   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
     Teapot_Helper_GetFrustumPlaneEquations(TIS.pMatrixFrustum,TIS.pMatrix,0);   // Last arg can probably be 0...
 #   endif
-    glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
     Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_pMatrix, 1 /*only setting 1 matrix*/, GL_FALSE /*transpose?*/, pMatrix);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_SetProjectionMatrixf(const float pMatrix[16])    {
 #   ifndef TEAPOT_USE_DOUBLE_PRECISION
     Teapot_SetProjectionMatrix(pMatrix);
 #   else
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    Teapot_Private_IncrementViewVersion();
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
     Teapot_Helper_ConvertMatrixf2d16(TIS.pMatrix,pMatrix);
 #   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
     Teapot_Helper_GetFrustumPlaneEquations(TIS.pMatrixFrustum,TIS.pMatrix,0);   // Last arg can probably be 0...
 #   endif
-    glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
     glUniformMatrix4fv(TIS.uLoc_pMatrix, 1 /*only setting 1 matrix*/, GL_FALSE /*transpose?*/, pMatrix);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 #   endif
 }
 
@@ -1905,6 +2873,7 @@ void Teapot_SetShadowVpMatrix(const tpoat unbiasedShadowVpMatrix[16])    {
 
     Teapot_Helper_MultMatrix(TIS.biasedShadowVpMatrix,bias,unbiasedShadowVpMatrix);
     Teapot_Helper_MultMatrix(TIS.biasedShadowVpMatrix,TIS.biasedShadowVpMatrix,TIS.vMatrixInverse);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_GetViewMatrixInverse(tpoat* res16)  {Teapot_Helper_CopyMatrix(res16,TIS.vMatrixInverse);}
 const tpoat* Teapot_GetViewMatrixInverseConstReference() {return TIS.vMatrixInverse;}
@@ -1913,24 +2882,29 @@ void Teapot_SetShadowDarkening(float darkeningFactorIn_0_80,float shadowMinInten
 #   if TEAPOT_SHADER_SHADOW_MAP_PCF>0
     TIS.shadowDarkening = TIS.shadowDarkening==0.0 ? 0.0 : (0.1/TIS.shadowDarkening);
 #   endif //TEAPOT_SHADER_SHADOW_MAP_PCF>0
-    glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
     glUniform2f(TIS.uLoc_shadowDarkening,TIS.shadowDarkening,TIS.shadowClamp);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_SetShadowMapFactor(float shadowMapResolutionFactorIn_0_1)    {
-    glUseProgram(TIS.programId);
+    TIS.shadowMapFactor = shadowMapResolutionFactorIn_0_1;
+    Teapot_Private_UseProgram(TIS.programId);
     glUniform1f(TIS.uLoc_shadowMapFactor,shadowMapResolutionFactorIn_0_1);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_SetShadowMapTexelIncrement(float shadowMapTexelIncrementX,float shadowMapTexelIncrementY)    {
-    glUseProgram(TIS.programId);
+    TIS.shadowMapTexelIncrement[0] = shadowMapTexelIncrementX;TIS.shadowMapTexelIncrement[1] = shadowMapTexelIncrementY;
+    Teapot_Private_UseProgram(TIS.programId);
     glUniform2f(TIS.uLoc_shadowMapTexelIncrement,shadowMapTexelIncrementX,shadowMapTexelIncrementY);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_LowLevel_SetMvMatrixUniformWithShadowSupport(const tpoat mvMatrix[16])  {
     tpoat tmp[16];
     Teapot_Helper_MultMatrix(tmp,TIS.biasedShadowVpMatrix,mvMatrix);
-    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_biasedShadowMvpMatrix,1,GL_FALSE,tmp);
+    Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_BIASED_SHADOW_MVP_MATRIX,TIS.uLoc_biasedShadowMvpMatrix,tmp);
     Teapot_LowLevel_SetMvMatrixUniform(mvMatrix);
 }
 void Teapot_LowLevel_SetMvMatrixUniformWithShadowSupportFloat(const float mvMatrix[16]) {
@@ -1945,68 +2919,174 @@ void Teapot_LowLevel_SetMvMatrixUniformWithShadowSupportFloat(const float mvMatr
 
 #ifdef TEAPOT_SHADER_FOG
 void Teapot_SetFogColor(float R, float G, float B)  {
-    glUseProgram(TIS.programId);
+    TIS.fogColor[0]=R;TIS.fogColor[1]=G;TIS.fogColor[2]=B;
+    Teapot_Private_UseProgram(TIS.programId);
     glUniform3f(TIS.uLoc_fogColor,R,G,B);
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 void Teapot_SetFogDistances(float startDistance,float endDistance)  {
-    glUseProgram(TIS.programId);
-    glUniform4f(TIS.uLoc_fogDistances,startDistance,endDistance,endDistance-startDistance,1.0/(endDistance-startDistance));
-    glUseProgram(0);
+    TIS.fogDistances[0]=startDistance;TIS.fogDistances[1]=endDistance;TIS.fogDistances[2]=endDistance-startDistance;TIS.fogDistances[3]=1.0/(endDistance-startDistance);
+    Teapot_Private_UseProgram(TIS.programId);
+    glUniform4fv(TIS.uLoc_fogDistances,1,TIS.fogDistances);
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
 }
 #endif //TEAPOT_SHADER_FOG
 
 
 void Teapot_LowLevel_EnableVertexAttributes(int enableVertexAttribArray,int enableNormalAttribArray) {
     if (enableVertexAttribArray) glEnableVertexAttribArray(TIS.aLoc_vertex);
-    if (enableNormalAttribArray) glEnableVertexAttribArray(TIS.aLoc_normal);
+    if (enableNormalAttribArray) {glEnableVertexAttribArray(TIS.aLoc_normal);glEnableVertexAttribArray(TIS.aLoc_material);}
+}
+// Sets the vertex attribute pointers for TIS.vertexBuffer (that must be bound). Negative locations are skipped.
+static void Teapot_Private_VertexAttribPointers(GLint aLoc_vertex,GLint aLoc_normal,GLint aLoc_material) {
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    if (aLoc_vertex>=0) glVertexAttribPointer(aLoc_vertex, 3, GL_FLOAT, GL_FALSE, sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS, 0);
+    if (aLoc_normal>=0) glVertexAttribPointer(aLoc_normal, 3, GL_FLOAT, GL_FALSE, sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS, (void*)(sizeof(float)*3));
+    if (aLoc_material>=0) glVertexAttribPointer(aLoc_material, 1, GL_FLOAT, GL_FALSE, sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS, (void*)(sizeof(float)*6));
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    if (aLoc_vertex>=0) glVertexAttribPointer(aLoc_vertex, 3, GL_SHORT, GL_FALSE, sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS, 0);
+    if (aLoc_normal>=0) glVertexAttribPointer(aLoc_normal, 2, GL_SHORT, GL_FALSE, sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS, (void*)(sizeof(short)*3));
+    if (aLoc_material>=0) glVertexAttribPointer(aLoc_material, 1, GL_SHORT, GL_FALSE, sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS, (void*)(sizeof(short)*5));
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+}
+// Sets u_dequantization for meshId (TEAPOT_ENABLE_VERTEX_QUANTIZATION only)
+static __inline void Teapot_Private_SetDequantization(int meshId) {
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_DEQUANTIZATION,0,TIS.uLoc_dequantization,2,&TIS.dequantization[meshId][0][0]);
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    (void)meshId;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
 }
 void Teapot_LowLevel_BindVertexBufferObject(void) {
-    glBindBuffer(GL_ARRAY_BUFFER, TIS.vertexBuffer);
-    glVertexAttribPointer(TIS.aLoc_vertex, 3, GL_FLOAT, GL_FALSE, sizeof(float)*6, 0);
-    glVertexAttribPointer(TIS.aLoc_normal, 3, GL_FLOAT, GL_FALSE, sizeof(float)*6, (void*)(sizeof(float)*3));
+    Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+    Teapot_Private_VertexAttribPointers(TIS.aLoc_vertex,TIS.aLoc_normal,TIS.aLoc_material);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TIS.elementBuffer);
 }
+#ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+// Binds TIS.vertexArrays[vao], capturing its layout the first time (and after Teapot_SetShaderFeatures(...)).
+// Returns 0 when vertex array objects are disabled: then the caller must set the vertex attributes as usual.
+static int Teapot_Private_BindVertexArray(int vao) {
+    int j;
+    if (TIS.vertexArrayObjectsDisabled) return 0;
+    if (!TIS.vertexArrays[vao]) {
+        glGenVertexArrays(1,&TIS.vertexArrays[vao]);
+        if (!TIS.vertexArrays[vao]) return 0;
+    }
+    glBindVertexArray(TIS.vertexArrays[vao]);TIS.vertexArrayBound = 1;
+    if (TIS.vertexArraysValidMask&(1U<<vao)) return 1;
+    TIS.vertexArraysValidMask|=(1U<<vao);
+    Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+    switch (vao) {
+    case TEAPOT_VAO_DRAW:
+        glEnableVertexAttribArray(TIS.aLoc_vertex);
+        glEnableVertexAttribArray(TIS.aLoc_normal);
+        glEnableVertexAttribArray(TIS.aLoc_material);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_vertex,TIS.aLoc_normal,TIS.aLoc_material);
+        break;
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    case TEAPOT_VAO_INSTANCED:
+        glEnableVertexAttribArray(TIS.aLoc_instVertex);
+        glEnableVertexAttribArray(TIS.aLoc_instNormal);
+        glEnableVertexAttribArray(TIS.aLoc_instMaterial);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_instVertex,TIS.aLoc_instNormal,TIS.aLoc_instMaterial);
+        for (j=0;j<TEAPOT_INSTANCE_NUM_VEC4;j++) {
+            if (TIS.aLoc_instData[j]<0) continue;
+            glEnableVertexAttribArray(TIS.aLoc_instData[j]);
+            glVertexAttribDivisor(TIS.aLoc_instData[j],1);
+        }
+        break;
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+    case TEAPOT_VAO_DEPTH:
+        glEnableVertexAttribArray(TIS.aLoc_depthVertex);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_depthVertex,-1,-1);
+        break;
+#   endif //TEAPOT_ENABLE_DEPTH_PREPASS
+#   ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    case TEAPOT_VAO_SHADOW_INSTANCED:
+        glEnableVertexAttribArray(TIS.aLoc_shadowInstVertex);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_shadowInstVertex,-1,-1);
+        for (j=0;j<4;j++) {
+            glEnableVertexAttribArray(TIS.aLoc_shadowInstMMatrix[j]);
+            glVertexAttribDivisor(TIS.aLoc_shadowInstMMatrix[j],1);
+        }
+        break;
+#   endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    default:
+        (void)j;break;
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TIS.elementBuffer);
+    return 1;
+}
+// Returns 1 if one of TIS.vertexArrays[] was bound (its vertex attributes don't need to be disabled)
+static __inline int Teapot_Private_UnbindVertexArray(void) {
+    if (!TIS.vertexArrayBound) return 0;
+    glBindVertexArray(0);TIS.vertexArrayBound = 0;
+    return 1;
+}
+void Teapot_Enable_VertexArrayObjects(void) {TIS.vertexArrayObjectsDisabled = 0;}
+void Teapot_Disable_VertexArrayObjects(void) {TIS.vertexArrayObjectsDisabled = 1;}
+int Teapot_Get_VertexArrayObjects_Enabled(void) {return !TIS.vertexArrayObjectsDisabled;}
+#else //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+static __inline int Teapot_Private_BindVertexArray(int vao) {(void)vao;return 0;}
+static __inline int Teapot_Private_UnbindVertexArray(void) {return 0;}
+#endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
 void Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(int enableVertexAttribArray,int enableNormalAttribArray) {
+    if (enableVertexAttribArray && enableNormalAttribArray && Teapot_Private_BindVertexArray(TEAPOT_VAO_DRAW)) return;
     Teapot_LowLevel_EnableVertexAttributes(enableVertexAttribArray,enableNormalAttribArray);
     Teapot_LowLevel_BindVertexBufferObject();
 }
 void Teapot_LowLevel_BindShaderProgram(void) {
-    glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
 }
 void Teapot_LowLevel_UnbindShaderProgram(void) {
-    glUseProgram(0);
+    Teapot_Private_UseProgram(0);
 }
 void Teapot_LowLevel_UnbindVertexBufferObject(void) {
-    glBindBuffer(GL_ARRAY_BUFFER,0);
+    Teapot_Private_BindArrayBuffer(0);
 }
 void Teapot_LowLevel_DisableVertexAttributes(int disableVertexAttribArray,int disableNormalAttribArray) {
+    if (disableVertexAttribArray && disableNormalAttribArray && Teapot_Private_UnbindVertexArray()) return;
+#   ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    if (TIS.vertexArrayBound) TIS.vertexArraysValidMask = 0;    // (the attributes below are disabled inside the bound vertex array object: its layout must be captured again)
+#   endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
     if (disableVertexAttribArray) glDisableVertexAttribArray(TIS.aLoc_vertex);
-    if (disableNormalAttribArray) glDisableVertexAttribArray(TIS.aLoc_normal);
+    if (disableNormalAttribArray) {glDisableVertexAttribArray(TIS.aLoc_normal);glDisableVertexAttribArray(TIS.aLoc_material);}
 }
 void Teapot_LowLevel_UnbindVertexBufferObjectAndDisableVertexAttributes(int disableVertexAttribArray,int disableNormalAttribArray) {
     Teapot_LowLevel_UnbindVertexBufferObject();
     Teapot_LowLevel_DisableVertexAttributes(disableVertexAttribArray,disableNormalAttribArray);
 }
 
-void Teapot_PreDraw(void)   {
-    if (TIS.programId)  {
+// Binds the vertex attributes, the buffers and the program used by Teapot_Draw(...)
+static void Teapot_Private_BindDrawState(void)  {
+    if (!Teapot_Private_BindVertexArray(TEAPOT_VAO_DRAW)) {
         glEnableVertexAttribArray(TIS.aLoc_vertex);
         glEnableVertexAttribArray(TIS.aLoc_normal);
-        glBindBuffer(GL_ARRAY_BUFFER, TIS.vertexBuffer);
-        glVertexAttribPointer(TIS.aLoc_vertex, 3, GL_FLOAT, GL_FALSE, sizeof(float)*6, 0);
-        glVertexAttribPointer(TIS.aLoc_normal, 3, GL_FLOAT, GL_FALSE, sizeof(float)*6, (void*)(sizeof(float)*3));
+        glEnableVertexAttribArray(TIS.aLoc_material);
+        Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_vertex,TIS.aLoc_normal,TIS.aLoc_material);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TIS.elementBuffer);
+    }
 
-        glUseProgram(TIS.programId);
+    Teapot_Private_UseProgram(TIS.programId);
+}
+void Teapot_PreDraw(void)   {
+    if (TIS.programId)  {
+#       ifdef TEAPOT_ENABLE_STATE_CACHE
+        Teapot_Private_InvalidateBindings(1);  // we don't know what the user has bound since Teapot_PostDraw()
+#       endif //TEAPOT_ENABLE_STATE_CACHE
+        Teapot_Private_BindDrawState();
     }
 }
 
 void Teapot_SetScaling(float scalingX, float scalingY, float scalingZ)  {
     TIS.scaling[0]=scalingX;TIS.scaling[1]=scalingY;TIS.scaling[2]=scalingZ;
-    glUniform4f(TIS.uLoc_scaling,scalingX,scalingY,scalingZ,1.f);
+    Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_SCALING,0,TIS.uLoc_scaling,scalingX,scalingY,scalingZ,1.f);
 }
 void Teapot_SetColor(float R,float G,float B,float A)  {
     TIS.color[0]=R;TIS.color[1]=G;TIS.color[2]=B;TIS.color[3]=A;
@@ -2029,17 +3109,17 @@ void Teapot_SetColor(float R,float G,float B,float A)  {
             const float speFac = 0.8f * A;
             TIS.colorSpecular[0]=R*speFac;TIS.colorSpecular[1]=G*speFac;TIS.colorSpecular[2]=B*speFac;
             if (A<0) TIS.colorSpecular[3]=-1.f*A;
-            glUniform4fv(TIS.uLoc_color,3,TIS.color);   // 3 vec4 in one call!
+            Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,3,TIS.color);   // 3 vec4 in one call!
         }
 #       else //TEAPOT_SHADER_SPECULAR
-        glUniform4fv(TIS.uLoc_color,2,TIS.color);   // 2 vec4 in one call!
+        Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,2,TIS.color);   // 2 vec4 in one call!
 #       endif //TEAPOT_SHADER_SPECULAR
     }
-    else glUniform4fv(TIS.uLoc_color,1,TIS.color);
+    else Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,1,TIS.color);
 }
 void Teapot_SetColorAmbient(float R,float G,float B)  {
     TIS.colorAmbient[0]=R;TIS.colorAmbient[1]=G;TIS.colorAmbient[2]=B;
-    glUniform4fv(TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
 }
 void Teapot_SetColorAmbientAndDiffuse(const float ambient[3],const float diffuse[4])    {
 #   ifdef TEAPOT_HINT_STRICTER_COLOR_MATERIAL
@@ -2050,7 +3130,7 @@ void Teapot_SetColorAmbientAndDiffuse(const float ambient[3],const float diffuse
             TIS.colorAmbient[k]=ambient[k];
         }
         TIS.color[3]=diffuse[3];
-        glUniform4fv(TIS.uLoc_color,2,TIS.color);   // 2 vec4 in one call!
+        Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,2,TIS.color);   // 2 vec4 in one call!
 #   ifdef TEAPOT_HINT_STRICTER_COLOR_MATERIAL
     }
     else Teapot_SetColor(diffuse[0],diffuse[1],diffuse[2],diffuse[3]);
@@ -2060,7 +3140,7 @@ void Teapot_SetColorAmbientAndDiffuse(const float ambient[3],const float diffuse
 void Teapot_SetColorSpecular(float R,float G,float B,float SHI) {
     TIS.colorSpecular[0]=R;TIS.colorSpecular[1]=G;TIS.colorSpecular[2]=B;
     if (SHI>0) TIS.colorSpecular[3]=SHI;
-    glUniform4f(TIS.uLoc_colorSpecular,R,G,B,TIS.colorSpecular[3]);
+    Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,2,TIS.uLoc_colorSpecular,R,G,B,TIS.colorSpecular[3]);
 }
 void Teapot_SetColorAmbientDiffuseAndSpecular(const float ambient[3],const float diffuse[4],const float specular_plus_shininess[4])    {
 #   ifdef TEAPOT_HINT_STRICTER_COLOR_MATERIAL
@@ -2073,7 +3153,7 @@ void Teapot_SetColorAmbientDiffuseAndSpecular(const float ambient[3],const float
         }
         TIS.color[3]=diffuse[3];
         if (specular_plus_shininess[3]>0) TIS.colorSpecular[3]=specular_plus_shininess[3];
-        glUniform4fv(TIS.uLoc_color,3,TIS.color);   // 3 vec4 in one call!
+        Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,3,TIS.color);   // 3 vec4 in one call!
 #   ifdef TEAPOT_HINT_STRICTER_COLOR_MATERIAL
     }
     else Teapot_SetColor(diffuse[0],diffuse[1],diffuse[2],diffuse[3]);
@@ -2081,8 +3161,8 @@ void Teapot_SetColorAmbientDiffuseAndSpecular(const float ambient[3],const float
 }
 #endif //TEAPOT_SHADER_SPECULAR
 
-void Teapot_Enable_ColorMaterial(void) {TIS.colorMaterialEnabled = 1;}
-void Teapot_Disable_ColorMaterial(void) {TIS.colorMaterialEnabled = 0;}
+void Teapot_Enable_ColorMaterial(void) {TIS.colorMaterialEnabled = 1;Teapot_Private_SetGlobalUniformsDirty();}
+void Teapot_Disable_ColorMaterial(void) {TIS.colorMaterialEnabled = 0;Teapot_Private_SetGlobalUniformsDirty();}
 int Teapot_Get_ColorMaterial_Enabled(void) {return TIS.colorMaterialEnabled;}
 
 void Teapot_Enable_MeshOutline(void) {TIS.meshOutlineEnabled = 1;}
@@ -2099,9 +3179,75 @@ void Teapot_Set_MeshOutline_Params(float polygonOffsetSlope,float polygonOffsetC
     TIS.polygonOffsetSlope = polygonOffsetSlope;
     TIS.polygonOffsetConstant = polygonOffsetConstant;
 }
+void Teapot_Enable_MeshOutlinePass(void) {TIS.meshOutlinePassEnabled = 1;}
+void Teapot_Disable_MeshOutlinePass(void) {TIS.meshOutlinePassEnabled = 0;}
+int Teapot_Get_MeshOutlinePass_Enabled(void) {return TIS.meshOutlinePassEnabled;}
+
+
+static __inline int Teapot_Private_IsMultiMaterialMesh(TeapotMeshEnum meshId) {
+    switch (meshId) {
+    case TEAPOT_MESH_CAR:
+    case TEAPOT_MESH_CHARACTER:
+    case TEAPOT_MESH_GHOST:
+    case TEAPOT_MESH_FLIPPER_RIGHT:
+    case TEAPOT_MESH_FLIPPER_LEFT:
+    case TEAPOT_MESH_SLEDGE:
+    case TEAPOT_MESH_PIVOT3D:
+        return 1;
+    default:
+        return 0;
+    }
+}
+// Sets u_materialParams (it affects only the vertices with a_material>0)
+static __inline void Teapot_Private_SetMaterialParams(float paletteEnabled,float paletteAmbientMix,float paletteAmbientScale,float paletteSpecularMix) {
+    Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_MATERIAL_PARAMS,0,TIS.uLoc_materialParams,paletteEnabled,paletteAmbientMix,paletteAmbientScale,paletteSpecularMix);
+}
+// Palette colors behave like Teapot_SetColor(...) with the alpha of the current color
+static __inline void Teapot_Private_SetDefaultMaterialParams(void) {
+    const float cm = (float)TIS.colorMaterialEnabled;
+    Teapot_Private_SetMaterialParams(1.f,cm,0.25f,cm);
+}
+// Returns the LOD of meshId (0 is the full mesh) based on the projected radius of its (scaled) aabb. mMatrix is the model matrix (or the mvMatrix)
+// and vpMatrix the matrix that projects it (the vpMatrix or the pMatrix, or the ones of the light).
+static int Teapot_Private_SelectLod(TeapotMeshEnum meshId,const tpoat* vpMatrix,const tpoat* mMatrix,const float* scaling3) {
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    const tpoat* v = vpMatrix;const tpoat* m = mMatrix;
+    tpoat c[3],h[3],p[3],w,axisScale2=0,tmp,size;
+    int i,lod;
+    if (TIS.lodNumInds[meshId][1]==0) return 0;
+    for (i=0;i<3;i++) {
+        c[i] = (TIS.aabbMin[meshId][i]+TIS.aabbMax[meshId][i])*(tpoat)0.5*scaling3[i];
+        h[i] = (TIS.aabbMax[meshId][i]-TIS.aabbMin[meshId][i])*(tpoat)0.5*scaling3[i];
+    }
+    for (i=0;i<3;i++) {
+        p[i] = m[i]*c[0]+m[4+i]*c[1]+m[8+i]*c[2]+m[12+i];
+        tmp = Teapot_Helper_Vector3Dot(&m[4*i],&m[4*i]);
+        if (axisScale2<tmp) axisScale2=tmp;
+    }
+    w = v[3]*p[0]+v[7]*p[1]+v[11]*p[2]+v[15];
+    if (w<=0) return 0;
+    size = sqrt(Teapot_Helper_Vector3Dot(h,h)*axisScale2*(v[1]*v[1]+v[5]*v[5]+v[9]*v[9]))/w;    // projected radius (1 = half the viewport height)
+    for (lod=0;lod<TEAPOT_NUM_MESH_LODS-1 && size<TIS.lodThresholds[lod];lod++) {}
+    while (lod>0 && TIS.lodNumInds[meshId][lod]==0) --lod;
+    return lod;
+#   else //TEAPOT_ENABLE_MESH_LODS
+    (void)meshId;(void)vpMatrix;(void)mMatrix;(void)scaling3;
+    return 0;
+#   endif //TEAPOT_ENABLE_MESH_LODS
+}
+// Index range of a LOD of meshId (the index type is always TIS.indsType[meshId])
+static __inline void Teapot_Private_GetLodRange(TeapotMeshEnum meshId,int lod,int* numIndsOut,size_t* indsOffsetOut) {
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    if (lod>0) {*numIndsOut = TIS.lodNumInds[meshId][lod];*indsOffsetOut = TIS.lodIndsOffset[meshId][lod];return;}
+#   else //TEAPOT_ENABLE_MESH_LODS
+    (void)lod;
+#   endif //TEAPOT_ENABLE_MESH_LODS
+    *numIndsOut = TIS.numInds[meshId];*indsOffsetOut = TIS.indsOffset[meshId];
+}
 
-
-void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
+// 'precomputedNCoefficients' (optional) come from Teapot_MeshData_CalculateMvMatrixFromArray(...) or Teapot_Scene_CalculateMvMatrices(...): when not NULL the object is already frustum culled and they are the accurate normal coefficients
+// 'precomputedBiasedShadowMvpMatrix' (can be NULL) is used only with TEAPOT_SHADER_USE_SHADOW_MAP
+static void Teapot_Private_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId, const float* precomputedNCoefficients, const tpoat* precomputedBiasedShadowMvpMatrix)    {
     if (meshId==TEAPOT_MESH_COUNT) return;
     else if (meshId == TEAPOT_MESH_CAPSULE)  {
         // We don't want to draw "scaled" capsules. Instead we want to regenerate valid capsules, reinterpreting Teapot_SetScaling(...)
@@ -2143,7 +3289,7 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
     }
 
 #   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
-    if (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z) {
+    if (!precomputedNCoefficients && (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z)) {
         const float scaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
         const float aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
         const float aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
@@ -2162,7 +3308,8 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
 
 #   ifdef TEAPOT_SHADER_USE_ACCURATE_NORMALS
 #   ifndef TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU
-    {
+    if (precomputedNCoefficients) Teapot_Private_Uniform3fv(TEAPOT_UNIFORM_SLOT_NCOEFFICIENTS,TIS.uLoc_nCoefficients,precomputedNCoefficients);
+    else {
         // We must calculate and sent u_nCoefficients: https://lxjk.github.io/2017/10/01/Stop-Using-Normal-Matrix.html
         const tpoat* m = mvMatrix;
         const float scaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
@@ -2171,21 +3318,27 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
             (tpoat)1/(Teapot_Helper_Vector3Dot(&m[4],&m[4])*(tpoat)scaling[1]),
             (tpoat)1/(Teapot_Helper_Vector3Dot(&m[8],&m[8])*(tpoat)scaling[2])
         };
-        glUniform3f(TIS.uLoc_nCoefficients,(float)nCoeff[0],(float)nCoeff[1],(float)nCoeff[2]);
+        const float fnCoeff[3] = {(float)nCoeff[0],(float)nCoeff[1],(float)nCoeff[2]};
+        Teapot_Private_Uniform3fv(TEAPOT_UNIFORM_SLOT_NCOEFFICIENTS,TIS.uLoc_nCoefficients,fnCoeff);
     }
 #   endif //TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU
 #   endif //TEAPOT_SHADER_USE_ACCURATE_NORMALS
+    (void)precomputedNCoefficients; // (unused when both TEAPOT_ENABLE_FRUSTUM_CULLING and the CPU side TEAPOT_SHADER_USE_ACCURATE_NORMALS are compiled out)
 
 
 #   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
-    {
+    if (precomputedBiasedShadowMvpMatrix) Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_BIASED_SHADOW_MVP_MATRIX,TIS.uLoc_biasedShadowMvpMatrix,precomputedBiasedShadowMvpMatrix);
+    else {
     tpoat tmp[16];
     Teapot_Helper_MultMatrix(tmp,TIS.biasedShadowVpMatrix,mvMatrix);
-    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_biasedShadowMvpMatrix,1,GL_FALSE,tmp);
+    Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_BIASED_SHADOW_MVP_MATRIX,TIS.uLoc_biasedShadowMvpMatrix,tmp);
     }
-#   endif
+#   else //TEAPOT_SHADER_USE_SHADOW_MAP
+    (void)precomputedBiasedShadowMvpMatrix;
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
 
-    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE,mvMatrix);
+    Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mvMatrix);
+    Teapot_Private_SetDequantization(meshId);
 
     if (meshId<TEAPOT_FIRST_MESHLINES_INDEX) {
         if (meshId == TEAPOT_MESH_PIVOT3D) {
@@ -2197,12 +3350,10 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
             const tpoat charScale = 0.1f;
             const tpoat cp[3]={0.56f*TIS.scaling[0],0.05f*TIS.scaling[1],0.f*TIS.scaling[2]};
 
-            // [ 0-30] 30 tri-faces: Center   (0.875,0.875,0.000)
-            // [30-54] 24 tri-faces: ArrowX   (0.875,0.000,0.000)
-            // [54-78] 24 tri-faces: ArrowY   (0.000,0.875,0.000)
-            // [78-102]24 tri-faces: Arrow>   (0.000,0.000,0.875)
-            int startInds = TIS.startInds[meshId];
-            const int numInds[4] = {90,72,72,72};
+            // [ 0-30] 30 tri-faces: Center   (material 0: TIS.color)
+            // [30-54] 24 tri-faces: ArrowX   (material 7: 0.875,0.000,0.000)
+            // [54-78] 24 tri-faces: ArrowY   (material 8: 0.000,0.875,0.000)
+            // [78-102]24 tri-faces: Arrow>   (material 9: 0.000,0.000,0.875)
             float brightness = (0.35f*TIS.color[0]+0.5f*TIS.color[1]+0.15f*TIS.color[2])*1.25f;
             if (brightness>1.f) brightness=1.f;
 
@@ -2211,61 +3362,52 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
                 const int mustUsePolygonOffset = (TIS.polygonOffsetSlope!=0 && TIS.polygonOffsetConstant!=0) ? 1 : 0;
                 const float opacity = TIS.color[3]<1 ? (TIS.colorMeshOutline[3]>TIS.color[3]?(TIS.color[3]*0.7f):(TIS.colorMeshOutline[3]*0.7f)) : TIS.colorMeshOutline[3];
 
-                if (mustUsePolygonOffset) {glEnable(GL_POLYGON_OFFSET_FILL);glPolygonOffset( TIS.polygonOffsetSlope, TIS.polygonOffsetConstant);}
-                glFrontFace(GL_CW);
+                if (mustUsePolygonOffset) {Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,1);Teapot_Private_PolygonOffset( TIS.polygonOffsetSlope, TIS.polygonOffsetConstant);}
+                Teapot_Private_FrontFace(GL_CW);
                 Teapot_SetScaling(pushScaling[0]*TIS.scalingMeshOutline,pushScaling[1]*TIS.scalingMeshOutline,pushScaling[2]*TIS.scalingMeshOutline);
-                glUniform4f(TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
-                glUniform4f(TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],opacity);
-
-                //Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mvMatrix);
-                glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
-                if (TIS.color[3]<opacity) glUniform4f(TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]);
-                glFrontFace(GL_CCW);
-                if (mustUsePolygonOffset) glDisable(GL_POLYGON_OFFSET_FILL);
+                Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
+                Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],opacity);
+                Teapot_Private_SetMaterialParams(0.f,0.f,0.f,0.f);
+
+                //Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mvMatrix);
+                glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],TIS.indsType[meshId],(const void*) TIS.indsOffset[meshId]);
+                if (TIS.color[3]<opacity) Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]);
+                Teapot_Private_FrontFace(GL_CCW);
+                if (mustUsePolygonOffset) Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,0);
             }
 
-            //glUniform4f(TIS.uLoc_colorAmbient,0.875,0.875,0,0);
-            glUniform4f(TIS.uLoc_colorAmbient,TIS.color[0],TIS.color[1],TIS.color[2],0);
-            glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-            startInds+=numInds[0];
-
-            glUniform4f(TIS.uLoc_colorAmbient,0.875*brightness,0,0,0);
-            glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-            startInds+=numInds[1];
-
-            glUniform4f(TIS.uLoc_colorAmbient,0,0.875*brightness,0,0);
-            glDrawElements(GL_TRIANGLES,numInds[2],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-            startInds+=numInds[2];
-
-            glUniform4f(TIS.uLoc_colorAmbient,0,0,0.875*brightness,0);
-            glDrawElements(GL_TRIANGLES,numInds[3],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-            startInds+=numInds[3];
-            //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
+            // unlit: the ambient color of the arrows is their palette color scaled by 'brightness'
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.color[0],TIS.color[1],TIS.color[2],0);
+            Teapot_Private_SetMaterialParams(1.f,1.f,brightness,0.f);
+            glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],TIS.indsType[meshId],(const void*) TIS.indsOffset[meshId]);
 
             Teapot_SetScaling(pushScaling[0]*charScale,pushScaling[1]*charScale,pushScaling[2]*charScale);
 #           ifndef TEAPOT_NO_MESH_TEXT_X
-            glUniform4f(TIS.uLoc_colorAmbient,0.875,0,0,0);
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,0.875,0,0,0);
             mv[12] = T[0] + cp[0]*mvMatrix[0] + cp[1]*mvMatrix[4] + cp[2]*mvMatrix[8];
             mv[13] = T[1] + cp[0]*mvMatrix[1] + cp[1]*mvMatrix[5] + cp[2]*mvMatrix[9];
             mv[14] = T[2] + cp[0]*mvMatrix[2] + cp[1]*mvMatrix[6] + cp[2]*mvMatrix[10];
-            Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mv);
-            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_X],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[TEAPOT_MESH_TEXT_X]*sizeof(unsigned short)));
+            Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mv);
+            Teapot_Private_SetDequantization(TEAPOT_MESH_TEXT_X);
+            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_X],TIS.indsType[TEAPOT_MESH_TEXT_X],(const void*) TIS.indsOffset[TEAPOT_MESH_TEXT_X]);
 #           endif //TEAPOT_NO_MESH_TEXT_X
 #           ifndef TEAPOT_NO_MESH_TEXT_Y
-            glUniform4f(TIS.uLoc_colorAmbient,0,0.875,0,0);
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,0,0.875,0,0);
             mv[12] = T[0] + cp[1]*mvMatrix[0] + cp[0]*mvMatrix[4] + cp[2]*mvMatrix[8];
             mv[13] = T[1] + cp[1]*mvMatrix[1] + cp[0]*mvMatrix[5] + cp[2]*mvMatrix[9];
             mv[14] = T[2] + cp[1]*mvMatrix[2] + cp[0]*mvMatrix[6] + cp[2]*mvMatrix[10];
-            Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mv);
-            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_Y],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[TEAPOT_MESH_TEXT_Y]*sizeof(unsigned short)));
+            Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mv);
+            Teapot_Private_SetDequantization(TEAPOT_MESH_TEXT_Y);
+            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_Y],TIS.indsType[TEAPOT_MESH_TEXT_Y],(const void*) TIS.indsOffset[TEAPOT_MESH_TEXT_Y]);
 #           endif //TEAPOT_NO_MESH_TEXT_Y
 #           ifndef TEAPOT_NO_MESH_TEXT_Z
-            glUniform4f(TIS.uLoc_colorAmbient,0,0.0,875,0);
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,0,0.0,875,0);
             mv[12] = T[0] + cp[2]*mvMatrix[0] + cp[1]*mvMatrix[4] + cp[0]*mvMatrix[8];
             mv[13] = T[1] + cp[2]*mvMatrix[1] + cp[1]*mvMatrix[5] + cp[0]*mvMatrix[9];
             mv[14] = T[2] + cp[2]*mvMatrix[2] + cp[1]*mvMatrix[6] + cp[0]*mvMatrix[10];
-            Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mv);
-            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_Z],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[TEAPOT_MESH_TEXT_Z]*sizeof(unsigned short)));
+            Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mv);
+            Teapot_Private_SetDequantization(TEAPOT_MESH_TEXT_Z);
+            glDrawElements(GL_TRIANGLES,TIS.numInds[TEAPOT_MESH_TEXT_Z],TIS.indsType[TEAPOT_MESH_TEXT_Z],(const void*) TIS.indsOffset[TEAPOT_MESH_TEXT_Z]);
 #           endif //TEAPOT_NO_MESH_TEXT_Z
 
 
@@ -2274,19 +3416,17 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
 #           endif //TEAPOT_NO_MESH_PIVOT3D
         }
         else    {
+            int lodNumInds;size_t lodIndsOffset;
+            Teapot_Private_GetLodRange(meshId,Teapot_Private_SelectLod(meshId,TIS.pMatrix,mvMatrix,TIS.scaling),&lodNumInds,&lodIndsOffset);
             if (TIS.meshOutlineEnabled && TIS.colorMeshOutline[3]>0)
             {
                 const float pushColorAmbient[4] = {TIS.colorAmbient[0],TIS.colorAmbient[1],TIS.colorAmbient[2],TIS.colorAmbient[3]};
                 const float pushScaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
                 const int mustUsePolygonOffset = (TIS.polygonOffsetSlope!=0 && TIS.polygonOffsetConstant!=0) ? 1 : 0;
                 const float opacity = TIS.color[3]<1 ? (TIS.colorMeshOutline[3]>TIS.color[3]?(TIS.color[3]*0.7f):(TIS.colorMeshOutline[3]*0.7f)) : TIS.colorMeshOutline[3];
-                int numInds = TIS.numInds[meshId];
-#               ifdef TEAPOT_NO_MESH_CAR_WHEELS
-                if (meshId==TEAPOT_MESH_CAR) numInds-=360;
-#               endif
 
-                if (mustUsePolygonOffset) {glEnable(GL_POLYGON_OFFSET_FILL);glPolygonOffset( TIS.polygonOffsetSlope, TIS.polygonOffsetConstant);}
-                glFrontFace(GL_CW);
+                if (mustUsePolygonOffset) {Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,1);Teapot_Private_PolygonOffset( TIS.polygonOffsetSlope, TIS.polygonOffsetConstant);}
+                Teapot_Private_FrontFace(GL_CW);
 #               ifdef TEAPOT_CENTER_MESHES_ON_FLOOR
                 if (meshId<TEAPOT_MESH_HALF_SPHERE_UP && TIS.scalingMeshOutline>1)  {
                     tpoat mv[16];int i;
@@ -2295,25 +3435,26 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
                     mv[12]+= cpY*mvMatrix[4];
                     mv[13]+= cpY*mvMatrix[5];
                     mv[14]+= cpY*mvMatrix[6];
-                    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mv);
+                    Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mv);
                 }
 #               endif
                 Teapot_SetScaling(pushScaling[0]*TIS.scalingMeshOutline,pushScaling[1]*TIS.scalingMeshOutline,pushScaling[2]*TIS.scalingMeshOutline);
-                glUniform4f(TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
-                glUniform4f(TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],opacity);
+                Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
+                Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],opacity);
+                if (Teapot_Private_IsMultiMaterialMesh(meshId)) Teapot_Private_SetMaterialParams(0.f,0.f,0.f,0.f);
 
-                glDrawElements(GL_TRIANGLES,numInds,GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
-                glFrontFace(GL_CCW);
-                if (mustUsePolygonOffset) glDisable(GL_POLYGON_OFFSET_FILL);
+                glDrawElements(GL_TRIANGLES,lodNumInds,TIS.indsType[meshId],(const void*) lodIndsOffset);
+                Teapot_Private_FrontFace(GL_CCW);
+                if (mustUsePolygonOffset) Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,0);
 
                 // This draws a wireframe mesh over the mesh (and works)
                 /*glEnable(  GL_POLYGON_OFFSET_LINE );
         glPolygonOffset( -2.5f, -2.5f );
         glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-        glUniform4f(TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
-        glUniform4f(TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.colorMeshOutline[3]);
-        Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mvMatrix);
-        glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
+        Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
+        Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.colorMeshOutline[3]);
+        Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mvMatrix);
+        glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],TIS.indsType[meshId],(const void*) TIS.indsOffset[meshId]);
         glDisable(GL_POLYGON_OFFSET_LINE);
         glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );*/
 
@@ -2321,149 +3462,50 @@ void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {
 
                 Teapot_SetScaling(pushScaling[0],pushScaling[1],pushScaling[2]);
                 Teapot_SetColorAmbient(pushColorAmbient[0],pushColorAmbient[1],pushColorAmbient[2]);
-                if (TIS.color[3]<opacity) glUniform4f(TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]);
+                if (TIS.color[3]<opacity) Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]);
 #               ifdef TEAPOT_CENTER_MESHES_ON_FLOOR
-                Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix,1,GL_FALSE, mvMatrix);
+                Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mvMatrix);
 #               endif
             }
-            switch (meshId) {
-            case TEAPOT_MESH_CAR:   {
-                int startInds = TIS.startInds[meshId];
-                const int numInds[3] = {156,24,         // Chassis, Glass, Black
-#               ifdef TEAPOT_NO_MESH_CAR_WHEELS
-                204                                     // Black:	204 inds
-#               else
-                564                                     // Wheels:	360 inds
-#               endif
-                };
-                const float pushColor[4] = {TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]};
-
-                glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[0];
+            // multi-material meshes (e.g. TEAPOT_MESH_CAR) are drawn with a single call too: see TeapotMultiMaterialMeshes
+            if (Teapot_Private_IsMultiMaterialMesh(meshId)) Teapot_Private_SetDefaultMaterialParams();
+            glDrawElements(GL_TRIANGLES,lodNumInds,TIS.indsType[meshId],(const void*) lodIndsOffset);
+        }
+    }
+    else {
+        const float pushColorAmbient[4] = {TIS.colorAmbient[0],TIS.colorAmbient[1],TIS.colorAmbient[2],TIS.colorAmbient[3]};
+        Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.color[0],TIS.color[1],TIS.color[2],0);
+        glDrawElements(GL_LINES,TIS.numInds[meshId],TIS.indsType[meshId],(const void*) TIS.indsOffset[meshId]);
+        Teapot_SetColorAmbient(pushColorAmbient[0],pushColorAmbient[1],pushColorAmbient[2]);
+    }
 
-                Teapot_SetColor(0.074895f,0.62175f,0.64f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[1];
+}
 
-                Teapot_SetColor(0.f,0.f,0.f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[2],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[2];
-                //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
+void Teapot_Draw_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId)    {Teapot_Private_Draw_Mv(mvMatrix,meshId,NULL,NULL);}
 
-                Teapot_SetColor(pushColor[0],pushColor[1],pushColor[2],pushColor[3]);
-            }
-            break;
-            case TEAPOT_MESH_CHARACTER:   {
-                int startInds = TIS.startInds[meshId];
-                const int numInds[3] = {327,216,183};       // Outfit, Black, Skin
-                const float pushColor[4] = {TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]};
+void Teapot_Draw_MvFloat(const float mvMatrix[16], TeapotMeshEnum meshId)    {
+#   ifndef TEAPOT_USE_DOUBLE_PRECISION
+    Teapot_Draw_Mv(mvMatrix,meshId);
+#   else
+    tpoat tmp[16];Teapot_Helper_ConvertMatrixf2d16(tmp,mvMatrix);
+    Teapot_Draw_Mv(tmp,meshId);
+#   endif
+}
 
-                glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[0];
+void Teapot_Draw(const tpoat mMatrix[16], TeapotMeshEnum meshId) {
+    tpoat mvMatrix[16]; // mvMatrix = vMatrix * mMatrix;
+    if (meshId==TEAPOT_MESH_COUNT) return;
+    Teapot_Helper_MultMatrix(mvMatrix,TIS.vMatrix,mMatrix);
+    Teapot_Draw_Mv(mvMatrix,meshId);
+}
 
-                Teapot_SetColor(0.02f,0.02f,0.02f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[1];
 
-                Teapot_SetColor(0.740000f,0.562612f,0.399372f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[2],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[2];
-                //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
-
-                Teapot_SetColor(pushColor[0],pushColor[1],pushColor[2],pushColor[3]);
-            }
-            break;
-            case TEAPOT_MESH_GHOST:   {
-                int startInds = TIS.startInds[meshId];
-                const int numInds[3] = {558,48,24};       // Color, White, Black
-                const float pushColor[4] = {TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]};
-
-                glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[0];
-
-                Teapot_SetColor(0.9f,0.9f,0.9f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[1];
-
-                Teapot_SetColor(0.02f,0.02f,0.02f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[2],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[2];
-                //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
-
-                Teapot_SetColor(pushColor[0],pushColor[1],pushColor[2],pushColor[3]);
-            }
-            break;
-            case TEAPOT_MESH_FLIPPER_RIGHT:
-            case TEAPOT_MESH_FLIPPER_LEFT:  {
-                int startInds = TIS.startInds[meshId];
-                const int numInds[2] = {384,180};       // Rubber, White
-                const float pushColor[4] = {TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]};
-
-                glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[0];
-
-                Teapot_SetColor(0.9f,0.9f,0.9f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[1];
-                //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
-
-                Teapot_SetColor(pushColor[0],pushColor[1],pushColor[2],pushColor[3]);
-            }
-            break;
-            case TEAPOT_MESH_SLEDGE: {
-                int startInds = TIS.startInds[meshId];
-                const int numInds[2] = {68*3,144*3};
-                const float pushColor[4] = {TIS.color[0],TIS.color[1],TIS.color[2],TIS.color[3]};
-
-                glDrawElements(GL_TRIANGLES,numInds[0],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[0];
-
-                Teapot_SetColor(0.9f,0.9f,0.f,pushColor[3]);
-                glDrawElements(GL_TRIANGLES,numInds[1],GL_UNSIGNED_SHORT,(const void*) (startInds*sizeof(unsigned short)));
-                startInds+=numInds[1];
-                //if (startInds!=TIS.startInds[meshId]+TIS.numInds[meshId]) {printf("ERROR: startInds(=%d)!=TIS.startInds[%d](=%d)+TIS.numInds[%d](=%d)\n",startInds,(int)meshId,TIS.startInds[meshId],(int)meshId,TIS.numInds[meshId]);exit(1);}
-
-                Teapot_SetColor(pushColor[0],pushColor[1],pushColor[2],pushColor[3]);
-            }            
-            break;
-            default:
-                glDrawElements(GL_TRIANGLES,TIS.numInds[meshId],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
-            break;
-            }
-        }
-    }
-    else {
-        const float pushColorAmbient[4] = {TIS.colorAmbient[0],TIS.colorAmbient[1],TIS.colorAmbient[2],TIS.colorAmbient[3]};
-        glUniform4f(TIS.uLoc_colorAmbient,TIS.color[0],TIS.color[1],TIS.color[2],0);
-        glDrawElements(GL_LINES,TIS.numInds[meshId],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
-        Teapot_SetColorAmbient(pushColorAmbient[0],pushColorAmbient[1],pushColorAmbient[2]);
-    }
-
-}
-
-void Teapot_Draw_MvFloat(const float mvMatrix[16], TeapotMeshEnum meshId)    {
-#   ifndef TEAPOT_USE_DOUBLE_PRECISION
-    Teapot_Draw_Mv(mvMatrix,meshId);
-#   else
-    tpoat tmp[16];Teapot_Helper_ConvertMatrixf2d16(tmp,mvMatrix);
-    Teapot_Draw_Mv(tmp,meshId);
-#   endif
-}
-
-void Teapot_Draw(const tpoat mMatrix[16], TeapotMeshEnum meshId) {
-    tpoat mvMatrix[16]; // mvMatrix = vMatrix * mMatrix;
-    if (meshId==TEAPOT_MESH_COUNT) return;
-    Teapot_Helper_MultMatrix(mvMatrix,TIS.vMatrix,mMatrix);
-    Teapot_Draw_Mv(mvMatrix,meshId);
-}
-
-
-void Teapot_DrawAabb_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId, const float *scaling3)   {
-    // user should set color and line width before the call (scaling is discarded)
-    if (meshId<TEAPOT_MESH_PIVOT3D) {
-        float pushScaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
-        float scaling[3],userScaling[3],aabb[3],center[3];
-        tpoat mat[16];int k;
+void Teapot_DrawAabb_Mv(const tpoat mvMatrix[16], TeapotMeshEnum meshId, const float *scaling3)   {
+    // user should set color and line width before the call (scaling is discarded)
+    if (meshId<TEAPOT_MESH_PIVOT3D) {
+        float pushScaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
+        float scaling[3],userScaling[3],aabb[3],center[3];
+        tpoat mat[16];int k;
 
         // Fill 'userScaling':
         if (scaling3) {userScaling[0]=scaling3[0];userScaling[1]=scaling3[1];userScaling[2]=scaling3[2];}
@@ -2518,132 +3560,1898 @@ void Teapot_DrawAabb(const tpoat mMatrix[16],TeapotMeshEnum meshId,const float*
 
 void Teapot_LowLevel_StartDisablingLighting(void) {
     TIS.colorAmbient[0]=TIS.colorAmbient[1]=TIS.colorAmbient[2]=0.8f;TIS.colorAmbient[3]=0.f;
-    glUniform4fv(TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
 }
 
 void Teapot_LowLevel_SetMvMatrixUniform(const tpoat mvMatrix[16])   {
-    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_mvMatrix, 1 /*only setting 1 matrix*/, GL_FALSE /*transpose?*/, mvMatrix);
+    Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mvMatrix);
+}
+void Teapot_LowLevel_SetMvMatrixUniformFloat(const float mvMatrix[16]) {
+#   ifdef TEAPOT_USE_DOUBLE_PRECISION
+    tpoat tmp[16];Teapot_Helper_ConvertMatrixf2d16(tmp,mvMatrix);
+    Teapot_LowLevel_SetMvMatrixUniform(tmp);
+#   else
+    Teapot_LowLevel_SetMvMatrixUniform(mvMatrix);
+#   endif
+}
+void Teapot_LowLevel_SetMeshUniforms(TeapotMeshEnum meshId)    {
+    if (Teapot_Private_IsMultiMaterialMesh(meshId)) Teapot_Private_SetDefaultMaterialParams();
+    Teapot_Private_SetDequantization(meshId);
+}
+void Teapot_LowLevel_DrawElements(TeapotMeshEnum meshId)    {
+    glDrawElements(meshId<TEAPOT_FIRST_MESHLINES_INDEX ? GL_TRIANGLES : GL_LINES,TIS.numInds[meshId],TIS.indsType[meshId],(const void*) TIS.indsOffset[meshId]);
+}
+
+void Teapot_LowLevel_StopDisablingLighting(void) {
+    TIS.colorAmbient[0]=TIS.colorAmbient[1]=TIS.colorAmbient[2]=0.25f;TIS.colorAmbient[3]=1.f;
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
+}
+
+void Teapot_PostDraw(void)  {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Private_InvalidateBindings(0);
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+    if (!Teapot_Private_UnbindVertexArray()) {
+        glDisableVertexAttribArray(TIS.aLoc_vertex);
+        glDisableVertexAttribArray(TIS.aLoc_normal);
+        glDisableVertexAttribArray(TIS.aLoc_material);
+    }
+}
+
+#ifdef TEAPOT_ENABLE_STATE_CACHE
+void Teapot_Invalidate_StateCache(void) {
+    Teapot_Private_InvalidateBindings(TIS.stateCache.bindingsValid);
+    Teapot_Private_InvalidateUniforms();
+}
+void Teapot_Get_StateCache_Counters(unsigned* numIssuedGLCallsOut,unsigned* numElidedGLCallsOut)   {
+    if (numIssuedGLCallsOut) *numIssuedGLCallsOut = TIS.stateCache.numIssuedGLCalls;
+    if (numElidedGLCallsOut) *numElidedGLCallsOut = TIS.stateCache.numElidedGLCalls;
+}
+void Teapot_Reset_StateCache_Counters(void) {TIS.stateCache.numIssuedGLCalls = TIS.stateCache.numElidedGLCalls = 0;}
+#endif //TEAPOT_ENABLE_STATE_CACHE
+#ifdef TEAPOT_ENABLE_MESH_LODS
+void Teapot_Set_MeshLod_Thresholds(const float thresholds[TEAPOT_NUM_MESH_LODS-1]) {int i;for (i=0;i<TEAPOT_NUM_MESH_LODS-1;i++) TIS.lodThresholds[i]=thresholds[i];}
+void Teapot_Get_MeshLod_Thresholds(float thresholdsOut[TEAPOT_NUM_MESH_LODS-1]) {int i;for (i=0;i<TEAPOT_NUM_MESH_LODS-1;i++) thresholdsOut[i]=TIS.lodThresholds[i];}
+int Teapot_Get_MeshLod_NumLevels(TeapotMeshEnum meshId) {
+    int n = 1;
+    while (n<TEAPOT_NUM_MESH_LODS && TIS.lodNumInds[meshId][n]>0) ++n;
+    return n;
+}
+int Teapot_Get_MeshLod_NumTriangles(TeapotMeshEnum meshId,int lod) {
+    if (lod<=0) return TIS.numInds[meshId]/3;
+    return lod<TEAPOT_NUM_MESH_LODS ? TIS.lodNumInds[meshId][lod]/3 : 0;
+}
+#endif //TEAPOT_ENABLE_MESH_LODS
+#ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+void Teapot_Get_VertexCache_ACMR(TeapotMeshEnum meshId,float* acmrBeforeOut,float* acmrAfterOut)  {
+    if (acmrBeforeOut) *acmrBeforeOut = TIS.acmr[meshId][0];
+    if (acmrAfterOut) *acmrAfterOut = TIS.acmr[meshId][1];
+}
+#endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+
+
+int Teapot_MeshData_Depth_Sorter(const void* pmd0,const void* pmd1) {
+    const Teapot_MeshData* md0 = *((const Teapot_MeshData* const*) (pmd0));
+    const Teapot_MeshData* md1 = *((const Teapot_MeshData* const*) (pmd1));
+    if (md0->color[3]<1.f)   {
+        if (md1->color[3]<1.f) return md1->mvMatrix[14]>md0->mvMatrix[14]?-1:1;
+        else return 1;
+    }
+    else if (md1->color[3]<1.f) return -1;
+    else return md1->mvMatrix[14]<md0->mvMatrix[14]?-1:1;   // optional new line: opaque object sorted front to back
+    return 0;
+}
+
+// Sort key (from MSB to LSB): [1 bit: transparent] [24 bits: quantized view depth (reversed for opaque objects)] [7 bits: meshId] [32 bits: material hash]
+#define TEAPOT_SORTKEY_DEPTH_BITS   (24)
+#define TEAPOT_SORTKEY_DEPTH_MAX    ((1<<TEAPOT_SORTKEY_DEPTH_BITS)-1)
+static __inline unsigned int Teapot_Private_MeshData_MaterialHash(const Teapot_MeshData* md)  {
+    // FNV-1a over the color bits
+    const unsigned char* p = (const unsigned char*) md->color;
+    unsigned int h = 2166136261U;int i;
+    for (i=0;i<(int)sizeof(md->color);i++) {h^=p[i];h*=16777619U;}
+    p = (const unsigned char*) md->colorAmbient;
+    for (i=0;i<(int)sizeof(md->colorAmbient);i++) {h^=p[i];h*=16777619U;}
+    return h;
+}
+static __inline unsigned long long Teapot_Private_MakeSortKey(int transparent,tpoat z,tpoat zMin,tpoat zMax,tpoat depthScale,int meshId,unsigned int materialHash)  {
+    // the camera looks at -Z: closer objects have bigger mvMatrix[14]
+    unsigned long long depth = (unsigned long long) (transparent ? ((z-zMin)*depthScale) : ((zMax-z)*depthScale));
+    if (depth>TEAPOT_SORTKEY_DEPTH_MAX) depth=TEAPOT_SORTKEY_DEPTH_MAX;
+    return ((unsigned long long)(transparent?1:0)<<63) | (depth<<(63-TEAPOT_SORTKEY_DEPTH_BITS)) | ((unsigned long long)(meshId&0x7F)<<32) | (unsigned long long)materialHash;
+}
+// Grows TIS.sortKeys, TIS.sortIndices and TIS.sortMeshes. Returns 0 when out of memory
+static int Teapot_Private_ReserveSortBuffers(int numKeys) {
+    if (TIS.sortCapacity<numKeys) {
+        // Every buffer grows on its own: if one realloc(...) fails, the others are still valid (and TIS.sortCapacity is unchanged)
+        const int capacity = numKeys + numKeys/2;
+        void* p;
+        if (!(p = realloc(TIS.sortKeys,2*capacity*sizeof(unsigned long long)))) return 0;
+        TIS.sortKeys = (unsigned long long*) p;
+        if (!(p = realloc(TIS.sortIndices,2*capacity*sizeof(unsigned int)))) return 0;
+        TIS.sortIndices = (unsigned int*) p;
+        if (!(p = realloc(TIS.sortMeshes,capacity*sizeof(Teapot_MeshData*)))) return 0;
+        TIS.sortMeshes = (Teapot_MeshData**) p;
+        TIS.sortCapacity = capacity;
+    }
+    return 1;
+}
+// Sorts the first 'numKeys' TIS.sortKeys and returns the sorted indices (LSD radix sort: 8 bits per pass, passes where all the keys share the same byte are skipped)
+static const unsigned int* Teapot_Private_RadixSortKeys(int numKeys) {
+    unsigned int histograms[8][256];
+    unsigned long long *keys = TIS.sortKeys,*keysTmp = &TIS.sortKeys[TIS.sortCapacity];
+    unsigned int *inds = TIS.sortIndices,*indsTmp = &TIS.sortIndices[TIS.sortCapacity];
+    int i,pass;
+    memset(histograms,0,sizeof(histograms));
+    for (i=0;i<numKeys;i++) {
+        const unsigned long long key = keys[i];
+        inds[i] = (unsigned int) i;
+        for (pass=0;pass<8;pass++) ++histograms[pass][(key>>(pass*8))&0xFF];
+    }
+    for (pass=0;pass<8;pass++) {
+        unsigned int* h = histograms[pass];
+        unsigned int sum = 0, cnt;
+        const int shift = pass*8;
+        if (h[(keys[0]>>shift)&0xFF]==(unsigned int)numKeys) continue;
+        for (i=0;i<256;i++) {cnt=h[i];h[i]=sum;sum+=cnt;}
+        for (i=0;i<numKeys;i++) {
+            const unsigned int dst = h[(keys[i]>>shift)&0xFF]++;
+            keysTmp[dst] = keys[i];indsTmp[dst] = inds[i];
+        }
+        {unsigned long long* tk=keys;keys=keysTmp;keysTmp=tk;}
+        {unsigned int* ti=inds;inds=indsTmp;indsTmp=ti;}
+    }
+    return inds;
+}
+void Teapot_MeshData_RadixSort(Teapot_MeshData* const* meshes,int numMeshes) {
+    const unsigned int* inds;
+    tpoat zMin,zMax,depthScale;
+    int i;
+    Teapot_MeshData** pMeshes = (Teapot_MeshData**) meshes;
+    if (!meshes || numMeshes<2) return;
+    if (!Teapot_Private_ReserveSortBuffers(numMeshes)) {
+        fprintf(stderr,"Error in teapot.h: Teapot_MeshData_RadixSort(...) out of memory: using qsort(...) instead.\n");
+        qsort((void*)meshes,numMeshes,sizeof(Teapot_MeshData*),Teapot_MeshData_Depth_Sorter);
+        return;
+    }
+
+    // 1) view depth range
+    zMin = zMax = meshes[0]->mvMatrix[14];
+    for (i=1;i<numMeshes;i++) {
+        const tpoat z = meshes[i]->mvMatrix[14];
+        if (zMin>z) zMin=z;
+        else if (zMax<z) zMax=z;
+    }
+    depthScale = (zMax>zMin) ? ((tpoat)TEAPOT_SORTKEY_DEPTH_MAX/(zMax-zMin)) : (tpoat)0;
+
+    // 2) keys
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[i];
+        TIS.sortKeys[i] = Teapot_Private_MakeSortKey(md->color[3]<1.f,md->mvMatrix[14],zMin,zMax,depthScale,md->meshId,Teapot_Private_MeshData_MaterialHash(md));
+    }
+
+    // 3) sort
+    inds = Teapot_Private_RadixSortKeys(numMeshes);
+
+    // 4) permutation
+    memcpy(TIS.sortMeshes,meshes,numMeshes*sizeof(Teapot_MeshData*));
+    for (i=0;i<numMeshes;i++) pMeshes[i] = TIS.sortMeshes[inds[i]];
+}
+
+void Teapot_MeshData_Clear(Teapot_MeshData* md) {
+    Teapot_Helper_IdentityMatrix(md->mvMatrix);
+    md->color[0]=md->color[1]=md->color[2]=0.75f;md->color[3]=1.f;
+    md->colorAmbient[0]=md->colorAmbient[1]=md->colorAmbient[2]=0.25f;
+    md->colorSpecular[0]=md->colorSpecular[1]=md->colorSpecular[2]=0.8f;md->colorSpecular[3]=20.f;
+    md->scaling[0]=md->scaling[1]=md->scaling[2]=1.f;
+    md->outlineEnabled = 0;md->active=1;
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    md->staticShadowCaster = 0;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    md->visible = 1;md->nCoefficients[0]=md->nCoefficients[1]=md->nCoefficients[2]=1.f;
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    md->transformVersion = 0;md->calculatedVersions[0]=md->calculatedVersions[1]=0;    // (TIS.viewVersion is never 0)
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+#   ifndef TEAPOT_MESHDATA_STRUCT_EXTRA_FIELDS
+    md->userPtr=0;
+#   endif
+}
+#ifdef __cplusplus
+_Teapot_MeshData::_Teapot_MeshData() {Teapot_MeshData_Clear(this);}
+#endif
+#ifndef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_MeshData_SetMvMatrix(Teapot_MeshData* md, const tpoat* mvMatrix16) {Teapot_Helper_CopyMatrix(md->mvMatrix,mvMatrix16);}
+#ifndef TEAPOT_MESHDATA_HAS_MMATRIX_PTR
+void Teapot_MeshData_SetMMatrix(Teapot_MeshData* md, const tpoat* mMatrix16) {Teapot_Helper_CopyMatrix(md->mMatrix,mMatrix16);}
+#endif //TEAPOT_MESHDATA_HAS_MMATRIX_PTR
+#else //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_MeshData_SetMvMatrix(Teapot_MeshData* md, const tpoat* mvMatrix16) {Teapot_Helper_CopyMatrix(md->mvMatrix,mvMatrix16);md->calculatedVersions[1]=0;}
+#ifndef TEAPOT_MESHDATA_HAS_MMATRIX_PTR
+void Teapot_MeshData_SetMMatrix(Teapot_MeshData* md, const tpoat* mMatrix16) {Teapot_Helper_CopyMatrix(md->mMatrix,mMatrix16);++md->transformVersion;}
+#endif //TEAPOT_MESHDATA_HAS_MMATRIX_PTR
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+// Per-object transform stage: mvMatrix, frustum culling and accurate normal coefficients
+// (Teapot_Private_CalculateFrameData(...) expects an already calculated mvMatrix)
+static __inline void Teapot_Private_CalculateFrameData(const tpoat* __restrict mvMatrix,TeapotMeshEnum meshId,const float* __restrict scaling3,int* __restrict visibleOut,float* __restrict nCoefficientsOut) {
+#   if (defined(TEAPOT_ENABLE_FRUSTUM_CULLING) || (defined(TEAPOT_SHADER_USE_ACCURATE_NORMALS) && !defined(TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU)))
+    const float scaling[3] = {scaling3[0]==0?1:scaling3[0],scaling3[1]==0?1:scaling3[1],scaling3[2]==0?1:scaling3[2]};
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    // Same as the test in Teapot_Draw_Mv(...) (TEAPOT_MESH_CAPSULE parts are culled separately there)
+    if (!visibleOut) {} // (culled later in batches: see Teapot_Private_CullBatch4(...))
+    else if (meshId<TEAPOT_MESH_COUNT && meshId!=TEAPOT_MESH_CAPSULE && (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z)) {
+        *visibleOut = Teapot_Helper_IsVisible(TIS.pMatrixFrustum,mvMatrix,
+                                              TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2],
+                                              TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]);
+    }
+    else *visibleOut = 1;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#       if (defined(TEAPOT_SHADER_USE_ACCURATE_NORMALS) && !defined(TEAPOT_SHADER_HINT_ACCURATE_NORMALS_GPU))
+    {
+        const tpoat* m = mvMatrix;
+        nCoefficientsOut[0] = (float) ((tpoat)1/(Teapot_Helper_Vector3Dot(&m[0],&m[0])*(tpoat)scaling[0]));
+        nCoefficientsOut[1] = (float) ((tpoat)1/(Teapot_Helper_Vector3Dot(&m[4],&m[4])*(tpoat)scaling[1]));
+        nCoefficientsOut[2] = (float) ((tpoat)1/(Teapot_Helper_Vector3Dot(&m[8],&m[8])*(tpoat)scaling[2]));
+    }
+#       endif
+#   endif
+    (void)mvMatrix;(void)meshId;(void)scaling3;(void)visibleOut;(void)nCoefficientsOut;
+}
+static __inline void Teapot_Private_MeshData_CalculateMvMatrixAndFrameData(Teapot_MeshData* md) {
+    Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);
+    Teapot_Private_CalculateFrameData(md->mvMatrix,md->meshId,md->scaling,&md->visible,md->nCoefficients);
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    md->calculatedVersions[0] = md->transformVersion;md->calculatedVersions[1] = TIS.viewVersion;
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+}
+void Teapot_MeshData_CalculateMvMatrix(Teapot_MeshData* md) {Teapot_Private_MeshData_CalculateMvMatrixAndFrameData(md);}
+
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+// Object space center and half extents of the (scaled) aabb of meshId. Returns 0 if meshId is never culled (same exceptions as Teapot_Private_CalculateFrameData(...))
+static __inline int Teapot_Private_GetCullingBox(TeapotMeshEnum meshId,const float* __restrict scaling3,tpoat* __restrict box6Out) {
+    int j;
+    if (meshId>=TEAPOT_MESH_COUNT || meshId==TEAPOT_MESH_CAPSULE || (meshId>=TEAPOT_MESH_TEXT_X && meshId<=TEAPOT_MESH_TEXT_Z)) return 0;
+    for (j=0;j<3;j++) {
+        const tpoat sca = (tpoat)(scaling3[j]==0?1:scaling3[j]);
+        box6Out[j] = (tpoat)(TIS.aabbMax[meshId][j]+TIS.aabbMin[meshId][j])*(tpoat)0.5*sca;
+        box6Out[3+j] = (tpoat)(TIS.aabbMax[meshId][j]-TIS.aabbMin[meshId][j])*(tpoat)0.5*(sca<0?-sca:sca);
+    }
+    return 1;
+}
+// Same test as Teapot_Helper_IsVisible(...) on 4 objects at once, using the center/half extents form of the OBB => AABB transformation
+// (the p-vertex of a plane gives: dot(plane,center)+dot(abs(plane),halfExtents)). Object k is described by mfMatrices16[k] and by &boxes24[6*k] (see Teapot_Private_GetCullingBox(...)).
+// Returns a 4-bit mask (bit k set if object k is visible). 'planes' can be any convex volume (numPlanes inward planes)
+static int Teapot_Private_CullBatch4(const tpoat (*planes)[4],int numPlanes,const tpoat* const mfMatrices16[4],const tpoat* __restrict boxes24) {
+    int i,k;
+#   if (defined(TEAPOT_USE_SIMD) && !defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__SSE__))
+    const __m128 signMask = _mm_set1_ps(-0.f),zero = _mm_setzero_ps();
+    __m128 c[4],e[4],visible = _mm_cmpeq_ps(zero,zero);
+    for (k=0;k<4;k++) {
+        const tpoat* m = mfMatrices16[k];const tpoat* b = &boxes24[6*k];
+        const __m128 col0 = _mm_loadu_ps(&m[0]),col1 = _mm_loadu_ps(&m[4]),col2 = _mm_loadu_ps(&m[8]),col3 = _mm_loadu_ps(&m[12]);
+        c[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col0,_mm_set1_ps(b[0])),_mm_mul_ps(col1,_mm_set1_ps(b[1]))),_mm_add_ps(_mm_mul_ps(col2,_mm_set1_ps(b[2])),col3));
+        e[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask,col0),_mm_set1_ps(b[3])),_mm_mul_ps(_mm_andnot_ps(signMask,col1),_mm_set1_ps(b[4]))),_mm_mul_ps(_mm_andnot_ps(signMask,col2),_mm_set1_ps(b[5])));
+    }
+    _MM_TRANSPOSE4_PS(c[0],c[1],c[2],c[3]);     // now c[0] holds the 4 x coordinates, c[1] the 4 y and c[2] the 4 z (same for e)
+    _MM_TRANSPOSE4_PS(e[0],e[1],e[2],e[3]);
+    for (i=0;i<numPlanes;i++) {
+        const tpoat* pl = planes[i];
+        const __m128 px = _mm_set1_ps(pl[0]),py = _mm_set1_ps(pl[1]),pz = _mm_set1_ps(pl[2]);
+        const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px,c[0]),_mm_mul_ps(py,c[1])),_mm_add_ps(_mm_mul_ps(pz,c[2]),_mm_set1_ps(pl[3])));
+        const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask,px),e[0]),_mm_mul_ps(_mm_andnot_ps(signMask,py),e[1])),_mm_mul_ps(_mm_andnot_ps(signMask,pz),e[2]));
+        visible = _mm_and_ps(visible,_mm_cmpge_ps(_mm_add_ps(dist,radius),zero));
+    }
+    return _mm_movemask_ps(visible);
+#   elif (defined(TEAPOT_USE_SIMD) && defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION) && defined(__AVX__))
+    const __m256d signMask = _mm256_set1_pd(-0.0),zero = _mm256_setzero_pd();
+    __m256d c[4],e[4],t[4],x,y,z,visible = _mm256_cmp_pd(zero,zero,_CMP_EQ_OQ);
+    for (k=0;k<4;k++) {
+        const tpoat* m = mfMatrices16[k];const tpoat* b = &boxes24[6*k];
+        const __m256d col0 = _mm256_loadu_pd(&m[0]),col1 = _mm256_loadu_pd(&m[4]),col2 = _mm256_loadu_pd(&m[8]),col3 = _mm256_loadu_pd(&m[12]);
+        c[k] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(col0,_mm256_set1_pd(b[0])),_mm256_mul_pd(col1,_mm256_set1_pd(b[1]))),_mm256_add_pd(_mm256_mul_pd(col2,_mm256_set1_pd(b[2])),col3));
+        e[k] = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_andnot_pd(signMask,col0),_mm256_set1_pd(b[3])),_mm256_mul_pd(_mm256_andnot_pd(signMask,col1),_mm256_set1_pd(b[4]))),_mm256_mul_pd(_mm256_andnot_pd(signMask,col2),_mm256_set1_pd(b[5])));
+    }
+    // 4x4 transposes (only x, y and z are needed)
+    t[0] = _mm256_unpacklo_pd(c[0],c[1]);t[1] = _mm256_unpackhi_pd(c[0],c[1]);t[2] = _mm256_unpacklo_pd(c[2],c[3]);t[3] = _mm256_unpackhi_pd(c[2],c[3]);
+    c[0] = _mm256_permute2f128_pd(t[0],t[2],0x20);c[1] = _mm256_permute2f128_pd(t[1],t[3],0x20);c[2] = _mm256_permute2f128_pd(t[0],t[2],0x31);
+    t[0] = _mm256_unpacklo_pd(e[0],e[1]);t[1] = _mm256_unpackhi_pd(e[0],e[1]);t[2] = _mm256_unpacklo_pd(e[2],e[3]);t[3] = _mm256_unpackhi_pd(e[2],e[3]);
+    e[0] = _mm256_permute2f128_pd(t[0],t[2],0x20);e[1] = _mm256_permute2f128_pd(t[1],t[3],0x20);e[2] = _mm256_permute2f128_pd(t[0],t[2],0x31);
+    for (i=0;i<numPlanes;i++) {
+        const tpoat* pl = planes[i];
+        __m256d dist,radius;
+        x = _mm256_set1_pd(pl[0]);y = _mm256_set1_pd(pl[1]);z = _mm256_set1_pd(pl[2]);
+        dist = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x,c[0]),_mm256_mul_pd(y,c[1])),_mm256_add_pd(_mm256_mul_pd(z,c[2]),_mm256_set1_pd(pl[3])));
+        radius = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_andnot_pd(signMask,x),e[0]),_mm256_mul_pd(_mm256_andnot_pd(signMask,y),e[1])),_mm256_mul_pd(_mm256_andnot_pd(signMask,z),e[2]));
+        visible = _mm256_and_pd(visible,_mm256_cmp_pd(_mm256_add_pd(dist,radius),zero,_CMP_GE_OQ));
+    }
+    return _mm256_movemask_pd(visible);
+#   else
+    int mask = 0;
+    for (k=0;k<4;k++) {
+        const tpoat* m = mfMatrices16[k];const tpoat* b = &boxes24[6*k];
+        tpoat c[3],e[3];
+        for (i=0;i<3;i++) {
+            c[i] = m[i]*b[0]+m[4+i]*b[1]+m[8+i]*b[2]+m[12+i];
+            e[i] = (tpoat)fabs(m[i])*b[3]+(tpoat)fabs(m[4+i])*b[4]+(tpoat)fabs(m[8+i])*b[5];
+        }
+        for (i=0;i<numPlanes;i++) {
+            const tpoat* pl = planes[i];
+            if (pl[0]*c[0]+pl[1]*c[1]+pl[2]*c[2]+pl[3] + (tpoat)fabs(pl[0])*e[0]+(tpoat)fabs(pl[1])*e[1]+(tpoat)fabs(pl[2])*e[2] < 0) break;
+        }
+        if (i==numPlanes) mask|=(1<<k);
+    }
+    return mask;
+#   endif
+}
+// Sets Teapot_MeshData::visible of all the meshes (in batches of 4 tested objects)
+static void Teapot_Private_MeshData_CullArray(Teapot_MeshData* const* meshes,int numMeshes,const tpoat frustumPlanes[6][4]) {
+    int i;
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numMeshes>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numMeshes;i+=4) {
+        const tpoat* mf[4];tpoat boxes[24];Teapot_MeshData* tested[4];
+        int k,mask,numTested=0;
+        for (k=i;k<i+4 && k<numMeshes;k++) {
+            Teapot_MeshData* md = meshes[k];
+            if (Teapot_Private_GetCullingBox(md->meshId,md->scaling,&boxes[6*numTested])) {mf[numTested]=md->mvMatrix;tested[numTested++]=md;}
+            else md->visible = 1;
+        }
+        if (numTested==0) continue;
+        for (k=numTested;k<4;k++) {mf[k]=mf[0];memcpy(&boxes[6*k],&boxes[0],6*sizeof(tpoat));}   // (padding)
+        mask = Teapot_Private_CullBatch4(frustumPlanes,6,mf,boxes);
+        for (k=0;k<numTested;k++) tested[k]->visible = (mask>>k)&1;
+    }
+}
+static int Teapot_Private_ReserveVisibleIndices(int numIndices) {
+    if (TIS.visibleIndicesCapacity<numIndices) {
+        const int capacity = numIndices + numIndices/2;
+        void* p = realloc(TIS.visibleIndices,capacity*sizeof(int));
+        if (!p) return 0;   // (TIS.visibleIndices is still valid)
+        TIS.visibleIndices = (int*) p;TIS.visibleIndicesCapacity = capacity;
+    }
+    return 1;
+}
+// Writes the indices of the active and visible meshes to 'visibleIndicesOut' (if not NULL) and returns their number
+static int Teapot_Private_MeshData_CompactVisible(Teapot_MeshData* const* meshes,int numMeshes,int* visibleIndicesOut) {
+    int i,numVisible=0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[i];
+        if (!md->active || !md->visible) continue;
+        if (visibleIndicesOut) visibleIndicesOut[numVisible] = i;
+        ++numVisible;
+    }
+    return numVisible;
+}
+int Teapot_CullMulti(Teapot_MeshData* const* meshes,int numMeshes,const tpoat frustumPlanes[6][4],int* visibleIndicesOut) {
+    if (!meshes || numMeshes<=0) return 0;
+    if (frustumPlanes) Teapot_Private_MeshData_CullArray(meshes,numMeshes,frustumPlanes);
+    else Teapot_Private_MeshData_CullArray(meshes,numMeshes,TIS.pMatrixFrustum);
+    return Teapot_Private_MeshData_CompactVisible(meshes,numMeshes,visibleIndicesOut);
+}
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+
+#ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_Get_MvMatrixUpdate_Counters(unsigned* numCalculatedOut,unsigned* numSkippedOut) {
+    if (numCalculatedOut) *numCalculatedOut = TIS.mvMatrixUpdateCounters[0];
+    if (numSkippedOut) *numSkippedOut = TIS.mvMatrixUpdateCounters[1];
+}
+void Teapot_Reset_MvMatrixUpdate_Counters(void) {TIS.mvMatrixUpdateCounters[0] = TIS.mvMatrixUpdateCounters[1] = 0;}
+static int Teapot_Private_ReserveDirtyMeshes(int numMeshes) {
+    if (TIS.dirtyMeshesCapacity<numMeshes) {
+        const int capacity = numMeshes + numMeshes/2;
+        void* p = realloc(TIS.dirtyMeshes,capacity*sizeof(Teapot_MeshData*));
+        if (!p) return 0;   // (TIS.dirtyMeshes is still valid)
+        TIS.dirtyMeshes = (Teapot_MeshData**) p;TIS.dirtyMeshesCapacity = capacity;
+    }
+    return 1;
+}
+#endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+void Teapot_MeshData_CalculateMvMatrixFromArray(Teapot_MeshData** meshes,int numMeshes) {
+    int i;if (!meshes || numMeshes<=0) return;
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    // Only the meshes whose transformVersion or view changed are processed below (culling included)
+    if (Teapot_Private_ReserveDirtyMeshes(numMeshes)) {
+        int numDirty = 0;
+        for (i=0;i<numMeshes;i++) {
+            Teapot_MeshData* md = meshes[i];
+            if (md->calculatedVersions[0]!=md->transformVersion || md->calculatedVersions[1]!=TIS.viewVersion) TIS.dirtyMeshes[numDirty++] = md;
+        }
+        TIS.mvMatrixUpdateCounters[1]+=(unsigned)(numMeshes-numDirty);
+        meshes = TIS.dirtyMeshes;numMeshes = numDirty;
+        if (numMeshes==0) return;
+    }
+    TIS.mvMatrixUpdateCounters[0]+=(unsigned)numMeshes;
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+#   ifdef TEAPOT_USE_OPENMP
+    // Static chunks of consecutive objects: every thread writes to its own (contiguous) set of Teapot_MeshData
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numMeshes>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numMeshes;i++) {
+        Teapot_MeshData* md = meshes[i];
+#       ifdef TEAPOT_CALCULATEMVMATRIXFROMARRAY_EXCLUDES_INACTIVE_MESHDATA
+        if (md->active) // optional
+#       endif
+        {
+            Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);
+            Teapot_Private_CalculateFrameData(md->mvMatrix,md->meshId,md->scaling,NULL,md->nCoefficients);
+#           ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+            md->calculatedVersions[0] = md->transformVersion;md->calculatedVersions[1] = TIS.viewVersion;
+#           endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+        }
+    }
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    Teapot_Private_MeshData_CullArray((Teapot_MeshData* const*)meshes,numMeshes,TIS.pMatrixFrustum);
+#   endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+}
+
+#ifdef TEAPOT_ENABLE_INSTANCING
+void Teapot_Enable_Instancing(void) {TIS.instancingEnabled = 1;}
+void Teapot_Disable_Instancing(void) {TIS.instancingEnabled = 0;}
+int Teapot_Get_Instancing_Enabled(void) {return (TIS.instancingEnabled && TIS.instancedProgramId) ? 1 : 0;}
+
+// Opaque triangle meshes without outline can be drawn by the instanced path
+static __inline int Teapot_Private_IsMeshIdInstanceable(TeapotMeshEnum meshId) {
+    if (meshId>=TEAPOT_FIRST_MESHLINES_INDEX) return 0;
+    switch (meshId) {
+    case TEAPOT_MESH_CAPSULE:
+    case TEAPOT_MESH_PIVOT3D:   // (it needs the TEXT meshes too)
+        return 0;
+    default:
+        return TIS.numInds[meshId]>0 ? 1 : 0;
+    }
+}
+static __inline int Teapot_Private_IsInstanceable(const Teapot_MeshData* md) {
+    if (!md->active || md->color[3]<1.f || md->outlineEnabled) return 0;
+    return Teapot_Private_IsMeshIdInstanceable(md->meshId);
+}
+
+static void Teapot_Private_SyncInstancedProgramUniforms(void) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    if (!TIS.stateCache.instancedProgramUniformsDirty) {++TIS.stateCache.numElidedGLCalls;return;}
+    TIS.stateCache.instancedProgramUniformsDirty = 0;
+    ++TIS.stateCache.numIssuedGLCalls;
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Helper_GlUniformMatrix4v(TIS.instLoc_pMatrix,1,GL_FALSE,TIS.pMatrix);
+    Teapot_Helper_GlUniform3v(TIS.instLoc_lightVector,1,TIS.lightDirectionViewSpace);
+    glUniform4f(TIS.instLoc_materialParams,1.f,(float)TIS.colorMaterialEnabled,0.25f,(float)TIS.colorMaterialEnabled);
+#   ifdef TEAPOT_SHADER_FOG
+    glUniform3fv(TIS.instLoc_fogColor,1,TIS.fogColor);
+    glUniform4fv(TIS.instLoc_fogDistances,1,TIS.fogDistances);
+#   endif //TEAPOT_SHADER_FOG
+#   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    Teapot_Helper_GlUniformMatrix4v(TIS.instLoc_biasedShadowVpMatrix,1,GL_FALSE,TIS.biasedShadowVpMatrix);
+    glUniform1i(TIS.instLoc_shadowMap,0);
+    glUniform2f(TIS.instLoc_shadowDarkening,TIS.shadowDarkening,TIS.shadowClamp);
+    glUniform1f(TIS.instLoc_shadowMapFactor,TIS.shadowMapFactor);
+    glUniform2fv(TIS.instLoc_shadowMapTexelIncrement,1,TIS.shadowMapTexelIncrement);
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+}
+
+static int Teapot_Private_ReserveInstanceData(int numInstances) {
+    if (TIS.instanceDataCapacity<numInstances) {
+        const int capacity = numInstances + numInstances/2;
+        void* p = realloc(TIS.instanceData,capacity*sizeof(float)*TEAPOT_INSTANCE_NUM_FLOATS);
+        if (!p) return 0;   // (TIS.instanceData is still valid)
+        TIS.instanceData = (float*) p;TIS.instanceDataCapacity = capacity;
+    }
+    return 1;
+}
+#ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+static int Teapot_Private_IsBufferStorageAvailable(void) {
+    const char* version = (const char*) glGetString(GL_VERSION);
+    int major=0,minor=0;GLint i,numExtensions=0;
+    if (!version || sscanf(version,"%d.%d",&major,&minor)!=2) return 0;  // (OpenGL ES version strings start with "OpenGL ES")
+    if (major>4 || (major==4 && minor>=4)) return 1;
+    if (major<3) return 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS,&numExtensions);
+    for (i=0;i<numExtensions;i++) {
+        const char* ext = (const char*) glGetStringi(GL_EXTENSIONS,(GLuint)i);
+        if (ext && strcmp(ext,"GL_ARB_buffer_storage")==0) return 1;
+    }
+    return 0;
+}
+// Replaces TIS.instanceBuffer with a new (mutable) buffer object: the GPU can still read the old one
+static void Teapot_Private_ReleaseRingBuffer(void) {
+    int i;
+    for (i=0;i<TEAPOT_RING_BUFFER_NUM_SECTIONS;i++) {
+        if (TIS.ringBufferFences[i]) {glDeleteSync(TIS.ringBufferFences[i]);TIS.ringBufferFences[i]=0;}
+    }
+    if (TIS.ringBufferMapped) {
+        Teapot_Private_BindArrayBuffer(0);
+        glDeleteBuffers(1,&TIS.instanceBuffer); // (implicitly unmapped)
+        glGenBuffers(1,&TIS.instanceBuffer);
+        TIS.instanceBufferCapacity = 0;
+    }
+    TIS.ringBufferMapped = NULL;
+    TIS.ringBufferSectionSize = TIS.ringBufferOffset = 0;
+    TIS.ringBufferSection = 0;
+}
+// (Re)creates the ring buffer with sections of at least 'minSectionSize' bytes. Returns 0 on failure (then the ring buffer is not available anymore)
+static int Teapot_Private_ResizeRingBuffer(size_t minSectionSize) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT;   // (not coherent: every stream is flushed by Teapot_Private_EndInstanceStream(...))
+    size_t sectionSize = TIS.ringBufferSectionSize>0 ? 2*TIS.ringBufferSectionSize : (size_t)TEAPOT_RING_BUFFER_MIN_SECTION_SIZE;
+    while (sectionSize<minSectionSize) sectionSize*=2;
+    Teapot_Private_ReleaseRingBuffer();    // (buffer storage is immutable: a new buffer object is needed)
+    Teapot_Private_BindArrayBuffer(TIS.instanceBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER,(GLsizeiptr)(TEAPOT_RING_BUFFER_NUM_SECTIONS*sectionSize),NULL,flags);
+    TIS.ringBufferMapped = (unsigned char*) glMapBufferRange(GL_ARRAY_BUFFER,0,(GLsizeiptr)(TEAPOT_RING_BUFFER_NUM_SECTIONS*sectionSize),flags|GL_MAP_FLUSH_EXPLICIT_BIT);
+    if (!TIS.ringBufferMapped) {
+        fprintf(stderr,"Error in teapot.h: the persistent ring buffer (%lu bytes) could not be mapped (the instance buffer is orphaned instead).\n",(unsigned long)(TEAPOT_RING_BUFFER_NUM_SECTIONS*sectionSize));
+        Teapot_Private_BindArrayBuffer(0);
+        glDeleteBuffers(1,&TIS.instanceBuffer);glGenBuffers(1,&TIS.instanceBuffer);
+        TIS.instanceBufferCapacity = 0;
+        TIS.ringBufferAvailable = 0;
+        return 0;
+    }
+    TIS.ringBufferSectionSize = sectionSize;
+    return 1;
+}
+void Teapot_Enable_PersistentRingBuffer(void) {TIS.ringBufferDisabled = 0;}
+void Teapot_Disable_PersistentRingBuffer(void) {TIS.ringBufferDisabled = 1;Teapot_Private_ReleaseRingBuffer();}
+int Teapot_Get_PersistentRingBuffer_Enabled(void) {return (!TIS.ringBufferDisabled && TIS.ringBufferAvailable) ? 1 : 0;}
+void Teapot_Get_PersistentRingBuffer_Counters(unsigned* numSectionSwitchesOut,unsigned* numStallsOut) {
+    if (numSectionSwitchesOut) *numSectionSwitchesOut = TIS.ringBufferCounters[0];
+    if (numStallsOut) *numStallsOut = TIS.ringBufferCounters[1];
+}
+#endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+// Returns where the caller writes the 'numFloats' floats of the next per-instance stream (NULL when out of memory): directly the mapped
+// ring buffer when TEAPOT_ENABLE_PERSISTENT_RING_BUFFER is available, TIS.instanceData otherwise. Then call Teapot_Private_EndInstanceStream(...).
+static float* Teapot_Private_BeginInstanceStream(int numFloats) {
+#   ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    TIS.ringBufferStreamMapped = 0;
+    if (TIS.ringBufferAvailable && !TIS.ringBufferDisabled) {
+        const size_t numBytes = ((size_t)numFloats*sizeof(float)+63)&~(size_t)63;   // (streams start at 64 byte boundaries)
+        if (numBytes<=TIS.ringBufferSectionSize || Teapot_Private_ResizeRingBuffer(numBytes)) {
+            if (TIS.ringBufferOffset+numBytes>(size_t)(TIS.ringBufferSection+1)*TIS.ringBufferSectionSize) {
+                // The current section is full: the GPU releases it when the draw calls issued so far are done, and we move to the next one
+                GLsync* fence;
+                TIS.ringBufferFences[TIS.ringBufferSection] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+                TIS.ringBufferSection = (TIS.ringBufferSection+1)%TEAPOT_RING_BUFFER_NUM_SECTIONS;
+                TIS.ringBufferOffset = (size_t)TIS.ringBufferSection*TIS.ringBufferSectionSize;
+                ++TIS.ringBufferCounters[0];
+                fence = &TIS.ringBufferFences[TIS.ringBufferSection];
+                if (*fence) {
+                    if (glClientWaitSync(*fence,0,0)==GL_TIMEOUT_EXPIRED) {
+                        ++TIS.ringBufferCounters[1];
+                        while (glClientWaitSync(*fence,GL_SYNC_FLUSH_COMMANDS_BIT,(GLuint64)1000000000)==GL_TIMEOUT_EXPIRED) {}
+                    }
+                    glDeleteSync(*fence);*fence = 0;
+                }
+            }
+            TIS.ringBufferStreamOffset = TIS.ringBufferOffset;
+            TIS.ringBufferOffset+=numBytes;
+            TIS.ringBufferStreamMapped = 1;
+            return (float*) (TIS.ringBufferMapped+TIS.ringBufferStreamOffset);
+        }
+    }
+#   endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    if (!Teapot_Private_ReserveInstanceData((numFloats+TEAPOT_INSTANCE_NUM_FLOATS-1)/TEAPOT_INSTANCE_NUM_FLOATS)) return NULL;
+    return TIS.instanceData;
+}
+// Binds TIS.instanceBuffer with the first 'numFloats' floats of the stream written after Teapot_Private_BeginInstanceStream(...), and returns their offset in bytes
+static size_t Teapot_Private_EndInstanceStream(int numFloats) {
+    Teapot_Private_BindArrayBuffer(TIS.instanceBuffer);
+#   ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    if (TIS.ringBufferStreamMapped) {
+        glFlushMappedBufferRange(GL_ARRAY_BUFFER,(GLintptr)TIS.ringBufferStreamOffset,(GLsizeiptr)(numFloats*sizeof(float)));
+        return TIS.ringBufferStreamOffset;
+    }
+#   endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    // buffer orphaning
+    if (TIS.instanceBufferCapacity<TIS.instanceDataCapacity) TIS.instanceBufferCapacity = TIS.instanceDataCapacity;
+    glBufferData(GL_ARRAY_BUFFER, TIS.instanceBufferCapacity*sizeof(float)*TEAPOT_INSTANCE_NUM_FLOATS, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, numFloats*sizeof(float), TIS.instanceData);
+    return 0;
+}
+// Writes an instance (TEAPOT_INSTANCE_NUM_FLOATS floats) to 'p'. 'scaling3' must not contain zeros. 'colorAmbient3' and 'colorSpecular4' are skipped when Teapot_Color_Material is enabled.
+static __inline void Teapot_Private_WriteInstance(float* __restrict p,const tpoat* __restrict mvMatrix,const float* __restrict scaling3,const float* color4,const float* colorAmbient3,const float* colorSpecular4) {
+    int j;
+    for (j=0;j<16;j++) p[j]=(float)mvMatrix[j];
+    p[16]=scaling3[0];p[17]=scaling3[1];p[18]=scaling3[2];p[19]=1.f;
+    p[20]=color4[0];p[21]=color4[1];p[22]=color4[2];p[23]=color4[3];
+    if (TIS.colorMaterialEnabled) {
+        // Same as Teapot_SetColor(...)
+        const float ambFac = 0.25f;
+        p[24]=color4[0]*ambFac;p[25]=color4[1]*ambFac;p[26]=color4[2]*ambFac;
+#       ifdef TEAPOT_SHADER_SPECULAR
+        {
+            const float speFac = 0.8f * color4[3];
+            p[28]=color4[0]*speFac;p[29]=color4[1]*speFac;p[30]=color4[2]*speFac;p[31]=TIS.colorSpecular[3];
+        }
+#       endif //TEAPOT_SHADER_SPECULAR
+    }
+    else {
+        p[24]=colorAmbient3[0];p[25]=colorAmbient3[1];p[26]=colorAmbient3[2];
+#       ifdef TEAPOT_SHADER_SPECULAR
+        p[28]=colorSpecular4[0];p[29]=colorSpecular4[1];p[30]=colorSpecular4[2];p[31]=colorSpecular4[3]>0?colorSpecular4[3]:TIS.colorSpecular[3];
+#       endif //TEAPOT_SHADER_SPECULAR
+    }
+    p[27]=TIS.colorAmbient[3];
+    (void)colorSpecular4;
+}
+// One bucket for every meshId and LOD
+#define TEAPOT_NUM_INSTANCE_BUCKETS (TEAPOT_MESH_COUNT*TEAPOT_NUM_MESH_LODS)
+static __inline int Teapot_Private_InstanceBucket(TeapotMeshEnum meshId,const tpoat* mvMatrix,const float* scaling3) {
+    return (int)meshId*TEAPOT_NUM_MESH_LODS+Teapot_Private_SelectLod(meshId,TIS.pMatrix,mvMatrix,scaling3);
+}
+// Ends the instance stream (see Teapot_Private_BeginInstanceStream(...)) of 'numInstances' instances and draws every bucket with one glDrawElementsInstanced(...)
+// 'outlines': 1 when the instances are mesh outlines (the palette of multi-material meshes is disabled)
+static void Teapot_Private_DrawInstanceBuckets(const int bucketStart[TEAPOT_NUM_INSTANCE_BUCKETS],const int bucketCount[TEAPOT_NUM_INSTANCE_BUCKETS],int numInstances,int outlines) {
+    const GLsizei stride = sizeof(float)*TEAPOT_INSTANCE_NUM_FLOATS;
+    const int vao = Teapot_Private_BindVertexArray(TEAPOT_VAO_INSTANCED);
+    size_t streamOffset;
+    int i,j;
+    Teapot_Private_UseProgram(TIS.instancedProgramId);
+    Teapot_Private_SyncInstancedProgramUniforms();
+    if (outlines) glUniform4f(TIS.instLoc_materialParams,0.f,0.f,0.f,0.f);
+    if (!vao) {
+        Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+        glEnableVertexAttribArray(TIS.aLoc_instVertex);
+        glEnableVertexAttribArray(TIS.aLoc_instNormal);
+        glEnableVertexAttribArray(TIS.aLoc_instMaterial);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_instVertex,TIS.aLoc_instNormal,TIS.aLoc_instMaterial);
+    }
+
+    streamOffset = Teapot_Private_EndInstanceStream(numInstances*TEAPOT_INSTANCE_NUM_FLOATS);  // (buckets are not compacted: the holes left by culled instances are uploaded too)
+    for (j=0;j<TEAPOT_INSTANCE_NUM_VEC4 && !vao;j++) {
+        if (TIS.aLoc_instData[j]<0) continue;
+        glEnableVertexAttribArray(TIS.aLoc_instData[j]);
+        glVertexAttribDivisor(TIS.aLoc_instData[j],1);
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {
+        const TeapotMeshEnum meshId = (TeapotMeshEnum) (i/TEAPOT_NUM_MESH_LODS);
+        int numInds;size_t indsOffset;
+        if (bucketCount[i]==0) continue;
+        for (j=0;j<TEAPOT_INSTANCE_NUM_VEC4;j++) {
+            if (TIS.aLoc_instData[j]<0) continue;
+            glVertexAttribPointer(TIS.aLoc_instData[j], 4, GL_FLOAT, GL_FALSE, stride, (void*)(streamOffset + bucketStart[i]*stride + sizeof(float)*4*j));
+        }
+#       ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        glUniform4fv(TIS.instLoc_dequantization,2,&TIS.dequantization[meshId][0][0]);
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        Teapot_Private_GetLodRange(meshId,i%TEAPOT_NUM_MESH_LODS,&numInds,&indsOffset);
+        glDrawElementsInstanced(GL_TRIANGLES,numInds,TIS.indsType[meshId],(const void*) indsOffset,bucketCount[i]);
+    }
+
+    // restore Teapot_PreDraw() state
+    if (outlines) glUniform4f(TIS.instLoc_materialParams,1.f,(float)TIS.colorMaterialEnabled,0.25f,(float)TIS.colorMaterialEnabled);   // (see Teapot_Private_SyncInstancedProgramUniforms())
+    if (!vao) {
+        for (j=0;j<TEAPOT_INSTANCE_NUM_VEC4;j++) {
+            if (TIS.aLoc_instData[j]<0) continue;
+            glVertexAttribDivisor(TIS.aLoc_instData[j],0);
+            glDisableVertexAttribArray(TIS.aLoc_instData[j]);
+        }
+        glDisableVertexAttribArray(TIS.aLoc_instVertex);
+        glDisableVertexAttribArray(TIS.aLoc_instNormal);
+        glDisableVertexAttribArray(TIS.aLoc_instMaterial);
+    }
+    Teapot_Private_BindDrawState();
+}
+
+// Draws all the instanceable meshes (see Teapot_Private_IsInstanceable(...)) with one glDrawElementsInstanced(...) per meshId (and LOD).
+// Must be called between Teapot_PreDraw() and Teapot_PostDraw(). Returns 1 if the instanceable meshes have been processed (and must be skipped by the caller).
+// 'drawList' (optional) has the indices of the 'numMeshes' meshes to process.
+static int Teapot_Private_DrawMultiInstanced(Teapot_MeshData* const* meshes,const int* drawList,int numMeshes,int precomputed) {
+    int bucketStart[TEAPOT_NUM_INSTANCE_BUCKETS],bucketCount[TEAPOT_NUM_INSTANCE_BUCKETS];
+    float* instanceData;
+    int i,numInstances=0,numVisibleInstances=0;
+    (void)precomputed;
+    if (!TIS.instancingEnabled || !TIS.instancedProgramId) return 0;
+
+    // 1) count instances per meshId
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) bucketCount[i]=0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        if (Teapot_Private_IsInstanceable(md)) {
+            const float scaling[3] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]};
+            ++bucketCount[Teapot_Private_InstanceBucket(md->meshId,md->mvMatrix,scaling)];
+        }
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {bucketStart[i]=numInstances;numInstances+=bucketCount[i];bucketCount[i]=0;}
+    if (numInstances==0) return 1;
+    if (!(instanceData = Teapot_Private_BeginInstanceStream(numInstances*TEAPOT_INSTANCE_NUM_FLOATS))) return 0;
+
+    // 2) fill the per-instance stream (bucket by bucket)
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        const TeapotMeshEnum meshId = md->meshId;
+        if (!Teapot_Private_IsInstanceable(md)) continue;
+        {
+            const float scaling[3] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]};
+#           ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+            if (precomputed) {if (!md->visible) continue;}
+            else if (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z) {
+                const float aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
+                const float aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
+                if (!Teapot_Helper_IsVisible(TIS.pMatrixFrustum,md->mvMatrix,aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2])) continue;
+            }
+#           endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+            {
+                const int bucket = Teapot_Private_InstanceBucket(meshId,md->mvMatrix,scaling);
+                Teapot_Private_WriteInstance(&instanceData[(bucketStart[bucket]+bucketCount[bucket]++)*TEAPOT_INSTANCE_NUM_FLOATS],md->mvMatrix,scaling,md->color,md->colorAmbient,md->colorSpecular);
+            }
+        }
+        ++numVisibleInstances;
+    }
+    if (numVisibleInstances==0) return 1;
+
+    // 3) upload and draw
+    Teapot_Private_DrawInstanceBuckets(bucketStart,bucketCount,numInstances,0);
+
+    return 1;
+}
+#endif //TEAPOT_ENABLE_INSTANCING
+
+void Teapot_Enable_FrontToBackSorting(void) {TIS.frontToBackSortingEnabled = 1;}
+void Teapot_Disable_FrontToBackSorting(void) {TIS.frontToBackSortingEnabled = 0;}
+int Teapot_Get_FrontToBackSorting_Enabled(void) {return TIS.frontToBackSortingEnabled;}
+// Draw order of Teapot_Enable_FrontToBackSorting(): opaque meshes front to back (same keys as Teapot_MeshData_RadixSort(...)), then the other meshes in array order.
+// Returns TIS.sortMeshes (numMeshes sorted meshes, that replace 'meshes' and 'drawList'), or NULL if out of memory
+static Teapot_MeshData* const* Teapot_Private_SortFrontToBack(Teapot_MeshData* const* meshes,const int* drawList,int numMeshes) {
+    const unsigned int* inds;
+    tpoat zMin=0,zMax=0,depthScale;
+    int i,numOpaque=0;
+    if (!Teapot_Private_ReserveSortBuffers(numMeshes)) return NULL;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        const tpoat z = md->mvMatrix[14];
+        if (md->color[3]<1.f) continue;
+        if (numOpaque++==0) zMin = zMax = z;
+        else if (zMin>z) zMin=z;
+        else if (zMax<z) zMax=z;
+    }
+    depthScale = (zMax>zMin) ? ((tpoat)TEAPOT_SORTKEY_DEPTH_MAX/(zMax-zMin)) : (tpoat)0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        if (md->color[3]<1.f) TIS.sortKeys[i] = ((unsigned long long)1<<63) | (unsigned long long)i;    // (stable)
+        else TIS.sortKeys[i] = Teapot_Private_MakeSortKey(0,md->mvMatrix[14],zMin,zMax,depthScale,md->meshId,Teapot_Private_MeshData_MaterialHash(md));
+    }
+    inds = Teapot_Private_RadixSortKeys(numMeshes);
+    for (i=0;i<numMeshes;i++) TIS.sortMeshes[i] = meshes[drawList ? drawList[inds[i]] : (int)inds[i]];
+    return TIS.sortMeshes;
+}
+
+#ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+void Teapot_Enable_DepthPrepass(void) {TIS.depthPrepassEnabled = 1;}
+void Teapot_Disable_DepthPrepass(void) {TIS.depthPrepassEnabled = 0;}
+int Teapot_Get_DepthPrepass_Enabled(void) {return (TIS.depthPrepassEnabled && TIS.depthProgramId) ? 1 : 0;}
+// Opaque triangle meshes without outline are drawn by the depth prepass ('skipInstanceable': the instanced path draws some of them)
+static __inline int Teapot_Private_IsDepthPrepassed(const Teapot_MeshData* md,int skipInstanceable) {
+    if (!md->active || md->color[3]<1.f || md->outlineEnabled || md->meshId>=TEAPOT_MESH_PIVOT3D || md->meshId==TEAPOT_MESH_CAPSULE) return 0;
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    if (skipInstanceable && Teapot_Private_IsInstanceable(md)) return 0;
+#   else //TEAPOT_ENABLE_INSTANCING
+    (void)skipInstanceable;
+#   endif //TEAPOT_ENABLE_INSTANCING
+    return 1;
+}
+// Writes the depth of the Teapot_Private_IsDepthPrepassed(...) meshes with TIS.depthProgramId (color writes are disabled) and returns their number.
+// Must be called between Teapot_PreDraw() and Teapot_PostDraw().
+static int Teapot_Private_DrawDepthPrepass(Teapot_MeshData* const* meshes,const int* drawList,int numMeshes,int precomputed,int skipInstanceable) {
+    GLboolean colorMask[4];
+    int i,numPrepassed=0,vao=0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        const TeapotMeshEnum meshId = md->meshId;
+        const float scaling[4] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2],1.f};
+        int lodNumInds;size_t lodIndsOffset;
+        if (!Teapot_Private_IsDepthPrepassed(md,skipInstanceable)) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && !md->visible) continue;
+#       else //TEAPOT_ENABLE_FRUSTUM_CULLING
+        (void)precomputed;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (numPrepassed++==0) {
+            glGetBooleanv(GL_COLOR_WRITEMASK,colorMask);
+            glColorMask(GL_FALSE,GL_FALSE,GL_FALSE,GL_FALSE);
+            Teapot_Private_UseProgram(TIS.depthProgramId);
+            Teapot_Helper_GlUniformMatrix4v(TIS.depthLoc_pMatrix,1,GL_FALSE,TIS.pMatrix);
+            if (!(vao=Teapot_Private_BindVertexArray(TEAPOT_VAO_DEPTH))) {
+                Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+                glEnableVertexAttribArray(TIS.aLoc_depthVertex);
+                Teapot_Private_VertexAttribPointers(TIS.aLoc_depthVertex,-1,-1);
+            }
+        }
+        Teapot_Helper_GlUniformMatrix4v(TIS.depthLoc_mvMatrix,1,GL_FALSE,md->mvMatrix);
+        glUniform4fv(TIS.depthLoc_scaling,1,scaling);
+#       ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        glUniform4fv(TIS.depthLoc_dequantization,2,&TIS.dequantization[meshId][0][0]);
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        Teapot_Private_GetLodRange(meshId,Teapot_Private_SelectLod(meshId,TIS.pMatrix,md->mvMatrix,scaling),&lodNumInds,&lodIndsOffset);    // (same LOD as the shaded pass)
+        glDrawElements(GL_TRIANGLES,lodNumInds,TIS.indsType[meshId],(const void*) lodIndsOffset);
+    }
+    if (numPrepassed>0) {
+        // restore Teapot_PreDraw() state
+        glColorMask(colorMask[0],colorMask[1],colorMask[2],colorMask[3]);
+        if (!vao && TIS.aLoc_depthVertex!=TIS.aLoc_vertex && TIS.aLoc_depthVertex!=TIS.aLoc_normal && TIS.aLoc_depthVertex!=TIS.aLoc_material) glDisableVertexAttribArray(TIS.aLoc_depthVertex);
+        Teapot_Private_BindDrawState();
+    }
+    return numPrepassed;
+}
+#endif //TEAPOT_ENABLE_DEPTH_PREPASS
+
+// Opaque triangle meshes have their outline drawn by Teapot_Private_DrawMeshOutlinePass(...) (when Teapot_Enable_MeshOutlinePass() is set)
+static __inline int Teapot_Private_IsMeshOutlineBatched(const Teapot_MeshData* md) {
+    if (!md->active || !md->outlineEnabled || md->color[3]<1.f || TIS.colorMeshOutline[3]<=0) return 0;
+    return (md->meshId<TEAPOT_MESH_PIVOT3D && md->meshId!=TEAPOT_MESH_CAPSULE && TIS.numInds[md->meshId]>0) ? 1 : 0;
+}
+// mvMatrix of the outline of 'md' (same as Teapot_Private_Draw_Mv(...)). 'tmp16' is used only with TEAPOT_CENTER_MESHES_ON_FLOOR
+static __inline const tpoat* Teapot_Private_GetMeshOutlineMvMatrix(const Teapot_MeshData* md,const float* scaling3,tpoat* tmp16) {
+#   ifdef TEAPOT_CENTER_MESHES_ON_FLOOR
+    if (md->meshId<TEAPOT_MESH_HALF_SPHERE_UP && TIS.scalingMeshOutline>1)  {
+        const tpoat* m = md->mvMatrix;
+        const float cpY = 2.f*TIS.halfExtents[md->meshId][1]*scaling3[1]*(1.0f-TIS.scalingMeshOutline)*0.5f;
+        int i;for (i=0;i<16;i++) tmp16[i] = m[i];
+        tmp16[12]+= cpY*m[4];
+        tmp16[13]+= cpY*m[5];
+        tmp16[14]+= cpY*m[6];
+        return tmp16;
+    }
+#   endif
+    (void)scaling3;(void)tmp16;
+    return md->mvMatrix;
+}
+#ifdef TEAPOT_ENABLE_INSTANCING
+// Instanced version of Teapot_Private_DrawMeshOutlinePass(...) (one glDrawElementsInstanced(...) per meshId and LOD). Returns 0 if out of memory.
+static int Teapot_Private_DrawMeshOutlinesInstanced(Teapot_MeshData* const* meshes,const int* drawList,int numMeshes,int precomputed) {
+    int bucketStart[TEAPOT_NUM_INSTANCE_BUCKETS],bucketCount[TEAPOT_NUM_INSTANCE_BUCKETS];
+    float* instanceData;
+    int i,numInstances=0;
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) bucketCount[i]=0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        if (Teapot_Private_IsMeshOutlineBatched(md)) {
+            const float scaling[3] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]};
+#           ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+            if (precomputed && !md->visible) continue;
+#           else //TEAPOT_ENABLE_FRUSTUM_CULLING
+            (void)precomputed;
+#           endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+            ++bucketCount[Teapot_Private_InstanceBucket(md->meshId,md->mvMatrix,scaling)];
+        }
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {bucketStart[i]=numInstances;numInstances+=bucketCount[i];bucketCount[i]=0;}
+    if (numInstances==0) return 1;
+    if (!(instanceData = Teapot_Private_BeginInstanceStream(numInstances*TEAPOT_INSTANCE_NUM_FLOATS))) return 0;
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        if (!Teapot_Private_IsMeshOutlineBatched(md)) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && !md->visible) continue;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+        {
+            const float scaling[3] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]};
+            const float outlineScaling[3] = {scaling[0]*TIS.scalingMeshOutline,scaling[1]*TIS.scalingMeshOutline,scaling[2]*TIS.scalingMeshOutline};
+            const int bucket = Teapot_Private_InstanceBucket(md->meshId,md->mvMatrix,scaling);  // (LOD of the mesh, not of its outline)
+            float* p = &instanceData[(bucketStart[bucket]+bucketCount[bucket]++)*TEAPOT_INSTANCE_NUM_FLOATS];
+            tpoat tmp[16];
+            Teapot_Private_WriteInstance(p,Teapot_Private_GetMeshOutlineMvMatrix(md,scaling,tmp),outlineScaling,TIS.colorMeshOutline,TIS.colorMeshOutline,md->colorSpecular);
+            p[24]=TIS.colorMeshOutline[0];p[25]=TIS.colorMeshOutline[1];p[26]=TIS.colorMeshOutline[2];p[27]=0.f;    // unlit
+        }
+    }
+    Teapot_Private_DrawInstanceBuckets(bucketStart,bucketCount,numInstances,1);
+    return 1;
+}
+#endif //TEAPOT_ENABLE_INSTANCING
+// Draws the outlines of all the Teapot_Private_IsMeshOutlineBatched(...) meshes, setting the outline state once.
+// Outlines are unlit, so only the mvMatrix and the scaling change per mesh. Since these meshes are opaque, the depth test
+// gives the same result as drawing every outline just before its mesh (like Teapot_Private_Draw_Mv(...) does).
+// Must be called between Teapot_PreDraw() and Teapot_PostDraw(), with glDepthMask(GL_TRUE). When 'precomputed' is set, the frustum culled meshes (Teapot_MeshData::visible==0) are skipped.
+static void Teapot_Private_DrawMeshOutlinePass(Teapot_MeshData* const* meshes,const int* drawList,int numMeshes,int precomputed) {
+    const int mustUsePolygonOffset = (TIS.polygonOffsetSlope!=0 && TIS.polygonOffsetConstant!=0) ? 1 : 0;
+    const float pushScaling[3] = {TIS.scaling[0],TIS.scaling[1],TIS.scaling[2]};
+    int i,numOutlines=0;
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    const int useInstancing = (TIS.instancingEnabled && TIS.instancedProgramId) ? 1 : 0;
+#   endif //TEAPOT_ENABLE_INSTANCING
+    for (i=0;i<numMeshes;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        const TeapotMeshEnum meshId = md->meshId;
+        if (!Teapot_Private_IsMeshOutlineBatched(md)) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && !md->visible) continue;
+#       else //TEAPOT_ENABLE_FRUSTUM_CULLING
+        (void)precomputed;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (numOutlines++==0) {
+            if (mustUsePolygonOffset) {Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,1);Teapot_Private_PolygonOffset( TIS.polygonOffsetSlope, TIS.polygonOffsetConstant);}
+            Teapot_Private_FrontFace(GL_CW);
+#           ifdef TEAPOT_ENABLE_INSTANCING
+            if (useInstancing && Teapot_Private_DrawMeshOutlinesInstanced(meshes,drawList,numMeshes,precomputed)) break;
+#           endif //TEAPOT_ENABLE_INSTANCING
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],0);
+            Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,TIS.colorMeshOutline[0],TIS.colorMeshOutline[1],TIS.colorMeshOutline[2],TIS.colorMeshOutline[3]);
+            Teapot_Private_SetMaterialParams(0.f,0.f,0.f,0.f);
+        }
+        {
+            const float scaling[3] = {md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]};
+            tpoat tmp[16];const tpoat* mv = Teapot_Private_GetMeshOutlineMvMatrix(md,scaling,tmp);
+            int lodNumInds;size_t lodIndsOffset;
+            Teapot_Private_GetLodRange(meshId,Teapot_Private_SelectLod(meshId,TIS.pMatrix,md->mvMatrix,scaling),&lodNumInds,&lodIndsOffset);
+            Teapot_SetScaling(scaling[0]*TIS.scalingMeshOutline,scaling[1]*TIS.scalingMeshOutline,scaling[2]*TIS.scalingMeshOutline);
+#           ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+            {
+            tpoat smvp[16];
+            Teapot_Helper_MultMatrix(smvp,TIS.biasedShadowVpMatrix,mv);
+            Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_BIASED_SHADOW_MVP_MATRIX,TIS.uLoc_biasedShadowMvpMatrix,smvp);
+            }
+#           endif
+            Teapot_Private_UniformMatrix4v(TEAPOT_UNIFORM_SLOT_MVMATRIX,TIS.uLoc_mvMatrix,mv);
+            Teapot_Private_SetDequantization(meshId);
+            glDrawElements(GL_TRIANGLES,lodNumInds,TIS.indsType[meshId],(const void*) lodIndsOffset);
+        }
+    }
+    if (numOutlines>0) {
+        Teapot_Private_FrontFace(GL_CCW);
+        if (mustUsePolygonOffset) Teapot_Private_SetCapability(GL_POLYGON_OFFSET_FILL,0);
+        Teapot_SetScaling(pushScaling[0],pushScaling[1],pushScaling[2]);
+        Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,1,TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
+        Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,1,TIS.color);
+        Teapot_Private_SetDefaultMaterialParams();
+    }
+}
+
+#ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+static int Teapot_Private_ReserveShadowMvpMatrices(int numMatrices) {
+    if (TIS.shadowMvpMatricesCapacity<numMatrices) {
+        const int capacity = numMatrices + numMatrices/2;
+        void* p = realloc(TIS.shadowMvpMatrices,16*capacity*sizeof(tpoat));
+        if (!p) return 0;   // (TIS.shadowMvpMatrices is still valid)
+        TIS.shadowMvpMatrices = (tpoat*) p;TIS.shadowMvpMatricesCapacity = capacity;
+    }
+    return 1;
+}
+// One sweep (after culling) that fills TIS.shadowMvpMatrices[16*i] for the i-th mesh of the draw list that Teapot_Private_DrawMulti_Mv(...) still has to draw (one by one).
+// Returns NULL when the shadow matrices must be calculated per draw
+static const tpoat* Teapot_Private_MeshData_CalculateShadowMvpMatrices(Teapot_MeshData* const* meshes,const int* drawList,int numDrawn,int precomputed,int skipInstanceable) {
+    tpoat biasedShadowVpMatrix[16];
+    tpoat* __restrict shadowMvpMatrices;
+    int i;
+    if (TIS.uLoc_biasedShadowMvpMatrix<0 || numDrawn<=0 || !Teapot_Private_ReserveShadowMvpMatrices(numDrawn)) return NULL;
+    shadowMvpMatrices = TIS.shadowMvpMatrices;
+    Teapot_Helper_CopyMatrix(biasedShadowVpMatrix,TIS.biasedShadowVpMatrix);    // (so that the compiler knows it can't alias the output)
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numDrawn>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numDrawn;i++) {
+        const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+        if (!md->active || md->color[3]==0) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && !md->visible) continue;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#       ifdef TEAPOT_ENABLE_INSTANCING
+        if (skipInstanceable && Teapot_Private_IsInstanceable(md)) continue;
+#       endif //TEAPOT_ENABLE_INSTANCING
+        Teapot_Helper_MultMatrixUncheckArgs(&shadowMvpMatrices[16*i],biasedShadowVpMatrix,md->mvMatrix);
+    }
+    (void)precomputed;(void)skipInstanceable;
+    return shadowMvpMatrices;
+}
+#endif //TEAPOT_SHADER_USE_SHADOW_MAP
+
+// 'precomputed': 1 if Teapot_MeshData_CalculateMvMatrixFromArray(...) has just been called on 'meshes' (so that Teapot_MeshData::visible and Teapot_MeshData::nCoefficients are valid)
+static void Teapot_Private_DrawMulti_Mv(Teapot_MeshData* const* meshes,int numMeshes,int mustSortObjectsForTransparency,int precomputed)  {
+    if (!meshes || numMeshes<=0) return;
+    if (mustSortObjectsForTransparency) Teapot_MeshData_RadixSort(meshes,numMeshes);
+    {
+        const int pushMeshOutlineEnabled = TIS.meshOutlineEnabled;
+        int i,startTransparentObjects=mustSortObjectsForTransparency?0:-1;
+        int numDrawn = numMeshes;const int* drawList = NULL;   // optional list of the meshes to draw
+        const tpoat* shadowMvpMatrices = NULL;                  // optional TIS.shadowMvpMatrices (in draw list order)
+        int instancedMeshesDrawn = 0;
+#       ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+#       ifdef TEAPOT_ENABLE_INSTANCING
+        const int skipInstanceable = (TIS.instancingEnabled && TIS.instancedProgramId) ? 1 : 0;
+#       else //TEAPOT_ENABLE_INSTANCING
+        const int skipInstanceable = 0;
+#       endif //TEAPOT_ENABLE_INSTANCING
+        GLint userDepthFunc = GL_LESS;
+        int numPrepassed = 0,depthFuncEqual = 0;
+#       endif //TEAPOT_ENABLE_DEPTH_PREPASS
+        int mustDrawOutlinePass = TIS.meshOutlinePassEnabled;   // (before the first transparent mesh)
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && Teapot_Private_ReserveVisibleIndices(numMeshes)) {
+            numDrawn = Teapot_Private_MeshData_CompactVisible(meshes,numMeshes,TIS.visibleIndices);
+            drawList = TIS.visibleIndices;
+        }
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (TIS.frontToBackSortingEnabled && !mustSortObjectsForTransparency && numDrawn>1) {
+            // (with mustSortObjectsForTransparency the opaque meshes are already sorted front to back)
+            Teapot_MeshData* const* sorted = Teapot_Private_SortFrontToBack(meshes,drawList,numDrawn);
+            if (sorted) {meshes = sorted;drawList = NULL;}
+        }
+#       ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+        if (TIS.depthPrepassEnabled && TIS.depthProgramId) {
+            numPrepassed = Teapot_Private_DrawDepthPrepass(meshes,drawList,numDrawn,precomputed,skipInstanceable);
+            if (numPrepassed>0) glGetIntegerv(GL_DEPTH_FUNC,&userDepthFunc);
+        }
+#       endif //TEAPOT_ENABLE_DEPTH_PREPASS
+#       ifdef TEAPOT_ENABLE_INSTANCING
+        instancedMeshesDrawn = Teapot_Private_DrawMultiInstanced(meshes,drawList,numDrawn,precomputed);
+#       endif //TEAPOT_ENABLE_INSTANCING
+#       ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+        shadowMvpMatrices = Teapot_Private_MeshData_CalculateShadowMvpMatrices(meshes,drawList,numDrawn,precomputed,instancedMeshesDrawn);
+#       endif //TEAPOT_SHADER_USE_SHADOW_MAP
+        for (i=0;i<numDrawn;i++) {
+            const Teapot_MeshData* md = meshes[drawList ? drawList[i] : i];
+#           ifdef TEAPOT_ENABLE_INSTANCING
+            if (instancedMeshesDrawn && Teapot_Private_IsInstanceable(md)) continue;
+#           endif //TEAPOT_ENABLE_INSTANCING
+#           ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+            if (precomputed && !md->visible) continue;
+#           endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#           ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+            if (numPrepassed>0) {
+                const int prepassed = Teapot_Private_IsDepthPrepassed(md,skipInstanceable);
+                if (prepassed!=depthFuncEqual) {depthFuncEqual = prepassed;glDepthFunc(prepassed ? GL_EQUAL : (GLenum)userDepthFunc);}
+            }
+#           endif //TEAPOT_ENABLE_DEPTH_PREPASS
+            if (md->active) {
+                if (mustDrawOutlinePass && md->color[3]<1.f) {
+#                   ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+                    if (depthFuncEqual) {depthFuncEqual = 0;glDepthFunc((GLenum)userDepthFunc);}
+#                   endif //TEAPOT_ENABLE_DEPTH_PREPASS
+                    Teapot_Private_DrawMeshOutlinePass(meshes,drawList,numDrawn,precomputed);
+                    mustDrawOutlinePass = 0;
+                }
+                TIS.meshOutlineEnabled = (md->outlineEnabled && !(TIS.meshOutlinePassEnabled && Teapot_Private_IsMeshOutlineBatched(md))) ? 1 : 0;
+                if (!TIS.colorMaterialEnabled)  {
+#               ifdef TEAPOT_SHADER_SPECULAR
+                    Teapot_SetColorAmbientDiffuseAndSpecular(md->colorAmbient,md->color,md->colorSpecular);
+#               else //TEAPOT_SHADER_SPECULAR
+                    Teapot_SetColorAmbientAndDiffuse(md->colorAmbient,md->color);
+#               endif //TEAPOT_SHADER_SPECULAR
+                }
+                else Teapot_SetColor(md->color[0],md->color[1],md->color[2],md->color[3]);
+                Teapot_SetScaling(md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]);
+                if (md->color[3]<1.f && startTransparentObjects==0) {
+                    startTransparentObjects=1;
+                    Teapot_Private_DepthMask(GL_FALSE);
+                    Teapot_Private_SetCapability(GL_BLEND,1);
+                }
+                if (md->color[3]!=0) Teapot_Private_Draw_Mv(md->mvMatrix,md->meshId,precomputed ? md->nCoefficients : NULL,shadowMvpMatrices ? &shadowMvpMatrices[16*i] : NULL);
+            }
+        }
+        if (startTransparentObjects==1) {
+            Teapot_Private_SetCapability(GL_BLEND,0);
+            Teapot_Private_DepthMask(GL_TRUE);
+        }
+#       ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+        if (depthFuncEqual) glDepthFunc((GLenum)userDepthFunc);
+#       endif //TEAPOT_ENABLE_DEPTH_PREPASS
+        if (mustDrawOutlinePass) Teapot_Private_DrawMeshOutlinePass(meshes,drawList,numDrawn,precomputed);
+        TIS.meshOutlineEnabled = pushMeshOutlineEnabled;
+        (void)instancedMeshesDrawn;(void)shadowMvpMatrices;
+    }
+}
+void Teapot_DrawMulti(Teapot_MeshData** meshes,int numMeshes,int mustSortObjectsForTransparency) {
+    Teapot_MeshData_CalculateMvMatrixFromArray(meshes,numMeshes);
+    Teapot_Private_DrawMulti_Mv(meshes,numMeshes,mustSortObjectsForTransparency,1);
+}
+void Teapot_DrawMulti_Mv(Teapot_MeshData* const* meshes,int numMeshes,int mustSortObjectsForTransparency)  {
+    Teapot_Private_DrawMulti_Mv(meshes,numMeshes,mustSortObjectsForTransparency,0);
+}
+
+void Teapot_Scene_Init(Teapot_Scene* scene,int initialCapacity) {
+    memset(scene,0,sizeof(Teapot_Scene));
+    if (initialCapacity>0) Teapot_Scene_Reserve(scene,initialCapacity);
+}
+void Teapot_Scene_Destroy(Teapot_Scene* scene) {
+    if (!scene) return;
+    if (scene->mMatrices) free(scene->mMatrices);
+    if (scene->mvMatrices) free(scene->mvMatrices);
+    if (scene->meshIds) free(scene->meshIds);
+    if (scene->scalings) free(scene->scalings);
+    if (scene->colors) free(scene->colors);
+    if (scene->flags) free(scene->flags);
+    if (scene->nCoefficients) free(scene->nCoefficients);
+    if (scene->userPtrs) free(scene->userPtrs);
+    memset(scene,0,sizeof(Teapot_Scene));
+}
+int Teapot_Scene_Reserve(Teapot_Scene* scene,int capacity) {
+    void* p;
+    if (capacity<=scene->capacity) return 1;
+    // Every array grows on its own: if one realloc(...) fails, the others are still valid (and scene->capacity is unchanged)
+#   define TEAPOT_SCENE_GROW_ARRAY(ARRAY,TYPE,NUM_PER_OBJECT) {                 \
+        p = realloc(scene->ARRAY,capacity*(NUM_PER_OBJECT)*sizeof(TYPE));       \
+        if (!p) {fprintf(stderr,"Error in teapot.h: Teapot_Scene_Reserve(...) out of memory (capacity=%d).\n",capacity);return 0;}  \
+        scene->ARRAY = (TYPE*) p;                                               \
+    }
+    TEAPOT_SCENE_GROW_ARRAY(mMatrices,tpoat,16)
+    TEAPOT_SCENE_GROW_ARRAY(mvMatrices,tpoat,16)
+    TEAPOT_SCENE_GROW_ARRAY(meshIds,unsigned char,1)
+    TEAPOT_SCENE_GROW_ARRAY(scalings,float,3)
+    TEAPOT_SCENE_GROW_ARRAY(colors,unsigned int,1)
+    TEAPOT_SCENE_GROW_ARRAY(flags,unsigned char,1)
+    TEAPOT_SCENE_GROW_ARRAY(nCoefficients,float,3)
+    TEAPOT_SCENE_GROW_ARRAY(userPtrs,void*,1)
+#   undef TEAPOT_SCENE_GROW_ARRAY
+    scene->capacity = capacity;
+    return 1;
+}
+int Teapot_Scene_AddObject(Teapot_Scene* scene,TeapotMeshEnum meshId,const tpoat* mMatrix16) {
+    int i = scene->numObjects;
+    if (i==scene->capacity && !Teapot_Scene_Reserve(scene,scene->capacity>0 ? 2*scene->capacity : 64)) return -1;
+    if (mMatrix16) Teapot_Helper_CopyMatrix(&scene->mMatrices[16*i],mMatrix16);
+    else Teapot_Helper_IdentityMatrix(&scene->mMatrices[16*i]);
+    Teapot_Helper_IdentityMatrix(&scene->mvMatrices[16*i]);
+    scene->meshIds[i] = (unsigned char) meshId;
+    scene->scalings[3*i]=scene->scalings[3*i+1]=scene->scalings[3*i+2]=1.f;
+    scene->colors[i] = Teapot_Helper_PackColor(0.75f,0.75f,0.75f,1.f);
+    scene->flags[i] = TEAPOT_SCENE_FLAG_ACTIVE|TEAPOT_SCENE_FLAG_VISIBLE;
+    scene->nCoefficients[3*i]=scene->nCoefficients[3*i+1]=scene->nCoefficients[3*i+2]=1.f;
+    scene->userPtrs[i] = NULL;
+    ++scene->numObjects;
+    return i;
+}
+void Teapot_Scene_SetMMatrix(Teapot_Scene* scene,int index,const tpoat* mMatrix16) {Teapot_Helper_CopyMatrix(&scene->mMatrices[16*index],mMatrix16);}
+
+void Teapot_Scene_CalculateMvMatrices(Teapot_Scene* scene) {
+    tpoat vMatrix[16];
+    const tpoat* __restrict mMatrices;
+    tpoat* __restrict mvMatrices;
+    int i,numObjects;
+    if (!scene || scene->numObjects<=0) return;
+    numObjects = scene->numObjects;mMatrices = scene->mMatrices;mvMatrices = scene->mvMatrices;
+    Teapot_Helper_CopyMatrix(vMatrix,TIS.vMatrix);  // (so that the compiler knows it can't alias the scene arrays)
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numObjects>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numObjects;i++) {
+        tpoat* mv = &mvMatrices[16*i];
+        Teapot_Helper_MultMatrixUncheckArgs(mv,vMatrix,&mMatrices[16*i]);
+        Teapot_Private_CalculateFrameData(mv,(TeapotMeshEnum)scene->meshIds[i],&scene->scalings[3*i],NULL,&scene->nCoefficients[3*i]);
+    }
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    // Frustum culling (in batches of 4 tested objects, like Teapot_CullMulti(...))
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numObjects>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numObjects;i+=4) {
+        const tpoat* mf[4];tpoat boxes[24];int tested[4];
+        int k,mask,numTested=0;
+        for (k=i;k<i+4 && k<numObjects;k++) {
+            if (Teapot_Private_GetCullingBox((TeapotMeshEnum)scene->meshIds[k],&scene->scalings[3*k],&boxes[6*numTested])) {mf[numTested]=&mvMatrices[16*k];tested[numTested++]=k;}
+            else scene->flags[k]|=TEAPOT_SCENE_FLAG_VISIBLE;
+        }
+        if (numTested==0) continue;
+        for (k=numTested;k<4;k++) {mf[k]=mf[0];memcpy(&boxes[6*k],&boxes[0],6*sizeof(tpoat));}   // (padding)
+        mask = Teapot_Private_CullBatch4(TIS.pMatrixFrustum,6,mf,boxes);
+        for (k=0;k<numTested;k++) {
+            if ((mask>>k)&1) scene->flags[tested[k]]|=TEAPOT_SCENE_FLAG_VISIBLE;
+            else scene->flags[tested[k]]&=~TEAPOT_SCENE_FLAG_VISIBLE;
+        }
+    }
+#   endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+}
+
+// Same order as Teapot_MeshData_RadixSort(...), but the scene is not touched: it returns the draw order (or NULL)
+static const unsigned int* Teapot_Private_Scene_RadixSort(const Teapot_Scene* scene) {
+    const int numObjects = scene->numObjects;
+    const tpoat* mvMatrices = scene->mvMatrices;
+    tpoat zMin,zMax,depthScale;
+    int i;
+    if (numObjects<2) return NULL;
+    if (!Teapot_Private_ReserveSortBuffers(numObjects)) {
+        fprintf(stderr,"Error in teapot.h: Teapot_DrawScene(...) out of memory: objects are not sorted.\n");
+        return NULL;
+    }
+    zMin = zMax = mvMatrices[14];
+    for (i=1;i<numObjects;i++) {
+        const tpoat z = mvMatrices[16*i+14];
+        if (zMin>z) zMin=z;
+        else if (zMax<z) zMax=z;
+    }
+    depthScale = (zMax>zMin) ? ((tpoat)TEAPOT_SORTKEY_DEPTH_MAX/(zMax-zMin)) : (tpoat)0;
+    for (i=0;i<numObjects;i++) {
+        const unsigned int rgba = scene->colors[i];
+        TIS.sortKeys[i] = Teapot_Private_MakeSortKey((rgba>>24)!=0xFF,mvMatrices[16*i+14],zMin,zMax,depthScale,scene->meshIds[i],rgba);
+    }
+    return Teapot_Private_RadixSortKeys(numObjects);
+}
+
+#ifdef TEAPOT_ENABLE_INSTANCING
+static __inline int Teapot_Private_Scene_IsInstanceable(const Teapot_Scene* scene,int i) {
+    if ((scene->flags[i]&(TEAPOT_SCENE_FLAG_ACTIVE|TEAPOT_SCENE_FLAG_OUTLINE))!=TEAPOT_SCENE_FLAG_ACTIVE || (scene->colors[i]>>24)!=0xFF) return 0;
+    return Teapot_Private_IsMeshIdInstanceable((TeapotMeshEnum)scene->meshIds[i]);
+}
+// Same as Teapot_Private_DrawMultiInstanced(...)
+static int Teapot_Private_DrawSceneInstanced(const Teapot_Scene* scene,int precomputed) {
+    int bucketStart[TEAPOT_NUM_INSTANCE_BUCKETS],bucketCount[TEAPOT_NUM_INSTANCE_BUCKETS];
+    float* instanceData;
+    int i,numInstances=0,numVisibleInstances=0;
+    if (!TIS.instancingEnabled || !TIS.instancedProgramId) return 0;
+
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) bucketCount[i]=0;
+    for (i=0;i<scene->numObjects;i++) {
+        if (Teapot_Private_Scene_IsInstanceable(scene,i)) {
+            const float* s = &scene->scalings[3*i];
+            const float scaling[3] = {s[0]==0?1:s[0],s[1]==0?1:s[1],s[2]==0?1:s[2]};
+            ++bucketCount[Teapot_Private_InstanceBucket((TeapotMeshEnum)scene->meshIds[i],&scene->mvMatrices[16*i],scaling)];
+        }
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {bucketStart[i]=numInstances;numInstances+=bucketCount[i];bucketCount[i]=0;}
+    if (numInstances==0) return 1;
+    if (!(instanceData = Teapot_Private_BeginInstanceStream(numInstances*TEAPOT_INSTANCE_NUM_FLOATS))) return 0;
+
+    for (i=0;i<scene->numObjects;i++) {
+        const TeapotMeshEnum meshId = (TeapotMeshEnum) scene->meshIds[i];
+        const float* s = &scene->scalings[3*i];
+        const float scaling[3] = {s[0]==0?1:s[0],s[1]==0?1:s[1],s[2]==0?1:s[2]};
+        float color[4];
+        if (!Teapot_Private_Scene_IsInstanceable(scene,i)) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed) {if (!(scene->flags[i]&TEAPOT_SCENE_FLAG_VISIBLE)) continue;}
+        else if (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z) {
+            const float aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
+            const float aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
+            if (!Teapot_Helper_IsVisible(TIS.pMatrixFrustum,&scene->mvMatrices[16*i],aabbMin[0],aabbMin[1],aabbMin[2],aabbMax[0],aabbMax[1],aabbMax[2])) continue;
+        }
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+        Teapot_Helper_UnpackColor(scene->colors[i],color);
+        {
+            const int bucket = Teapot_Private_InstanceBucket(meshId,&scene->mvMatrices[16*i],scaling);
+            Teapot_Private_WriteInstance(&instanceData[(bucketStart[bucket]+bucketCount[bucket]++)*TEAPOT_INSTANCE_NUM_FLOATS],&scene->mvMatrices[16*i],scaling,color,TIS.colorAmbient,TIS.colorSpecular);
+        }
+        ++numVisibleInstances;
+    }
+    if (numVisibleInstances==0) return 1;
+
+    Teapot_Private_DrawInstanceBuckets(bucketStart,bucketCount,numInstances,0);
+    (void)precomputed;
+    return 1;
+}
+#endif //TEAPOT_ENABLE_INSTANCING
+
+#ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+// Same as Teapot_Private_MeshData_CalculateShadowMvpMatrices(...), but TIS.shadowMvpMatrices[16*i] belongs to the i-th scene object
+static const tpoat* Teapot_Private_Scene_CalculateShadowMvpMatrices(const Teapot_Scene* scene,int precomputed,int skipInstanceable) {
+    tpoat biasedShadowVpMatrix[16];
+    const tpoat* __restrict mvMatrices = scene->mvMatrices;
+    tpoat* __restrict shadowMvpMatrices;
+    int i;const int numObjects = scene->numObjects;
+    if (TIS.uLoc_biasedShadowMvpMatrix<0 || !Teapot_Private_ReserveShadowMvpMatrices(numObjects)) return NULL;
+    shadowMvpMatrices = TIS.shadowMvpMatrices;
+    Teapot_Helper_CopyMatrix(biasedShadowVpMatrix,TIS.biasedShadowVpMatrix);
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numObjects>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numObjects;i++) {
+        const unsigned char flags = scene->flags[i];
+        if (!(flags&TEAPOT_SCENE_FLAG_ACTIVE)) continue;
+#       ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+        if (precomputed && !(flags&TEAPOT_SCENE_FLAG_VISIBLE)) continue;
+#       endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#       ifdef TEAPOT_ENABLE_INSTANCING
+        if (skipInstanceable && Teapot_Private_Scene_IsInstanceable(scene,i)) continue;
+#       endif //TEAPOT_ENABLE_INSTANCING
+        Teapot_Helper_MultMatrixUncheckArgs(&shadowMvpMatrices[16*i],biasedShadowVpMatrix,&mvMatrices[16*i]);
+    }
+    (void)precomputed;(void)skipInstanceable;
+    return shadowMvpMatrices;
+}
+#endif //TEAPOT_SHADER_USE_SHADOW_MAP
+
+// 'precomputed': 1 if Teapot_Scene_CalculateMvMatrices(...) has just been called on 'scene' (so that TEAPOT_SCENE_FLAG_VISIBLE and nCoefficients are valid)
+static void Teapot_Private_DrawScene_Mv(const Teapot_Scene* scene,int mustSortObjectsForTransparency,int precomputed)  {
+    const unsigned int* order = NULL;
+    if (!scene || scene->numObjects<=0) return;
+    if (mustSortObjectsForTransparency) order = Teapot_Private_Scene_RadixSort(scene);
+    {
+        const int pushMeshOutlineEnabled = TIS.meshOutlineEnabled;
+        int k,startTransparentObjects=mustSortObjectsForTransparency?0:-1;
+#       ifdef TEAPOT_ENABLE_INSTANCING
+        const int instancedMeshesDrawn = Teapot_Private_DrawSceneInstanced(scene,precomputed);
+#       else //TEAPOT_ENABLE_INSTANCING
+        const int instancedMeshesDrawn = 0;
+#       endif //TEAPOT_ENABLE_INSTANCING
+#       ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+        const tpoat* shadowMvpMatrices = Teapot_Private_Scene_CalculateShadowMvpMatrices(scene,precomputed,instancedMeshesDrawn);
+#       else //TEAPOT_SHADER_USE_SHADOW_MAP
+        const tpoat* shadowMvpMatrices = NULL;
+#       endif //TEAPOT_SHADER_USE_SHADOW_MAP
+        for (k=0;k<scene->numObjects;k++) {
+            const int i = order ? (int)order[k] : k;
+            const unsigned char flags = scene->flags[i];
+            const float* s = &scene->scalings[3*i];
+            float color[4];
+            if (!(flags&TEAPOT_SCENE_FLAG_ACTIVE)) continue;
+#           ifdef TEAPOT_ENABLE_INSTANCING
+            if (instancedMeshesDrawn && Teapot_Private_Scene_IsInstanceable(scene,i)) continue;
+#           endif //TEAPOT_ENABLE_INSTANCING
+#           ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+            if (precomputed && !(flags&TEAPOT_SCENE_FLAG_VISIBLE)) continue;
+#           endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+            Teapot_Helper_UnpackColor(scene->colors[i],color);
+            TIS.meshOutlineEnabled = (flags&TEAPOT_SCENE_FLAG_OUTLINE) ? 1 : 0;
+            Teapot_SetColor(color[0],color[1],color[2],color[3]);
+            Teapot_SetScaling(s[0]==0?1:s[0],s[1]==0?1:s[1],s[2]==0?1:s[2]);
+            if (color[3]<1.f && startTransparentObjects==0) {
+                startTransparentObjects=1;
+                Teapot_Private_DepthMask(GL_FALSE);
+                Teapot_Private_SetCapability(GL_BLEND,1);
+            }
+            if (color[3]!=0) Teapot_Private_Draw_Mv(&scene->mvMatrices[16*i],(TeapotMeshEnum)scene->meshIds[i],precomputed ? &scene->nCoefficients[3*i] : NULL,shadowMvpMatrices ? &shadowMvpMatrices[16*i] : NULL);
+        }
+        if (startTransparentObjects==1) {
+            Teapot_Private_SetCapability(GL_BLEND,0);
+            Teapot_Private_DepthMask(GL_TRUE);
+        }
+        TIS.meshOutlineEnabled = pushMeshOutlineEnabled;
+        (void)instancedMeshesDrawn;
+    }
+}
+void Teapot_DrawScene(Teapot_Scene* scene,int mustSortObjectsForTransparency) {
+    Teapot_Scene_CalculateMvMatrices(scene);
+    Teapot_Private_DrawScene_Mv(scene,mustSortObjectsForTransparency,1);
+}
+void Teapot_DrawScene_Mv(const Teapot_Scene* scene,int mustSortObjectsForTransparency) {
+    Teapot_Private_DrawScene_Mv(scene,mustSortObjectsForTransparency,0);
+}
+
+void Teapot_Bvh_Init(Teapot_Bvh* bvh) {memset(bvh,0,sizeof(Teapot_Bvh));}
+void Teapot_Bvh_Destroy(Teapot_Bvh* bvh) {
+    if (!bvh) return;
+    if (bvh->nodes) free(bvh->nodes);
+    if (bvh->items) free(bvh->items);
+    if (bvh->itemAabbs) free(bvh->itemAabbs);
+    memset(bvh,0,sizeof(Teapot_Bvh));
+}
+// World space aabb of the OBB (obbMatrix,aabbMin,aabbMax)
+static void Teapot_Private_Bvh_ObbToWorldAabb(const tpoat* __restrict m,const tpoat* aabbMin,const tpoat* aabbMax,tpoat* __restrict aabb6Out) {
+    int i;
+    const tpoat c[3] = {(aabbMin[0]+aabbMax[0])*(tpoat)0.5,(aabbMin[1]+aabbMax[1])*(tpoat)0.5,(aabbMin[2]+aabbMax[2])*(tpoat)0.5};
+    const tpoat e[3] = {(tpoat)fabs(aabbMax[0]-aabbMin[0])*(tpoat)0.5,(tpoat)fabs(aabbMax[1]-aabbMin[1])*(tpoat)0.5,(tpoat)fabs(aabbMax[2]-aabbMin[2])*(tpoat)0.5};
+    for (i=0;i<3;i++) {
+        const tpoat center = m[i]*c[0]+m[4+i]*c[1]+m[8+i]*c[2]+m[12+i];
+        const tpoat extent = (tpoat)fabs(m[i])*e[0]+(tpoat)fabs(m[4+i])*e[1]+(tpoat)fabs(m[8+i])*e[2];
+        aabb6Out[i] = center-extent;aabb6Out[3+i] = center+extent;
+    }
+}
+static __inline void Teapot_Private_Bvh_MeshDataWorldAabb(const Teapot_MeshData* md,tpoat* aabb6Out) {
+    tpoat aabbMin[3],aabbMax[3];
+    Teapot_Private_MeshData_GetPickingAabb(md,aabbMin,aabbMax);
+    Teapot_Private_Bvh_ObbToWorldAabb(md->mMatrix,aabbMin,aabbMax,aabb6Out);
+}
+static __inline tpoat Teapot_Private_Bvh_HalfArea(const tpoat* aabb6) {
+    const tpoat dx = aabb6[3]-aabb6[0],dy = aabb6[4]-aabb6[1],dz = aabb6[5]-aabb6[2];
+    return dx*dy+dy*dz+dz*dx;
+}
+static __inline void Teapot_Private_Bvh_Grow(tpoat* __restrict aabb6InOut,const tpoat* __restrict aabb6) {
+    int j;for (j=0;j<3;j++) {if (aabb6InOut[j]>aabb6[j]) aabb6InOut[j]=aabb6[j];if (aabb6InOut[3+j]<aabb6[3+j]) aabb6InOut[3+j]=aabb6[3+j];}
+}
+static __inline void Teapot_Private_Bvh_SetEmpty(tpoat* aabb6) {
+    aabb6[0]=aabb6[1]=aabb6[2]=(tpoat)1e30;aabb6[3]=aabb6[4]=aabb6[5]=(tpoat)-1e30;
+}
+static int Teapot_Private_Bvh_Reserve(Teapot_Bvh* bvh,int numItems) {
+    void* p;
+    if (numItems<=bvh->capacity) return 1;
+    // Every array grows on its own (as in Teapot_Scene_Reserve(...))
+    if (!(p = realloc(bvh->nodes,2*numItems*sizeof(Teapot_BvhNode)))) return 0;
+    bvh->nodes = (Teapot_BvhNode*) p;
+    if (!(p = realloc(bvh->items,numItems*sizeof(int)))) return 0;
+    bvh->items = (int*) p;
+    if (!(p = realloc(bvh->itemAabbs,6*numItems*sizeof(tpoat)))) return 0;
+    bvh->itemAabbs = (tpoat*) p;
+    bvh->capacity = numItems;
+    return 1;
+}
+// Sets the bounds of the node from its items (leaf) or from its children (inner node)
+static __inline void Teapot_Private_Bvh_UpdateNodeBounds(Teapot_Bvh* bvh,Teapot_BvhNode* node) {
+    tpoat* aabb = node->aabbMin;    // (aabbMin[3] and aabbMax[3] are contiguous)
+    int i;
+    Teapot_Private_Bvh_SetEmpty(aabb);
+    if (node->count>0) {for (i=0;i<node->count;i++) Teapot_Private_Bvh_Grow(aabb,&bvh->itemAabbs[6*(node->start+i)]);}
+    else {Teapot_Private_Bvh_Grow(aabb,bvh->nodes[node->start].aabbMin);Teapot_Private_Bvh_Grow(aabb,bvh->nodes[node->start+1].aabbMin);}
+}
+#define TEAPOT_BVH_MAX_DEPTH (64)
+// Builds the hierarchy on bvh->items and bvh->itemAabbs (already filled)
+static void Teapot_Private_Bvh_BuildNodes(Teapot_Bvh* bvh) {
+    int stack[TEAPOT_BVH_MAX_DEPTH],depths[TEAPOT_BVH_MAX_DEPTH],stackSize=0;
+    bvh->numNodes = 1;
+    bvh->nodes[0].start = 0;bvh->nodes[0].count = bvh->numItems;
+    stack[stackSize]=0;depths[stackSize++]=0;
+    while (stackSize>0) {
+        const int nodeIndex = stack[--stackSize],depth = depths[stackSize];
+        Teapot_BvhNode* node = &bvh->nodes[nodeIndex];
+        const int start = node->start,count = node->count;
+        tpoat centroidMin[3],centroidMax[3],bestCost;
+        int i,j,axis,bestAxis=-1,bestSplit=0,mid;
+        Teapot_Private_Bvh_UpdateNodeBounds(bvh,node);
+        if (count<=TEAPOT_BVH_MAX_LEAF_SIZE || depth>=TEAPOT_BVH_MAX_DEPTH-2) continue;
+        for (j=0;j<3;j++) {centroidMin[j]=(tpoat)1e30;centroidMax[j]=(tpoat)-1e30;}
+        for (i=start;i<start+count;i++) {
+            const tpoat* b = &bvh->itemAabbs[6*i];
+            for (j=0;j<3;j++) {const tpoat c = b[j]+b[3+j];if (centroidMin[j]>c) centroidMin[j]=c;if (centroidMax[j]<c) centroidMax[j]=c;}  // (2*centroid)
+        }
+        // Binned SAH: cost(split) = halfArea(left)*numLeft + halfArea(right)*numRight
+        bestCost = Teapot_Private_Bvh_HalfArea(node->aabbMin)*(tpoat)count;
+        for (axis=0;axis<3;axis++) {
+            tpoat binAabbs[TEAPOT_BVH_NUM_BINS][6],rightAabb[6],rightArea[TEAPOT_BVH_NUM_BINS];
+            int binCounts[TEAPOT_BVH_NUM_BINS],rightCount[TEAPOT_BVH_NUM_BINS],leftCount;tpoat leftAabb[6];
+            const tpoat extent = centroidMax[axis]-centroidMin[axis];
+            tpoat binScale;
+            if (extent<=0) continue;
+            binScale = (tpoat)TEAPOT_BVH_NUM_BINS/extent;
+            for (i=0;i<TEAPOT_BVH_NUM_BINS;i++) {binCounts[i]=0;Teapot_Private_Bvh_SetEmpty(binAabbs[i]);}
+            for (i=start;i<start+count;i++) {
+                const tpoat* b = &bvh->itemAabbs[6*i];
+                int bin = (int)((b[axis]+b[3+axis]-centroidMin[axis])*binScale);
+                if (bin>=TEAPOT_BVH_NUM_BINS) bin=TEAPOT_BVH_NUM_BINS-1;
+                ++binCounts[bin];Teapot_Private_Bvh_Grow(binAabbs[bin],b);
+            }
+            Teapot_Private_Bvh_SetEmpty(rightAabb);
+            for (i=TEAPOT_BVH_NUM_BINS-1,j=0;i>0;i--) {
+                j+=binCounts[i];Teapot_Private_Bvh_Grow(rightAabb,binAabbs[i]);
+                rightCount[i]=j;rightArea[i]=j>0 ? Teapot_Private_Bvh_HalfArea(rightAabb) : 0;
+            }
+            Teapot_Private_Bvh_SetEmpty(leftAabb);leftCount=0;
+            for (i=1;i<TEAPOT_BVH_NUM_BINS;i++) {  // split between bin i-1 and bin i
+                tpoat cost;
+                leftCount+=binCounts[i-1];Teapot_Private_Bvh_Grow(leftAabb,binAabbs[i-1]);
+                if (leftCount==0 || rightCount[i]==0) continue;
+                cost = Teapot_Private_Bvh_HalfArea(leftAabb)*(tpoat)leftCount+rightArea[i]*(tpoat)rightCount[i];
+                if (cost<bestCost) {bestCost=cost;bestAxis=axis;bestSplit=i;}
+            }
+        }
+        if (bestAxis<0) {
+            // No split is cheaper than a leaf: big leaves are split in half anyway (on the longest centroid axis)
+            if (count<=4*TEAPOT_BVH_MAX_LEAF_SIZE) continue;
+            mid = start+count/2;
+        }
+        else {
+            // Partition (items and itemAabbs together)
+            const tpoat binScale = (tpoat)TEAPOT_BVH_NUM_BINS/(centroidMax[bestAxis]-centroidMin[bestAxis]);
+            int lo=start,hi=start+count-1;
+            while (lo<=hi) {
+                const tpoat* b = &bvh->itemAabbs[6*lo];
+                int bin = (int)((b[bestAxis]+b[3+bestAxis]-centroidMin[bestAxis])*binScale);
+                if (bin>=TEAPOT_BVH_NUM_BINS) bin=TEAPOT_BVH_NUM_BINS-1;
+                if (bin<bestSplit) ++lo;
+                else {
+                    tpoat tmp[6];const int t = bvh->items[lo];bvh->items[lo]=bvh->items[hi];bvh->items[hi]=t;
+                    memcpy(tmp,&bvh->itemAabbs[6*lo],sizeof(tmp));memcpy(&bvh->itemAabbs[6*lo],&bvh->itemAabbs[6*hi],sizeof(tmp));memcpy(&bvh->itemAabbs[6*hi],tmp,sizeof(tmp));
+                    --hi;
+                }
+            }
+            mid = lo;
+        }
+        // Two children (the node is now an inner node, its bounds are already set)
+        {
+            const int left = bvh->numNodes;
+            bvh->numNodes+=2;
+            node = &bvh->nodes[nodeIndex];
+            bvh->nodes[left].start = start;bvh->nodes[left].count = mid-start;
+            bvh->nodes[left+1].start = mid;bvh->nodes[left+1].count = start+count-mid;
+            node->start = left;node->count = 0;
+            stack[stackSize]=left+1;depths[stackSize++]=depth+1;
+            stack[stackSize]=left;depths[stackSize++]=depth+1;
+        }
+    }
+}
+int Teapot_Bvh_Build(Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,int numMeshes) {
+    int i;
+    if (!bvh) return 0;
+    bvh->numNodes = bvh->numItems = 0;
+    if (!meshes || numMeshes<=0) return 1;
+    if (!Teapot_Private_Bvh_Reserve(bvh,numMeshes)) {fprintf(stderr,"Error in teapot.h: Teapot_Bvh_Build(...) out of memory (numMeshes=%d).\n",numMeshes);return 0;}
+    for (i=0;i<numMeshes;i++) {bvh->items[i]=i;Teapot_Private_Bvh_MeshDataWorldAabb(meshes[i],&bvh->itemAabbs[6*i]);}
+    bvh->numItems = numMeshes;
+    Teapot_Private_Bvh_BuildNodes(bvh);
+    return 1;
+}
+int Teapot_Bvh_BuildGeneric(Teapot_Bvh* bvh,int numMeshes,void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData),void* userData) {
+    int i;
+    if (!bvh) return 0;
+    bvh->numNodes = bvh->numItems = 0;
+    if (!getMeshDataCallback || numMeshes<=0) return 1;
+    if (!Teapot_Private_Bvh_Reserve(bvh,numMeshes)) {fprintf(stderr,"Error in teapot.h: Teapot_Bvh_BuildGeneric(...) out of memory (numMeshes=%d).\n",numMeshes);return 0;}
+    for (i=0;i<numMeshes;i++) {
+        tpoat obbMatrix[16]={1,0,0,0,   0,1,0,0,    0,0,1,0,    0,0,0,1},aabbMin[3],aabbMax[3];
+        getMeshDataCallback(i,obbMatrix,aabbMin,aabbMax,userData);
+        bvh->items[i]=i;Teapot_Private_Bvh_ObbToWorldAabb(obbMatrix,aabbMin,aabbMax,&bvh->itemAabbs[6*i]);
+    }
+    bvh->numItems = numMeshes;
+    Teapot_Private_Bvh_BuildNodes(bvh);
+    return 1;
+}
+void Teapot_Bvh_Refit(Teapot_Bvh* bvh,Teapot_MeshData* const* meshes) {
+    int i;
+    if (!bvh || !meshes || bvh->numNodes==0) return;
+    for (i=0;i<bvh->numItems;i++) Teapot_Private_Bvh_MeshDataWorldAabb(meshes[bvh->items[i]],&bvh->itemAabbs[6*i]);
+    for (i=bvh->numNodes-1;i>=0;i--) Teapot_Private_Bvh_UpdateNodeBounds(bvh,&bvh->nodes[i]);   // (children first)
+}
+
+// Ray vs node aabb. Returns the entry distance, or a negative value if the node is missed (or farther than 'maxDistance', when it is positive)
+static __inline tpoat Teapot_Private_Bvh_RayNodeDistance(const Teapot_BvhNode* node,const tpoat* rayOrigin3,const tpoat* invRayDir3,tpoat maxDistance) {
+    tpoat tMin = 0,tMax = (tpoat)1000000000000;int j;
+    if (maxDistance>0) tMax = maxDistance;
+    for (j=0;j<3;j++) {
+        tpoat t1 = (node->aabbMin[j]-rayOrigin3[j])*invRayDir3[j];
+        tpoat t2 = (node->aabbMax[j]-rayOrigin3[j])*invRayDir3[j];
+        if (t1>t2) {tpoat w=t1;t1=t2;t2=w;}
+        if (t1>tMin) tMin=t1;
+        if (t2<tMax) tMax=t2;
+        if (tMin>tMax) return -1;
+    }
+    return tMin;
+}
+// Front to back traversal: every leaf item is passed to 'testItem(...)' (that must return 1 and its distance on collision). Returns the nearest colliding item (or -1)
+static int Teapot_Private_Bvh_RayQuery(const Teapot_Bvh* bvh,const tpoat* rayOrigin3,const tpoat* rayDir3,int (*testItem)(int item,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* tMinOut,const void* userData),const void* userData,tpoat* pOptionalDistanceOut) {
+    int stack[2*TEAPOT_BVH_MAX_DEPTH],stackSize=0,rv=-1,i,j;
+    tpoat intersection_distance = 0,invRayDir[3];
+    if (pOptionalDistanceOut) *pOptionalDistanceOut=0;
+    if (!bvh || bvh->numNodes==0) return -1;
+    for (j=0;j<3;j++) invRayDir[j] = rayDir3[j]!=0 ? (tpoat)1/rayDir3[j] : (tpoat)1e30;
+    if (Teapot_Private_Bvh_RayNodeDistance(&bvh->nodes[0],rayOrigin3,invRayDir,0)<0) return -1;
+    stack[stackSize++]=0;
+    while (stackSize>0) {
+        const Teapot_BvhNode* node = &bvh->nodes[stack[--stackSize]];
+        if (node->count>0) {
+            for (i=node->start;i<node->start+node->count;i++) {
+                tpoat tMin;
+                if (testItem(bvh->items[i],rayOrigin3,rayDir3,&tMin,userData) && (intersection_distance<=0 || intersection_distance>tMin)) {
+                    intersection_distance = tMin;
+                    rv = bvh->items[i];
+                }
+            }
+        }
+        else {
+            // Both children are tested here: the nearest one is visited first
+            const tpoat d0 = Teapot_Private_Bvh_RayNodeDistance(&bvh->nodes[node->start],rayOrigin3,invRayDir,intersection_distance);
+            const tpoat d1 = Teapot_Private_Bvh_RayNodeDistance(&bvh->nodes[node->start+1],rayOrigin3,invRayDir,intersection_distance);
+            if (d0>=0 && d1>=0) {
+                if (d0<=d1) {stack[stackSize++]=node->start+1;stack[stackSize++]=node->start;}
+                else {stack[stackSize++]=node->start;stack[stackSize++]=node->start+1;}
+            }
+            else if (d0>=0) stack[stackSize++]=node->start;
+            else if (d1>=0) stack[stackSize++]=node->start+1;
+        }
+    }
+    if (pOptionalDistanceOut) *pOptionalDistanceOut=intersection_distance;
+    return rv;
+}
+static int Teapot_Private_Bvh_TestMeshData(int item,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* tMinOut,const void* userData) {
+    const Teapot_MeshData* md = ((Teapot_MeshData* const*)userData)[item];
+    tpoat aabbMin[3],aabbMax[3];
+    if (!md->active) return 0;
+    Teapot_Private_MeshData_GetPickingAabb(md,aabbMin,aabbMax);
+    return Teapot_Private_RayObbIntersection(md->mMatrix,aabbMin,aabbMax,rayOrigin3,rayDir3,tMinOut);
+}
+Teapot_MeshData* Teapot_Bvh_GetMeshUnderMouseFromRay(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut) {
+    int item;
+    if (pOptionalDistanceOut) *pOptionalDistanceOut=0;
+    if (!meshes) return NULL;
+    item = Teapot_Private_Bvh_RayQuery(bvh,rayOrigin3,rayDir3,&Teapot_Private_Bvh_TestMeshData,(const void*)meshes,pOptionalDistanceOut);
+    return item>=0 ? meshes[item] : NULL;
+}
+Teapot_MeshData* Teapot_Bvh_GetMeshUnderMouse(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,int mouseX,int mouseY,const int* viewport4,tpoat* pOptionalDistanceOut) {
+    tpoat vpMatrixInv[16];
+    tpoat rayOrigin[3] = {0,0,0};
+    tpoat rayDir[3] = {0,0,-1};
+    if (pOptionalDistanceOut) *pOptionalDistanceOut=0;
+    if (!meshes || !viewport4) return NULL;
+    Teapot_Helper_MultMatrix(vpMatrixInv,TIS.pMatrix,TIS.vMatrix);
+    Teapot_Helper_InvertMatrix(vpMatrixInv,vpMatrixInv);
+    Teapot_Helper_UnProjectMouseCoords(rayOrigin,rayDir,mouseX,mouseY,vpMatrixInv,viewport4);
+    return Teapot_Bvh_GetMeshUnderMouseFromRay(bvh,meshes,rayOrigin,rayDir,pOptionalDistanceOut);
 }
-void Teapot_LowLevel_SetMvMatrixUniformFloat(const float mvMatrix[16]) {
-#   ifdef TEAPOT_USE_DOUBLE_PRECISION
-    tpoat tmp[16];Teapot_Helper_ConvertMatrixf2d16(tmp,mvMatrix);
-    Teapot_LowLevel_SetMvMatrixUniform(tmp);
-#   else
-    Teapot_LowLevel_SetMvMatrixUniform(mvMatrix);
-#   endif
+typedef struct {
+    void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData);
+    void* userData;
+} Teapot_Private_Bvh_GenericQuery;
+static int Teapot_Private_Bvh_TestGeneric(int item,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* tMinOut,const void* userData) {
+    const Teapot_Private_Bvh_GenericQuery* q = (const Teapot_Private_Bvh_GenericQuery*) userData;
+    tpoat obbMatrix[16]={1,0,0,0,   0,1,0,0,    0,0,1,0,    0,0,0,1},aabbMin[3],aabbMax[3];
+    q->getMeshDataCallback(item,obbMatrix,aabbMin,aabbMax,q->userData);
+    return Teapot_Private_RayObbIntersection(obbMatrix,aabbMin,aabbMax,rayOrigin3,rayDir3,tMinOut);
 }
-void Teapot_LowLevel_DrawElements(TeapotMeshEnum meshId)    {
-    glDrawElements(meshId<TEAPOT_FIRST_MESHLINES_INDEX ? GL_TRIANGLES : GL_LINES,TIS.numInds[meshId],GL_UNSIGNED_SHORT,(const void*) (TIS.startInds[meshId]*sizeof(unsigned short)));
+int Teapot_Bvh_GetMeshUnderMouseFromRayGeneric(const Teapot_Bvh* bvh,void (*getMeshDataCallback)(int idx,tpoat* __restrict mMatrix16InOut,tpoat aabbMinOut[3],tpoat aabbMaxOut[3],void* userData),const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* pOptionalDistanceOut,void* userData) {
+    Teapot_Private_Bvh_GenericQuery q;
+    if (pOptionalDistanceOut) *pOptionalDistanceOut=0;
+    if (!getMeshDataCallback) return -1;
+    q.getMeshDataCallback = getMeshDataCallback;q.userData = userData;
+    return Teapot_Private_Bvh_RayQuery(bvh,rayOrigin3,rayDir3,&Teapot_Private_Bvh_TestGeneric,&q,pOptionalDistanceOut);
 }
 
-void Teapot_LowLevel_StopDisablingLighting(void) {
-    TIS.colorAmbient[0]=TIS.colorAmbient[1]=TIS.colorAmbient[2]=0.25f;TIS.colorAmbient[3]=1.f;
-    glUniform4fv(TIS.uLoc_colorAmbient,1,TIS.colorAmbient);
+#ifdef TEAPOT_ENABLE_EXACT_PICKING
+static __inline unsigned Teapot_Private_GetMeshIndex(TeapotMeshEnum meshId,int i) {
+    const unsigned char* p = &TIS.meshBuffer.inds[TIS.indsOffset[meshId]];
+    return TIS.indsType[meshId]==GL_UNSIGNED_INT ? ((const unsigned*)p)[i] : (unsigned)((const unsigned short*)p)[i];
 }
-
-void Teapot_PostDraw(void)  {
-    glUseProgram(0);
-    glBindBuffer(GL_ARRAY_BUFFER,0);
-    glDisableVertexAttribArray(TIS.aLoc_vertex);
-    glDisableVertexAttribArray(TIS.aLoc_normal);
+int Teapot_GetMeshTriangle(TeapotMeshEnum meshId,int triangle,float v0[3],float v1[3],float v2[3]) {
+    float* v[3];int j;
+    if (meshId<0 || meshId>=TEAPOT_MESH_COUNT || triangle<0 || 3*triangle+2>=TIS.numInds[meshId] || !TIS.meshBuffer.inds) return 0;
+    v[0]=v0;v[1]=v1;v[2]=v2;
+    for (j=0;j<3;j++) memcpy(v[j],&TIS.meshBuffer.verts[Teapot_Private_GetMeshIndex(meshId,3*triangle+j)*TEAPOT_VERTEX_NUM_FLOATS],3*sizeof(float));
+    return 1;
 }
-
-
-int Teapot_MeshData_Depth_Sorter(const void* pmd0,const void* pmd1) {
-    const Teapot_MeshData* md0 = *((const Teapot_MeshData* const*) (pmd0));
-    const Teapot_MeshData* md1 = *((const Teapot_MeshData* const*) (pmd1));
-    if (md0->color[3]<1.f)   {
-        if (md1->color[3]<1.f) return md1->mvMatrix[14]>md0->mvMatrix[14]?-1:1;
-        else return 1;
+static void Teapot_Private_MeshTriBvh_Destroy(Teapot_MeshTriBvh* tb) {
+    Teapot_Bvh_Destroy(&tb->bvh);
+    if (tb->tris) {free(tb->tris);tb->tris=NULL;}
+}
+// Builds TIS.triBvhs[meshId] from TIS.meshBuffer (meshes without triangles get an empty hierarchy). Returns 0 when out of memory
+static int Teapot_Private_MeshTriBvh_Build(TeapotMeshEnum meshId) {
+    Teapot_MeshTriBvh* tb = &TIS.triBvhs[meshId];
+    const int numTris = meshId<TEAPOT_FIRST_MESHLINES_INDEX && meshId!=TEAPOT_MESH_CAPSULE ? TIS.numInds[meshId]/3 : 0;
+    int i,j,k,numPadded=0,*padded;
+    Teapot_Private_MeshTriBvh_Destroy(tb);
+    if (numTris<=0) return 1;
+    if (!Teapot_Private_Bvh_Reserve(&tb->bvh,numTris)) goto oom;
+    for (i=0;i<numTris;i++) {
+        tpoat* aabb = &tb->bvh.itemAabbs[6*i];
+        Teapot_Private_Bvh_SetEmpty(aabb);
+        for (j=0;j<3;j++) {
+            const float* p = &TIS.meshBuffer.verts[Teapot_Private_GetMeshIndex(meshId,3*i+j)*TEAPOT_VERTEX_NUM_FLOATS];
+            for (k=0;k<3;k++) {if (aabb[k]>p[k]) aabb[k]=p[k];if (aabb[3+k]<p[k]) aabb[3+k]=p[k];}
+        }
+        tb->bvh.items[i]=i;
     }
-    else if (md1->color[3]<1.f) return -1;
-    else return md1->mvMatrix[14]<md0->mvMatrix[14]?-1:1;   // optional new line: opaque object sorted front to back
+    tb->bvh.numItems = numTris;
+    Teapot_Private_Bvh_BuildNodes(&tb->bvh);
+
+    // Leaves are padded to multiples of 4 items, so that every leaf is made of whole SIMD groups
+    for (i=0;i<tb->bvh.numNodes;i++) numPadded+=(tb->bvh.nodes[i].count+3)&(~3);
+    padded = (int*) malloc(numPadded*sizeof(int));
+    tb->tris = (float*) malloc(9*numPadded*sizeof(float));
+    if (!padded || !tb->tris) {if (padded) free(padded);goto oom;}
+    for (i=0,numPadded=0;i<tb->bvh.numNodes;i++) {
+        Teapot_BvhNode* node = &tb->bvh.nodes[i];
+        if (node->count==0) continue;
+        for (j=0;j<node->count;j++) padded[numPadded+j] = tb->bvh.items[node->start+j];
+        for (;j&3;j++) padded[numPadded+j] = -1;
+        node->start = numPadded;numPadded+=j;
+    }
+    free(tb->bvh.items);tb->bvh.items = padded;tb->bvh.numItems = numPadded;
+    free(tb->bvh.itemAabbs);tb->bvh.itemAabbs = NULL;tb->bvh.capacity = 0;
+    memset(tb->tris,0,9*numPadded*sizeof(float));   // (padding triangles are degenerate: they are never hit)
+    for (i=0;i<numPadded;i++) {
+        float v[3][3];float* g = &tb->tris[36*(i/4)+(i&3)];
+        if (padded[i]<0) continue;
+        for (j=0;j<3;j++) memcpy(v[j],&TIS.meshBuffer.verts[Teapot_Private_GetMeshIndex(meshId,3*padded[i]+j)*TEAPOT_VERTEX_NUM_FLOATS],3*sizeof(float));
+        for (k=0;k<3;k++) {g[4*k]=v[0][k];g[4*(3+k)]=v[1][k]-v[0][k];g[4*(6+k)]=v[2][k]-v[0][k];}
+    }
+    return 1;
+    oom:
+    fprintf(stderr,"Error in teapot.h: can't build the triangle hierarchy of mesh %d (out of memory).\n",(int)meshId);
+    Teapot_Private_MeshTriBvh_Destroy(tb);
     return 0;
 }
-
-void Teapot_MeshData_Clear(Teapot_MeshData* md) {
-    Teapot_Helper_IdentityMatrix(md->mvMatrix);
-    md->color[0]=md->color[1]=md->color[2]=0.75f;md->color[3]=1.f;
-    md->colorAmbient[0]=md->colorAmbient[1]=md->colorAmbient[2]=0.25f;
-    md->colorSpecular[0]=md->colorSpecular[1]=md->colorSpecular[2]=0.8f;md->colorSpecular[3]=20.f;
-    md->scaling[0]=md->scaling[1]=md->scaling[2]=1.f;
-    md->outlineEnabled = 0;md->active=1;
-#   ifndef TEAPOT_MESHDATA_STRUCT_EXTRA_FIELDS
-    md->userPtr=0;
+// Moller-Trumbore (double sided) against 4 triangles (SoA, see Teapot_MeshTriBvh::tris). Returns the lane of the nearest hit in (0,*tInOut), or -1
+static __inline int Teapot_Private_RayTriangles4(const float* __restrict g,const float* rayOrigin3,const float* rayDir3,float* tInOut,float* uvOut) {
+#   if (defined(TEAPOT_USE_SIMD) && (defined(__AVX__) || (defined(__SSE__) && !defined(TEAPOT_MATRIX_USE_DOUBLE_PRECISION))))
+    const __m128 dx = _mm_set1_ps(rayDir3[0]),dy = _mm_set1_ps(rayDir3[1]),dz = _mm_set1_ps(rayDir3[2]);
+    const __m128 e1x = _mm_loadu_ps(g+12),e1y = _mm_loadu_ps(g+16),e1z = _mm_loadu_ps(g+20);
+    const __m128 e2x = _mm_loadu_ps(g+24),e2y = _mm_loadu_ps(g+28),e2z = _mm_loadu_ps(g+32);
+    const __m128 tx = _mm_sub_ps(_mm_set1_ps(rayOrigin3[0]),_mm_loadu_ps(g)),ty = _mm_sub_ps(_mm_set1_ps(rayOrigin3[1]),_mm_loadu_ps(g+4)),tz = _mm_sub_ps(_mm_set1_ps(rayOrigin3[2]),_mm_loadu_ps(g+8));
+    const __m128 zero = _mm_setzero_ps(),one = _mm_set1_ps(1.f);
+    // p = d x e2, q = t x e1
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy,e2z),_mm_mul_ps(dz,e2y)),py = _mm_sub_ps(_mm_mul_ps(dz,e2x),_mm_mul_ps(dx,e2z)),pz = _mm_sub_ps(_mm_mul_ps(dx,e2y),_mm_mul_ps(dy,e2x));
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty,e1z),_mm_mul_ps(tz,e1y)),qy = _mm_sub_ps(_mm_mul_ps(tz,e1x),_mm_mul_ps(tx,e1z)),qz = _mm_sub_ps(_mm_mul_ps(tx,e1y),_mm_mul_ps(ty,e1x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x,px),_mm_mul_ps(e1y,py)),_mm_mul_ps(e1z,pz));
+    const __m128 invDet = _mm_div_ps(one,det);
+    const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx,px),_mm_mul_ps(ty,py)),_mm_mul_ps(tz,pz)),invDet);
+    const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,qx),_mm_mul_ps(dy,qy)),_mm_mul_ps(dz,qz)),invDet);
+    const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x,qx),_mm_mul_ps(e2y,qy)),_mm_mul_ps(e2z,qz)),invDet);
+    __m128 hit = _mm_and_ps(_mm_cmpneq_ps(det,zero),_mm_and_ps(_mm_cmpge_ps(u,zero),_mm_cmpge_ps(v,zero)));
+    int mask,i,rv=-1;
+    hit = _mm_and_ps(hit,_mm_and_ps(_mm_cmple_ps(_mm_add_ps(u,v),one),_mm_and_ps(_mm_cmpgt_ps(t,zero),_mm_cmplt_ps(t,_mm_set1_ps(*tInOut)))));
+    mask = _mm_movemask_ps(hit);
+    if (mask) {
+        float ts[4],us[4],vs[4];
+        _mm_storeu_ps(ts,t);_mm_storeu_ps(us,u);_mm_storeu_ps(vs,v);
+        for (i=0;i<4;i++) {
+            if ((mask&(1<<i)) && ts[i]<*tInOut) {*tInOut=ts[i];uvOut[0]=us[i];uvOut[1]=vs[i];rv=i;}
+        }
+    }
+    return rv;
+#   else
+    int i,rv=-1;
+    for (i=0;i<4;i++) {
+        const float e1[3] = {g[12+i],g[16+i],g[20+i]},e2[3] = {g[24+i],g[28+i],g[32+i]};
+        const float tv[3] = {rayOrigin3[0]-g[i],rayOrigin3[1]-g[4+i],rayOrigin3[2]-g[8+i]};
+        const float p[3] = {rayDir3[1]*e2[2]-rayDir3[2]*e2[1],rayDir3[2]*e2[0]-rayDir3[0]*e2[2],rayDir3[0]*e2[1]-rayDir3[1]*e2[0]};
+        const float det = e1[0]*p[0]+e1[1]*p[1]+e1[2]*p[2];
+        float invDet,u,v,t,q[3];
+        if (det==0) continue;
+        invDet = 1.f/det;
+        u = (tv[0]*p[0]+tv[1]*p[1]+tv[2]*p[2])*invDet;
+        if (!(u>=0 && u<=1)) continue;
+        q[0] = tv[1]*e1[2]-tv[2]*e1[1];q[1] = tv[2]*e1[0]-tv[0]*e1[2];q[2] = tv[0]*e1[1]-tv[1]*e1[0];
+        v = (rayDir3[0]*q[0]+rayDir3[1]*q[1]+rayDir3[2]*q[2])*invDet;
+        if (!(v>=0 && u+v<=1)) continue;
+        t = (e2[0]*q[0]+e2[1]*q[1]+e2[2]*q[2])*invDet;
+        if (t>0 && t<*tInOut) {*tInOut=t;uvOut[0]=u;uvOut[1]=v;rv=i;}
+    }
+    return rv;
 #   endif
 }
-#ifdef __cplusplus
-_Teapot_MeshData::_Teapot_MeshData() {Teapot_MeshData_Clear(this);}
-#endif
-void Teapot_MeshData_SetMvMatrix(Teapot_MeshData* md, const tpoat* mvMatrix16) {Teapot_Helper_CopyMatrix(md->mvMatrix,mvMatrix16);}
-#ifndef TEAPOT_MESHDATA_HAS_MMATRIX_PTR
-void Teapot_MeshData_SetMMatrix(Teapot_MeshData* md, const tpoat* mMatrix16) {Teapot_Helper_CopyMatrix(md->mMatrix,mMatrix16);}
-#endif //TEAPOT_MESHDATA_HAS_MMATRIX_PTR
-void Teapot_MeshData_CalculateMvMatrix(Teapot_MeshData* md) {Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);}
-
-#ifndef TEAPOT_USE_OPENMP
-void Teapot_MeshData_CalculateMvMatrixFromArray(Teapot_MeshData** meshes,int numMeshes) {
-    int i;if (!meshes || numMeshes<=0) return;
-    for (i=0;i<numMeshes;i++) {
-        Teapot_MeshData* md = meshes[i];
-#       ifdef TEAPOT_CALCULATEMVMATRIXFROMARRAY_EXCLUDES_INACTIVE_MESHDATA
-        if (md->active) // optional
-#       endif
-            Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);
+// Nearest triangle hit by a mesh space ray (front to back traversal). Returns the triangle (or -1), and updates *tInOut (the max distance on entry) and uvOut
+static int Teapot_Private_MeshTriBvh_Raycast(const Teapot_MeshTriBvh* tb,const tpoat* rayOrigin3,const tpoat* rayDir3,float* tInOut,float* uvOut) {
+    int stack[2*TEAPOT_BVH_MAX_DEPTH],stackSize=0,rv=-1,i,j;
+    tpoat invRayDir[3];
+    const float o[3] = {(float)rayOrigin3[0],(float)rayOrigin3[1],(float)rayOrigin3[2]},d[3] = {(float)rayDir3[0],(float)rayDir3[1],(float)rayDir3[2]};
+    if (tb->bvh.numNodes==0) return -1;
+    for (j=0;j<3;j++) invRayDir[j] = rayDir3[j]!=0 ? (tpoat)1/rayDir3[j] : (tpoat)1e30;
+    if (Teapot_Private_Bvh_RayNodeDistance(&tb->bvh.nodes[0],rayOrigin3,invRayDir,*tInOut)<0) return -1;
+    stack[stackSize++]=0;
+    while (stackSize>0) {
+        const Teapot_BvhNode* node = &tb->bvh.nodes[stack[--stackSize]];
+        if (node->count>0) {
+            for (i=node->start;i<node->start+node->count;i+=4) {
+                const int lane = Teapot_Private_RayTriangles4(&tb->tris[9*i],o,d,tInOut,uvOut);
+                if (lane>=0) rv = tb->bvh.items[i+lane];
+            }
+        }
+        else {
+            const tpoat d0 = Teapot_Private_Bvh_RayNodeDistance(&tb->bvh.nodes[node->start],rayOrigin3,invRayDir,*tInOut);
+            const tpoat d1 = Teapot_Private_Bvh_RayNodeDistance(&tb->bvh.nodes[node->start+1],rayOrigin3,invRayDir,*tInOut);
+            if (d0>=0 && d1>=0) {
+                if (d0<=d1) {stack[stackSize++]=node->start+1;stack[stackSize++]=node->start;}
+                else {stack[stackSize++]=node->start;stack[stackSize++]=node->start+1;}
+            }
+            else if (d0>=0) stack[stackSize++]=node->start;
+            else if (d1>=0) stack[stackSize++]=node->start+1;
+        }
     }
+    return rv;
 }
-#else //TEAPOT_USE_OPENMP
-void Teapot_MeshData_CalculateMvMatrixFromArray(Teapot_MeshData** meshes,int numMeshes) {
-    int i;if (!meshes || numMeshes<=0) return;
-#   pragma omp parallel
-    for (i=0;i<numMeshes;i++) {
-        Teapot_MeshData* md = meshes[i];
-#       ifdef TEAPOT_CALCULATEMVMATRIXFROMARRAY_EXCLUDES_INACTIVE_MESHDATA
-        if (md->active) // optional
-#       endif
-            Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);
+// Updates 'hit' if md is hit nearer than hit->mesh (when not NULL). Returns 1 in that case
+static int Teapot_Private_MeshData_RaycastExact(const Teapot_MeshData* md,const tpoat* rayOrigin3,const tpoat* rayDir3,Teapot_RaycastHit* hit) {
+    const TeapotMeshEnum meshId = md->meshId;
+    tpoat aabbMin[3],aabbMax[3],tMin;
+    int j,triangle=-1;float uv[2]={0,0};
+    if (!md->active) return 0;
+    // The OBB test comes first (it's cheaper, and no triangle can be nearer than the OBB)
+    Teapot_Private_MeshData_GetPickingAabb(md,aabbMin,aabbMax);
+    if (!Teapot_Private_RayObbIntersection(md->mMatrix,aabbMin,aabbMax,rayOrigin3,rayDir3,&tMin) || (hit->mesh && tMin>=hit->distance)) return 0;
+    if (meshId<TEAPOT_MESH_COUNT && TIS.triBvhs[meshId].bvh.numNodes>0) {
+        // Ray in mesh space: the ray parameter does not change
+        tpoat inv[16],o[3],d[3];float t = hit->mesh ? (float)hit->distance : (float)1e30;
+        if (md->scaling[0]==0 || md->scaling[1]==0 || md->scaling[2]==0 || !Teapot_Helper_InvertMatrix(inv,md->mMatrix)) return 0;
+        for (j=0;j<3;j++) {
+            o[j] = (inv[j]*rayOrigin3[0]+inv[4+j]*rayOrigin3[1]+inv[8+j]*rayOrigin3[2]+inv[12+j])/md->scaling[j];
+            d[j] = (inv[j]*rayDir3[0]+inv[4+j]*rayDir3[1]+inv[8+j]*rayDir3[2])/md->scaling[j];
+        }
+        if ((triangle = Teapot_Private_MeshTriBvh_Raycast(&TIS.triBvhs[meshId],o,d,&t,uv))<0) return 0;
+        tMin = t;
     }
+    else if (meshId<TEAPOT_MESH_COUNT && meshId!=TEAPOT_MESH_CAPSULE && meshId<TEAPOT_FIRST_MESHLINES_INDEX) return 0; // (empty user mesh)
+    hit->mesh = (Teapot_MeshData*) md;
+    hit->distance = tMin;
+    for (j=0;j<3;j++) hit->point[j] = rayOrigin3[j]+rayDir3[j]*tMin;
+    hit->triangle = triangle;
+    hit->barycentrics[0] = uv[0];hit->barycentrics[1] = uv[1];
+    return 1;
 }
-#endif //TEAPOT_USE_OPENMP
-
-void Teapot_DrawMulti(Teapot_MeshData** meshes,int numMeshes,int mustSortObjectsForTransparency) {
-    Teapot_MeshData_CalculateMvMatrixFromArray(meshes,numMeshes);
-    Teapot_DrawMulti_Mv(meshes,numMeshes,mustSortObjectsForTransparency);
+int Teapot_MeshData_RaycastExact(Teapot_MeshData* const* meshes,int numMeshes,const tpoat* rayOrigin3,const tpoat* rayDir3,Teapot_RaycastHit* hitOut) {
+    int i;
+    if (!hitOut) return 0;
+    memset(hitOut,0,sizeof(Teapot_RaycastHit));hitOut->triangle = -1;
+    if (!meshes || numMeshes<=0) return 0;
+    for (i=0;i<numMeshes;i++) Teapot_Private_MeshData_RaycastExact(meshes[i],rayOrigin3,rayDir3,hitOut);
+    return hitOut->mesh ? 1 : 0;
 }
-void Teapot_DrawMulti_Mv(Teapot_MeshData* const* meshes,int numMeshes,int mustSortObjectsForTransparency)  {
-    if (!meshes || numMeshes<=0) return;
-    if (mustSortObjectsForTransparency) qsort((void*)meshes,numMeshes,sizeof(Teapot_MeshData*),Teapot_MeshData_Depth_Sorter);
-    {
-        const int pushMeshOutlineEnabled = TIS.meshOutlineEnabled;
-        int i,startTransparentObjects=mustSortObjectsForTransparency?0:-1;
-        for (i=0;i<numMeshes;i++) {
-            const Teapot_MeshData* md = meshes[i];
-            if (md->active) {
-                TIS.meshOutlineEnabled = md->outlineEnabled;
-                if (!TIS.colorMaterialEnabled)  {
-#               ifdef TEAPOT_SHADER_SPECULAR
-                    Teapot_SetColorAmbientDiffuseAndSpecular(md->colorAmbient,md->color,md->colorSpecular);
-#               else //TEAPOT_SHADER_SPECULAR
-                    Teapot_SetColorAmbientAndDiffuse(md->colorAmbient,md->color);
-#               endif //TEAPOT_SHADER_SPECULAR
-                }
-                else Teapot_SetColor(md->color[0],md->color[1],md->color[2],md->color[3]);
-                Teapot_SetScaling(md->scaling[0]==0?1:md->scaling[0],md->scaling[1]==0?1:md->scaling[1],md->scaling[2]==0?1:md->scaling[2]);
-                if (md->color[3]<1.f && startTransparentObjects==0) {
-                    startTransparentObjects=1;
-                    glDepthMask(GL_FALSE);
-                    glEnable(GL_BLEND);
+int Teapot_MeshData_RaycastExactUnderMouse(Teapot_MeshData* const* meshes,int numMeshes,int mouseX,int mouseY,const int* viewport4,Teapot_RaycastHit* hitOut) {
+    tpoat vpMatrixInv[16];
+    tpoat rayOrigin[3] = {0,0,0};
+    tpoat rayDir[3] = {0,0,-1};
+    if (!hitOut) return 0;
+    if (!viewport4) {memset(hitOut,0,sizeof(Teapot_RaycastHit));hitOut->triangle = -1;return 0;}
+    Teapot_Helper_MultMatrix(vpMatrixInv,TIS.pMatrix,TIS.vMatrix);
+    Teapot_Helper_InvertMatrix(vpMatrixInv,vpMatrixInv);
+    Teapot_Helper_UnProjectMouseCoords(rayOrigin,rayDir,mouseX,mouseY,vpMatrixInv,viewport4);
+    return Teapot_MeshData_RaycastExact(meshes,numMeshes,rayOrigin,rayDir,hitOut);
+}
+typedef struct {
+    Teapot_MeshData* const* meshes;
+    Teapot_RaycastHit* hit;
+} Teapot_Private_Bvh_ExactQuery;
+static int Teapot_Private_Bvh_TestMeshDataExact(int item,const tpoat* rayOrigin3,const tpoat* rayDir3,tpoat* tMinOut,const void* userData) {
+    const Teapot_Private_Bvh_ExactQuery* q = (const Teapot_Private_Bvh_ExactQuery*) userData;
+    if (!Teapot_Private_MeshData_RaycastExact(q->meshes[item],rayOrigin3,rayDir3,q->hit)) return 0;
+    *tMinOut = q->hit->distance;
+    return 1;
+}
+int Teapot_Bvh_RaycastExact(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat* rayOrigin3,const tpoat* rayDir3,Teapot_RaycastHit* hitOut) {
+    Teapot_Private_Bvh_ExactQuery q;
+    if (!hitOut) return 0;
+    memset(hitOut,0,sizeof(Teapot_RaycastHit));hitOut->triangle = -1;
+    if (!meshes) return 0;
+    q.meshes = meshes;q.hit = hitOut;
+    Teapot_Private_Bvh_RayQuery(bvh,rayOrigin3,rayDir3,&Teapot_Private_Bvh_TestMeshDataExact,&q,NULL);
+    return hitOut->mesh ? 1 : 0;
+}
+#endif //TEAPOT_ENABLE_EXACT_PICKING
+
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+int Teapot_Bvh_CullMulti(const Teapot_Bvh* bvh,Teapot_MeshData* const* meshes,const tpoat frustumPlanes[6][4],int* visibleIndicesOut) {
+    // Every stack entry is a node and the mask of the planes that still intersect its parent (nodes inside all the planes are accepted without testing their children)
+    int stack[2*TEAPOT_BVH_MAX_DEPTH],masks[2*TEAPOT_BVH_MAX_DEPTH],stackSize=0,numVisible=0,i;
+    tpoat planes[6][4];
+    if (!bvh || !meshes || bvh->numNodes==0) return 0;
+    if (frustumPlanes) memcpy(planes,frustumPlanes,sizeof(planes));
+    else {
+        tpoat vpMatrix[16];
+        Teapot_Helper_MultMatrix(vpMatrix,TIS.pMatrix,TIS.vMatrix);
+        Teapot_Helper_GetFrustumPlaneEquations(planes,vpMatrix,0);
+    }
+    for (i=0;i<bvh->numItems;i++) {
+        // Same exceptions as Teapot_Private_GetCullingBox(...)
+        const TeapotMeshEnum meshId = meshes[i]->meshId;
+        meshes[i]->visible = (meshId>=TEAPOT_MESH_COUNT || meshId==TEAPOT_MESH_CAPSULE || (meshId>=TEAPOT_MESH_TEXT_X && meshId<=TEAPOT_MESH_TEXT_Z)) ? 1 : 0;
+    }
+    stack[stackSize]=0;masks[stackSize++]=63;
+    while (stackSize>0) {
+        const Teapot_BvhNode* node = &bvh->nodes[stack[--stackSize]];
+        int mask = masks[stackSize],culled = 0,p;
+        for (p=0;p<6 && !culled;p++) {
+            const tpoat* pl = planes[p];
+            tpoat dMax,dMin;
+            if (!(mask&(1<<p))) continue;
+            dMax = pl[3]+pl[0]*(pl[0]>0?node->aabbMax[0]:node->aabbMin[0])+pl[1]*(pl[1]>0?node->aabbMax[1]:node->aabbMin[1])+pl[2]*(pl[2]>0?node->aabbMax[2]:node->aabbMin[2]);
+            if (dMax<0) culled = 1;
+            else {
+                dMin = pl[3]+pl[0]*(pl[0]>0?node->aabbMin[0]:node->aabbMax[0])+pl[1]*(pl[1]>0?node->aabbMin[1]:node->aabbMax[1])+pl[2]*(pl[2]>0?node->aabbMin[2]:node->aabbMax[2]);
+                if (dMin>=0) mask&=~(1<<p);  // fully inside this plane
+            }
+        }
+        if (culled) continue;
+        if (node->count>0 && mask!=0) {
+            // Leaf intersecting some planes: its items are tested one by one
+            for (i=node->start;i<node->start+node->count;i++) {
+                const tpoat* b = &bvh->itemAabbs[6*i];
+                for (p=0;p<6;p++) {
+                    const tpoat* pl = planes[p];
+                    if ((mask&(1<<p)) && pl[3]+pl[0]*b[pl[0]>0?3:0]+pl[1]*b[pl[1]>0?4:1]+pl[2]*b[pl[2]>0?5:2]<0) break;
                 }
-                if (md->color[3]!=0) Teapot_Draw_Mv(md->mvMatrix,md->meshId);
+                if (p==6) meshes[bvh->items[i]]->visible = 1;
             }
         }
-        if (startTransparentObjects==1) {
-            glDisable(GL_BLEND);
-            glDepthMask(GL_TRUE);
+        else if (mask==0) {
+            // Node fully inside the frustum: all the leaves below are visible (the items of a subtree are contiguous)
+            int first,last;
+            const Teapot_BvhNode* n = node;
+            while (n->count==0) n = &bvh->nodes[n->start];          // leftmost leaf
+            first = n->start;
+            n = node;
+            while (n->count==0) n = &bvh->nodes[n->start+1];        // rightmost leaf
+            last = n->start+n->count;
+            for (i=first;i<last;i++) meshes[bvh->items[i]]->visible = 1;
         }
-        TIS.meshOutlineEnabled = pushMeshOutlineEnabled;
+        else {
+            stack[stackSize]=node->start+1;masks[stackSize++]=mask;
+            stack[stackSize]=node->start;masks[stackSize++]=mask;
+        }
+    }
+    for (i=0;i<bvh->numItems;i++) {
+        const Teapot_MeshData* md = meshes[i];
+        if (!md->active || !md->visible) continue;
+        if (visibleIndicesOut) visibleIndicesOut[numVisible] = i;
+        ++numVisible;
     }
+    return numVisible;
 }
+void Teapot_Bvh_DrawMulti(const Teapot_Bvh* bvh,Teapot_MeshData** meshes,int mustSortObjectsForTransparency) {
+    int i,numMeshes;
+    if (!bvh || !meshes || bvh->numItems<=0) return;
+    numMeshes = bvh->numItems;
+    Teapot_Bvh_CullMulti(bvh,meshes,NULL,NULL);
+    // Transform stage (visible objects only)
+#   ifdef TEAPOT_USE_OPENMP
+#   pragma omp parallel for schedule(static,TEAPOT_OPENMP_CHUNK_SIZE) if(numMeshes>=TEAPOT_OPENMP_MIN_NUM_MESHES)
+#   endif //TEAPOT_USE_OPENMP
+    for (i=0;i<numMeshes;i++) {
+        Teapot_MeshData* md = meshes[i];
+        if (!md->visible || !md->active) continue;
+        Teapot_Helper_MultMatrixUncheckArgs(md->mvMatrix,TIS.vMatrix,md->mMatrix);
+        Teapot_Private_CalculateFrameData(md->mvMatrix,md->meshId,md->scaling,NULL,md->nCoefficients);
+    }
+    Teapot_Private_DrawMulti_Mv(meshes,numMeshes,mustSortObjectsForTransparency,1);
+}
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
 
 static __inline void Teapot_Private_DrawArmatureBone(const tpoat mMatrix16[16],tpoat length,void (*DrawCallback)(const tpoat mMatrix[16],TeapotMeshEnum meshId))   {
     // Draws armature bone (in y direction with tail in mMatrix16)
@@ -2692,10 +5500,13 @@ void Teapot_Helper_DrawArmatureBone_Mv(const tpoat mvMatrix[16],tpoat length)
 void Teapot_MeshData_DrawAabb(const Teapot_MeshData* mesh)  {if (mesh)   Teapot_DrawAabb(mesh->mMatrix,mesh->meshId,mesh->scaling);}
 
 // Loading shader function
-static __inline GLhandleARB Teapot_LoadShader(const char* buffer, const unsigned int type)
+// 'defines' (optional) is injected as a second source string (after the "#version" line of 'buffer', if present)
+static __inline GLhandleARB Teapot_LoadShaderWithDefines(const char* defines,const char* buffer, const unsigned int type)
 {
     GLhandleARB handle;
-    const GLcharARB* files[1];
+    const GLcharARB* files[3];
+    GLint lengths[3];
+    GLsizei numFiles = 1;
 
     // shader Compilation variable
     GLint result;				// Compilation code result
@@ -2711,12 +5522,23 @@ static __inline GLhandleARB Teapot_LoadShader(const char* buffer, const unsigned
         exit(0);
     }
 
-    files[0] = (const GLcharARB*)buffer;
+    files[0] = (const GLcharARB*)buffer;lengths[0] = -1;
+    if (defines && defines[0]!='\0')    {
+        const char* afterVersion = buffer;
+        if (strncmp(buffer,"#version",8)==0) {
+            const char* endl = strchr(buffer,'\n');
+            if (endl) afterVersion = endl+1;
+        }
+        lengths[0] = (GLint) (afterVersion-buffer);
+        files[1] = (const GLcharARB*)defines;lengths[1] = -1;
+        files[2] = (const GLcharARB*)afterVersion;lengths[2] = -1;
+        numFiles = 3;
+    }
     glShaderSource(
                 handle, //The handle to our shader
-                1, //The number of files.
+                numFiles, //The number of files.
                 files, //An array of const char * data, which represents the source code of theshaders
-                NULL);
+                lengths);
 
     glCompileShader(handle);
 
@@ -2748,7 +5570,89 @@ static __inline GLhandleARB Teapot_LoadShader(const char* buffer, const unsigned
     return handle;
 }
 
-static __inline GLuint Teapot_LoadShaderProgramFromSource(const char* vs,const char* fs)	{
+#ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+// Header of a program binary cache file (followed by 'length' bytes of binary)
+typedef struct {
+    char magic[4];              // "TPB1"
+    unsigned long long key;     // see Teapot_Private_ProgramBinaryKey(...)
+    GLenum format;
+    GLint length;
+} Teapot_Private_ProgramBinaryHeader;
+static __inline unsigned long long Teapot_Private_HashString(unsigned long long h,const char* str) {
+    // FNV-1a (the terminating zero is hashed too)
+    if (str) {for (;*str;++str) h = (h^(unsigned char)(*str))*1099511628211ULL;}
+    return h*1099511628211ULL;
+}
+// Returns 0 when the cache can't be used
+static unsigned long long Teapot_Private_ProgramBinaryKey(const char* defines,const char* vs,const char* fs) {
+    unsigned long long h = 14695981039346656037ULL;
+    if (TIS.programBinaryCacheDisabled || !TIS.programBinaryFormatsAvailable) return 0;
+    h = Teapot_Private_HashString(h,(const char*)glGetString(GL_VENDOR));
+    h = Teapot_Private_HashString(h,(const char*)glGetString(GL_RENDERER));
+    h = Teapot_Private_HashString(h,(const char*)glGetString(GL_VERSION));
+    h = Teapot_Private_HashString(h,defines);
+    h = Teapot_Private_HashString(h,vs);
+    h = Teapot_Private_HashString(h,fs);
+    return h ? h : 1;
+}
+static void Teapot_Private_GetProgramBinaryPath(char* path,unsigned long long key) {
+    sprintf(path,"%s%08lx%08lx.bin",TIS.programBinaryCachePath[0]!='\0' ? TIS.programBinaryCachePath : TEAPOT_PROGRAM_BINARY_CACHE_PATH,(unsigned long)(key>>32),(unsigned long)(key&0xFFFFFFFFUL));
+}
+// Returns 0 if the file is missing, or does not match, or the driver rejects the binary (e.g. after a driver update): then the program must be compiled from source
+static GLuint Teapot_Private_LoadProgramBinary(unsigned long long key) {
+    char path[sizeof(TIS.programBinaryCachePath)+32];
+    Teapot_Private_ProgramBinaryHeader header;
+    GLuint programId = 0;
+    GLint result = 0,numFormats = 0,i;
+    GLint* formats = NULL;void* binary = NULL;
+    FILE* f;
+    Teapot_Private_GetProgramBinaryPath(path,key);
+    f = fopen(path,"rb");
+    if (!f) return 0;
+    if (fread(&header,sizeof(header),1,f)==1 && memcmp(header.magic,"TPB1",4)==0 && header.key==key && header.length>0) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&numFormats);
+        formats = numFormats>0 ? (GLint*) malloc(numFormats*sizeof(GLint)) : NULL;
+        if (formats) {
+            glGetIntegerv(GL_PROGRAM_BINARY_FORMATS,formats);
+            for (i=0;i<numFormats;i++) {if ((GLenum)formats[i]==header.format) break;}
+            if (i<numFormats && (binary=malloc(header.length))!=NULL && fread(binary,1,header.length,f)==(size_t)header.length) {
+                programId = glCreateProgram();
+                glProgramBinary(programId,header.format,binary,header.length);
+                glGetProgramiv(programId,GL_LINK_STATUS,&result);
+                if (!result) {glDeleteProgram(programId);programId=0;}
+            }
+            if (binary) free(binary);
+            free(formats);
+        }
+    }
+    fclose(f);
+    return programId;
+}
+static void Teapot_Private_SaveProgramBinary(GLuint programId,unsigned long long key) {
+    char path[sizeof(TIS.programBinaryCachePath)+32];
+    Teapot_Private_ProgramBinaryHeader header;
+    GLint length = 0;void* binary;
+    FILE* f;
+    glGetProgramiv(programId,GL_PROGRAM_BINARY_LENGTH,&length);
+    if (length<=0 || (binary=malloc(length))==NULL) return;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,"TPB1",4);header.key = key;
+    glGetProgramBinary(programId,length,&header.length,&header.format,binary);
+    if (header.length>0) {
+        Teapot_Private_GetProgramBinaryPath(path,key);
+        f = fopen(path,"wb");
+        if (f) {
+            const int ok = fwrite(&header,sizeof(header),1,f)==1 && fwrite(binary,1,header.length,f)==(size_t)header.length;
+            fclose(f);
+            if (!ok) remove(path);   // (a truncated file would be rejected anyway)
+        }
+        else fprintf(stderr,"Error in teapot.h: can't write the program binary cache file \"%s\".\n",path);
+    }
+    free(binary);
+}
+#endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+
+static __inline GLuint Teapot_LoadShaderProgramFromSourceWithDefines(const char* defines,const char* vs,const char* fs)	{
     // shader Compilation variable
     GLint result;				// Compilation code result
     GLint errorLoglength ;
@@ -2758,15 +5662,26 @@ static __inline GLuint Teapot_LoadShaderProgramFromSource(const char* vs,const c
     GLhandleARB vertexShaderHandle;
     GLhandleARB fragmentShaderHandle;
     GLuint programId = 0;
+#   ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+    const clock_t startTicks = clock();
+    const unsigned long long key = Teapot_Private_ProgramBinaryKey(defines,vs,fs);
+    if (key && (programId=Teapot_Private_LoadProgramBinary(key))!=0) {
+        ++TIS.programLoadCounters[0];TIS.programLoadTicks+=clock()-startTicks;
+        return programId;
+    }
+#   endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
 
-    vertexShaderHandle   = Teapot_LoadShader(vs,GL_VERTEX_SHADER);
-    fragmentShaderHandle = Teapot_LoadShader(fs,GL_FRAGMENT_SHADER);
+    vertexShaderHandle   = Teapot_LoadShaderWithDefines(defines,vs,GL_VERTEX_SHADER);
+    fragmentShaderHandle = Teapot_LoadShaderWithDefines(defines,fs,GL_FRAGMENT_SHADER);
     if (!vertexShaderHandle || !fragmentShaderHandle) return 0;
 
     programId = glCreateProgram();
 
     glAttachShader(programId,vertexShaderHandle);
     glAttachShader(programId,fragmentShaderHandle);
+#   ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+    if (key) glProgramParameteri(programId,GL_PROGRAM_BINARY_RETRIEVABLE_HINT,GL_TRUE);
+#   endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
     glLinkProgram(programId);
 
     //Link checking.
@@ -2797,13 +5712,18 @@ static __inline GLuint Teapot_LoadShaderProgramFromSource(const char* vs,const c
     glDeleteShader(vertexShaderHandle);
     glDeleteShader(fragmentShaderHandle);
 
+#   ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+    if (key && result) Teapot_Private_SaveProgramBinary(programId,key);
+    ++TIS.programLoadCounters[1];TIS.programLoadTicks+=clock()-startTicks;
+#   endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
     return programId;
 }
+static __inline GLuint Teapot_LoadShaderProgramFromSource(const char* vs,const char* fs)	{return Teapot_LoadShaderProgramFromSourceWithDefines(NULL,vs,fs);}
 
 // numVerts is the number of vertices (= number of 3 floats)
 // numInds is the number of triangle indices (= 3 * num triangles)
 // pNormsOut must be the same size as pVerts
-__inline static void CalculateVertexNormals(const float* pVerts,int numVerts,int vertsStrideInNumComponents,const unsigned short* pInds,int numInds,float* pNormsOut,int normsStrideInNumComponents)   {
+__inline static void CalculateVertexNormals(const float* pVerts,int numVerts,int vertsStrideInNumComponents,const unsigned* pInds,int numInds,float* pNormsOut,int normsStrideInNumComponents)   {
     if (!pVerts || !pNormsOut || !pInds || numInds<3 || numVerts<3) return;
     // Calculate vertex normals
     {
@@ -2866,6 +5786,10 @@ __inline static void GetAabbHalfExtentsAndCenter(const float* pVerts,const int n
 }
 
 void Teapot_Destroy(void) {
+#   ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    {int i;for (i=0;i<TEAPOT_VAO_COUNT;i++) {if (TIS.vertexArrays[i]) {glDeleteVertexArrays(1,&TIS.vertexArrays[i]);TIS.vertexArrays[i]=0;}}}
+    TIS.vertexArraysValidMask = 0;TIS.vertexArrayBound = 0;
+#   endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
     if (TIS.vertexBuffer) {
         glDeleteBuffers(1,&TIS.vertexBuffer);
         TIS.vertexBuffer = 0;
@@ -2874,32 +5798,103 @@ void Teapot_Destroy(void) {
         glDeleteBuffers(1,&TIS.elementBuffer);
         TIS.elementBuffer = 0;
     }
+    if (TIS.meshBuffer.verts) free(TIS.meshBuffer.verts);
+    if (TIS.meshBuffer.inds) free(TIS.meshBuffer.inds);
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    if (TIS.meshBuffer.qverts) free(TIS.meshBuffer.qverts);
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    memset(&TIS.meshBuffer,0,sizeof(Teapot_MeshBuffer));
+#   ifdef TEAPOT_ENABLE_EXACT_PICKING
+    {int i;for (i=0;i<TEAPOT_MESH_COUNT;i++) Teapot_Private_MeshTriBvh_Destroy(&TIS.triBvhs[i]);}
+#   endif //TEAPOT_ENABLE_EXACT_PICKING
     if (TIS.programId) {
-        glDeleteProgram(TIS.programId);TIS.programId=0;
+        int i;for (i=0;i<=TEAPOT_SHADER_FEATURE_ALL;i++) {
+            if (TIS.shaderVariants[i]) {glDeleteProgram(TIS.shaderVariants[i]);TIS.shaderVariants[i]=0;}
+#           ifdef TEAPOT_ENABLE_INSTANCING
+            if (TIS.instancedShaderVariants[i]) {glDeleteProgram(TIS.instancedShaderVariants[i]);TIS.instancedShaderVariants[i]=0;}
+#           endif //TEAPOT_ENABLE_INSTANCING
+        }
+        TIS.programId=0;
+    }
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    TIS.instancedProgramId=0;
+#   ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    if (TIS.shadowInstancedProgramId) {
+        glDeleteProgram(TIS.shadowInstancedProgramId);TIS.shadowInstancedProgramId=0;
+    }
+#   endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+#   ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    {int i;for (i=0;i<TEAPOT_RING_BUFFER_NUM_SECTIONS;i++) {if (TIS.ringBufferFences[i]) {glDeleteSync(TIS.ringBufferFences[i]);TIS.ringBufferFences[i]=0;}}}
+    TIS.ringBufferMapped = NULL;TIS.ringBufferSectionSize = TIS.ringBufferOffset = 0;TIS.ringBufferSection = 0;
+#   endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    if (TIS.instanceBuffer) {
+        glDeleteBuffers(1,&TIS.instanceBuffer); // (implicitly unmapped)
+        TIS.instanceBuffer = 0;
     }
+    TIS.instanceBufferCapacity = 0;
+    if (TIS.instanceData) {free(TIS.instanceData);TIS.instanceData=NULL;}
+    TIS.instanceDataCapacity = 0;
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+    if (TIS.depthProgramId) {
+        glDeleteProgram(TIS.depthProgramId);TIS.depthProgramId=0;
+    }
+#   endif //TEAPOT_ENABLE_DEPTH_PREPASS
+    if (TIS.sortKeys) {free(TIS.sortKeys);TIS.sortKeys=NULL;}
+    if (TIS.sortIndices) {free(TIS.sortIndices);TIS.sortIndices=NULL;}
+    if (TIS.sortMeshes) {free(TIS.sortMeshes);TIS.sortMeshes=NULL;}
+    TIS.sortCapacity = 0;
+    if (TIS.pickingObbs) {free(TIS.pickingObbs);TIS.pickingObbs=NULL;}
+    TIS.pickingObbsCapacity = 0;
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    if (TIS.staticShadowCache.frameBuffer) glDeleteFramebuffers(1,&TIS.staticShadowCache.frameBuffer);
+    if (TIS.staticShadowCache.depthBuffer) glDeleteRenderbuffers(1,&TIS.staticShadowCache.depthBuffer);
+    TIS.staticShadowCache.frameBuffer = TIS.staticShadowCache.depthBuffer = 0;
+    TIS.staticShadowCache.bufferWidth = TIS.staticShadowCache.bufferHeight = 0;
+    TIS.staticShadowCache.valid = 0;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+#   ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+    if (TIS.visibleIndices) {free(TIS.visibleIndices);TIS.visibleIndices=NULL;}
+    TIS.visibleIndicesCapacity = 0;
+    if (TIS.shadowCasters) {free(TIS.shadowCasters);TIS.shadowCasters=NULL;}
+    TIS.shadowCastersCapacity = 0;
+#   endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    if (TIS.shadowMvpMatrices) {free(TIS.shadowMvpMatrices);TIS.shadowMvpMatrices=NULL;}
+    TIS.shadowMvpMatricesCapacity = 0;
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    if (TIS.dirtyMeshes) {free(TIS.dirtyMeshes);TIS.dirtyMeshes=NULL;}
+    TIS.dirtyMeshesCapacity = 0;
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Private_InvalidateBindings(0);
+    Teapot_Private_InvalidateUniforms();
+#   endif //TEAPOT_ENABLE_STATE_CACHE
 }
 
-static void AddMeshVertsAndInds(float* totVerts,const int MAX_TOTAL_VERTS,int* numTotVerts,int totVertsStrideInNumComponents,unsigned short* totInds,const int MAX_TOTAL_INDS,int* numTotInds,
-                                const float* verts,int numVerts,const unsigned short* inds,int numInds,TeapotMeshEnum meshId) {
-    int i,i3;
-    float* pTotVerts = &totVerts[(*numTotVerts)*totVertsStrideInNumComponents];
-    unsigned short* pTotInds = &totInds[*numTotInds];
-    if (*numTotVerts+numVerts>MAX_TOTAL_VERTS) {
-        if (meshId>=TEAPOT_MESH_USER_00 && meshId<TEAPOT_MESH_CUBE)
-            fprintf(stderr,"Error in teapot.h: not enough user mesh vertices [TEAPOT_MAX_NUM_MESH_VERTS+TEAPOT_MAX_NUM_USER_MESH_VERTICES must be at least: %d (you can set it in the Teapot_Init(void) implementation or just define a bigger TEAPOT_MAX_NUM_USER_MESH_VERTICES)\n",*numTotVerts+numVerts);
-        else
-            fprintf(stderr,"Error in teapot.h: TEAPOT_MAX_NUM_MESH_VERTS must be at least: %d (you can set it in the Teapot_Init(void) implementation)\n",*numTotVerts+numVerts);
-        exit(0);
-    }
-    if (*numTotInds+numInds>MAX_TOTAL_INDS) {
-        if (meshId>=TEAPOT_MESH_USER_00 && meshId<TEAPOT_MESH_CUBE)
-            fprintf(stderr,"Error: not enough user mesh indices [TEAPOT_MAX_NUM_MESH_INDS+TEAPOT_MAX_NUM_USER_MESH_INDICES must be at least: %d (you can set it in the Teapot_Init(void) implementation or just define a bigger TEAPOT_MAX_NUM_USER_MESH_INDICES)\n",*numTotInds+numInds);
-        else
-            fprintf(stderr,"Error: TEAPOT_MAX_NUM_MESH_INDS must be at least: %d (you can set it in the Teapot_Init(void) implementation)\n",*numTotInds+numInds);
-        exit(0);
+// Grows *pData so that it can store at least 'num' elements (new elements are zeroed). Returns 0 on failure (leaving *pData untouched).
+static int Teapot_Private_Grow(void** pData,size_t* pCapacity,size_t num,size_t elementSize) {
+    size_t capacity = *pCapacity;void* data;
+    if (num<=capacity) return 1;
+    if (capacity<256) capacity = 256;
+    while (capacity<num) capacity*=2;
+    data = realloc(*pData,capacity*elementSize);
+    if (!data) {
+        fprintf(stderr,"Error in teapot.h: out of memory (can't allocate %lu bytes).\n",(unsigned long)(capacity*elementSize));
+        return 0;
     }
-    TIS.startInds[meshId] = *numTotInds;
-    TIS.numInds[meshId] = numInds;
+    memset((unsigned char*)data+(*pCapacity)*elementSize,0,(capacity-(*pCapacity))*elementSize);
+    *pData = data;*pCapacity = capacity;
+    return 1;
+}
+static __inline size_t Teapot_Private_IndexSize(GLenum indsType) {return indsType==GL_UNSIGNED_INT ? sizeof(unsigned int) : sizeof(unsigned short);}
+
+// Copies a mesh (verts are 3 floats each, inds are relative to verts) into pVertsOut (TEAPOT_VERTEX_NUM_FLOATS floats per vertex) and pIndsOut,
+// and calculates its normals and its aabb. Only one of inds16 and inds32 must be used.
+static void Teapot_Private_ProcessMeshVertsAndInds(float* pVertsOut,unsigned* pIndsOut,const float* verts,int numVerts,const unsigned short* inds16,const unsigned* inds32,int numInds,TeapotMeshEnum meshId) {
+    int i,i3;
+    float* pTotVerts = pVertsOut;
 
     // HERE we can do stuff on verts/inds---------------------------------------
     for (i=0;i<numVerts;i++) {
@@ -2911,66 +5906,654 @@ static void AddMeshVertsAndInds(float* totVerts,const int MAX_TOTAL_VERTS,int* n
 #       else //TEAPOT_INVERT_MESHES_Z_AXIS
         pTotVerts[2] = -verts[i3+2];
 #       endif //TEAPOT_INVERT_MESHES_Z_AXIS
+        pTotVerts[3] = pTotVerts[4] = pTotVerts[5] = pTotVerts[6] = 0.f;   // normal and material
+
+        pTotVerts+=TEAPOT_VERTEX_NUM_FLOATS;
+    }
+
+    for (i=0;i<numInds;i++) pIndsOut[i] = inds16 ? (unsigned) inds16[i] : inds32[i];
+#   ifdef TEAPOT_INVERT_MESHES_Z_AXIS
+    if (meshId<TEAPOT_FIRST_MESHLINES_INDEX)    {
+        for (i=0;i+2<numInds;i+=3) {const unsigned tmp = pIndsOut[i+1];pIndsOut[i+1] = pIndsOut[i+2];pIndsOut[i+2] = tmp;}
+    }
+#   endif //TEAPOT_INVERT_MESHES_Z_AXIS
+    //---------------------------------------------------------------------------
+
+    GetAabbHalfExtentsAndCenter(pVertsOut,numVerts,TEAPOT_VERTEX_NUM_FLOATS,&TIS.halfExtents[meshId][0],&TIS.centerPoint[meshId][0]);
+
+    /*fprintf(stderr,"%d) centerPoint:%1.2f,%1.2f,%1.2f   halfExtents:%1.2f,%1.2f,%1.2f\n",meshId,
+            TIS.centerPoint[meshId][0],TIS.centerPoint[meshId][1],TIS.centerPoint[meshId][2],
+            TIS.halfExtents[meshId][0],TIS.halfExtents[meshId][1],TIS.halfExtents[meshId][2]
+            );*/
+
+#   ifdef TEAPOT_CENTER_MESHES_ON_FLOOR
+    //if (meshId<=TEAPOT_MESH_SPHERE2)
+    //if (meshId!=TEAPOT_MESH_CYLINDER_LATERAL_SURFACE && meshId!=TEAPOT_MESH_HALF_SPHERE_UP && meshId!=TEAPOT_MESH_HALF_SPHERE_DOWN && meshId!=TEAPOT_MESH_PIVOT3D)
+    if (meshId<TEAPOT_MESH_CYLINDER_LATERAL_SURFACE || meshId>=TEAPOT_FIRST_MESHLINES_INDEX)
+    {
+        pTotVerts = pVertsOut;
+        for (i=1;i<numVerts*TEAPOT_VERTEX_NUM_FLOATS;i+=TEAPOT_VERTEX_NUM_FLOATS) {
+            pTotVerts[i] += TIS.halfExtents[meshId][1];
+        }
+    }
+    TIS.centerPoint[meshId][1]+= TIS.halfExtents[meshId][1];
+#   endif //TEAPOT_CENTER_MESHES_ON_FLOOR
+
+    {
+        float center[3];float halfAabb[3];
+        for (i=0;i<3;i++) {
+            center[i] = TIS.centerPoint[meshId][i];
+            halfAabb[i] = TIS.halfExtents[meshId][i];
+            TIS.aabbMin[meshId][i] = center[i] - halfAabb[i];
+            TIS.aabbMax[meshId][i] = center[i] + halfAabb[i];
+        }
+    }
+
+    if (meshId<TEAPOT_FIRST_MESHLINES_INDEX) CalculateVertexNormals(pVertsOut,numVerts,TEAPOT_VERTEX_NUM_FLOATS,pIndsOut,numInds,pVertsOut+3,TEAPOT_VERTEX_NUM_FLOATS);
+
+    if (gTeapotInitCallback && inds16) gTeapotInitCallback(meshId,verts,numVerts,inds16,numInds);
+}
+// Writes numInds indices to dst+offset as 'type' indices (GL_UNSIGNED_INT indices are aligned to 4 bytes). Returns the offset where they have been written.
+static size_t Teapot_Private_PackIndices(unsigned char* dst,size_t offset,const unsigned* inds,int numInds,GLenum type) {
+    int i;
+    if (type==GL_UNSIGNED_INT) {
+        offset = (offset+sizeof(unsigned)-1)/sizeof(unsigned)*sizeof(unsigned);
+        memcpy(&dst[offset],inds,numInds*sizeof(unsigned));
+    }
+    else {
+        unsigned short* p = (unsigned short*) &dst[offset];
+        for (i=0;i<numInds;i++) p[i] = (unsigned short) inds[i];
+    }
+    return offset;
+}
+
+// Used by Teapot_Init(void) to collect the embedded meshes
+typedef struct {
+    float* verts;size_t numVerts,maxVerts;  // TEAPOT_VERTEX_NUM_FLOATS floats per vertex
+    unsigned* inds;size_t numInds,maxInds;  // absolute indices
+    int segStartInds[TEAPOT_MESH_COUNT],segNumInds[TEAPOT_MESH_COUNT];    // index range stored by each mesh (some meshes just reference a part of another one)
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    int lodStartInds[TEAPOT_MESH_COUNT][TEAPOT_NUM_MESH_LODS];  // the LOD indices are appended after all the meshes
+#   endif //TEAPOT_ENABLE_MESH_LODS
+    int failed;
+} Teapot_MeshBuilder;
+
+static void AddMeshVertsAndInds(Teapot_MeshBuilder* mb,const float* verts,int numVerts,const unsigned short* inds,int numInds,TeapotMeshEnum meshId) {
+    size_t i;
+    if (mb->failed) return;
+    if (!Teapot_Private_Grow((void**)&mb->verts,&mb->maxVerts,mb->numVerts+numVerts,sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS) ||
+        !Teapot_Private_Grow((void**)&mb->inds,&mb->maxInds,mb->numInds+numInds,sizeof(unsigned))) {mb->failed = 1;return;}
+    TIS.startInds[meshId] = mb->segStartInds[meshId] = (int) mb->numInds;
+    TIS.numInds[meshId] = mb->segNumInds[meshId] = numInds;
+
+    Teapot_Private_ProcessMeshVertsAndInds(&mb->verts[mb->numVerts*TEAPOT_VERTEX_NUM_FLOATS],&mb->inds[mb->numInds],verts,numVerts,inds,NULL,numInds,meshId);
+    for (i=mb->numInds;i<mb->numInds+numInds;i++) mb->inds[i]+=(unsigned) mb->numVerts;
+
+    mb->numVerts+=numVerts;
+    mb->numInds+=numInds;
+}
+
+// First-fit: returns the lowest (aligned) start>=regionStart where 'size' elements don't overlap any of the numRanges (starts[i],sizes[i]) ranges
+static size_t Teapot_Private_FindFreeRange(const size_t* starts,const size_t* sizes,int numRanges,size_t regionStart,size_t size,size_t alignment) {
+    size_t start = (regionStart+alignment-1)/alignment*alignment;int i,overlaps = 1;
+    while (overlaps) {
+        overlaps = 0;
+        for (i=0;i<numRanges;i++) {
+            if (sizes[i]==0 || starts[i]>=start+size || starts[i]+sizes[i]<=start) continue;
+            start = (starts[i]+sizes[i]+alignment-1)/alignment*alignment;overlaps = 1;
+        }
+    }
+    return start;
+}
+
+#ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+#   ifndef TEAPOT_VERTEX_CACHE_SIZE
+#       define TEAPOT_VERTEX_CACHE_SIZE (16)
+#   endif //TEAPOT_VERTEX_CACHE_SIZE
+// Average cache miss ratio of a triangle list with a FIFO cache of TEAPOT_VERTEX_CACHE_SIZE entries
+static float Teapot_Private_CalculateACMR(const unsigned* inds,int numInds) {
+    unsigned cache[TEAPOT_VERTEX_CACHE_SIZE];
+    int i,j,numCached=0,head=0,numMisses=0;
+    if (numInds<3) return 0.f;
+    for (i=0;i<numInds;i++) {
+        for (j=0;j<numCached;j++) {if (cache[j]==inds[i]) break;}
+        if (j<numCached) continue;
+        ++numMisses;
+        if (numCached<TEAPOT_VERTEX_CACHE_SIZE) cache[numCached++] = inds[i];
+        else {cache[head] = inds[i];head = (head+1)%TEAPOT_VERTEX_CACHE_SIZE;}
+    }
+    return (float)numMisses*3.f/(float)numInds;
+}
+typedef struct {float metric;int cluster;} Teapot_TriangleCluster;
+static int Teapot_Private_TriangleCluster_Sorter(const void* pc0,const void* pc1) {
+    const Teapot_TriangleCluster* c0 = (const Teapot_TriangleCluster*) pc0;
+    const Teapot_TriangleCluster* c1 = (const Teapot_TriangleCluster*) pc1;
+    if (c0->metric!=c1->metric) return c0->metric>c1->metric ? -1 : 1;
+    return c0->cluster-c1->cluster;
+}
+// Reorders (in place) the triangles of a triangle list (Tipsify: Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007).
+// The clusters delimited by the cache flushes are then sorted so that the outward-facing ones (that usually occlude the others) come first.
+// 'verts' (TEAPOT_VERTEX_NUM_FLOATS floats per vertex) is used only by the overdraw sort. Returns 0 when out of memory (inds are left untouched).
+static int Teapot_Private_OptimizeTriangleOrder(unsigned* inds,int numInds,const float* verts) {
+    const int k = TEAPOT_VERTEX_CACHE_SIZE,numTris = numInds/3;
+    int *offsets,*adj,*live,*cacheTime,*emitted,*deadEnd,*clusterStarts;
+    unsigned *out,minV,maxV;
+    Teapot_TriangleCluster* clusters;
+    int i,j,c,n,f,s=k+1,cursor=0,numDeadEnd=0,numOut=0,numClusters=0;
+    float meshCenter[3]={0.f,0.f,0.f};
+    if (numTris<2) return 1;
+    minV=maxV=inds[0];
+    for (i=1;i<numTris*3;i++) {if (minV>inds[i]) minV=inds[i];else if (maxV<inds[i]) maxV=inds[i];}
+    n = (int)(maxV-minV)+1;
+    offsets = (int*) malloc(sizeof(int)*(3*n+1+8*numTris+1));  // offsets,live,cacheTime,adj,emitted,deadEnd,clusterStarts
+    out = (unsigned*) malloc(sizeof(unsigned)*3*numTris);
+    clusters = (Teapot_TriangleCluster*) malloc(sizeof(Teapot_TriangleCluster)*numTris);
+    if (!offsets || !out || !clusters) {
+        fprintf(stderr,"Error in teapot.h: out of memory (can't optimize a mesh with %d triangles).\n",numTris);
+        if (offsets) free(offsets);
+        if (out) free(out);
+        if (clusters) free(clusters);
+        return 0;
+    }
+    live = offsets+n+1;cacheTime = live+n;adj = cacheTime+n;emitted = adj+3*numTris;
+    deadEnd = emitted+numTris;clusterStarts = deadEnd+3*numTris;
+    memset(offsets,0,sizeof(int)*(3*n+1));memset(emitted,0,sizeof(int)*numTris);
+
+    // vertex-triangle adjacency
+    for (i=0;i<numTris*3;i++) ++live[inds[i]-minV];
+    for (i=0;i<n;i++) offsets[i+1] = offsets[i]+live[i];
+    for (i=0;i<numTris*3;i++) {const int v = (int)(inds[i]-minV);adj[offsets[v]+cacheTime[v]++] = i/3;}
+    memset(cacheTime,0,sizeof(int)*n);
+
+    f = (int)(inds[0]-minV);
+    clusterStarts[numClusters++] = 0;
+    while (f>=0) {
+        int best=-1,bestPriority=-1;
+        for (i=offsets[f];i<offsets[f+1];i++) {
+            const int t = adj[i];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            for (c=0;c<3;c++) {
+                const int v = (int)(inds[3*t+c]-minV);
+                out[numOut++] = inds[3*t+c];
+                deadEnd[numDeadEnd++] = v;
+                --live[v];
+                if (s-cacheTime[v]>k) cacheTime[v] = s++;
+            }
+        }
+        // next fanning vertex: the 1-ring vertex that stays longest in the cache (but that will not be evicted by its own triangles)
+        for (i=offsets[f];i<offsets[f+1];i++) {
+            for (c=0;c<3;c++) {
+                const int v = (int)(inds[3*adj[i]+c]-minV);
+                int priority = 0;
+                if (live[v]<=0) continue;
+                if (s-cacheTime[v]+2*live[v]<=k) priority = s-cacheTime[v];
+                if (priority>bestPriority) {bestPriority = priority;best = v;}
+            }
+        }
+        if (best<0) {
+            // dead end: a recently used vertex, or the first vertex that still has triangles
+            while (numDeadEnd>0 && best<0) {const int v = deadEnd[--numDeadEnd];if (live[v]>0) best = v;}
+            while (cursor<n && best<0) {if (live[cursor]>0) best = cursor;else ++cursor;}
+            if (best>=0) clusterStarts[numClusters++] = numOut/3;
+        }
+        f = best;
+    }
+    clusterStarts[numClusters] = numTris;
+
+    // overdraw: sorts the clusters by dot(clusterCenter-meshCenter,clusterNormal) (descending)
+    for (i=0;i<numTris*3;i++) {for (c=0;c<3;c++) meshCenter[c]+=verts[out[i]*TEAPOT_VERTEX_NUM_FLOATS+c];}
+    for (c=0;c<3;c++) meshCenter[c]/=(float)(numTris*3);
+    for (j=0;j<numClusters;j++) {
+        float center[3]={0.f,0.f,0.f},normal[3]={0.f,0.f,0.f};
+        for (i=clusterStarts[j];i<clusterStarts[j+1];i++) {
+            const float* v0 = &verts[out[3*i]*TEAPOT_VERTEX_NUM_FLOATS];
+            const float* v1 = &verts[out[3*i+1]*TEAPOT_VERTEX_NUM_FLOATS];
+            const float* v2 = &verts[out[3*i+2]*TEAPOT_VERTEX_NUM_FLOATS];
+            const float e1[3] = {v1[0]-v0[0],v1[1]-v0[1],v1[2]-v0[2]};
+            const float e2[3] = {v2[0]-v0[0],v2[1]-v0[1],v2[2]-v0[2]};
+            normal[0]+=e1[1]*e2[2]-e1[2]*e2[1];
+            normal[1]+=e1[2]*e2[0]-e1[0]*e2[2];
+            normal[2]+=e1[0]*e2[1]-e1[1]*e2[0];     // area weighted
+            for (c=0;c<3;c++) center[c]+=v0[c]+v1[c]+v2[c];
+        }
+        for (c=0;c<3;c++) center[c]/=(float)(3*(clusterStarts[j+1]-clusterStarts[j]));
+        clusters[j].metric = (center[0]-meshCenter[0])*normal[0]+(center[1]-meshCenter[1])*normal[1]+(center[2]-meshCenter[2])*normal[2];
+        clusters[j].cluster = j;
+    }
+    qsort(clusters,numClusters,sizeof(Teapot_TriangleCluster),Teapot_Private_TriangleCluster_Sorter);
+    for (j=0,numOut=0;j<numClusters;j++) {
+        const int first = clusterStarts[clusters[j].cluster],last = clusterStarts[clusters[j].cluster+1];
+        memcpy(&inds[numOut],&out[3*first],sizeof(unsigned)*3*(last-first));
+        numOut+=3*(last-first);
+    }
+
+    free(clusters);free(out);free(offsets);
+    return 1;
+}
+// Moves the vertices referenced by inds in the order of their first use (the set of used vertex slots does not change). Returns 0 when out of memory.
+static int Teapot_Private_OptimizeVertexFetch(float* verts,unsigned* inds,int numInds) {
+    unsigned *remap,*slots,minV,maxV,numUsed=0;
+    float* tmp;int i,n;
+    if (numInds<=0) return 1;
+    minV=maxV=inds[0];
+    for (i=1;i<numInds;i++) {if (minV>inds[i]) minV=inds[i];else if (maxV<inds[i]) maxV=inds[i];}
+    n = (int)(maxV-minV)+1;
+    remap = (unsigned*) malloc(sizeof(unsigned)*2*n);
+    tmp = (float*) malloc(sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS*n);
+    if (!remap || !tmp) {
+        fprintf(stderr,"Error in teapot.h: out of memory (can't optimize a mesh with %d vertices).\n",n);
+        if (remap) free(remap);
+        if (tmp) free(tmp);
+        return 0;
+    }
+    slots = remap+n;
+    for (i=0;i<n;i++) remap[i] = ~0U;
+    for (i=0;i<numInds;i++) remap[inds[i]-minV] = 0;
+    for (i=0;i<n;i++) {if (remap[i]==0) slots[numUsed++] = minV+i;}     // used slots (in ascending order)
+    for (i=0;i<n;i++) remap[i] = ~0U;
+    for (i=0,numUsed=0;i<numInds;i++) {
+        const unsigned v = inds[i]-minV;
+        if (remap[v]==~0U) {
+            remap[v] = slots[numUsed];  // the numUsed-th vertex used for the first time goes to the numUsed-th slot
+            memcpy(&tmp[numUsed*TEAPOT_VERTEX_NUM_FLOATS],&verts[inds[i]*TEAPOT_VERTEX_NUM_FLOATS],sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS);
+            ++numUsed;
+        }
+        inds[i] = remap[v];
+    }
+    for (i=0;i<(int)numUsed;i++) memcpy(&verts[slots[i]*TEAPOT_VERTEX_NUM_FLOATS],&tmp[i*TEAPOT_VERTEX_NUM_FLOATS],sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS);
+    free(tmp);free(remap);
+    return 1;
+}
+#endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+
+#ifdef TEAPOT_ENABLE_MESH_LODS
+#ifndef TEAPOT_MESH_LOD_MAX_ERROR
+#define TEAPOT_MESH_LOD_MAX_ERROR (0.02f)
+#endif //TEAPOT_MESH_LOD_MAX_ERROR
+typedef struct {float cost;unsigned from,to;} Teapot_EdgeCollapse;
+static int Teapot_Private_EdgeCollapse_Sorter(const void* pc0,const void* pc1) {
+    const Teapot_EdgeCollapse* c0 = (const Teapot_EdgeCollapse*) pc0;
+    const Teapot_EdgeCollapse* c1 = (const Teapot_EdgeCollapse*) pc1;
+    if (c0->cost!=c1->cost) return c0->cost<c1->cost ? -1 : 1;
+    if (c0->from!=c1->from) return c0->from<c1->from ? -1 : 1;
+    return c0->to<c1->to ? -1 : (c0->to>c1->to ? 1 : 0);
+}
+static int Teapot_Private_Edge_Sorter(const void* pe0,const void* pe1) {
+    const unsigned* e0 = (const unsigned*) pe0;const unsigned* e1 = (const unsigned*) pe1;
+    if (e0[0]!=e1[0]) return e0[0]<e1[0] ? -1 : 1;
+    return e0[1]<e1[1] ? -1 : (e0[1]>e1[1] ? 1 : 0);
+}
+static __inline double Teapot_Private_QuadricError(const double* q,const float* p) {
+    const double x=p[0],y=p[1],z=p[2];
+    return q[0]*x*x+2.0*q[1]*x*y+2.0*q[2]*x*z+2.0*q[3]*x+q[4]*y*y+2.0*q[5]*y*z+2.0*q[6]*y+q[7]*z*z+2.0*q[8]*z+q[9];
+}
+static __inline void Teapot_Private_TriangleNormal(const float* p0,const float* p1,const float* p2,float* n) {
+    const float e1[3] = {p1[0]-p0[0],p1[1]-p0[1],p1[2]-p0[2]};
+    const float e2[3] = {p2[0]-p0[0],p2[1]-p0[1],p2[2]-p0[2]};
+    n[0] = e1[1]*e2[2]-e1[2]*e2[1];n[1] = e1[2]*e2[0]-e1[0]*e2[2];n[2] = e1[0]*e2[1]-e1[1]*e2[0];
+}
+// Returns 1 if the collapse of vertex a onto vertex b (both relative to minV) keeps the surface valid. 'offsets' and 'adj' list the triangles of every vertex.
+// 'stamps' (one per vertex) must never contain 'stamp' or 'stamp+1' before the call.
+static int Teapot_Private_IsValidEdgeCollapse(unsigned a,unsigned b,const unsigned* inds,const int* offsets,const int* adj,const float* verts,unsigned minV,unsigned* stamps,unsigned stamp) {
+    int j,c,numShared=0,numCommon=0;
+    // link condition: a and b must share only the vertices opposite to their common triangles (otherwise the collapse folds the surface onto itself, or pinches two parts together)
+    for (j=offsets[a];j<offsets[a+1];j++) {
+        const unsigned* t = &inds[3*adj[j]];
+        for (c=0;c<3;c++) {const unsigned v = t[c]-minV;if (v==b) ++numShared;stamps[v] = stamp;}
+    }
+    for (j=offsets[b];j<offsets[b+1];j++) {
+        const unsigned* t = &inds[3*adj[j]];
+        for (c=0;c<3;c++) {const unsigned v = t[c]-minV;if (v!=a && v!=b && stamps[v]==stamp) {stamps[v] = stamp+1;++numCommon;}}
+    }
+    if (numCommon!=numShared) return 0;
+    // every remaining triangle of a must not flip, degenerate or turn by more than about 75 degrees
+    for (j=offsets[a];j<offsets[a+1];j++) {
+        const unsigned* t = &inds[3*adj[j]];
+        const float* p[3];float n0[3],n1[3];double l0,l1,d;
+        if (t[0]-minV==b || t[1]-minV==b || t[2]-minV==b) continue;    // (it's removed)
+        for (c=0;c<3;c++) p[c] = &verts[t[c]*TEAPOT_VERTEX_NUM_FLOATS];
+        Teapot_Private_TriangleNormal(p[0],p[1],p[2],n0);
+        for (c=0;c<3;c++) {if (t[c]-minV==a) p[c] = &verts[(b+minV)*TEAPOT_VERTEX_NUM_FLOATS];}
+        Teapot_Private_TriangleNormal(p[0],p[1],p[2],n1);
+        l0 = (double)n0[0]*n0[0]+(double)n0[1]*n0[1]+(double)n0[2]*n0[2];
+        l1 = (double)n1[0]*n1[0]+(double)n1[1]*n1[1]+(double)n1[2]*n1[2];
+        d = (double)n0[0]*n1[0]+(double)n0[1]*n1[1]+(double)n0[2]*n1[2];
+        if (l1<=l0*1.0e-4 || d<=0 || d*d<0.0625*l0*l1) return 0;
+    }
+    return 1;
+}
+// Generates the LODs 1..TEAPOT_NUM_MESH_LODS-1 of a triangle list, one after the other in lodIndsOut (that must hold numInds*(TEAPOT_NUM_MESH_LODS-1) indices).
+// 'inds' are indices of 'verts' (TEAPOT_VERTEX_NUM_FLOATS floats per vertex). lodNumIndsOut[lod] is zero for the LODs that are not generated. Returns the total number of LOD indices.
+// The LODs are snapshots of a single quadric edge collapse simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics", 1997),
+// so that their error is always measured against the full mesh. The quadrics are not area weighted: their error is a sum of squared distances.
+// LOD i has at most half the triangles of LOD i-1, and it stops earlier when the next collapse costs more than (TEAPOT_MESH_LOD_MAX_ERROR*2.5^(i-1)*meshRadius)^2.
+// No further LOD is generated when a LOD can't remove at least 15% of the triangles of the previous one.
+// Vertices only collapse onto other vertices with the same material (so that the LODs can share the vertices of their mesh). The vertices of the border edges are locked.
+static int Teapot_Private_GenerateLods(const unsigned* inds,int numInds,const float* verts,unsigned* lodIndsOut,int lodNumIndsOut[TEAPOT_NUM_MESH_LODS]) {
+    int numOut = numInds/3*3,numPrev,total=0,lod,i,j,c,n,pass;
+    unsigned minV,maxV,*work,*collapseTo,*edges,*stamps,stamp=1;
+    int *offsets,*adj;
+    unsigned char* flags;   // 1: locked, 2: touched by a collapse of the current pass
+    double* quadrics;double maxCost;
+    float aabbMin[3],aabbMax[3],maxError = TEAPOT_MESH_LOD_MAX_ERROR;
+    Teapot_EdgeCollapse* collapses;
+    for (lod=0;lod<TEAPOT_NUM_MESH_LODS;lod++) lodNumIndsOut[lod] = 0;
+    if (numOut<3*48) return 0;     // (too small)
+    minV=maxV=inds[0];
+    for (i=1;i<numOut;i++) {if (minV>inds[i]) minV=inds[i];else if (maxV<inds[i]) maxV=inds[i];}
+    n = (int)(maxV-minV)+1;
+    work = (unsigned*) malloc(sizeof(unsigned)*numOut);
+    quadrics = (double*) calloc(10*n,sizeof(double));
+    flags = (unsigned char*) calloc(n,1);
+    stamps = (unsigned*) calloc(n,sizeof(unsigned));
+    collapseTo = (unsigned*) malloc(sizeof(unsigned)*n);
+    offsets = (int*) malloc(sizeof(int)*(n+1+numOut));
+    edges = (unsigned*) malloc(sizeof(unsigned)*2*numOut);
+    collapses = (Teapot_EdgeCollapse*) malloc(sizeof(Teapot_EdgeCollapse)*2*numOut);
+    if (!work || !quadrics || !flags || !stamps || !collapseTo || !offsets || !edges || !collapses) {
+        fprintf(stderr,"Error in teapot.h: out of memory (can't simplify a mesh with %d triangles).\n",numOut/3);
+    }
+    else {
+        memcpy(work,inds,sizeof(unsigned)*numOut);
+        adj = offsets+n+1;
+        // quadric of every vertex: the sum of the planes of its triangles
+        for (c=0;c<3;c++) {aabbMin[c]=aabbMax[c]=verts[work[0]*TEAPOT_VERTEX_NUM_FLOATS+c];}
+        for (i=0;i<numOut;i+=3) {
+            float nrm[3];double l,a,b,cc,d;
+            const float* p0 = &verts[work[i]*TEAPOT_VERTEX_NUM_FLOATS];
+            for (j=0;j<3;j++) {
+                const float* p = &verts[work[i+j]*TEAPOT_VERTEX_NUM_FLOATS];
+                for (c=0;c<3;c++) {if (aabbMin[c]>p[c]) aabbMin[c]=p[c];else if (aabbMax[c]<p[c]) aabbMax[c]=p[c];}
+            }
+            Teapot_Private_TriangleNormal(p0,&verts[work[i+1]*TEAPOT_VERTEX_NUM_FLOATS],&verts[work[i+2]*TEAPOT_VERTEX_NUM_FLOATS],nrm);
+            l = sqrt(nrm[0]*nrm[0]+nrm[1]*nrm[1]+nrm[2]*nrm[2]);
+            if (l<=0) continue;
+            a = nrm[0]/l;b = nrm[1]/l;cc = nrm[2]/l;d = -(a*p0[0]+b*p0[1]+cc*p0[2]);
+            for (c=0;c<3;c++) {
+                double* q = &quadrics[10*(work[i+c]-minV)];
+                q[0]+=a*a;q[1]+=a*b;q[2]+=a*cc;q[3]+=a*d;q[4]+=b*b;
+                q[5]+=b*cc;q[6]+=b*d;q[7]+=cc*cc;q[8]+=cc*d;q[9]+=d*d;
+            }
+        }
+        // locks the vertices of the border (and non-manifold) edges: this preserves open borders and the seams between split vertices
+        for (i=0;i<numOut;i+=3) {
+            for (c=0;c<3;c++) {
+                const unsigned a = work[i+c]-minV,b = work[i+(c+1)%3]-minV;
+                edges[2*(i+c)] = a<b?a:b;edges[2*(i+c)+1] = a<b?b:a;
+            }
+        }
+        qsort(edges,numOut,2*sizeof(unsigned),Teapot_Private_Edge_Sorter);
+        for (i=0;i<numOut;i=j) {
+            for (j=i+1;j<numOut && edges[2*j]==edges[2*i] && edges[2*j+1]==edges[2*i+1];j++) {}
+            if (j-i!=2) {flags[edges[2*i]]|=1;flags[edges[2*i+1]]|=1;}
+        }
 
-        pTotVerts+=totVertsStrideInNumComponents;
+        for (lod=1,numPrev=numOut;lod<TEAPOT_NUM_MESH_LODS;lod++,maxError*=2.5f) {
+            const int targetNumInds = numPrev/6*3;
+            if (numPrev<3*48) break;     // (too small)
+            maxCost = 0;
+            for (c=0;c<3;c++) maxCost+=(double)(aabbMax[c]-aabbMin[c])*(aabbMax[c]-aabbMin[c]);
+            maxCost*=0.25*maxError*maxError;    // (radius*maxError)^2
+            // every pass performs the cheapest independent collapses
+            for (pass=0;pass<64 && numOut>targetNumInds;pass++) {
+                int numCollapses=0,numCollapsed=0,numRemoved=0;
+                memset(offsets,0,sizeof(int)*(n+1));
+                for (i=0;i<numOut;i++) ++offsets[work[i]-minV+1];
+                for (i=0;i<n;i++) {offsets[i+1]+=offsets[i];collapseTo[i]=0;}
+                for (i=0;i<numOut;i++) {const unsigned v = work[i]-minV;adj[offsets[v]+collapseTo[v]++] = i/3;}
+                for (i=0;i<n;i++) {collapseTo[i]=~0U;flags[i]&=~2;}
+                for (i=0;i<numOut;i+=3) {
+                    for (c=0;c<3;c++) {
+                        const unsigned a = work[i+c],b = work[i+(c+1)%3];
+                        const float* pa = &verts[a*TEAPOT_VERTEX_NUM_FLOATS];const float* pb = &verts[b*TEAPOT_VERTEX_NUM_FLOATS];
+                        double cost;
+                        if (pa[6]!=pb[6]) continue;     // different materials
+                        if (!(flags[a-minV]&1)) {
+                            cost = Teapot_Private_QuadricError(&quadrics[10*(a-minV)],pb)+Teapot_Private_QuadricError(&quadrics[10*(b-minV)],pb);
+                            if (cost<=maxCost) {Teapot_EdgeCollapse* ec = &collapses[numCollapses++];ec->cost = (float)cost;ec->from = a-minV;ec->to = b-minV;}
+                        }
+                        if (!(flags[b-minV]&1)) {
+                            cost = Teapot_Private_QuadricError(&quadrics[10*(a-minV)],pa)+Teapot_Private_QuadricError(&quadrics[10*(b-minV)],pa);
+                            if (cost<=maxCost) {Teapot_EdgeCollapse* ec = &collapses[numCollapses++];ec->cost = (float)cost;ec->from = b-minV;ec->to = a-minV;}
+                        }
+                    }
+                }
+                qsort(collapses,numCollapses,sizeof(Teapot_EdgeCollapse),Teapot_Private_EdgeCollapse_Sorter);
+                for (i=0;i<numCollapses && numOut-numRemoved>targetNumInds;i++) {
+                    const unsigned a = collapses[i].from,b = collapses[i].to;
+                    if ((flags[a]|flags[b])&2) continue;
+                    if (!Teapot_Private_IsValidEdgeCollapse(a,b,work,offsets,adj,verts,minV,stamps,stamp)) {stamp+=2;continue;}
+                    stamp+=2;
+                    collapseTo[a] = b+minV;
+                    for (c=0;c<10;c++) quadrics[10*b+c]+=quadrics[10*a+c];
+                    for (j=offsets[a];j<offsets[a+1];j++) {
+                        const unsigned* t = &work[3*adj[j]];
+                        for (c=0;c<3;c++) flags[t[c]-minV]|=2;
+                        if (t[0]-minV==b || t[1]-minV==b || t[2]-minV==b) numRemoved+=3;
+                    }
+                    for (j=offsets[b];j<offsets[b+1];j++) {
+                        const unsigned* t = &work[3*adj[j]];
+                        for (c=0;c<3;c++) flags[t[c]-minV]|=2;
+                    }
+                    ++numCollapsed;
+                }
+                if (numCollapsed==0) break;
+                // applies the collapses and removes the degenerate triangles
+                for (i=0,j=0;i<numOut;i+=3) {
+                    unsigned t[3];
+                    for (c=0;c<3;c++) {const unsigned v = work[i+c];t[c] = collapseTo[v-minV]!=~0U ? collapseTo[v-minV] : v;}
+                    if (t[0]==t[1] || t[1]==t[2] || t[0]==t[2]) continue;
+                    work[j++]=t[0];work[j++]=t[1];work[j++]=t[2];
+                }
+                numOut = j;
+            }
+            if (numOut<3 || numOut*20>numPrev*17) break;    // (less than 15% triangles removed)
+            memcpy(&lodIndsOut[total],work,sizeof(unsigned)*numOut);
+#           ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+            Teapot_Private_OptimizeTriangleOrder(&lodIndsOut[total],numOut,verts);
+#           endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+            lodNumIndsOut[lod] = numOut;total+=numOut;
+            numPrev = numOut;
+        }
     }
-
-    if (meshId<TEAPOT_FIRST_MESHLINES_INDEX)    {
-        for (i=0;i<numInds;i+=3) {
-            pTotInds[0] = inds[i]+(*numTotVerts);
-#           ifndef  TEAPOT_INVERT_MESHES_Z_AXIS
-            pTotInds[1] = inds[i+1]+(*numTotVerts);
-            pTotInds[2] = inds[i+2]+(*numTotVerts);
-#           else //TEAPOT_INVERT_MESHES_Z_AXIS
-            pTotInds[2] = inds[i+1]+(*numTotVerts);
-            pTotInds[1] = inds[i+2]+(*numTotVerts);
-#           endif //TEAPOT_INVERT_MESHES_Z_AXIS
-            pTotInds+=3;
+    if (collapses) free(collapses);
+    if (edges) free(edges);
+    if (offsets) free(offsets);
+    if (collapseTo) free(collapseTo);
+    if (stamps) free(stamps);
+    if (flags) free(flags);
+    if (quadrics) free(quadrics);
+    if (work) free(work);
+    return total;
+}
+#endif //TEAPOT_ENABLE_MESH_LODS
+
+#ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+// Octahedral encoding of the unit vector n (a zero vector is encoded as +Z)
+static void Teapot_Private_OctEncode(const float* n,short* out) {
+    const float l1 = fabs(n[0])+fabs(n[1])+fabs(n[2]);
+    float x=0.f,y=0.f;
+    if (l1>0.f) {
+        x = n[0]/l1;y = n[1]/l1;
+        if (n[2]<0.f) {
+            const float tx = x;
+            x = (1.f-fabs(y))*(tx>=0.f?1.f:-1.f);
+            y = (1.f-fabs(tx))*(y>=0.f?1.f:-1.f);
         }
     }
-    else {
-        for (i=0;i<numInds;i+=2) {
-            pTotInds[0] = inds[i]+(*numTotVerts);
-            pTotInds[1] = inds[i+1]+(*numTotVerts);
-            pTotInds+=2;
+    out[0] = (short) (x>=0.f ? x*32767.f+0.5f : x*32767.f-0.5f);
+    out[1] = (short) (y>=0.f ? y*32767.f+0.5f : y*32767.f-0.5f);
+}
+// Fills TIS.meshBuffer.qverts for the vertices referenced by inds (+baseVertex) using their aabb, and returns the (offset,scale) to dequantize them
+static void Teapot_Private_QuantizeMesh(const unsigned* inds,int numInds,size_t baseVertex,float dequantization[2][4]) {
+    const Teapot_MeshBuffer* b = &TIS.meshBuffer;
+    float mins[3]={0.f,0.f,0.f},maxs[3]={0.f,0.f,0.f};
+    int i,j;
+    for (i=0;i<numInds;i++) {
+        const float* v = &b->verts[(baseVertex+inds[i])*TEAPOT_VERTEX_NUM_FLOATS];
+        for (j=0;j<3;j++) {
+            if (i==0 || mins[j]>v[j]) mins[j]=v[j];
+            if (i==0 || maxs[j]<v[j]) maxs[j]=v[j];
         }
     }
-    //---------------------------------------------------------------------------
-
-    GetAabbHalfExtentsAndCenter(&totVerts[(*numTotVerts)*totVertsStrideInNumComponents],numVerts,6,&TIS.halfExtents[meshId][0],&TIS.centerPoint[meshId][0]);
+    for (j=0;j<3;j++) {
+        dequantization[0][j] = (mins[j]+maxs[j])*0.5f;
+        dequantization[1][j] = (maxs[j]-mins[j])*0.5f/32767.f;
+    }
+    dequantization[0][3] = dequantization[1][3] = 0.f;
+    for (i=0;i<numInds;i++) {
+        const size_t vi = baseVertex+inds[i];
+        const float* v = &b->verts[vi*TEAPOT_VERTEX_NUM_FLOATS];
+        short* q = &b->qverts[vi*TEAPOT_QVERTEX_NUM_SHORTS];
+        for (j=0;j<3;j++) {
+            float f = dequantization[1][j]>0.f ? (v[j]-dequantization[0][j])/dequantization[1][j] : 0.f;
+            if (f>32767.f) f=32767.f;
+            else if (f<-32767.f) f=-32767.f;
+            q[j] = (short) (f>=0.f ? f+0.5f : f-0.5f);
+        }
+        Teapot_Private_OctEncode(&v[3],&q[3]);
+        q[5] = (short) v[6];
+    }
+}
+#endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+
+// Uploads numVerts vertices of TIS.meshBuffer starting at startVert to TIS.vertexBuffer (that must be bound). If mustResize is true, the whole buffer is reallocated.
+static void Teapot_Private_UploadVerts(size_t startVert,size_t numVerts,int mustResize) {
+    const Teapot_MeshBuffer* b = &TIS.meshBuffer;
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    const size_t stride = sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS;
+    const unsigned char* data = (const unsigned char*) b->verts;
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    const size_t stride = sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS;
+    const unsigned char* data = (const unsigned char*) b->qverts;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    if (mustResize) glBufferData(GL_ARRAY_BUFFER, stride*b->maxVerts, data, GL_STATIC_DRAW);
+    else glBufferSubData(GL_ARRAY_BUFFER, stride*startVert, stride*numVerts, &data[stride*startVert]);
+}
 
-    /*fprintf(stderr,"%d) centerPoint:%1.2f,%1.2f,%1.2f   halfExtents:%1.2f,%1.2f,%1.2f\n",meshId,
-            TIS.centerPoint[meshId][0],TIS.centerPoint[meshId][1],TIS.centerPoint[meshId][2],
-            TIS.halfExtents[meshId][0],TIS.halfExtents[meshId][1],TIS.halfExtents[meshId][2]
-            );*/
+// Sub-allocates a user mesh after the embedded meshes in TIS.meshBuffer (growing it when needed). The old mesh (if any) is replaced only on success
+// (its space can be reused): on failure it's left untouched, and so are the capacities of TIS.meshBuffer (that must match the GL buffers). It does not touch the GL buffers.
+static int Teapot_Private_SetUserMesh(TeapotMeshEnum meshId,const float* verts,int numVerts,const unsigned short* inds16,const unsigned* inds32,int numInds) {
+    Teapot_MeshBuffer* b = &TIS.meshBuffer;
+    const int u = (int)meshId-TEAPOT_MESH_USER_00;
+    const int maxTotalInds = numInds*TEAPOT_NUM_MESH_LODS;  // (the LODs are stored after the mesh)
+    const size_t oldNumVerts = b->userNumVerts[u],oldNumIndsBytes = b->userNumIndsBytes[u];
+    const size_t oldMaxVerts = b->maxVerts,oldMaxIndsBytes = b->maxIndsBytes;
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    const size_t oldMaxQVerts = b->maxQVerts;
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    size_t startVerts,startIndsBytes,indexSize;GLenum indsType;
+    unsigned* tmpInds;int i,numTotalInds = numInds;
+    b->userNumVerts[u] = b->userNumIndsBytes[u] = 0;    // (so that the free range searches can return the space of the old mesh)
+    startVerts = Teapot_Private_FindFreeRange(b->userStartVerts,b->userNumVerts,TEAPOT_NUM_USER_MESHES,b->numFixedVerts,numVerts,1);
+    indsType = (startVerts+numVerts>0x10000) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;indexSize = Teapot_Private_IndexSize(indsType);
+    startIndsBytes = Teapot_Private_FindFreeRange(b->userStartIndsBytes,b->userNumIndsBytes,TEAPOT_NUM_USER_MESHES,b->numFixedIndsBytes,maxTotalInds*indexSize,sizeof(unsigned int));
+    b->userNumVerts[u] = oldNumVerts;b->userNumIndsBytes[u] = oldNumIndsBytes;
+
+    // Everything that can fail comes before the first write
+    tmpInds = (unsigned*) malloc(sizeof(unsigned)*maxTotalInds);
+    if (!tmpInds) {fprintf(stderr,"Error in teapot.h: out of memory (can't allocate %lu bytes).\n",(unsigned long)(sizeof(unsigned)*maxTotalInds));return 0;}
+    if (!Teapot_Private_Grow((void**)&b->verts,&b->maxVerts,startVerts+numVerts,sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS)
+#       ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        || !Teapot_Private_Grow((void**)&b->qverts,&b->maxQVerts,b->maxVerts,sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS)
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        || !Teapot_Private_Grow((void**)&b->inds,&b->maxIndsBytes,startIndsBytes+maxTotalInds*indexSize,1)) {
+        // the (larger) reallocated blocks are kept, but their capacities must still match the GL buffers
+        b->maxVerts = oldMaxVerts;b->maxIndsBytes = oldMaxIndsBytes;
+#       ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        b->maxQVerts = oldMaxQVerts;
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        free(tmpInds);return 0;
+    }
 
-#   ifdef TEAPOT_CENTER_MESHES_ON_FLOOR
-    //if (meshId<=TEAPOT_MESH_SPHERE2)
-    //if (meshId!=TEAPOT_MESH_CYLINDER_LATERAL_SURFACE && meshId!=TEAPOT_MESH_HALF_SPHERE_UP && meshId!=TEAPOT_MESH_HALF_SPHERE_DOWN && meshId!=TEAPOT_MESH_PIVOT3D)
-    if (meshId<TEAPOT_MESH_CYLINDER_LATERAL_SURFACE || meshId>=TEAPOT_FIRST_MESHLINES_INDEX)
-    {
-        pTotVerts = &totVerts[(*numTotVerts)*totVertsStrideInNumComponents];
-        for (i=1;i<numVerts*totVertsStrideInNumComponents;i+=totVertsStrideInNumComponents) {
-            pTotVerts[i] += TIS.halfExtents[meshId][1];
-        }
+    Teapot_Private_ProcessMeshVertsAndInds(&b->verts[startVerts*TEAPOT_VERTEX_NUM_FLOATS],tmpInds,verts,numVerts,inds16,inds32,numInds,meshId);
+#   ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+    TIS.acmr[meshId][0] = Teapot_Private_CalculateACMR(tmpInds,numInds);
+    if (Teapot_Private_OptimizeTriangleOrder(tmpInds,numInds,&b->verts[startVerts*TEAPOT_VERTEX_NUM_FLOATS]))
+        Teapot_Private_OptimizeVertexFetch(&b->verts[startVerts*TEAPOT_VERTEX_NUM_FLOATS],tmpInds,numInds);
+    TIS.acmr[meshId][1] = Teapot_Private_CalculateACMR(tmpInds,numInds);
+#   endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    for (i=0;i<TEAPOT_NUM_MESH_LODS;i++) TIS.lodNumInds[meshId][i] = 0;
+    numTotalInds+=Teapot_Private_GenerateLods(tmpInds,numInds,&b->verts[startVerts*TEAPOT_VERTEX_NUM_FLOATS],&tmpInds[numInds],TIS.lodNumInds[meshId]);
+#   endif //TEAPOT_ENABLE_MESH_LODS
+#   ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    Teapot_Private_QuantizeMesh(tmpInds,numInds,startVerts,TIS.dequantization[meshId]);
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    if (indsType==GL_UNSIGNED_INT) {unsigned* p = (unsigned*) &b->inds[startIndsBytes];for (i=0;i<numTotalInds;i++) p[i] = tmpInds[i]+(unsigned)startVerts;}
+    else {unsigned short* p = (unsigned short*) &b->inds[startIndsBytes];for (i=0;i<numTotalInds;i++) p[i] = (unsigned short) (tmpInds[i]+startVerts);}
+    free(tmpInds);
+
+    b->userStartVerts[u] = startVerts;b->userNumVerts[u] = numVerts;
+    b->userStartIndsBytes[u] = startIndsBytes;b->userNumIndsBytes[u] = numTotalInds*indexSize;
+    TIS.startInds[meshId] = (int) (startIndsBytes/indexSize);
+    TIS.numInds[meshId] = numInds;
+    TIS.indsType[meshId] = indsType;
+    TIS.indsOffset[meshId] = startIndsBytes;
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    for (i=1,startIndsBytes+=numInds*indexSize;i<TEAPOT_NUM_MESH_LODS;i++) {
+        TIS.lodIndsOffset[meshId][i] = startIndsBytes;
+        startIndsBytes+=TIS.lodNumInds[meshId][i]*indexSize;
     }
-    TIS.centerPoint[meshId][1]+= TIS.halfExtents[meshId][1];
-#   endif //TEAPOT_CENTER_MESHES_ON_FLOOR
+#   endif //TEAPOT_ENABLE_MESH_LODS
+#   ifdef TEAPOT_ENABLE_EXACT_PICKING
+    Teapot_Private_MeshTriBvh_Build(meshId);   // (on failure the mesh is picked by its OBB)
+#   endif //TEAPOT_ENABLE_EXACT_PICKING
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    TIS.staticShadowCache.valid = 0;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    return 1;
+}
 
-    {
-        float center[3];float halfAabb[3];
-        for (i=0;i<3;i++) {
-            center[i] = TIS.centerPoint[meshId][i];
-            halfAabb[i] = TIS.halfExtents[meshId][i];
-            TIS.aabbMin[meshId][i] = center[i] - halfAabb[i];
-            TIS.aabbMax[meshId][i] = center[i] + halfAabb[i];
+int Teapot_Set_UserMesh(TeapotMeshEnum meshId,const float* verts,int numVerts,const unsigned int* inds,int numInds) {
+    Teapot_MeshBuffer* b = &TIS.meshBuffer;
+    const size_t oldMaxVerts = b->maxVerts,oldMaxIndsBytes = b->maxIndsBytes;
+    size_t u;int i;
+    if (meshId<TEAPOT_MESH_USER_00 || meshId>=TEAPOT_MESH_CUBE) {
+        fprintf(stderr,"Error in teapot.h: Teapot_Set_UserMesh(...) accepts only TEAPOT_MESH_USER_XX meshes.\n");
+        return 0;
+    }
+    if (!TIS.vertexBuffer || !verts || !inds || numVerts<3 || numInds<3) return 0;
+    for (i=0;i<numInds;i++) {
+        if (inds[i]>=(unsigned)numVerts) {
+            fprintf(stderr,"Error in teapot.h: Teapot_Set_UserMesh(...): inds[%d]=%u is out of range (numVerts=%d).\n",i,inds[i],numVerts);
+            return 0;
         }
     }
+    if (!Teapot_Private_SetUserMesh(meshId,verts,numVerts,NULL,inds,numInds)) return 0;
+    u = meshId-TEAPOT_MESH_USER_00;
 
-    *numTotVerts+=numVerts;
-    *numTotInds+=numInds;
-
-    if (gTeapotInitCallback) gTeapotInitCallback(meshId,verts,numVerts,inds,numInds);
+    Teapot_Private_UnbindVertexArray();    // (binding GL_ELEMENT_ARRAY_BUFFER below would change the one of the bound vertex array object)
+    Teapot_Private_BindArrayBuffer(TIS.vertexBuffer);
+    Teapot_Private_UploadVerts(b->userStartVerts[u],b->userNumVerts[u],b->maxVerts!=oldMaxVerts);
+    Teapot_Private_BindArrayBuffer(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TIS.elementBuffer);
+    if (b->maxIndsBytes!=oldMaxIndsBytes) glBufferData(GL_ELEMENT_ARRAY_BUFFER, b->maxIndsBytes, b->inds, GL_STATIC_DRAW);
+    else glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, b->userStartIndsBytes[u], b->userNumIndsBytes[u], &b->inds[b->userStartIndsBytes[u]]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return 1;
+}
+void Teapot_Remove_UserMesh(TeapotMeshEnum meshId) {
+    Teapot_MeshBuffer* b = &TIS.meshBuffer;
+    int i,u;
+    if (meshId<TEAPOT_MESH_USER_00 || meshId>=TEAPOT_MESH_CUBE) return;
+    u = (int)meshId-TEAPOT_MESH_USER_00;
+    b->userNumVerts[u] = b->userNumIndsBytes[u] = 0;  // (its space can be reused by the next Teapot_Set_UserMesh(...))
+    TIS.numInds[meshId] = 0;
+    for (i=0;i<3;i++) TIS.halfExtents[meshId][i] = TIS.centerPoint[meshId][i] = TIS.aabbMin[meshId][i] = TIS.aabbMax[meshId][i] = 0;
+#   ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+    TIS.acmr[meshId][0] = TIS.acmr[meshId][1] = 0.f;
+#   endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    for (i=0;i<TEAPOT_NUM_MESH_LODS;i++) TIS.lodNumInds[meshId][i] = 0;
+#   endif //TEAPOT_ENABLE_MESH_LODS
+#   ifdef TEAPOT_ENABLE_EXACT_PICKING
+    Teapot_Private_MeshTriBvh_Destroy(&TIS.triBvhs[meshId]);
+#   endif //TEAPOT_ENABLE_EXACT_PICKING
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    TIS.staticShadowCache.valid = 0;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
 }
 
 
@@ -3005,100 +6588,310 @@ void Teapot_Set_Init_UserMeshCallback(TeapotInitUserMeshCallback callback) {gTea
 
 #if (defined(DYNAMIC_RESOLUTION_H) && defined(TEAPOT_SHADER_USE_SHADOW_MAP))
 #if ((defined(DYNAMIC_RESOLUTION_USE_DOUBLE_PRECISION) && defined(TEAPOT_USE_DOUBLE_PRECISION)) || (!defined(DYNAMIC_RESOLUTION_USE_DOUBLE_PRECISION) && !defined(TEAPOT_USE_DOUBLE_PRECISION)))
-static void Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],float transparent_threshold, int use_frustum_culling, void (*optionalAdditionalObjectsCallback)(void* userData),void* userData)
-{
-    int i;
-    Dynamic_Resolution_Bind_Shadow();   // Binds the shadow map FBO and its shader program
-    glClear(GL_DEPTH_BUFFER_BIT);
-    Dynamic_Resolution_Shadow_Set_VpMatrix(lvpMatrix16);  // lvpMatrix16 is good if we can use mMatrix below. If we MUST use mvMatrix below, here we must pass (lvpMatrix * cameraViewMatrixInverse). Please see Dynamic_Resolution_MultMatrix(...) and Teapot_GetViewMatrixInverse(...) methods.
-    Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1);
-    for (i=0;i<numMeshData;i++) {
-        const Teapot_MeshData* md = pMeshData[i];
-        TeapotMeshEnum meshId = md->meshId;
-        if (md->active && md->color[3]>=transparent_threshold && meshId<TEAPOT_MESH_PIVOT3D)
-        {
-            if (use_frustum_culling) {
-            // We could enable frustum culling here too...
-            // but we don't... it's something manual...
-            // (we must extract the shadow frustum planes and then call Teapot_Helper_IsVisible(...).
-            // Please see Teapot_Helper_GetFrustumPlaneEquations(...);)
-            // Not sure this works for meshId==TEAPOT_MESH_CAPSULE...
-
-                if (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z) {
-                    const float* scaling = md->scaling;
-                    const tpoat aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
-                    const tpoat aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
-
-                    if (!Teapot_Helper_IsVisible(lvpMatrixFrustumPlaneEquations,
-                                                 md->mMatrix,
-                                                 aabbMin[0],aabbMin[1],aabbMin[2],
-                                                 aabbMax[0],aabbMax[1],aabbMax[2]))
-                    {
-                        //fprintf(stderr,"MeshId=%d\n",meshId);
-                        continue;
-                    }
-                }
+// Draws meshId (at the LOD selected by lvpMatrix) with the dynamic_resolution.h shadow program (no teapot.h uniform is touched)
+static void Teapot_Private_Shadow_DrawElements(const tpoat* lvpMatrix,const tpoat* mMatrix,float scalingX,float scalingY,float scalingZ,TeapotMeshEnum meshId) {
+    const float scaling[3] = {scalingX,scalingY,scalingZ};
+    int numInds;size_t indsOffset;
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    Dynamic_Resolution_Shadow_Set_MMatrix(mMatrix);
+    Dynamic_Resolution_Shadow_Set_Scaling(scalingX,scalingY,scalingZ);
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    // the shadow program can't dequantize a_qvertex: we fold (offset,scale) into its mMatrix
+    const float* o = TIS.dequantization[meshId][0];const float* d = TIS.dequantization[meshId][1];
+    const float s[3] = {scalingX*d[0],scalingY*d[1],scalingZ*d[2]};
+    const float so[3] = {scalingX*o[0],scalingY*o[1],scalingZ*o[2]};
+    tpoat m[16];int c,r;
+    for (c=0;c<3;c++) {for (r=0;r<4;r++) m[4*c+r] = mMatrix[4*c+r]*s[c];}
+    for (r=0;r<4;r++) m[12+r] = mMatrix[12+r]+mMatrix[r]*so[0]+mMatrix[4+r]*so[1]+mMatrix[8+r]*so[2];
+    Dynamic_Resolution_Shadow_Set_MMatrix(m);
+    Dynamic_Resolution_Shadow_Set_Scaling(1.f,1.f,1.f);
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    Teapot_Private_GetLodRange(meshId,Teapot_Private_SelectLod(meshId,lvpMatrix,mMatrix,scaling),&numInds,&indsOffset);
+    glDrawElements(GL_TRIANGLES,numInds,TIS.indsType[meshId],(const void*) indsOffset);
+}
+// A shadow caster (TEAPOT_MESH_CAPSULE casts 3 of them)
+typedef struct {
+    TeapotMeshEnum meshId;
+    const tpoat* mMatrix;
+    float scaling[3];
+} Teapot_Private_ShadowCaster;
+// Values of the 'casterFilter' args below
+enum {TEAPOT_SHADOW_CASTERS_ALL=-1,TEAPOT_SHADOW_CASTERS_DYNAMIC=0,TEAPOT_SHADOW_CASTERS_STATIC=1};
+// (Opt) Simplify meshes (with TEAPOT_ENABLE_MESH_LODS, LODs are selected too: see Teapot_Private_Shadow_DrawElements(...))
+static __inline TeapotMeshEnum Teapot_Private_GetShadowMeshId(TeapotMeshEnum meshId) {
+    if (meshId==TEAPOT_MESH_SPHERE2)    meshId=TEAPOT_MESH_SPHERE1;
+    else if (meshId==TEAPOT_MESH_CONE2) meshId=TEAPOT_MESH_CONE1;
+    else if (meshId==TEAPOT_MESH_CUBIC_GROUND)  meshId=TEAPOT_MESH_CUBE;
+#   ifdef TEAPOT_USE_SIMPLER_CUBE_ROUNDED_SHADOW
+    else if (meshId==TEAPOT_MESH_CUBE_ROUNDED)    meshId=TEAPOT_MESH_CUBE;
+#   endif
+    return meshId;
+}
+// Fills 'casters' with the shadow casters of 'md' and returns their number (0 to 3). 'mats' is used to store the mMatrices of the TEAPOT_MESH_CAPSULE parts
+static int Teapot_Private_GetShadowCasters(const Teapot_MeshData* md,int casterFilter,float transparent_threshold,const tpoat lvpMatrixFrustumPlaneEquations[6][4],int use_frustum_culling,Teapot_Private_ShadowCaster casters[3],tpoat mats[3][16]) {
+    TeapotMeshEnum meshId = md->meshId;
+    if (!(md->active && md->color[3]>=transparent_threshold && meshId<TEAPOT_MESH_PIVOT3D)) return 0;
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    if (casterFilter!=TEAPOT_SHADOW_CASTERS_ALL && (md->staticShadowCaster ? TEAPOT_SHADOW_CASTERS_STATIC : TEAPOT_SHADOW_CASTERS_DYNAMIC)!=casterFilter) return 0;
+#   else //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    (void)casterFilter;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    if (use_frustum_culling) {
+    // We could enable frustum culling here too...
+    // but we don't... it's something manual...
+    // (we must extract the shadow frustum planes and then call Teapot_Helper_IsVisible(...).
+    // Please see Teapot_Helper_GetFrustumPlaneEquations(...);)
+    // Not sure this works for meshId==TEAPOT_MESH_CAPSULE...
+
+        if (meshId<TEAPOT_MESH_TEXT_X || meshId>TEAPOT_MESH_TEXT_Z) {
+            const float* scaling = md->scaling;
+            const tpoat aabbMin[3] = {TIS.aabbMin[meshId][0]*scaling[0],TIS.aabbMin[meshId][1]*scaling[1],TIS.aabbMin[meshId][2]*scaling[2]};
+            const tpoat aabbMax[3] = {TIS.aabbMax[meshId][0]*scaling[0],TIS.aabbMax[meshId][1]*scaling[1],TIS.aabbMax[meshId][2]*scaling[2]};
+
+            if (!Teapot_Helper_IsVisible(lvpMatrixFrustumPlaneEquations,
+                                         md->mMatrix,
+                                         aabbMin[0],aabbMin[1],aabbMin[2],
+                                         aabbMax[0],aabbMax[1],aabbMax[2]))
+            {
+                //fprintf(stderr,"MeshId=%d\n",meshId);
+                return 0;
             }
+        }
+    }
 
 
-            if (meshId==TEAPOT_MESH_CAPSULE) {
-                // unluckily TEAPOT_MESH_CAPSULE is special... sorry!
-                // We don't want to draw "scaled" capsules. Instead we want to regenerate valid capsules, reinterpreting Teapot_SetScaling(...)
-#               if (!defined(TEAPOT_NO_MESH_CYLINDER) && !defined(TEAPOT_NO_MESH_HALF_SPHERE_UP) && !defined(TEAPOT_NO_MESH_HALF_SPHERE_DOWN))
-                const float height = md->scaling[1];
-                const float diameter = (md->scaling[0]+md->scaling[2])*0.5f;
-                const float yAxis[3] = {md->mMatrix[4],md->mMatrix[5],md->mMatrix[6]};
-                tpoat mat[16];
-                float tmp,center[3],origin[3];				
-				Teapot_GetMeshAabbCenter(TEAPOT_MESH_CYLINDER_LATERAL_SURFACE,center);                
-				tmp = (diameter*center[1]);
-
-                origin[0] = md->mMatrix[12]+md->mMatrix[4]*tmp;
-				origin[1] = md->mMatrix[13]-md->mMatrix[5]*tmp;
-				origin[2] = md->mMatrix[14]-md->mMatrix[6]*tmp;
-
-                center[1]=-center[1];   //
-                //origin[1]-=diameter*center[1];
-
-                memcpy(mat,md->mMatrix,sizeof(mat));
-                mat[12] = origin[0];    mat[13] = origin[1];    mat[14] = origin[2];
-                Dynamic_Resolution_Shadow_Set_Scaling(diameter,height,diameter);
-                Dynamic_Resolution_Shadow_Set_MMatrix(mat); // mMatrix here (or mvMatrix if we had called above Dynamic_Resolution_Shadow_Set_VpMatrix(lCombined * cameraViewMatrixInverse);)
-                Teapot_LowLevel_DrawElements(TEAPOT_MESH_CYLINDER_LATERAL_SURFACE);
-
-                // TEAPOT_MESH_HALF_SPHERE_UP and TEAPOT_MESH_HALF_SPHERE_DOWN are not affected by TEAPOT_CENTER_MESHES_ON_FLOOR
-                Dynamic_Resolution_Shadow_Set_Scaling(diameter,diameter,diameter);
-                tmp = height*(0.5f-center[1]);
-                mat[12] = origin[0] + yAxis[0]*tmp;
-                mat[13] = origin[1] + yAxis[1]*tmp;
-                mat[14] = origin[2] + yAxis[2]*tmp;
-                Dynamic_Resolution_Shadow_Set_MMatrix(mat); // mMatrix here (or mvMatrix if we had called above Dynamic_Resolution_Shadow_Set_VpMatrix(lCombined * cameraViewMatrixInverse);)
-                Teapot_LowLevel_DrawElements(TEAPOT_MESH_HALF_SPHERE_UP);
-
-                tmp = -height*(0.5f+center[1]);
-                mat[12] = origin[0] + yAxis[0]*tmp;
-                mat[13] = origin[1] + yAxis[1]*tmp;
-                mat[14] = origin[2] + yAxis[2]*tmp;
-                Dynamic_Resolution_Shadow_Set_MMatrix(mat); // mMatrix here (or mvMatrix if we had called above Dynamic_Resolution_Shadow_Set_VpMatrix(lCombined * cameraViewMatrixInverse);)
-                Teapot_LowLevel_DrawElements(TEAPOT_MESH_HALF_SPHERE_DOWN);
-#               endif // !defined(...)
-                continue;
-            }
+    if (meshId==TEAPOT_MESH_CAPSULE) {
+        // unluckily TEAPOT_MESH_CAPSULE is special... sorry!
+        // We don't want to draw "scaled" capsules. Instead we want to regenerate valid capsules, reinterpreting Teapot_SetScaling(...)
+#       if (!defined(TEAPOT_NO_MESH_CYLINDER) && !defined(TEAPOT_NO_MESH_HALF_SPHERE_UP) && !defined(TEAPOT_NO_MESH_HALF_SPHERE_DOWN))
+        const float height = md->scaling[1];
+        const float diameter = (md->scaling[0]+md->scaling[2])*0.5f;
+        const float yAxis[3] = {md->mMatrix[4],md->mMatrix[5],md->mMatrix[6]};
+        float tmp,center[3],origin[3];
+        int j;
+        Teapot_GetMeshAabbCenter(TEAPOT_MESH_CYLINDER_LATERAL_SURFACE,center);
+        tmp = (diameter*center[1]);
 
-            // (Opt) Simplify meshes
-            if (meshId==TEAPOT_MESH_SPHERE2)    meshId=TEAPOT_MESH_SPHERE1;
-            else if (meshId==TEAPOT_MESH_CONE2) meshId=TEAPOT_MESH_CONE1;
-            else if (meshId==TEAPOT_MESH_CUBIC_GROUND)  meshId=TEAPOT_MESH_CUBE;
-#           ifdef TEAPOT_USE_SIMPLER_CUBE_ROUNDED_SHADOW
-            else if (meshId==TEAPOT_MESH_CUBE_ROUNDED)    meshId=TEAPOT_MESH_CUBE;
-#           endif
-            // End (Opt)
+        origin[0] = md->mMatrix[12]+md->mMatrix[4]*tmp;
+        origin[1] = md->mMatrix[13]-md->mMatrix[5]*tmp;
+        origin[2] = md->mMatrix[14]-md->mMatrix[6]*tmp;
+
+        center[1]=-center[1];   //
+        //origin[1]-=diameter*center[1];
+
+        for (j=0;j<3;j++) {memcpy(mats[j],md->mMatrix,sizeof(mats[j]));casters[j].mMatrix = mats[j];}
+        mats[0][12] = origin[0];    mats[0][13] = origin[1];    mats[0][14] = origin[2];
+        casters[0].meshId = TEAPOT_MESH_CYLINDER_LATERAL_SURFACE;
+        casters[0].scaling[0] = diameter;casters[0].scaling[1] = height;casters[0].scaling[2] = diameter;
+
+        // TEAPOT_MESH_HALF_SPHERE_UP and TEAPOT_MESH_HALF_SPHERE_DOWN are not affected by TEAPOT_CENTER_MESHES_ON_FLOOR
+        tmp = height*(0.5f-center[1]);
+        mats[1][12] = origin[0] + yAxis[0]*tmp;
+        mats[1][13] = origin[1] + yAxis[1]*tmp;
+        mats[1][14] = origin[2] + yAxis[2]*tmp;
+        casters[1].meshId = TEAPOT_MESH_HALF_SPHERE_UP;
+
+        tmp = -height*(0.5f+center[1]);
+        mats[2][12] = origin[0] + yAxis[0]*tmp;
+        mats[2][13] = origin[1] + yAxis[1]*tmp;
+        mats[2][14] = origin[2] + yAxis[2]*tmp;
+        casters[2].meshId = TEAPOT_MESH_HALF_SPHERE_DOWN;
+        for (j=1;j<3;j++) {casters[j].scaling[0] = casters[j].scaling[1] = casters[j].scaling[2] = diameter;}
+        return 3;
+#       else // !defined(...)
+        (void)mats;
+        return 0;
+#       endif // !defined(...)
+    }
+
+    casters[0].meshId = Teapot_Private_GetShadowMeshId(meshId);
+    casters[0].mMatrix = md->mMatrix;  // mMatrix here (or mvMatrix if we had called Dynamic_Resolution_Shadow_Set_VpMatrix(lvpMatrix * cameraViewMatrixInverse);)
+    casters[0].scaling[0] = md->scaling[0];casters[0].scaling[1] = md->scaling[1];casters[0].scaling[2] = md->scaling[2];
+    return 1;
+}
+#ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+// Draws all the shadow casters with one glDrawElementsInstanced(...) per (simplified) meshId and LOD, using TIS.shadowInstancedProgramId.
+// Must be called after Dynamic_Resolution_Bind_Shadow() and Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1) (their state is restored). Returns 0 if nothing has been drawn (and the caller must draw the casters).
+static int Teapot_Private_DrawMulti_ShadowMap_Instanced(Teapot_MeshData* const* pMeshData,int numMeshData,int casterFilter,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],float transparent_threshold, int use_frustum_culling) {
+    const GLsizei stride = sizeof(float)*TEAPOT_SHADOW_INSTANCE_NUM_FLOATS;
+    int bucketStart[TEAPOT_NUM_INSTANCE_BUCKETS],bucketCount[TEAPOT_NUM_INSTANCE_BUCKETS];
+    Teapot_Private_ShadowCaster casters[3];tpoat mats[3][16];
+    GLint shadowProgramId = 0;
+    float* instanceData;size_t streamOffset;
+    int i,j,k,numInstances=0,vao;
+    if (!TIS.instancingEnabled || !TIS.shadowInstancedProgramId) return 0;
+
+    // 1) count casters per meshId and LOD
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) bucketCount[i]=0;
+    for (i=0;i<numMeshData;i++) {
+        const int numCasters = Teapot_Private_GetShadowCasters(pMeshData[i],casterFilter,transparent_threshold,lvpMatrixFrustumPlaneEquations,use_frustum_culling,casters,mats);
+        for (j=0;j<numCasters;j++) ++bucketCount[(int)casters[j].meshId*TEAPOT_NUM_MESH_LODS+Teapot_Private_SelectLod(casters[j].meshId,lvpMatrix16,casters[j].mMatrix,casters[j].scaling)];
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {bucketStart[i]=numInstances;numInstances+=bucketCount[i];bucketCount[i]=0;}
+    if (numInstances==0) return 1;
+    if (!(instanceData = Teapot_Private_BeginInstanceStream(numInstances*TEAPOT_SHADOW_INSTANCE_NUM_FLOATS))) return 0;
+
+    // 2) fill the per-instance stream (bucket by bucket)
+    for (i=0;i<numMeshData;i++) {
+        const int numCasters = Teapot_Private_GetShadowCasters(pMeshData[i],casterFilter,transparent_threshold,lvpMatrixFrustumPlaneEquations,use_frustum_culling,casters,mats);
+        for (j=0;j<numCasters;j++) {
+            const Teapot_Private_ShadowCaster* c = &casters[j];
+            const int bucket = (int)c->meshId*TEAPOT_NUM_MESH_LODS+Teapot_Private_SelectLod(c->meshId,lvpMatrix16,c->mMatrix,c->scaling);
+            float* p = &instanceData[(bucketStart[bucket]+bucketCount[bucket]++)*TEAPOT_SHADOW_INSTANCE_NUM_FLOATS];
+            for (k=0;k<12;k++) p[k]=(float)c->mMatrix[k]*c->scaling[k/4];
+            for (k=12;k<16;k++) p[k]=(float)c->mMatrix[k];
+        }
+    }
+
+    // 3) upload and draw
+    glGetIntegerv(GL_CURRENT_PROGRAM,&shadowProgramId);    // the dynamic_resolution.h shadow program (restored below for optionalAdditionalObjectsCallback)
+    glUseProgram(TIS.shadowInstancedProgramId);
+    Teapot_Helper_GlUniformMatrix4v(TIS.shadowInstLoc_lvpMatrix,1,GL_FALSE,lvpMatrix16);
+    if (!(vao=Teapot_Private_BindVertexArray(TEAPOT_VAO_SHADOW_INSTANCED))) {
+        glEnableVertexAttribArray(TIS.aLoc_shadowInstVertex);
+        Teapot_Private_VertexAttribPointers(TIS.aLoc_shadowInstVertex,-1,-1);
+    }
 
-            Dynamic_Resolution_Shadow_Set_MMatrix(md->mMatrix); // mMatrix here (or mvMatrix if we had called above Dynamic_Resolution_Shadow_Set_VpMatrix(lvpMatrix * cameraViewMatrixInverse);)
-            Dynamic_Resolution_Shadow_Set_Scaling(md->scaling[0],md->scaling[1],md->scaling[2]);
-            Teapot_LowLevel_DrawElements(meshId);
+    streamOffset = Teapot_Private_EndInstanceStream(numInstances*TEAPOT_SHADOW_INSTANCE_NUM_FLOATS);
+    for (j=0;j<4 && !vao;j++) {
+        glEnableVertexAttribArray(TIS.aLoc_shadowInstMMatrix[j]);
+        glVertexAttribDivisor(TIS.aLoc_shadowInstMMatrix[j],1);
+    }
+    for (i=0;i<TEAPOT_NUM_INSTANCE_BUCKETS;i++) {
+        const TeapotMeshEnum meshId = (TeapotMeshEnum) (i/TEAPOT_NUM_MESH_LODS);
+        int numInds;size_t indsOffset;
+        if (bucketCount[i]==0) continue;
+        for (j=0;j<4;j++) glVertexAttribPointer(TIS.aLoc_shadowInstMMatrix[j], 4, GL_FLOAT, GL_FALSE, stride, (void*)(streamOffset + bucketStart[i]*stride + sizeof(float)*4*j));
+#       ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        glUniform4fv(TIS.shadowInstLoc_dequantization,2,&TIS.dequantization[meshId][0][0]);
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        Teapot_Private_GetLodRange(meshId,i%TEAPOT_NUM_MESH_LODS,&numInds,&indsOffset);
+        glDrawElementsInstanced(GL_TRIANGLES,numInds,TIS.indsType[meshId],(const void*) indsOffset,bucketCount[i]);
+    }
+
+    // restore the state of the non-instanced shadow pass
+    if (!vao) {
+        for (j=0;j<4;j++) {
+            glVertexAttribDivisor(TIS.aLoc_shadowInstMMatrix[j],0);
+            glDisableVertexAttribArray(TIS.aLoc_shadowInstMMatrix[j]);
+        }
+        glDisableVertexAttribArray(TIS.aLoc_shadowInstVertex);
+    }
+    Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1);
+    glUseProgram((GLuint)shadowProgramId);
+    return 1;
+}
+#endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+// Draws the casters selected by 'casterFilter' into the bound shadow map
+static void Teapot_Private_DrawMulti_ShadowMap(Teapot_MeshData* const* pMeshData,int numMeshData,int casterFilter,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],float transparent_threshold, int use_frustum_culling) {
+    Teapot_Private_ShadowCaster casters[3];tpoat mats[3][16];
+    int i,j;
+#   ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    if (Teapot_Private_DrawMulti_ShadowMap_Instanced(pMeshData,numMeshData,casterFilter,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,use_frustum_culling)) return;
+#   endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    for (i=0;i<numMeshData;i++) {
+        const int numCasters = Teapot_Private_GetShadowCasters(pMeshData[i],casterFilter,transparent_threshold,lvpMatrixFrustumPlaneEquations,use_frustum_culling,casters,mats);
+        for (j=0;j<numCasters;j++) Teapot_Private_Shadow_DrawElements(lvpMatrix16,casters[j].mMatrix,casters[j].scaling[0],casters[j].scaling[1],casters[j].scaling[2],casters[j].meshId);
+    }
+}
+#ifdef TEAPOT_PRIVATE_STATIC_SHADOW_CACHE
+static __inline unsigned long long Teapot_Private_HashWords(unsigned long long h,const void* data,size_t numBytes) {
+    // FNV-1a on 32-bit words
+    const unsigned char* p = (const unsigned char*) data;
+    size_t i;unsigned w;
+    for (i=0;i+4<=numBytes;i+=4) {memcpy(&w,&p[i],4);h = (h^w)*1099511628211ULL;}
+    return h;
+}
+// Hash of everything that affects the depth of the static shadow casters
+static unsigned long long Teapot_Private_HashStaticShadowCasters(Teapot_MeshData* const* pMeshData,int numMeshData,float transparent_threshold) {
+    unsigned long long h = 14695981039346656037ULL;
+    int i;
+    for (i=0;i<numMeshData;i++) {
+        const Teapot_MeshData* md = pMeshData[i];
+        if (md->staticShadowCaster) {
+            const int key[3] = {i,(int)md->meshId,(md->active && md->color[3]>=transparent_threshold) ? 1 : 0};
+            h = Teapot_Private_HashWords(h,key,sizeof(key));
+            h = Teapot_Private_HashWords(h,md->scaling,sizeof(md->scaling));
+            h = Teapot_Private_HashWords(h,md->mMatrix,16*sizeof(tpoat));
         }
     }
+    return h;
+}
+static int Teapot_Private_StaticShadowCache_IsLvpMatrixValid(const Teapot_Private_StaticShadowCache* c,const tpoat* lvpMatrix16) {
+    const tpoat xyThreshold = (tpoat)0.5/(tpoat)(c->width>c->height ? c->width : c->height); // a quarter of a texel (in NDC)
+    int i;
+    for (i=0;i<16;i++) {
+        const tpoat threshold = (i==12 || i==13) ? xyThreshold : (i==14 ? (tpoat)c->depthThreshold : (tpoat)1e-6);
+        if (fabs(lvpMatrix16[i]-c->lvpMatrix[i])>threshold) return 0;
+    }
+    return 1;
+}
+// Must be called after Dynamic_Resolution_Bind_Shadow(). Returns 0 if the cache can't be used. Otherwise it clears the shadow map (if the cache is out of date, it draws and stores the static casters first),
+// copies the cached static casters into it, and returns 1 (so that only the dynamic casters must be drawn)
+static int Teapot_Private_StaticShadowCache_Bind(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],float transparent_threshold, int use_frustum_culling) {
+    Teapot_Private_StaticShadowCache* c = &TIS.staticShadowCache;
+    const int bufferWidth = (int) Dynamic_Resolution_GetShadowMapTextureWidth(),bufferHeight = (int) Dynamic_Resolution_GetShadowMapTextureHeight();
+    GLint shadowFrameBuffer=0,viewport[4];
+    unsigned long long hash;
+    if (!c->enabled) return 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING,&shadowFrameBuffer);
+    glGetIntegerv(GL_VIEWPORT,viewport);
+    if (!c->frameBuffer || c->bufferWidth!=bufferWidth || c->bufferHeight!=bufferHeight) {
+        // (re)create the cache with the same depth format of the shadow map (glBlitFramebuffer(...) needs it)
+        GLint depthBits=0,depthType=GL_UNSIGNED_NORMALIZED;GLenum format;
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE,&depthBits);
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE,&depthType);
+        format = depthType==GL_FLOAT ? GL_DEPTH_COMPONENT32F : (depthBits<=16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT24);
+#       ifdef GL_DEPTH_COMPONENT32
+        if (depthType!=GL_FLOAT && depthBits>24) format = GL_DEPTH_COMPONENT32;
+#       endif
+        if (!c->frameBuffer) {glGenFramebuffers(1,&c->frameBuffer);glGenRenderbuffers(1,&c->depthBuffer);}
+        glBindRenderbuffer(GL_RENDERBUFFER,c->depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER,format,bufferWidth,bufferHeight);
+        glBindRenderbuffer(GL_RENDERBUFFER,0);
+        glBindFramebuffer(GL_FRAMEBUFFER,c->frameBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,c->depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr,"Error in teapot.h: the static shadow cache frame buffer is not complete (the static shadow cache is disabled).\n");
+            c->enabled = 0;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER,(GLuint)shadowFrameBuffer);
+        c->bufferWidth = bufferWidth;c->bufferHeight = bufferHeight;
+        c->valid = 0;
+        if (!c->enabled) return 0;
+    }
+    hash = Teapot_Private_HashStaticShadowCasters(pMeshData,numMeshData,transparent_threshold);
+    if (!c->valid || c->hash!=hash || c->width!=viewport[2] || c->height!=viewport[3] || c->transparentThreshold!=transparent_threshold || c->frustumCulling!=use_frustum_culling || !Teapot_Private_StaticShadowCache_IsLvpMatrixValid(c,lvpMatrix16)) {
+        // redraw the static casters and store them
+        glClear(GL_DEPTH_BUFFER_BIT);
+        Teapot_Private_DrawMulti_ShadowMap(pMeshData,numMeshData,TEAPOT_SHADOW_CASTERS_STATIC,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,use_frustum_culling);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER,(GLuint)shadowFrameBuffer);glBindFramebuffer(GL_DRAW_FRAMEBUFFER,c->frameBuffer);
+        glBlitFramebuffer(0,0,viewport[2],viewport[3],0,0,viewport[2],viewport[3],GL_DEPTH_BUFFER_BIT,GL_NEAREST);
+        c->valid = 1;c->hash = hash;c->width = viewport[2];c->height = viewport[3];
+        c->transparentThreshold = transparent_threshold;c->frustumCulling = use_frustum_culling;
+        Teapot_Helper_CopyMatrix(c->lvpMatrix,lvpMatrix16);
+    }
+    else {
+        // copy the stored static casters (instead of clearing the shadow map)
+        glBindFramebuffer(GL_READ_FRAMEBUFFER,c->frameBuffer);glBindFramebuffer(GL_DRAW_FRAMEBUFFER,(GLuint)shadowFrameBuffer);
+        glBlitFramebuffer(0,0,viewport[2],viewport[3],0,0,viewport[2],viewport[3],GL_DEPTH_BUFFER_BIT,GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER,(GLuint)shadowFrameBuffer);
+    return 1;
+}
+#endif //TEAPOT_PRIVATE_STATIC_SHADOW_CACHE
+static void Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],float transparent_threshold, int use_frustum_culling, void (*optionalAdditionalObjectsCallback)(void* userData),void* userData)
+{
+    int casterFilter = TEAPOT_SHADOW_CASTERS_ALL;
+    Dynamic_Resolution_Bind_Shadow();   // Binds the shadow map FBO and its shader program
+    Dynamic_Resolution_Shadow_Set_VpMatrix(lvpMatrix16);  // lvpMatrix16 is good if we can use mMatrix below. If we MUST use mvMatrix below, here we must pass (lvpMatrix * cameraViewMatrixInverse). Please see Dynamic_Resolution_MultMatrix(...) and Teapot_GetViewMatrixInverse(...) methods.
+    Teapot_LowLevel_BindVertexBufferObjectAndEnableVertexAttributes(1,1);
+#   ifdef TEAPOT_PRIVATE_STATIC_SHADOW_CACHE
+    if (Teapot_Private_StaticShadowCache_Bind(pMeshData,numMeshData,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,use_frustum_culling)) casterFilter = TEAPOT_SHADOW_CASTERS_DYNAMIC;
+    else
+#   endif //TEAPOT_PRIVATE_STATIC_SHADOW_CACHE
+    glClear(GL_DEPTH_BUFFER_BIT);
+    Teapot_Private_DrawMulti_ShadowMap(pMeshData,numMeshData,casterFilter,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,use_frustum_culling);
     Teapot_LowLevel_UnbindVertexBufferObjectAndDisableVertexAttributes(1,1);
     if (optionalAdditionalObjectsCallback) {
         optionalAdditionalObjectsCallback(userData);
@@ -3117,33 +6910,104 @@ void Teapot_HiLevel_DrawMulti_ShadowMap_Vp(Teapot_MeshData* const* pMeshData,int
 void Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithFrustumCulling(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4], float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData),void* userData) {
     Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(pMeshData,numMeshData,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,1,optionalAdditionalObjectsCallback,userData);
 }
+#ifdef TEAPOT_ENABLE_FRUSTUM_CULLING
+void Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithCasterCulling(Teapot_MeshData* const* pMeshData,int numMeshData,const tpoat* lvpMatrix16,const tpoat lvpMatrixFrustumPlaneEquations[6][4],const tpoat casterCullingPlanes[][4],int numCasterCullingPlanes, float transparent_threshold, void (*optionalAdditionalObjectsCallback)(void* userData),void* userData) {
+    int i,numCasters=0;int* counters = TIS.shadowCasterCullingCounters;
+    counters[0]=counters[1]=counters[2]=counters[3]=0;
+    if (numMeshData<=0) {Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(pMeshData,0,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,0,optionalAdditionalObjectsCallback,userData);return;}
+    if (TIS.shadowCastersCapacity<numMeshData) {
+        const int capacity = numMeshData + numMeshData/2;
+        void* p = realloc(TIS.shadowCasters,capacity*sizeof(Teapot_MeshData*));
+        if (p) {TIS.shadowCasters = (Teapot_MeshData**) p;TIS.shadowCastersCapacity = capacity;}
+        else {
+            // (TIS.shadowCasters is still valid)
+            fprintf(stderr,"Error in teapot.h: Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithCasterCulling(...) out of memory (numMeshData=%d). Using Teapot_HiLevel_DrawMulti_ShadowMap_Vp_WithFrustumCulling(...).\n",numMeshData);
+            Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(pMeshData,numMeshData,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,1,optionalAdditionalObjectsCallback,userData);
+            return;
+        }
+    }
+    // batches of 4 tested casters (like Teapot_Private_MeshData_CullArray(...)), tested against both volumes
+    for (i=0;i<numMeshData;) {
+        const tpoat* mf[4];tpoat boxes[24];Teapot_MeshData* tested[4];
+        int k,lightMask,casterMask,numTested=0;
+        for (;i<numMeshData && numTested<4;i++) {
+            Teapot_MeshData* md = pMeshData[i];
+            if (!(md->active && md->color[3]>=transparent_threshold && md->meshId<TEAPOT_MESH_PIVOT3D)) continue;   // not a caster
+#           ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+            if (md->staticShadowCaster && TIS.staticShadowCache.enabled) {TIS.shadowCasters[numCasters++]=md;continue;}
+#           endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+            if (Teapot_Private_GetCullingBox(Teapot_Private_GetShadowMeshId(md->meshId),md->scaling,&boxes[6*numTested])) {mf[numTested]=md->mMatrix;tested[numTested++]=md;}  // (box of the mesh we draw)
+            else TIS.shadowCasters[numCasters++]=md;
+        }
+        if (numTested==0) continue;
+        for (k=numTested;k<4;k++) {mf[k]=mf[0];memcpy(&boxes[6*k],&boxes[0],6*sizeof(tpoat));}   // (padding)
+        lightMask = Teapot_Private_CullBatch4(lvpMatrixFrustumPlaneEquations,6,mf,boxes);
+        casterMask = numCasterCullingPlanes>0 ? Teapot_Private_CullBatch4(casterCullingPlanes,numCasterCullingPlanes,mf,boxes) : 15;
+        for (k=0;k<numTested;k++) {
+            const int inLight = (lightMask>>k)&1,inCasterVolume = (casterMask>>k)&1;
+            counters[1]+=!inLight;counters[2]+=!inCasterVolume;
+            if (inLight && inCasterVolume) TIS.shadowCasters[numCasters++]=tested[k];
+            else ++counters[3];
+        }
+        counters[0]+=numTested;
+    }
+    // (the surviving casters keep their order, so the static shadow cache hash does not change)
+    Teapot_MeshData_HiLevel_DrawMulti_ShadowMap_Vp_Internal(TIS.shadowCasters,numCasters,lvpMatrix16,lvpMatrixFrustumPlaneEquations,transparent_threshold,0,optionalAdditionalObjectsCallback,userData);
+}
+void Teapot_Get_ShadowCasterCulling_Counters(int* numTestedOut,int* numCulledByLightFrustumOut,int* numCulledByCasterCullingPlanesOut,int* numCulledOut) {
+    const int* counters = TIS.shadowCasterCullingCounters;
+    if (numTestedOut) *numTestedOut = counters[0];
+    if (numCulledByLightFrustumOut) *numCulledByLightFrustumOut = counters[1];
+    if (numCulledByCasterCullingPlanesOut) *numCulledByCasterCullingPlanesOut = counters[2];
+    if (numCulledOut) *numCulledOut = counters[3];
+}
+#endif //TEAPOT_ENABLE_FRUSTUM_CULLING
+#ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+void Teapot_Enable_StaticShadowCache(void) {TIS.staticShadowCache.enabled = 1;}
+void Teapot_Disable_StaticShadowCache(void) {TIS.staticShadowCache.enabled = 0;}
+int Teapot_Get_StaticShadowCache_Enabled(void) {return TIS.staticShadowCache.enabled;}
+void Teapot_Invalidate_StaticShadowCache(void) {TIS.staticShadowCache.valid = 0;}
+void Teapot_Set_StaticShadowCache_LvpMatrixThreshold(float depthThreshold) {TIS.staticShadowCache.depthThreshold = depthThreshold>0 ? depthThreshold : 0;}
+#endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
 #endif
 #endif
 
-void Teapot_Init(void) {
-    int i,j;
-    TIS.colorMaterialEnabled = 0;
-    TIS.meshOutlineEnabled = 0;
-    Teapot_Set_MeshOutline_Color(0,0,0,1);
-    //Teapot_Set_MeshOutline_Scaling(1.0f);Teapot_Set_MeshOutline_Params(-2.0f,-250.f);
-    Teapot_Set_MeshOutline_Scaling(1.015f);Teapot_Set_MeshOutline_Params(-1.0f,-250.f);
-    TIS.vertexBuffer = TIS.elementBuffer = 0;
-    for (i=0;i<TEAPOT_MESH_COUNT;i++) {
-        TIS.startInds[i] = TIS.numInds[i] = 0;
-        TIS.halfExtents[i][0]=TIS.halfExtents[i][1]=TIS.halfExtents[i][2]=0;
-        TIS.centerPoint[i][0]=TIS.centerPoint[i][1]=TIS.centerPoint[i][2]=0;
+#ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+void Teapot_Set_ProgramBinaryCache_Path(const char* pathPrefix) {
+    TIS.programBinaryCachePath[0]='\0';
+    if (pathPrefix) {
+        if (strlen(pathPrefix)<sizeof(TIS.programBinaryCachePath)) strcpy(TIS.programBinaryCachePath,pathPrefix);
+        else fprintf(stderr,"Error in teapot.h: Teapot_Set_ProgramBinaryCache_Path(...): path too long (the default one is used).\n");
     }
+}
+void Teapot_Enable_ProgramBinaryCache(void) {TIS.programBinaryCacheDisabled = 0;}
+void Teapot_Disable_ProgramBinaryCache(void) {TIS.programBinaryCacheDisabled = 1;}
+int Teapot_Get_ProgramBinaryCache_Enabled(void) {return !TIS.programBinaryCacheDisabled;}
+void Teapot_Get_ProgramLoad_Counters(int* numLoadedFromCacheOut,int* numCompiledOut,float* loadMillisecondsOut) {
+    if (numLoadedFromCacheOut) *numLoadedFromCacheOut = TIS.programLoadCounters[0];
+    if (numCompiledOut) *numCompiledOut = TIS.programLoadCounters[1];
+    if (loadMillisecondsOut) *loadMillisecondsOut = (float)(1000.0*(double)TIS.programLoadTicks/(double)CLOCKS_PER_SEC);
+}
+#endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
 
-    TIS.programId =  Teapot_LoadShaderProgramFromSource(*TeapotVS,*TeapotFS);
-    if (!TIS.programId) return;
-
+// Teapot_SetShaderFeatures(...) helpers
+static void Teapot_Private_GetProgramLocations(void) {
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
     TIS.aLoc_vertex = glGetAttribLocation(TIS.programId, "a_vertex");
     TIS.aLoc_normal = glGetAttribLocation(TIS.programId, "a_normal");
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    TIS.aLoc_vertex = glGetAttribLocation(TIS.programId, "a_qvertex");
+    TIS.aLoc_normal = glGetAttribLocation(TIS.programId, "a_qnormal");
+    TIS.uLoc_dequantization = glGetUniformLocation(TIS.programId,"u_dequantization");
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    TIS.aLoc_material = glGetAttribLocation(TIS.programId, "a_material");
     TIS.uLoc_mvMatrix = glGetUniformLocation(TIS.programId,"u_mvMatrix");
     TIS.uLoc_pMatrix = glGetUniformLocation(TIS.programId,"u_pMatrix");
     TIS.uLoc_nCoefficients = glGetUniformLocation(TIS.programId,"u_nCoefficients");
     TIS.uLoc_scaling = glGetUniformLocation(TIS.programId,"u_scaling");
     TIS.uLoc_lightVector = glGetUniformLocation(TIS.programId,"u_lightVector");
+    TIS.uLoc_palette = glGetUniformLocation(TIS.programId,"u_palette");
+    TIS.uLoc_materialParams = glGetUniformLocation(TIS.programId,"u_materialParams");
     TIS.uLoc_color = glGetUniformLocation(TIS.programId,"u_colorData[0]");
     TIS.uLoc_colorAmbient = glGetUniformLocation(TIS.programId,"u_colorData[1]");
     TIS.uLoc_colorSpecular = glGetUniformLocation(TIS.programId,"u_colorData[2]");
@@ -3154,6 +7018,229 @@ void Teapot_Init(void) {
     TIS.uLoc_shadowDarkening = glGetUniformLocation(TIS.programId,"u_shadowDarkening");
     TIS.uLoc_shadowMapFactor = glGetUniformLocation(TIS.programId,"u_shadowMapFactor");
     TIS.uLoc_shadowMapTexelIncrement = glGetUniformLocation(TIS.programId,"u_shadowMapTexelIncrement");
+}
+#ifdef TEAPOT_ENABLE_INSTANCING
+// It also sets u_palette (that never changes)
+static void Teapot_Private_GetInstancedProgramLocations(void) {
+    static const char* instDataNames[8] = {"a_mvMatrix0","a_mvMatrix1","a_mvMatrix2","a_mvMatrix3","a_scaling","a_colorData0","a_colorData1","a_colorData2"};
+    int i;
+#   ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    TIS.aLoc_instVertex = glGetAttribLocation(TIS.instancedProgramId, "a_vertex");
+    TIS.aLoc_instNormal = glGetAttribLocation(TIS.instancedProgramId, "a_normal");
+#   else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    TIS.aLoc_instVertex = glGetAttribLocation(TIS.instancedProgramId, "a_qvertex");
+    TIS.aLoc_instNormal = glGetAttribLocation(TIS.instancedProgramId, "a_qnormal");
+    TIS.instLoc_dequantization = glGetUniformLocation(TIS.instancedProgramId,"u_dequantization");
+#   endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+    TIS.aLoc_instMaterial = glGetAttribLocation(TIS.instancedProgramId, "a_material");
+    for (i=0;i<TEAPOT_INSTANCE_NUM_VEC4;i++) TIS.aLoc_instData[i] = glGetAttribLocation(TIS.instancedProgramId, instDataNames[i]);
+    TIS.instLoc_pMatrix = glGetUniformLocation(TIS.instancedProgramId,"u_pMatrix");
+    TIS.instLoc_lightVector = glGetUniformLocation(TIS.instancedProgramId,"u_lightVector");
+    TIS.instLoc_materialParams = glGetUniformLocation(TIS.instancedProgramId,"u_materialParams");
+    glUseProgram(TIS.instancedProgramId);
+    glUniform4fv(glGetUniformLocation(TIS.instancedProgramId,"u_palette"),TEAPOT_MATERIAL_PALETTE_SIZE,&TeapotMaterialPalette[0][0]);
+    glUseProgram(0);
+    TIS.instLoc_fogColor = glGetUniformLocation(TIS.instancedProgramId,"u_fogColor");
+    TIS.instLoc_fogDistances = glGetUniformLocation(TIS.instancedProgramId,"u_fogDistances");
+    TIS.instLoc_biasedShadowVpMatrix = glGetUniformLocation(TIS.instancedProgramId,"u_biasedShadowMvpMatrix");
+    TIS.instLoc_shadowMap = glGetUniformLocation(TIS.instancedProgramId,"u_shadowMap");
+    TIS.instLoc_shadowDarkening = glGetUniformLocation(TIS.instancedProgramId,"u_shadowDarkening");
+    TIS.instLoc_shadowMapFactor = glGetUniformLocation(TIS.instancedProgramId,"u_shadowMapFactor");
+    TIS.instLoc_shadowMapTexelIncrement = glGetUniformLocation(TIS.instancedProgramId,"u_shadowMapTexelIncrement");
+}
+#endif //TEAPOT_ENABLE_INSTANCING
+// The disabled features become TEAPOT_NO_XXX definitions of the shader source
+static void Teapot_Private_GetShaderVariantDefines(char* defines,int features,int instanced) {
+    defines[0]='\0';
+    if (instanced) strcat(defines,"#define TEAPOT_INSTANCING\n");
+    if (!(features&TEAPOT_SHADER_FEATURE_SPECULAR)) strcat(defines,"#define TEAPOT_NO_SPECULAR\n");
+    if (!(features&TEAPOT_SHADER_FEATURE_FOG)) strcat(defines,"#define TEAPOT_NO_FOG\n");
+    if (!(features&TEAPOT_SHADER_FEATURE_ACCURATE_NORMALS)) strcat(defines,"#define TEAPOT_NO_ACCURATE_NORMALS\n");
+    if (!(features&TEAPOT_SHADER_FEATURE_SHADOW_MAP)) strcat(defines,"#define TEAPOT_NO_SHADOW_MAP\n");
+    if (!(features&TEAPOT_SHADER_FEATURE_SHADOW_MAP_PCF)) strcat(defines,"#define TEAPOT_NO_SHADOW_MAP_PCF\n");
+}
+// Uploads the current global and per-object uniforms to TIS.programId (that has just changed)
+static void Teapot_Private_UploadProgramUniforms(void) {
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Private_InvalidateBindings(TIS.stateCache.bindingsValid);
+    Teapot_Private_InvalidateUniforms();
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Private_UseProgram(TIS.programId);
+    Teapot_Helper_GlUniformMatrix4v(TIS.uLoc_pMatrix,1,GL_FALSE,TIS.pMatrix);
+    Teapot_Helper_GlUniform3v(TIS.uLoc_lightVector,1,TIS.lightDirectionViewSpace);
+    glUniform4fv(TIS.uLoc_palette,TEAPOT_MATERIAL_PALETTE_SIZE,&TeapotMaterialPalette[0][0]);
+#   ifdef TEAPOT_SHADER_FOG
+    glUniform3fv(TIS.uLoc_fogColor,1,TIS.fogColor);
+    glUniform4fv(TIS.uLoc_fogDistances,1,TIS.fogDistances);
+#   endif //TEAPOT_SHADER_FOG
+#   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    glUniform1i(TIS.uLoc_shadowMap,0);
+    glUniform2f(TIS.uLoc_shadowDarkening,TIS.shadowDarkening,TIS.shadowClamp);
+    glUniform1f(TIS.uLoc_shadowMapFactor,TIS.shadowMapFactor);
+    glUniform2fv(TIS.uLoc_shadowMapTexelIncrement,1,TIS.shadowMapTexelIncrement);
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+    Teapot_Private_SetDefaultMaterialParams();
+    Teapot_Private_Uniform4f(TEAPOT_UNIFORM_SLOT_SCALING,0,TIS.uLoc_scaling,TIS.scaling[0],TIS.scaling[1],TIS.scaling[2],1.f);
+#   ifdef TEAPOT_SHADER_SPECULAR
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,3,TIS.color);
+#   else //TEAPOT_SHADER_SPECULAR
+    Teapot_Private_Uniform4fv(TEAPOT_UNIFORM_SLOT_COLOR_DATA,0,TIS.uLoc_color,2,TIS.color);
+#   endif //TEAPOT_SHADER_SPECULAR
+    Teapot_Private_UseProgram(0);
+    Teapot_Private_SetGlobalUniformsDirty();
+}
+int Teapot_GetAvailableShaderFeatures(void) {
+    int features = 0;
+#   ifdef TEAPOT_SHADER_SPECULAR
+    features|=TEAPOT_SHADER_FEATURE_SPECULAR;
+#   endif //TEAPOT_SHADER_SPECULAR
+#   ifdef TEAPOT_SHADER_FOG
+    features|=TEAPOT_SHADER_FEATURE_FOG;
+#   endif //TEAPOT_SHADER_FOG
+#   ifdef TEAPOT_SHADER_USE_ACCURATE_NORMALS
+    features|=TEAPOT_SHADER_FEATURE_ACCURATE_NORMALS;
+#   endif //TEAPOT_SHADER_USE_ACCURATE_NORMALS
+#   ifdef TEAPOT_SHADER_USE_SHADOW_MAP
+    features|=TEAPOT_SHADER_FEATURE_SHADOW_MAP;
+#   if (TEAPOT_SHADER_SHADOW_MAP_PCF>1)
+    features|=TEAPOT_SHADER_FEATURE_SHADOW_MAP_PCF;
+#   endif //TEAPOT_SHADER_SHADOW_MAP_PCF
+#   endif //TEAPOT_SHADER_USE_SHADOW_MAP
+    return features;
+}
+int Teapot_GetShaderFeatures(void) {return TIS.shaderFeatures;}
+int Teapot_SetShaderFeatures(int features) {
+    char defines[256];
+    features&=Teapot_GetAvailableShaderFeatures();
+    if (!TIS.programId) return 0;
+    if (features==TIS.shaderFeatures) return 1;
+    if (!TIS.shaderVariants[features]) {
+        Teapot_Private_GetShaderVariantDefines(defines,features,0);
+        TIS.shaderVariants[features] = Teapot_LoadShaderProgramFromSourceWithDefines(defines,*TeapotVS,*TeapotFS);
+        if (!TIS.shaderVariants[features]) {fprintf(stderr,"Error in teapot.h: Teapot_SetShaderFeatures(%d) can't compile its shader program (the current one is kept).\n",features);return 0;}
+    }
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    if (TIS.instancedProgramId && !TIS.instancedShaderVariants[features]) {
+        Teapot_Private_GetShaderVariantDefines(defines,features,1);
+        TIS.instancedShaderVariants[features] = Teapot_LoadShaderProgramFromSourceWithDefines(defines,*TeapotVS,*TeapotFS);
+        if (!TIS.instancedShaderVariants[features]) {fprintf(stderr,"Error in teapot.h: Teapot_SetShaderFeatures(%d) can't compile its instanced shader program (the current one is kept).\n",features);return 0;}
+    }
+#   endif //TEAPOT_ENABLE_INSTANCING
+    TIS.shaderFeatures = features;
+    TIS.programId = TIS.shaderVariants[features];
+    Teapot_Private_GetProgramLocations();
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    if (TIS.instancedProgramId) {
+        TIS.instancedProgramId = TIS.instancedShaderVariants[features];
+        Teapot_Private_GetInstancedProgramLocations();
+    }
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    TIS.vertexArraysValidMask = 0;  // the attribute locations may have changed
+#   endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    Teapot_Private_UploadProgramUniforms();
+    return 1;
+}
+
+void Teapot_Init(void) {
+    int i,j;
+#   ifdef TEAPOT_ENABLE_STATE_CACHE
+    Teapot_Private_InvalidateBindings(0);
+    Teapot_Private_InvalidateUniforms();
+    Teapot_Reset_StateCache_Counters();
+#   endif //TEAPOT_ENABLE_STATE_CACHE
+    TIS.colorMaterialEnabled = 0;
+    TIS.frontToBackSortingEnabled = 0;
+#   ifdef TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+    TIS.vertexArraysValidMask = 0;TIS.vertexArrayBound = 0;
+#   endif //TEAPOT_ENABLE_VERTEX_ARRAY_OBJECT
+#   ifdef TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+    TIS.programLoadCounters[0] = TIS.programLoadCounters[1] = 0;TIS.programLoadTicks = 0;
+    {GLint numFormats = 0;glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS,&numFormats);TIS.programBinaryFormatsAvailable = numFormats>0 ? 1 : 0;}
+#   endif //TEAPOT_ENABLE_PROGRAM_BINARY_CACHE
+#   ifdef TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    Teapot_Private_IncrementViewVersion();
+    Teapot_Reset_MvMatrixUpdate_Counters();
+#   endif //TEAPOT_ENABLE_INCREMENTAL_MVMATRIX_UPDATE
+    TIS.meshOutlineEnabled = 0;
+    TIS.meshOutlinePassEnabled = 1;
+    Teapot_Set_MeshOutline_Color(0,0,0,1);
+    //Teapot_Set_MeshOutline_Scaling(1.0f);Teapot_Set_MeshOutline_Params(-2.0f,-250.f);
+    Teapot_Set_MeshOutline_Scaling(1.015f);Teapot_Set_MeshOutline_Params(-1.0f,-250.f);
+    TIS.vertexBuffer = TIS.elementBuffer = 0;
+    for (i=0;i<TEAPOT_MESH_COUNT;i++) {
+        TIS.startInds[i] = TIS.numInds[i] = 0;
+        TIS.halfExtents[i][0]=TIS.halfExtents[i][1]=TIS.halfExtents[i][2]=0;
+        TIS.centerPoint[i][0]=TIS.centerPoint[i][1]=TIS.centerPoint[i][2]=0;
+#       ifdef TEAPOT_ENABLE_MESH_LODS
+        for (j=0;j<TEAPOT_NUM_MESH_LODS;j++) {TIS.lodNumInds[i][j] = 0;TIS.lodIndsOffset[i][j] = 0;}
+#       endif //TEAPOT_ENABLE_MESH_LODS
+    }
+#   ifdef TEAPOT_ENABLE_MESH_LODS
+    for (i=0;i<TEAPOT_NUM_MESH_LODS-1;i++) TIS.lodThresholds[i] = i==0 ? 0.2f : TIS.lodThresholds[i-1]*0.4f;    // 0.2f,0.08f,0.032f,...
+#   endif //TEAPOT_ENABLE_MESH_LODS
+#   ifdef TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+    memset(&TIS.staticShadowCache,0,sizeof(Teapot_Private_StaticShadowCache));
+    TIS.staticShadowCache.enabled = 1;
+    TIS.staticShadowCache.depthThreshold = 0.0005f;
+#   endif //TEAPOT_ENABLE_STATIC_SHADOW_CACHE
+
+    TIS.programId =  Teapot_LoadShaderProgramFromSource(*TeapotVS,*TeapotFS);
+    if (!TIS.programId) return;
+    memset(TIS.shaderVariants,0,sizeof(TIS.shaderVariants));
+    TIS.shaderFeatures = Teapot_GetAvailableShaderFeatures();
+    TIS.shaderVariants[TIS.shaderFeatures] = TIS.programId;
+    Teapot_Private_GetProgramLocations();
+
+#   ifdef TEAPOT_ENABLE_INSTANCING
+    TIS.instancingEnabled = 1;
+    TIS.instanceBufferCapacity = 0;
+#   ifdef TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    TIS.ringBufferMapped = NULL;memset(TIS.ringBufferFences,0,sizeof(TIS.ringBufferFences));
+    TIS.ringBufferSectionSize = TIS.ringBufferOffset = 0;TIS.ringBufferSection = 0;
+    TIS.ringBufferCounters[0] = TIS.ringBufferCounters[1] = 0;
+    TIS.ringBufferAvailable = Teapot_Private_IsBufferStorageAvailable();   // (the ring buffer is created by the first instanced pass)
+#   endif //TEAPOT_ENABLE_PERSISTENT_RING_BUFFER
+    TIS.instancedProgramId = Teapot_LoadShaderProgramFromSourceWithDefines("#define TEAPOT_INSTANCING\n",*TeapotVS,*TeapotFS);
+    memset(TIS.instancedShaderVariants,0,sizeof(TIS.instancedShaderVariants));
+    TIS.instancedShaderVariants[TIS.shaderFeatures] = TIS.instancedProgramId;
+    if (TIS.instancedProgramId) {
+        Teapot_Private_GetInstancedProgramLocations();
+        glGenBuffers(1, &TIS.instanceBuffer);
+    }
+    else fprintf(stderr,"Error in teapot.h: the instanced shader program could not be created (TEAPOT_ENABLE_INSTANCING is ignored).\n");
+#   ifdef TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+    TIS.shadowInstancedProgramId = TIS.instancedProgramId ? Teapot_LoadShaderProgramFromSource(*TeapotShadowInstancedVS,*TeapotShadowInstancedFS) : 0;
+    if (TIS.shadowInstancedProgramId) {
+        static const char* mMatrixNames[4] = {"a_mMatrix0","a_mMatrix1","a_mMatrix2","a_mMatrix3"};
+#       ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        TIS.aLoc_shadowInstVertex = glGetAttribLocation(TIS.shadowInstancedProgramId, "a_vertex");
+#       else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        TIS.aLoc_shadowInstVertex = glGetAttribLocation(TIS.shadowInstancedProgramId, "a_qvertex");
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        for (i=0;i<4;i++) TIS.aLoc_shadowInstMMatrix[i] = glGetAttribLocation(TIS.shadowInstancedProgramId, mMatrixNames[i]);
+        TIS.shadowInstLoc_lvpMatrix = glGetUniformLocation(TIS.shadowInstancedProgramId,"u_lvpMatrix");
+        TIS.shadowInstLoc_dequantization = glGetUniformLocation(TIS.shadowInstancedProgramId,"u_dequantization");
+    }
+    else if (TIS.instancedProgramId) fprintf(stderr,"Error in teapot.h: the instanced shadow program could not be created (the shadow pass is not instanced).\n");
+#   endif //TEAPOT_PRIVATE_INSTANCED_SHADOW_PASS
+#   endif //TEAPOT_ENABLE_INSTANCING
+#   ifdef TEAPOT_ENABLE_DEPTH_PREPASS
+    TIS.depthPrepassEnabled = 1;
+    TIS.depthProgramId = Teapot_LoadShaderProgramFromSource(*TeapotDepthVS,*TeapotDepthFS);
+    if (TIS.depthProgramId) {
+#       ifndef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        TIS.aLoc_depthVertex = glGetAttribLocation(TIS.depthProgramId, "a_vertex");
+#       else //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        TIS.aLoc_depthVertex = glGetAttribLocation(TIS.depthProgramId, "a_qvertex");
+#       endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+        TIS.depthLoc_mvMatrix = glGetUniformLocation(TIS.depthProgramId,"u_mvMatrix");
+        TIS.depthLoc_scaling = glGetUniformLocation(TIS.depthProgramId,"u_scaling");
+        TIS.depthLoc_pMatrix = glGetUniformLocation(TIS.depthProgramId,"u_pMatrix");
+        TIS.depthLoc_dequantization = glGetUniformLocation(TIS.depthProgramId,"u_dequantization");
+    }
+    else fprintf(stderr,"Error in teapot.h: the depth prepass shader program could not be created (TEAPOT_ENABLE_DEPTH_PREPASS is ignored).\n");
+#   endif //TEAPOT_ENABLE_DEPTH_PREPASS
 
 
     /*
@@ -3197,6 +7284,8 @@ void Teapot_Init(void) {
 #       ifdef TEAPOT_SHADER_USE_SHADOW_MAP
         glUniform1i(TIS.uLoc_shadowMap,0);
 #       endif // TEAPOT_SHADER_USE_SHADOW_MAP
+        glUniform4fv(TIS.uLoc_palette,TEAPOT_MATERIAL_PALETTE_SIZE,&TeapotMaterialPalette[0][0]);
+        Teapot_Private_SetDefaultMaterialParams();
         Teapot_SetScaling(1,1,1);
         Teapot_SetColor(0.75,0.75,0.75,1);
         TIS.colorAmbient[3]=1;Teapot_SetColorAmbient(0.25,0.25,0.25);
@@ -3207,25 +7296,8 @@ void Teapot_Init(void) {
     }
 
     {        
-#       ifndef TEAPOT_MAX_NUM_MESH_VERTS
-#           define TEAPOT_MAX_NUM_MESH_VERTS  (3268)
-#       endif //TEAPOT_MAX_NUM_MESH_VERTS
-#       ifndef TEAPOT_MAX_NUM_MESH_INDS
-#           define TEAPOT_MAX_NUM_MESH_INDS   (16176)
-#       endif //TEAPOT_MAX_NUM_MESH_INDS
-
-#       ifndef TEAPOT_MAX_NUM_USER_MESH_VERTICES
-#           define TEAPOT_MAX_NUM_USER_MESH_VERTICES (1000)
-#       endif //TEAPOT_MAX_NUM_USER_MESH_VERTICES
-
-#       ifndef TEAPOT_MAX_NUM_USER_MESH_INDICES
-#           define TEAPOT_MAX_NUM_USER_MESH_INDICES (5000)
-#       endif //TEAPOT_MAX_NUM_USER_MESH_INDICES
-
-        float totVerts[(TEAPOT_MAX_NUM_MESH_VERTS+TEAPOT_MAX_NUM_USER_MESH_VERTICES)*3*2];    // last x2 is because we use a single VBO with interleaved vertices and normals
-        float* norms=&totVerts[0]+3;		    // pointer to the 1st normal
-        unsigned short totInds[TEAPOT_MAX_NUM_MESH_INDS+TEAPOT_MAX_NUM_USER_MESH_INDICES];
-
+        Teapot_MeshBuilder mb;
+        Teapot_MeshBuffer* mbuf = &TIS.meshBuffer;
 
 #       ifdef TEAPOT_NO_MESH_PLANE_BACK_FACES
 #           define TEAPOT_NO_MESH_PLANE_X_BACK_FACE
@@ -3233,8 +7305,7 @@ void Teapot_Init(void) {
 #           define TEAPOT_NO_MESH_PLANE_Z_BACK_FACE
 #       endif //TEAPOT_NO_MESH_PLANE_BACK_FACES
 
-        int numTotVerts = 0;
-        int numTotInds = 0;
+        memset(&mb,0,sizeof(mb));
 
         for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++)    {
             switch (i)  {
@@ -3321,7 +7392,7 @@ void Teapot_Init(void) {
                         5,361,371,2,339,341,461,356,358,6,371,373,4,386,388,271,255,251,38,52,446,52,54,462,462,54,55,448,55,57,57,71,458,71,73,463,463,73,74,460,74,8,8,10,414,10,12,464,464,12,13,416,13,15,15,33,430,33,35,465,465,35,36,
                         432,36,38};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3421,7 +7492,7 @@ void Teapot_Init(void) {
                         387,389,160,223,169,426,166,165,162,166,162,341,35,167,445,35,445,36,153,152,158,153,158,157,7,6,342,157,425,240,352,386,385,342,430,344,342,344,343,145,345,239,145,239,431,141,142,0,350,433,349,302,140,139,351,352,348,351,348,347,353,351,354,
                         357,114,380,357,380,358,295,357,382,295,382,360,122,434,123,446,393,121,446,121,363,436,364,435,436,435,440,367,381,441,379,127,359,379,359,369,439,374,373,100,368,367,100,367,101,105,373,94,105,94,93,375,97,99,378,93,96,378,96,377};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3460,7 +7531,7 @@ void Teapot_Init(void) {
                     // Black:	204 inds
                     // Wheels:	360 inds
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3484,7 +7555,7 @@ void Teapot_Init(void) {
                         73,76,77,7,2,9,7,61,4,7,74,77,9,74,7,9,71,74,61,7,76,61,13,8,61,75,59,8,72,71,13,58,67,13,61,59,13,66,8,59,63,69,65,69,62,69,60,59,69,63,62,63,59,75,68,65,64,68,67,58,67,66,13,
                         66,63,72,74,71,70,71,9,8,72,8,66,77,74,73,77,76,7,76,75,61,75,72,63,75,76,73};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3524,7 +7595,7 @@ void Teapot_Init(void) {
 
                     // numVerts = 191; numInds =  726
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3559,7 +7630,7 @@ void Teapot_Init(void) {
 
                     // numVerts = 107; numInds =  630
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3580,7 +7651,7 @@ void Teapot_Init(void) {
 
                     // numVerts = 52; numInds =  240
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3619,14 +7690,14 @@ void Teapot_Init(void) {
                     // 0) Rubber {0.64f,0.05f,0.05f}: first 128 triangles == 384 inds [0,384);
                     // 1) White: {0.65f,0.65f,0.65f}: last 60 triangles == 180 inds [384,564);
 #                   ifndef TEAPOT_MESH_FLIPPER_RIGHT
-                    if (i==TEAPOT_MESH_FLIPPER_RIGHT) AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,numVerts,inds,numInds,(TeapotMeshEnum)i);
+                    if (i==TEAPOT_MESH_FLIPPER_RIGHT) AddMeshVertsAndInds(&mb,verts,numVerts,inds,numInds,(TeapotMeshEnum)i);
 #                   endif
 #                   ifndef TEAPOT_MESH_FLIPPER_LEFT
                     if (i==TEAPOT_MESH_FLIPPER_LEFT) {
                         float vertsMirror[160*3];unsigned short indsMirror[564];size_t idx,idx3;
                         for (idx=0;idx<numVerts;idx++) {idx3=3*idx;vertsMirror[idx3]=-verts[idx3];vertsMirror[idx3+1]=verts[idx3+1];vertsMirror[idx3+2]=verts[idx3+2];}
                         for (idx=0;idx<numInds;idx+=3) {indsMirror[idx]=inds[idx];indsMirror[idx+1]=inds[idx+2];indsMirror[idx+2]=inds[idx+1];}
-                        AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,vertsMirror,numVerts,indsMirror,numInds,(TeapotMeshEnum)i);
+                        AddMeshVertsAndInds(&mb,vertsMirror,numVerts,indsMirror,numInds,(TeapotMeshEnum)i);
                     }
 #                   endif
                 }
@@ -3659,7 +7730,7 @@ void Teapot_Init(void) {
                     // Upperpart: 68*3 inds
                     // Lowerpart: 144*3 inds
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3679,7 +7750,7 @@ void Teapot_Init(void) {
                         37,36,33,12,11,37,12,38,17,17,8,12,17,39,25,39,17,40,40,17,38,40,38,39,38,34,41,41,34,39,41,39,38,36,37,42,42,37,35,42,35,36,35,20,43,43,20,36,43,36,35,32,24,44,44,24,30,44,30,32,30,13,45,
                         45,13,32,45,32,30,28,29,46,46,29,27,46,27,28,27,5,47,47,5,28,47,28,27};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3733,7 +7804,7 @@ void Teapot_Init(void) {
                         267,278,277,268,279,278,269,270,279,270,281,280,271,282,281,272,283,282,273,284,283,274,285,284,275,286,285,276,287,286,277,288,287,278,289,288,279,280,289,280,291,290,281,292,291,282,293,292,283,294,293,284,295,294,285,296,295,286,297,296,287,298,297,
                         288,299,298,289,290,299,290,1,0,291,2,1,292,3,2,293,4,3,294,5,4,295,6,5,296,7,6,297,8,7,298,9,8,299,0,9};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3747,7 +7818,7 @@ void Teapot_Init(void) {
                     const unsigned short inds[] = {
                         3,0,2,5,6,4,9,10,11,13,14,12,19,16,17,23,20,22,3,1,0,5,7,6,9,8,10,13,15,14,19,18,16,23,21,20};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3765,7 +7836,7 @@ void Teapot_Init(void) {
                         45,42,41,46,43,42,34,44,33,48,45,44,49,46,45,50,47,46,35,48,34,52,49,48,53,50,49,54,51,50,19,52,35,31,53,52,30,54,53,29,55,54,28,4,36,43,39,5,47,38,39,51,37,38,55,36,37,32,40,24,40,41,25,
                         41,42,26,42,43,27,33,44,40,44,45,41,45,46,42,46,47,43,34,48,44,48,49,45,49,50,46,50,51,47,35,52,48,52,53,49,53,54,50,54,55,51,19,31,52,31,30,53,30,29,54,29,28,55};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3800,7 +7871,7 @@ void Teapot_Init(void) {
                         125,124,120,126,125,121,127,126,122,123,130,123,124,133,125,134,133,126,136,134,127,138,136,130,131,129,133,132,131,134,135,132,136,137,135,138,139,137,131,141,140,132,142,141,135,143,142,135,137,144,137,139,145,141,147,146,142,148,147,143,149,148,143,144,
                         150,144,145,151};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3815,7 +7886,7 @@ void Teapot_Init(void) {
                         ,0,1,2,2,3,0   // Back
 #                       endif //TEAPOT_NO_MESH_PLANE_X_BACK_FACE
                     };
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3830,7 +7901,7 @@ void Teapot_Init(void) {
                         ,0,1,2,2,3,0    // Back
 #                       endif //TEAPOT_NO_MESH_PLANE_Y_BACK_FACE
                     };
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3845,7 +7916,7 @@ void Teapot_Init(void) {
                         ,3,2,0,2,1,0    // Back
 #                       endif //TEAPOT_NO_MESH_PLANE_Z_BACK_FACE
                     };
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3863,7 +7934,7 @@ void Teapot_Init(void) {
                         13,24,23,13,25,24,13,14,25,27,28,26,29,30,28,31,32,30,33,34,32,35,36,34,37,38,36,39,40,38,41,42,40,43,44,42,45,46,44,47,48,46,49,26,48,27,29,28,29,31,30,31,33,32,33,35,34,35,37,36,37,39,38,
                         39,41,40,41,43,42,43,45,44,45,47,46,47,49,48,49,27,26};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3878,7 +7949,7 @@ void Teapot_Init(void) {
                         1,0,2,3,0,1,4,0,3,5,0,4,6,0,5,7,0,6,8,0,7,9,0,8,10,0,9,11,0,10,12,0,11,2,0,12,13,14,15,13,15,16,13,16,17,13,17,18,13,18,19,13,19,20,13,20,21,13,21,22,13,22,23,
                         13,23,24,13,24,25,13,25,14};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3896,7 +7967,7 @@ void Teapot_Init(void) {
                         13,23,24,13,24,25,13,25,14,26,12,27,12,28,27,28,10,29,10,30,29,9,31,30,31,7,32,7,33,32,33,5,34,5,35,34,4,36,35,3,37,36,37,2,26,26,2,12,12,11,28,28,11,10,10,9,30,9,8,31,31,8,7,
                         7,6,33,33,6,5,5,4,35,4,3,36,3,0,37,37,0,2};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3910,7 +7981,7 @@ void Teapot_Init(void) {
                     const unsigned short inds[] = {
                         0,1,2,3,4,5,0,6,1,7,8,9,10,11,12,13,14,15};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3924,7 +7995,7 @@ void Teapot_Init(void) {
                     const unsigned short inds[] = {
                         0,1,2,5,6,7,10,11,12,0,13,1,3,14,4,5,15,6,8,16,9,10,17,11};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3943,7 +8014,7 @@ void Teapot_Init(void) {
                         29,26,34,26,7,34,27,33,7,27,24,33,24,6,33,25,32,6,25,22,32,22,10,32,30,31,9,30,21,31,21,4,31,28,29,8,28,20,29,20,3,29,26,27,7,26,18,27,18,2,27,24,25,6,24,14,25,14,1,25,22,23,10,
                         22,15,23,15,5,23,16,21,5,16,19,21,19,4,21,19,20,4,19,17,20,17,3,20,17,18,3,17,12,18,12,2,18,15,16,5,15,13,16,13,0,16,12,14,2,12,13,14,13,1,14};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3980,7 +8051,7 @@ void Teapot_Init(void) {
                         156,25,26,22,157,156,157,158,156,156,158,25,158,24,25,23,17,157,17,16,157,157,16,158,16,15,158,158,15,24,15,0,24,12,20,2,13,159,12,14,160,13,12,159,20,159,19,20,13,160,159,160,161,159,159,161,19,161,18,19,14,15,160,
                         15,16,160,160,16,161,16,17,161,161,17,18,17,1,18};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -3999,7 +8070,7 @@ void Teapot_Init(void) {
                         52,53,51,54,55,53,56,57,55,58,59,57,60,61,59,62,41,61,39,42,40,42,44,43,44,46,45,46,48,47,48,50,49,50,52,51,52,54,53,54,56,55,56,58,57,58,60,59,60,62,61,62,39,41};
 
                     // Probably wrong. We Must do a AddMeshVertsAndIndsLines()
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4036,7 +8107,7 @@ void Teapot_Init(void) {
                         10,9,13,10,14,15,14,18,19,15,19,20,13,17,18,18,22,23,19,23,24,17,21,22,24,23,27,22,21,25,22,26,27,28,27,31,25,29,30,26,30,31,31,30,34,32,31,35,30,29,33,34,38,39,36,35,39,33,37,38,39,43,44,
                         38,37,41,38,42,43,42,41,45,42,46,47,43,47,48,46,50,51,47,51,52,45,49,50,51,55,56,50,49,53,50,54,55,56,55,2,53,0,1,54,1,2};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4058,7 +8129,7 @@ void Teapot_Init(void) {
                         10,9,13,10,14,15,14,18,19,15,19,20,13,17,18,18,22,23,19,23,24,17,21,22,24,23,27,22,21,25,22,26,27,28,27,31,25,29,30,26,30,31,31,30,34,32,31,35,30,29,33,34,38,39,36,35,39,33,37,38,39,43,44,
                         38,37,41,38,42,43,42,41,45,42,46,47,43,47,48,46,50,51,47,51,52,45,49,50,51,55,56,50,49,53,50,54,55,56,55,2,53,0,1,54,1,2};
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4110,7 +8181,7 @@ void Teapot_Init(void) {
                     // [54-78] 24 tri-faces: ArrowY   (0.000,0.875,0.000)
                     // [78-102]24 tri-faces: Arrow>   (0.000,0.000,0.875)
 
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4126,7 +8197,7 @@ void Teapot_Init(void) {
                         0,1,2,0,3,1,3,4,5,3,6,4,0,6,3,7,6,0,7,8,6,8,9,6,7,10,8,11,9,8};
 
                     // Probably wrong. We Must do a AddMeshVertsAndIndsLines()
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4141,7 +8212,7 @@ void Teapot_Init(void) {
                         0,1,2,0,3,1,3,4,5,3,6,4,0,6,3,7,6,0};
 
                     // Probably wrong. We Must do a AddMeshVertsAndIndsLines()
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4156,7 +8227,7 @@ void Teapot_Init(void) {
                         0,1,2,0,3,1,3,4,1,5,4,3,5,6,4,5,7,6};
 
                     // Probably wrong. We Must do a AddMeshVertsAndIndsLines()
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4164,22 +8235,6 @@ void Teapot_Init(void) {
             }
         }
 
-        if (gTeapotInitUserMeshCallback)    {
-            const int lastUserMeshIndex = TEAPOT_MESH_USER_00+(TEAPOT_MESH_CUBE-TEAPOT_MESH_USER_00);
-            for (i=TEAPOT_MESH_USER_00;i<lastUserMeshIndex;i++) {
-                const float* pVerts=NULL;const unsigned short* pInds=NULL;
-                int numVerts=0,numInds=0;
-                gTeapotInitUserMeshCallback((TeapotMeshEnum) i,&pVerts,&numVerts,&pInds,&numInds);
-                if (pVerts && pInds && numVerts>3 && numInds>3) {
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS+TEAPOT_MAX_NUM_USER_MESH_VERTICES,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS+TEAPOT_MAX_NUM_USER_MESH_INDICES,&numTotInds,pVerts,numVerts,pInds,numInds,(TeapotMeshEnum)i);
-                }
-            }
-        }
-
-        //printf("Teapot_init(): numTotVerts = %d numTotInds = %d",numTotVerts,numTotInds);
-
-        CalculateVertexNormals(totVerts,numTotVerts,6,totInds,numTotInds,norms,6);
-
         for (i=TEAPOT_FIRST_MESHLINES_INDEX;i<TEAPOT_MESH_COUNT;i++)    {
             switch (i)  {
             case TEAPOT_MESHLINES_CUBE_EDGES: {
@@ -4203,7 +8258,7 @@ void Teapot_Init(void) {
                         0,4, 1,5, 2,6, 3,7};
 
                     // Probably wrong. We Must do a AddMeshVertsAndIndsLines()
-                    AddMeshVertsAndInds(totVerts,TEAPOT_MAX_NUM_MESH_VERTS+TEAPOT_MAX_NUM_USER_MESH_VERTICES,&numTotVerts,6,totInds,TEAPOT_MAX_NUM_MESH_INDS+TEAPOT_MAX_NUM_USER_MESH_INDICES,&numTotInds,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
+                    AddMeshVertsAndInds(&mb,verts,sizeof(verts)/(sizeof(verts[0])*3),inds,sizeof(inds)/sizeof(inds[0]),(TeapotMeshEnum)i);
                 }
 #               endif
             }
@@ -4211,14 +8266,187 @@ void Teapot_Init(void) {
             }
         }
 
+        // Sets the material of each vertex (see TeapotMultiMaterialMeshes).
+        // Vertices shared by parts with different materials are duplicated (and their indices remapped).
+        {
+            const int numMultiMaterialMeshes = (int)(sizeof(TeapotMultiMaterialMeshes)/sizeof(TeapotMultiMaterialMeshes[0]));
+            int maxNumDuplicates = 0,numDuplicates = 0;
+            int* duplicates = NULL;    // pairs: (original vertex index, duplicated vertex index)
+            for (i=0;i<numMultiMaterialMeshes;i++) {
+                for (j=0;j<TeapotMultiMaterialMeshes[i].numParts;j++) maxNumDuplicates+=TeapotMultiMaterialMeshes[i].numInds[j];
+            }
+            if (!mb.failed && Teapot_Private_Grow((void**)&mb.verts,&mb.maxVerts,mb.numVerts+maxNumDuplicates,sizeof(float)*TEAPOT_VERTEX_NUM_FLOATS))
+                duplicates = (int*) malloc(sizeof(int)*2*maxNumDuplicates);
+            if (!duplicates) {
+                fprintf(stderr,"Error in teapot.h: Teapot_Init() can't allocate the vertex buffer.\n");
+                if (mb.verts) free(mb.verts);
+                if (mb.inds) free(mb.inds);
+                return;
+            }
+            for (i=0;i<(int)mb.numVerts;i++) mb.verts[i*TEAPOT_VERTEX_NUM_FLOATS+6] = -1.f;    // not assigned yet
+            for (i=0;i<numMultiMaterialMeshes;i++) {
+                const Teapot_MultiMaterialMesh* mm = &TeapotMultiMaterialMeshes[i];
+                int k,l,startInds = TIS.startInds[mm->meshId];
+                const int firstDuplicate = numDuplicates;
+                if (TIS.numInds[mm->meshId]==0) continue;
+                for (j=0;j<mm->numParts;j++) {
+                    const float material = (float) mm->materials[j];
+                    const int endInds = startInds+mm->numInds[j];
+                    for (k=startInds;k<endInds;k++) {
+                        int vi = (int) mb.inds[k];
+                        float* v = &mb.verts[vi*TEAPOT_VERTEX_NUM_FLOATS];
+                        if (v[6]<0.f) {v[6] = material;continue;}
+                        if (v[6]==material) continue;
+                        // shared with another part: reuse or make a duplicate
+                        for (l=firstDuplicate;l<numDuplicates;l++) {
+                            if (duplicates[2*l]==vi && mb.verts[duplicates[2*l+1]*TEAPOT_VERTEX_NUM_FLOATS+6]==material) break;
+                        }
+                        if (l==numDuplicates) {
+                            const int di = (int) mb.numVerts++;
+                            float* d = &mb.verts[di*TEAPOT_VERTEX_NUM_FLOATS];
+                            for (l=0;l<6;l++) d[l] = v[l];
+                            d[6] = material;
+                            duplicates[2*numDuplicates] = vi;duplicates[2*numDuplicates+1] = di;
+                            l = numDuplicates++;
+                        }
+                        mb.inds[k] = (unsigned) duplicates[2*l+1];
+                    }
+                    startInds = endInds;
+                }
+            }
+            for (i=0;i<(int)mb.numVerts;i++) {float* v = &mb.verts[i*TEAPOT_VERTEX_NUM_FLOATS+6];if (*v<0.f) *v = 0.f;}
+            free(duplicates);
+#           ifdef TEAPOT_NO_MESH_CAR_WHEELS
+            if (TIS.numInds[TEAPOT_MESH_CAR]>0) TIS.numInds[TEAPOT_MESH_CAR]-=360;    // wheels are the last 360 indices
+#           endif //TEAPOT_NO_MESH_CAR_WHEELS
+        }
+
+#       ifdef TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+        // Reorders the triangles of every triangle mesh for the post-transform vertex cache, and then its vertices for fetch locality
+        for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++) TIS.acmr[i][0] = Teapot_Private_CalculateACMR(&mb.inds[TIS.startInds[i]],TIS.numInds[i]);
+        for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++) {
+            // the index ranges of the meshes that are a part of this one (e.g. TEAPOT_MESH_CYLINDER_LATERAL_SURFACE) are optimized separately
+            int cuts[2*TEAPOT_MESH_COUNT+2],numCuts=0,k,ok=1;
+            const int segStart = mb.segStartInds[i],segEnd = segStart+mb.segNumInds[i];
+            if (mb.segNumInds[i]<3) continue;
+            cuts[numCuts++] = segStart;cuts[numCuts++] = segEnd;
+            for (j=0;j<TEAPOT_MESH_COUNT;j++) {
+                if (TIS.numInds[j]==0) continue;
+                if (TIS.startInds[j]>segStart && TIS.startInds[j]<segEnd) cuts[numCuts++] = TIS.startInds[j];
+                if (TIS.startInds[j]+TIS.numInds[j]>segStart && TIS.startInds[j]+TIS.numInds[j]<segEnd) cuts[numCuts++] = TIS.startInds[j]+TIS.numInds[j];
+            }
+            for (j=1;j<numCuts;j++) {const int c = cuts[j];for (k=j;k>0 && cuts[k-1]>c;k--) cuts[k] = cuts[k-1];cuts[k] = c;}
+            for (j=0;j<numCuts-1 && ok;j++) {
+                if (cuts[j+1]-cuts[j]<3 || (cuts[j]-segStart)%3!=0 || (cuts[j+1]-cuts[j])%3!=0) continue;
+                ok = Teapot_Private_OptimizeTriangleOrder(&mb.inds[cuts[j]],cuts[j+1]-cuts[j],mb.verts);
+            }
+            if (ok) Teapot_Private_OptimizeVertexFetch(mb.verts,&mb.inds[segStart],mb.segNumInds[i]);
+        }
+        for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++) TIS.acmr[i][1] = Teapot_Private_CalculateACMR(&mb.inds[TIS.startInds[i]],TIS.numInds[i]);
+#       endif //TEAPOT_ENABLE_VERTEX_CACHE_OPTIMIZATION
+
+#       ifdef TEAPOT_ENABLE_MESH_LODS
+        // Appends the simplified LODs of every triangle mesh to mb.inds (they use the vertices of their mesh)
+        for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++) {
+            unsigned* lodInds;int numLodInds;
+            if (TIS.numInds[i]<3 || i==TEAPOT_MESH_PIVOT3D || (i>=TEAPOT_MESH_TEXT_X && i<=TEAPOT_MESH_TEXT_Z)) continue;
+            lodInds = (unsigned*) malloc(sizeof(unsigned)*TIS.numInds[i]*(TEAPOT_NUM_MESH_LODS-1));
+            if (!lodInds) continue;
+            numLodInds = Teapot_Private_GenerateLods(&mb.inds[TIS.startInds[i]],TIS.numInds[i],mb.verts,lodInds,TIS.lodNumInds[i]);
+            if (numLodInds>0 && Teapot_Private_Grow((void**)&mb.inds,&mb.maxInds,mb.numInds+numLodInds,sizeof(unsigned))) {
+                memcpy(&mb.inds[mb.numInds],lodInds,sizeof(unsigned)*numLodInds);
+                for (j=1;j<TEAPOT_NUM_MESH_LODS;j++) {mb.lodStartInds[i][j] = (int) mb.numInds;mb.numInds+=TIS.lodNumInds[i][j];}
+            }
+            else for (j=0;j<TEAPOT_NUM_MESH_LODS;j++) TIS.lodNumInds[i][j] = 0;
+            free(lodInds);
+        }
+#       endif //TEAPOT_ENABLE_MESH_LODS
+
+        // Packs the indices: every mesh uses GL_UNSIGNED_SHORT, unless it references a vertex beyond 65535
+        {
+            size_t segOffset[TEAPOT_MESH_COUNT];GLenum segType[TEAPOT_MESH_COUNT];
+            size_t numIndsBytes = 0;
+            memset(mbuf,0,sizeof(Teapot_MeshBuffer));
+            mbuf->verts = mb.verts;mbuf->maxVerts = mb.maxVerts;
+            mbuf->numFixedVerts = mb.numVerts;
+            if (!Teapot_Private_Grow((void**)&mbuf->inds,&mbuf->maxIndsBytes,(mb.numInds+TEAPOT_MESH_COUNT*TEAPOT_NUM_MESH_LODS)*sizeof(unsigned),1)
+#               ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+                || !Teapot_Private_Grow((void**)&mbuf->qverts,&mbuf->maxQVerts,mbuf->maxVerts,sizeof(short)*TEAPOT_QVERTEX_NUM_SHORTS)
+#               endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+                ) {
+                free(mb.inds);return;
+            }
+            for (i=0;i<TEAPOT_MESH_COUNT;i++) {
+                const unsigned* pInds = &mb.inds[mb.segStartInds[i]];
+                const int numInds = mb.segNumInds[i];
+                unsigned maxInd = 0;
+                segOffset[i] = 0;segType[i] = GL_UNSIGNED_SHORT;
+                if (numInds==0) continue;
+                for (j=0;j<numInds;j++) {if (maxInd<pInds[j]) maxInd=pInds[j];}
+                if (maxInd>0xFFFF) segType[i] = GL_UNSIGNED_INT;
+                segOffset[i] = numIndsBytes = Teapot_Private_PackIndices(mbuf->inds,numIndsBytes,pInds,numInds,segType[i]);
+                numIndsBytes+=numInds*Teapot_Private_IndexSize(segType[i]);
+#               ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+                Teapot_Private_QuantizeMesh(pInds,numInds,0,TIS.dequantization[i]);
+#               endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+            }
+            for (i=0;i<TEAPOT_MESH_COUNT;i++) {
+                TIS.indsType[i] = GL_UNSIGNED_SHORT;TIS.indsOffset[i] = 0;
+                if (TIS.numInds[i]==0) continue;
+                // owner of the index range (e.g. TEAPOT_MESH_CYLINDER_LATERAL_SURFACE is a part of TEAPOT_MESH_CYLINDER)
+                for (j=0;j<TEAPOT_MESH_COUNT;j++) {
+                    if (mb.segNumInds[j]>0 && TIS.startInds[i]>=mb.segStartInds[j] && TIS.startInds[i]<mb.segStartInds[j]+mb.segNumInds[j]) break;
+                }
+                if (j==TEAPOT_MESH_COUNT) {
+                    TIS.numInds[i] = 0;
+#                   ifdef TEAPOT_ENABLE_MESH_LODS
+                    for (j=0;j<TEAPOT_NUM_MESH_LODS;j++) TIS.lodNumInds[i][j] = 0;
+#                   endif //TEAPOT_ENABLE_MESH_LODS
+                    continue;
+                }
+                TIS.indsType[i] = segType[j];
+#               ifdef TEAPOT_ENABLE_MESH_LODS
+                {
+                    int k;  // the LODs use the index type of the mesh (they reference a subset of its vertices)
+                    for (k=1;k<TEAPOT_NUM_MESH_LODS;k++) {
+                        if (TIS.lodNumInds[i][k]==0) continue;
+                        TIS.lodIndsOffset[i][k] = numIndsBytes = Teapot_Private_PackIndices(mbuf->inds,numIndsBytes,&mb.inds[mb.lodStartInds[i][k]],TIS.lodNumInds[i][k],segType[j]);
+                        numIndsBytes+=TIS.lodNumInds[i][k]*Teapot_Private_IndexSize(segType[j]);
+                    }
+                }
+#               endif //TEAPOT_ENABLE_MESH_LODS
+#               ifdef TEAPOT_ENABLE_VERTEX_QUANTIZATION
+                if (i!=j) memcpy(TIS.dequantization[i],TIS.dequantization[j],sizeof(TIS.dequantization[i]));
+#               endif //TEAPOT_ENABLE_VERTEX_QUANTIZATION
+                TIS.indsOffset[i] = segOffset[j]+(TIS.startInds[i]-mb.segStartInds[j])*Teapot_Private_IndexSize(segType[j]);
+            }
+            mbuf->numFixedIndsBytes = numIndsBytes;
+            free(mb.inds);
+#           ifdef TEAPOT_ENABLE_EXACT_PICKING
+            for (i=0;i<TEAPOT_FIRST_MESHLINES_INDEX;i++) Teapot_Private_MeshTriBvh_Build((TeapotMeshEnum)i);
+#           endif //TEAPOT_ENABLE_EXACT_PICKING
+        }
+
+        if (gTeapotInitUserMeshCallback)    {
+            for (i=TEAPOT_MESH_USER_00;i<TEAPOT_MESH_CUBE;i++) {
+                const float* pVerts=NULL;const unsigned short* pInds=NULL;
+                int numVerts=0,numInds=0;
+                gTeapotInitUserMeshCallback((TeapotMeshEnum) i,&pVerts,&numVerts,&pInds,&numInds);
+                if (pVerts && pInds && numVerts>3 && numInds>3) {
+                    Teapot_Private_SetUserMesh((TeapotMeshEnum)i,pVerts,numVerts,pInds,NULL,numInds);
+                }
+            }
+        }
+
+        // The GL buffers have the same capacity of TIS.meshBuffer (so that Teapot_Set_UserMesh(...) can often use glBufferSubData(...))
         glGenBuffers(1, &TIS.vertexBuffer);
         glBindBuffer(GL_ARRAY_BUFFER, TIS.vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*numTotVerts, totVerts, GL_STATIC_DRAW);
+        Teapot_Private_UploadVerts(0,0,1);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
         glGenBuffers(1, &TIS.elementBuffer);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, TIS.elementBuffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*numTotInds, totInds, GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mbuf->maxIndsBytes, mbuf->inds, GL_STATIC_DRAW);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 